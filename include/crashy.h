@@ -18,27 +18,94 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include <time.h>
+#include <string.h>
+#include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <functional>
 #include <optional>
+#include <vector>
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#endif
 #include <sstream>
 #include <iomanip>
 
 class CrashOptions {
 	public:
   std::string currentExecutable;
-	// so there is no default SSL functionality
-	// to upload it to a HTTPS server, you have to do it yourself
-	// there is a default way relying on curl installed on your system
-	enum SendFormat : uint8_t {NONE=0, PLAIN_TEXT=1, JSON_SENTRY=2};
+	// there is no default SSL functionality: to upload to a HTTPS server, set `httpsTransport` or `sender`
+	// ENVELOPE_SENTRY: Sentry envelope with the event and the attachments as separate items
+	// BINARY_REPORT: compact versioned binary encoding, converted to the other formats by the crashy-decode tool
+	enum SendFormat : uint8_t {NONE=0, PLAIN_TEXT=1, JSON_SENTRY=2, ENVELOPE_SENTRY=3, BINARY_REPORT=4};
 	SendFormat sendFormat = SendFormat::NONE;
+	// compression of the payload given to `sender` (use Content-Encoding: gzip or zstd when uploading)
+	// if the compression library was not available at build time, the payload is not compressed
+	enum Compression : uint8_t {NO_COMPRESSION=0, GZIP=1, ZSTD=2};
+	Compression compression = Compression::NO_COMPRESSION;
+	// files added as attachment to an ENVELOPE_SENTRY report (e.g. log files), read by the crash reporter when a crash occurs
+	std::vector<std::string> attachments;
+	size_t attachmentMaxBytes = 1024 * 1024; // per attachment, the end of larger files is included
 	// can be called with old report formats
 	// return value indicated success (so report is removed from persistent storage)
 	std::function<void (SendFormat format)> prepare;
 	std::function<bool (SendFormat format, const std::string& data)> sender;
 
+	// built-in HTTP/1.1 upload, used if `sender` is not set: a Sentry DSN (https://<key>@<host>/<project id>),
+	// or a URL reports are POSTed to
+	std::string dsn;
+	std::chrono::milliseconds uploadTimeout {10000}; // per connect, read or write
+	unsigned uploadRetries = 3; // on network errors, 5xx and 429 responses, with exponential backoff
+	// connection for https:// URLs (e.g. wrapping OpenSSL): write and read return the number of bytes, or -1 on error
+	struct Connection {
+		std::function<ssize_t (const char* data, size_t size)> write;
+		std::function<ssize_t (char* data, size_t size)> read;
+	};
+	std::function<std::optional<Connection> (const std::string& host, uint16_t port)> httpsTransport;
+
+	// more destinations for each report, in addition to `sender` or `dsn`, all sent to at the same time
+	// the report is rendered once per distinct format; `compression` applies to all of them
+	struct Sink {
+		std::string name; // in error messages
+		SendFormat format = JSON_SENTRY;
+		std::function<bool (SendFormat format, const std::string& data)> sender;
+		std::string dsn; // built-in HTTP upload, if `sender` is not set
+		std::chrono::milliseconds timeout {0}; // total time for the sink, including retries (0: unlimited)
+		unsigned retries = 0;
+	};
+	std::vector<Sink> sinks;
+
+	// local sink, in addition to `sender` or `dsn`: each report is appended as one line of JSON (the Sentry event,
+	// with "type":"crash") to this file, for a log shipping agent; the file is rotated by size
+	std::string ndjsonFile;
+	size_t ndjsonMaxBytes = 16 * 1024 * 1024; // 0: no rotation
+	unsigned ndjsonMaxFiles = 3; // rotated files kept (file.1 is the most recent)
+
+	// per-thread breadcrumb rings (CrashBreadcrumb) in shared memory, read by the crash reporter after a crash
+	// (0 rings: disabled); threads beyond the number of rings do not record breadcrumbs
+	unsigned breadcrumbRings = 64;
+	unsigned breadcrumbRingEntries = 64; // per thread, rounded up to a power of two (an entry takes 256 bytes)
+	size_t maxRingBreadcrumbs = 100; // most recent breadcrumbs of all rings together in a report
+	unsigned breadcrumbFormats = 1024; // call sites of CRASHY_BREADCRUMB (a format takes 256 bytes)
+
+	// flight recorder, if the library is built with CRASHY_FLIGHT_RECORDER (code linked with it is compiled with
+	// -finstrument-functions): function entries and exits per thread in lossy rings in shared memory, the last
+	// events of each thread are included in the report (0 rings: disabled)
+	unsigned flightRecorderRings = 64;
+	unsigned flightRecorderEvents = 1024; // per thread, rounded up to a power of two (an event takes 16 bytes)
+	unsigned flightRecorderReportEvents = 64; // most recent, per thread
+	// modules recorded (file names such as "libengine.so", or the name of the executable); empty: all modules
+	// code loaded after GenerateDumpOnCrash is recorded only if flightRecorderModules is empty
+	std::vector<std::string> flightRecorderModules;
+	std::vector<std::string> flightRecorderExcludeModules;
+
 	// returns name of current context/thread/executor
+	// runs in the signal handler of the crashed thread: prefer CrashSetContext, which needs no callback
 	std::function<const char*()> getContext;
 
 	// breadcrumbs (log level, time, message)
@@ -52,8 +119,19 @@ class CrashOptions {
 
 	// directory to store crash reports in a persistent way before the file uploader is called
 	// if unset, reports are directly send (and if `sender` returns false, they are lost)
-	//std::string persistentCrashReportsDirectory;
-	//
+	// stored reports are sent when the crash reporter starts, and after each crash
+	std::string persistentCrashReportsDirectory;
+	size_t spoolMaxReports = 100; // oldest reports are removed first (0: unlimited)
+	size_t spoolMaxBytes = 64 * 1024 * 1024;
+	unsigned uploadConcurrency = 2; // reports sent at the same time when sending stored reports
+
+	// rate limit per crash fingerprint (based on the build-id and offsets of the top frames, before symbolization):
+	// at most this many reports per window; more crashes with the same fingerprint are only counted,
+	// and this count is included in the next report (0: unlimited)
+	unsigned maxReportsPerFingerprint = 0;
+	std::chrono::seconds fingerprintWindow {3600};
+	std::string fingerprintStore; // file with the counters, default: in persistentCrashReportsDirectory
+
 	std::string release = ""; // suggestion: [git revision]
 	std::string dist = ""; // distribution, suggestion [gitlab pipeline iid (per project)]
 	std::string environment = "local";
@@ -72,9 +150,376 @@ class CrashOptions {
 	}
 	std::string path;
   bool reportUsername = false;
+
+	// number of threads used by the crash reporter to resolve stack frames (0: number of cores)
+	unsigned symbolizationThreads = 0;
+	// budget for resolving the stack frames of a report (0: unlimited), for all its stacks and flight recorder
+	// functions together; frames not resolved within the budget are reported with the symbol name only, or with
+	// module and offset only, and are marked as such in the report
+	std::chrono::milliseconds symbolizationTimeout {0};
+	// resident memory of the crash reporter, in bytes, above which resolving stops (the peak where the current size is
+	// not available: only Linux has it)
+	size_t symbolizationMemoryLimit = 0;
+	// priority of the crash reporter process: nice increment, and (Linux only) idle I/O scheduling class
+	int reporterNice = 0;
+	bool reporterIdleIO = false;
+
+	// include source code lines around each frame in the report (0: disabled)
+	// source files are looked up in the given directories (with the file name as it is in the stack trace)
+	unsigned sourceContextLines = 0;
+	std::vector<std::string> sourceRoots;
+	size_t sourceContextMaxBytes = 64 * 1024; // for all frames together
+
+	// budget for the snapshot of the resource state of the crashed process (memory, file descriptors, threads,
+	// cgroup pressure, system load), read by the crash reporter from /proc (Linux only; 0: disabled)
+	std::chrono::milliseconds processMetricsBudget {20};
+
+	// non-fatal events (CrashCaptureNonFatal) queued to the crash reporter, which symbolizes and sends them as reports
+	// of their level (0: disabled); events are dropped while the queue is full (an event takes 832 bytes)
+	unsigned nonFatalQueueSize = 64;
+	// rate limit per call site of CrashCaptureNonFatal: at most this many reports per window; more events are only
+	// counted, and this count is included in the next report (0: unlimited)
+	unsigned nonFatalMaxPerCallSite = 10;
+	std::chrono::seconds nonFatalWindow {3600};
+
+	// sampling CPU profiler (Linux only): each thread is sampled this many times per second of CPU time it uses (with
+	// SIGPROF), and the crash reporter aggregates the stacks until CrashWriteProfile is called (0: disabled)
+	unsigned profilerFrequency = 0;
+	unsigned profilerRings = 64; // threads sampled at the same time
+	// per thread, rounded up to a power of two (a sample takes 264 bytes); the crash reporter takes the samples once a
+	// second, older samples of a thread are lost if there are more in the meantime
+	unsigned profilerRingSamples = 256;
+
+	// hang watchdog (Linux only): threads registered with CrashWatchThread that send no heartbeat within their threshold
+	// are reported as a hang, with the stacks of all threads (0: disabled)
+	unsigned watchdogSlots = 64; // threads watched at the same time
+	std::chrono::milliseconds watchdogInterval {100}; // of checking the heartbeats, while threads are watched
+	// real-time signal to capture the stacks of the threads (0: SIGRTMIN + 5), handled once a thread is watched
+	int stackSignal = 0;
+	// after a hang is reported, kill the process (SIGKILL), and run this shell command (if not empty) to restart it
+	bool watchdogKill = false;
+	std::string watchdogRestartCommand;
+
+	// CrashDeadline (Linux only): threads with a deadline at the same time (0: disabled); a thread of the process
+	// checks the deadlines every deadlineCheckInterval, and captures the stack of a thread past its deadline with the
+	// stack signal; the stack is queued as a non-fatal event (see nonFatalQueueSize)
+	unsigned deadlineSlots = 256;
+	std::chrono::milliseconds deadlineCheckInterval {5};
+
+	// frames in code without ELF image that is not registered with CrashRegisterCodeRange are looked up in the
+	// /tmp/perf-<pid>.map file (written by JIT runtimes for perf) by the crash reporter
+	bool readPerfMap = false;
+
+	// skip symbolization in the crash reporter: frames are reported as module, offset and build-id
+	// (with a Sentry debug_meta image list), to be symbolized offline with the crashy-symbolize tool
+	bool rawReport = false;
 };
 
 void GenerateDumpOnCrash(CrashOptions&& options = {});
+// levels of breadcrumbs (as in Sentry)
+enum CrashLevel : uint8_t {CRASH_DEBUG=0, CRASH_INFO=1, CRASH_WARNING=2, CRASH_ERROR=3, CRASH_FATAL=4};
+// adds a breadcrumb to the ring of the calling thread (see CrashOptions::breadcrumbRings): lock-free and without
+// allocations; messages are cut off at 240 bytes
+void CrashBreadcrumb(CrashLevel level, const char* message, size_t length);
+inline void CrashBreadcrumb(CrashLevel level, const std::string& message) {
+	CrashBreadcrumb(level, message.data(), message.size());
+}
+
+// crash context of the calling thread: key/value pairs such as a request id, tenant or actor name, reported as tags
+// if this thread crashes, and as context if another thread crashes; stored in the shared memory of the breadcrumb
+// rings (CrashOptions::breadcrumbRings), so nothing runs in the crashed process to report it
+// at most 8 keys per thread, keys are cut off at 31 bytes and values at 95 bytes
+void CrashSetContext(const char* key, std::string_view value);
+void CrashClearContext(const char* key);
+// copies the value of a key of the calling thread (zero terminated), returns false if the key is not set
+bool CrashGetContext(const char* key, char* value, size_t size);
+
+// sets a context key for the lifetime of the scope, and restores the previous value afterwards
+class CrashContextScope {
+	const char* key;
+	char previous[96];
+	bool hadPrevious;
+ public:
+	CrashContextScope(const char* key, std::string_view value) : key(key) {
+		hadPrevious = CrashGetContext(key, previous, sizeof(previous));
+		CrashSetContext(key, value);
+	}
+	~CrashContextScope() {
+		if (hadPrevious)
+			CrashSetContext(key, previous);
+		else
+			CrashClearContext(key);
+	}
+	CrashContextScope(const CrashContextScope&) = delete;
+	CrashContextScope& operator=(const CrashContextScope&) = delete;
+};
+
+// code without ELF image (JIT compiled or generated at runtime): frames in [begin, end) are reported with this
+// name, and optionally with a line of sourceFile (lines sorted by offset, the last one at or before the offset of the
+// frame applies); name, sourceFile and lines are copied
+// registering is cheap (amortized, the sorted table is rebuilt once per 64 registrations); the crash handler reads the
+// table without locks
+struct CrashCodeLine {
+	uint32_t offset; // from begin
+	uint32_t line;
+};
+void CrashRegisterCodeRange(const void* begin, const void* end, const char* name, const char* sourceFile = nullptr, const CrashCodeLine* lines = nullptr, size_t lineCount = 0);
+// begin as given to CrashRegisterCodeRange; call before the code is freed or reused
+void CrashUnregisterCodeRange(const void* begin);
+
+// reports an error without crashing: only the return addresses of the stack of the calling thread are captured
+// (microseconds, no symbolization) and queued to the crash reporter, which resolves them and sends the report as a
+// handled event of this level (see CrashOptions::nonFatalQueueSize); messages are cut off at 256 bytes
+void CrashCaptureNonFatal(CrashLevel level, std::string_view message);
+
+// output of CrashWriteProfile: folded stacks (a line per stack, "main;run;parse 42", as used for flame graphs), or a
+// pprof profile (protocol buffer, gzip compressed if zlib is available)
+enum CrashProfileFormat : uint8_t {CRASH_PROFILE_FOLDED=0, CRASH_PROFILE_PPROF=1};
+// the crash reporter writes the CPU profile (see CrashOptions::profilerFrequency) of the samples since the previous
+// profile to path, with each distinct address symbolized once; waits until the file is written (at most a minute)
+// returns false (and sets errno) if the profiler is disabled, or the file could not be written
+bool CrashWriteProfile(const char* path, CrashProfileFormat format = CRASH_PROFILE_FOLDED);
+
+// the calling thread is watched (see CrashOptions::watchdogSlots): it is reported as hung if it does not call
+// CrashHeartbeat for longer than threshold, such as an event loop that is stalled or a deadlocked worker
+// calling it again changes the name and threshold; returns false (and sets errno) if no slot is available
+bool CrashWatchThread(const char* name, std::chrono::milliseconds threshold);
+// a relaxed store of the current time in the slot of the calling thread (nothing if it is not watched)
+void CrashHeartbeat();
+// stops watching the calling thread, for instance before it blocks on purpose (done as well when the thread exits)
+void CrashUnwatchThread();
+
+class CrashDeadline; // below
+
+// structured breadcrumbs, formatted by the crash reporter instead of by every call:
+//   CRASHY_BREADCRUMB(CRASH_INFO, "request {id} done in {} us", id, micros);
+// only a reference to the format and the arguments (binary) are stored in the ring of the thread; a placeholder
+// with a name also adds the argument as data of the breadcrumb (key "id" above); use {{ and }} for braces
+// arguments: integers, enums, floating point, bool, pointers, and strings (cut off, as a breadcrumb is 240 bytes)
+#define CRASHY_BREADCRUMB(level, format, ...) do { \
+		static crashy::BreadcrumbFormat crashyBreadcrumbFormat {format, level, decltype(crashy::ListArgumentTypes(__VA_ARGS__))::types}; \
+		crashy::Breadcrumb(crashyBreadcrumbFormat, ##__VA_ARGS__); \
+	} while (0)
+
+namespace crashy {
+enum ArgumentType : uint8_t {INTEGER=1, UNSIGNED=2, FLOATING=3, BOOLEAN=4, STRING=5, POINTER=6};
+
+template <typename T>
+constexpr uint8_t ArgumentTypeOf() {
+	using U = std::decay_t<T>;
+	if constexpr (std::is_same_v<U, bool>)
+		return BOOLEAN;
+	else if constexpr (std::is_enum_v<U>)
+		return std::is_signed_v<std::underlying_type_t<U>> ? INTEGER : UNSIGNED;
+	else if constexpr (std::is_integral_v<U>)
+		return std::is_signed_v<U> ? INTEGER : UNSIGNED;
+	else if constexpr (std::is_floating_point_v<U>)
+		return FLOATING;
+	else if constexpr (std::is_convertible_v<const U&, std::string_view>)
+		return STRING;
+	else if constexpr (std::is_pointer_v<U>)
+		return POINTER;
+	else
+		static_assert(sizeof(U) == 0, "unsupported type of breadcrumb argument");
+}
+
+// zero terminated list of the types of the arguments, for decltype in CRASHY_BREADCRUMB (not evaluated)
+template <typename... Args>
+struct ArgumentTypes {
+	static_assert(sizeof...(Args) <= 16, "at most 16 arguments per breadcrumb");
+	static constexpr uint8_t types[sizeof...(Args) + 1] = {ArgumentTypeOf<Args>()..., 0};
+};
+template <typename... Args>
+ArgumentTypes<Args...> ListArgumentTypes(const Args&...);
+
+// one per call site, registered in the shared memory of the crash reporter on first use
+struct BreadcrumbFormat {
+	const char* format;
+	CrashLevel level;
+	const uint8_t* types;
+	std::atomic<uint32_t> id {0}; // 0 until registered, UINT32_MAX if the table was full
+};
+
+const size_t BREADCRUMB_ARGUMENTS = 240;
+// arguments start after 4 bytes reserved for the id of the format
+void StructuredBreadcrumb(BreadcrumbFormat& format, char* arguments, size_t length);
+
+inline std::string_view ArgumentString(const char* string) {
+	return string ? std::string_view(string) : std::string_view();
+}
+template <typename T>
+inline std::string_view ArgumentString(const T& string) {
+	return std::string_view(string);
+}
+
+// strings: length byte and the characters; other types: 8 bytes (bool: 1 byte)
+template <typename T>
+inline void EncodeArgument(char*& p, char* end, const T& value) {
+	constexpr uint8_t type = ArgumentTypeOf<T>();
+	if constexpr (type == STRING) {
+		std::string_view string = ArgumentString(value);
+		if (p == end)
+			return;
+		size_t length = std::min({string.size(), size_t(end - p - 1), size_t(255)});
+		*p++ = char(length);
+		memcpy(p, string.data(), length);
+		p += length;
+	} else if constexpr (type == BOOLEAN) {
+		if (p < end)
+			*p++ = value ? 1 : 0;
+	} else {
+		uint64_t bits;
+		if constexpr (type == FLOATING) {
+			double number = double(value);
+			memcpy(&bits, &number, sizeof(bits));
+		} else if constexpr (type == POINTER) {
+			bits = uint64_t(uintptr_t(value));
+		} else {
+			bits = uint64_t(value);
+		}
+		if (end - p < 8) {
+			p = end;
+			return;
+		}
+		memcpy(p, &bits, sizeof(bits));
+		p += sizeof(bits);
+	}
+}
+
+template <typename... Args>
+inline void Breadcrumb(BreadcrumbFormat& format, const Args&... args) {
+	char buffer[BREADCRUMB_ARGUMENTS];
+	char* p = buffer + 4;
+	(EncodeArgument(p, buffer + sizeof(buffer), args), ...);
+	StructuredBreadcrumb(format, buffer, size_t(p - buffer));
+}
+
+// a coroutine in the logical (async) stack of a thread, see AsyncStackPromise
+struct AsyncFrame {
+	void* resumeAddress = nullptr; // where the coroutine is suspended, nullptr while it runs
+	AsyncFrame* awaiter = nullptr; // the coroutine that created this one (and awaits it)
+	AsyncFrame* previous = nullptr; // what ran on the thread before this coroutine was resumed
+};
+// innermost coroutine running on this thread, its awaiters are reported as "async stack" after the physical frames
+extern thread_local AsyncFrame* currentAsyncFrame;
+
+// of the calling thread, see CrashDeadline
+// the earliest deadline of the active guards (steady clock ns, 0 if none), read by the thread checking deadlines
+extern thread_local std::atomic<int64_t>* deadlineSlot;
+std::atomic<int64_t>* ClaimDeadlineSlot();
+extern thread_local CrashDeadline* currentDeadline; // innermost guard
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+template <typename Awaitable>
+decltype(auto) GetAwaiter(Awaitable&& awaitable) {
+	if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); })
+		return std::forward<Awaitable>(awaitable).operator co_await();
+	else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); })
+		return operator co_await(std::forward<Awaitable>(awaitable));
+	else
+		return std::forward<Awaitable>(awaitable);
+}
+
+// keeps currentAsyncFrame up to date around a suspension point
+template <typename Awaiter>
+class AsyncStackAwaiter {
+	AsyncFrame& frame;
+	Awaiter awaiter;
+ public:
+	template <typename A>
+	AsyncStackAwaiter(AsyncFrame& frame, A&& awaiter) noexcept(std::is_nothrow_constructible_v<Awaiter, A&&>) : frame(frame), awaiter(std::forward<A>(awaiter)) {
+	}
+	bool await_ready() noexcept(noexcept(awaiter.await_ready())) {
+		return awaiter.await_ready();
+	}
+	// not inlined: the return address is the suspension point in the coroutine
+	template <typename Promise>
+	[[gnu::noinline]] decltype(auto) await_suspend(std::coroutine_handle<Promise> handle) noexcept(noexcept(awaiter.await_suspend(handle))) {
+		frame.resumeAddress = __builtin_return_address(0);
+		// a new coroutine suspends at its initial suspend point before it ever ran: its creator keeps running
+		if (currentAsyncFrame == &frame)
+			currentAsyncFrame = frame.previous;
+		return awaiter.await_suspend(handle);
+	}
+	decltype(auto) await_resume() noexcept(noexcept(awaiter.await_resume())) {
+		if (currentAsyncFrame != &frame) {
+			frame.previous = currentAsyncFrame;
+			currentAsyncFrame = &frame;
+		}
+		frame.resumeAddress = nullptr;
+		return awaiter.await_resume();
+	}
+};
+
+// opt-in mixin for promise types, so crash reports include the chain of awaiting coroutines:
+//   struct promise_type : crashy::AsyncStackPromise {
+//     auto initial_suspend() { return Track(std::suspend_always{}); }
+//     auto final_suspend() noexcept { return Track(FinalAwaiter{}); }
+//     ...
+//   };
+// all co_await expressions in the coroutine are tracked with await_transform (so the promise type should not define
+// its own); the awaiter is the coroutine running when this coroutine is created, as in co_await Child()
+class AsyncStackPromise {
+	AsyncFrame asyncFrame;
+ public:
+	AsyncStackPromise() noexcept {
+		asyncFrame.awaiter = currentAsyncFrame;
+	}
+	~AsyncStackPromise() {
+		// destroyed without suspending at the final suspend point
+		if (currentAsyncFrame == &asyncFrame)
+			currentAsyncFrame = asyncFrame.previous;
+	}
+	template <typename Awaitable>
+	auto Track(Awaitable&& awaitable) noexcept(noexcept(GetAwaiter(std::forward<Awaitable>(awaitable)))) {
+		using Awaiter = decltype(GetAwaiter(std::forward<Awaitable>(awaitable)));
+		// awaiters that are temporaries are moved into the wrapper
+		using Stored = std::conditional_t<std::is_lvalue_reference_v<Awaiter>, Awaiter, std::remove_cvref_t<Awaiter>>;
+		return AsyncStackAwaiter<Stored>(asyncFrame, GetAwaiter(std::forward<Awaitable>(awaitable)));
+	}
+	template <typename Awaitable>
+	auto await_transform(Awaitable&& awaitable) {
+		return Track(std::forward<Awaitable>(awaitable));
+	}
+};
+#endif
+}
+// a scope that should end within budget: if it still runs after its deadline, its stack is captured once (the thread
+// is interrupted by the stack signal, only to unwind its stack) and reported as a slow operation, a warning named
+// after the guard (see CrashOptions::deadlineSlots); name is not copied, it should live as long as the guard
+//   CrashDeadline guard(std::chrono::milliseconds(50), "handle_request");
+// costs a clock read and an atomic store on entry, and an atomic store on exit
+class CrashDeadline {
+	std::atomic<int64_t>* slot;
+ public:
+	const char* name;
+	int64_t start; // steady clock ns
+	int64_t deadline;
+	int64_t earliest; // deadline of this guard and the guards it is nested in
+	CrashDeadline* previous;
+	bool reported = false;
+
+	CrashDeadline(std::chrono::nanoseconds budget, const char* name) : name(name) {
+		slot = crashy::deadlineSlot ? crashy::deadlineSlot : crashy::ClaimDeadlineSlot();
+		start = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		earliest = deadline = start + budget.count();
+		previous = crashy::currentDeadline;
+		if (previous && previous->earliest < earliest)
+			earliest = previous->earliest;
+		crashy::currentDeadline = this;
+		// the guard is complete before the signal handler can be asked to look at it
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		slot->store(earliest, std::memory_order_relaxed);
+	}
+	~CrashDeadline() {
+		slot->store(previous ? previous->earliest : 0, std::memory_order_relaxed);
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		crashy::currentDeadline = previous;
+	}
+	CrashDeadline(const CrashDeadline&) = delete;
+	CrashDeadline& operator=(const CrashDeadline&) = delete;
+};
+
 const char* SetCurrentExecutable(const char* executable);
 const char* GetCurrentExecutable();
 extern "C" int PrintCurrentCallStack(int max_size);
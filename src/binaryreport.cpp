@@ -0,0 +1,490 @@
+#include "binaryreport.h"
+
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+static const char MAGIC[4] = {'C', 'R', 'B', 'R'};
+// 1: breadcrumb times in seconds
+// 2: breadcrumb times in ns, with thread and data
+// 3: frames in registered code ranges (FRAME_CODE_RANGE)
+// 4: kind of non-fatal reports, stacks of other threads
+// 5: name of slow operations
+static const uint32_t VERSION = 5;
+
+// bits in the flags of a report
+static const uint32_t HAS_SIGNAL = 1 << 0;
+static const uint32_t HAS_EXCEPTION = 1 << 1;
+static const uint32_t HAS_ASSERT = 1 << 2;
+static const uint32_t RAW_REPORT = 1 << 3;
+static const uint32_t HAS_METRICS = 1 << 4;
+static const uint32_t HAS_THREAD_CONTEXTS = 1 << 5;
+static const uint32_t HAS_FLIGHT_RECORDER = 1 << 6;
+static const uint32_t HAS_NON_FATAL = 1 << 7;
+static const uint32_t HAS_THREADS = 1 << 8;
+
+// bits in the flags of a frame (the lowest two bits are CrashFrame::Detail)
+static const uint32_t FRAME_DETAIL_MASK = 3;
+static const uint32_t FRAME_HAS_MODULE = 1 << 2;
+static const uint32_t FRAME_HAS_SOURCE = 1 << 3;
+static const uint32_t FRAME_HAS_CONTEXT = 1 << 4;
+static const uint32_t FRAME_ASYNC = 1 << 5;
+static const uint32_t FRAME_CODE_RANGE = 1 << 6; // with the offset in the range
+
+namespace {
+
+class Encoder {
+	std::unordered_map<std::string, uint64_t> index;
+	std::vector<const std::string*> strings;
+ public:
+	std::string body;
+
+	void varint(uint64_t value) {
+		while (value >= 0x80) {
+			body += char(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		body += char(value);
+	}
+	void zigzag(int64_t value) {
+		varint((uint64_t(value) << 1) ^ uint64_t(value >> 63));
+	}
+	// index in the string table
+	void string(const std::string& value) {
+		auto [it, inserted] = index.emplace(value, strings.size());
+		if (inserted)
+			strings.push_back(&it->first);
+		varint(it->second);
+	}
+
+	std::string finish() {
+		Encoder header;
+		header.body.append(MAGIC, sizeof(MAGIC));
+		header.varint(VERSION);
+		header.varint(strings.size());
+		for (auto* string : strings) {
+			header.varint(string->size());
+			header.body += *string;
+		}
+		return header.body + body;
+	}
+};
+
+class Decoder {
+	const uint8_t* p;
+	const uint8_t* end;
+	std::vector<std::string> strings;
+ public:
+	bool good = true;
+	uint64_t version = 0;
+
+	Decoder(const std::string& data) : p(reinterpret_cast<const uint8_t*>(data.data())), end(p + data.size()) {
+	}
+
+	uint64_t varint() {
+		uint64_t value = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			if (p >= end) {
+				good = false;
+				return 0;
+			}
+			uint8_t byte = *p++;
+			value |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		good = false;
+		return 0;
+	}
+	int64_t zigzag() {
+		uint64_t value = varint();
+		return int64_t(value >> 1) ^ -int64_t(value & 1);
+	}
+	std::string string() {
+		uint64_t i = varint();
+		if (i >= strings.size()) {
+			good = false;
+			return {};
+		}
+		return strings[i];
+	}
+
+	bool header() {
+		if (size_t(end - p) < sizeof(MAGIC) || memcmp(p, MAGIC, sizeof(MAGIC)) != 0)
+			return false;
+		p += sizeof(MAGIC);
+		version = varint();
+		if (version == 0 || version > VERSION)
+			return false;
+		uint64_t count = varint();
+		// each string takes at least a byte, so a corrupt count does not allocate too much
+		if (!good || count > uint64_t(end - p))
+			return false;
+		strings.reserve(count);
+		for (uint64_t i = 0; i < count && good; ++i) {
+			uint64_t length = varint();
+			if (length > uint64_t(end - p)) {
+				good = false;
+				break;
+			}
+			strings.emplace_back(reinterpret_cast<const char*>(p), size_t(length));
+			p += length;
+		}
+		return good;
+	}
+};
+
+}
+
+static void EncodeFrames(Encoder& e, const std::vector<CrashFrame>& frames) {
+	e.varint(frames.size());
+	uint64_t previousPC = 0;
+	for (auto& frame : frames) {
+		bool hasContext = !frame.contextLine.empty() || !frame.preContext.empty() || !frame.postContext.empty();
+		e.varint(uint32_t(frame.detail) | (frame.module.empty() ? 0 : FRAME_HAS_MODULE) |
+				(frame.sourceFile.empty() ? 0 : FRAME_HAS_SOURCE) | (hasContext ? FRAME_HAS_CONTEXT : 0) | (frame.async ? FRAME_ASYNC : 0) |
+				(frame.codeRange ? FRAME_CODE_RANGE : 0));
+		// frames of a stack are close to each other, so deltas are small
+		e.zigzag(int64_t(uintptr_t(frame.pc) - previousPC));
+		previousPC = uintptr_t(frame.pc);
+		e.string(frame.symbolName);
+		if (!frame.module.empty()) {
+			e.string(frame.module);
+			e.varint(frame.offsetInFile);
+		}
+		if (frame.codeRange)
+			e.varint(frame.offsetInFile);
+		e.string(frame.functionName);
+		e.string(frame.library);
+		if (!frame.sourceFile.empty()) {
+			e.string(frame.sourceFile);
+			e.varint(frame.lineNumber);
+			e.varint(frame.column);
+		}
+		if (hasContext) {
+			e.varint(frame.preContext.size());
+			for (auto& line : frame.preContext)
+				e.string(line);
+			e.string(frame.contextLine);
+			e.varint(frame.postContext.size());
+			for (auto& line : frame.postContext)
+				e.string(line);
+		}
+	}
+}
+
+static void DecodeFrames(Decoder& d, std::vector<CrashFrame>& frames) {
+	uint64_t count = d.varint();
+	uint64_t pc = 0;
+	for (uint64_t i = 0; i < count && d.good; ++i) {
+		CrashFrame frame;
+		uint64_t frameFlags = d.varint();
+		frame.detail = CrashFrame::Detail(frameFlags & FRAME_DETAIL_MASK);
+		frame.async = frameFlags & FRAME_ASYNC;
+		pc += uint64_t(d.zigzag());
+		frame.pc = reinterpret_cast<void*>(uintptr_t(pc));
+		frame.symbolName = d.string();
+		if (frameFlags & FRAME_HAS_MODULE) {
+			frame.module = d.string();
+			frame.offsetInFile = uint32_t(d.varint());
+		}
+		if (frameFlags & FRAME_CODE_RANGE) {
+			frame.codeRange = true;
+			frame.offsetInFile = uint32_t(d.varint());
+		}
+		frame.functionName = d.string();
+		frame.library = d.string();
+		if (frameFlags & FRAME_HAS_SOURCE) {
+			frame.sourceFile = d.string();
+			frame.lineNumber = uint32_t(d.varint());
+			frame.column = uint32_t(d.varint());
+		}
+		if (frameFlags & FRAME_HAS_CONTEXT) {
+			for (uint64_t n = d.varint(); n > 0 && d.good; --n)
+				frame.preContext.push_back(d.string());
+			frame.contextLine = d.string();
+			for (uint64_t n = d.varint(); n > 0 && d.good; --n)
+				frame.postContext.push_back(d.string());
+		}
+		frames.push_back(std::move(frame));
+	}
+}
+
+std::string EncodeReport(const CrashReport& crash, const CrashOptions& options) {
+	Encoder e;
+	uint32_t flags = (crash.signal ? HAS_SIGNAL : 0) | (crash.uncaughtException ? HAS_EXCEPTION : 0) |
+		(crash.assertViolation ? HAS_ASSERT : 0) | (options.rawReport ? RAW_REPORT : 0) |
+		(crash.processMetrics.empty() ? 0 : HAS_METRICS) | (crash.threadContexts.empty() ? 0 : HAS_THREAD_CONTEXTS) |
+		(crash.flightRecorder.empty() ? 0 : HAS_FLIGHT_RECORDER) | (crash.nonFatal ? HAS_NON_FATAL : 0) |
+		(crash.threads.empty() ? 0 : HAS_THREADS);
+	e.varint(flags);
+	e.zigzag(crash.timestamp);
+	e.string(crash.eventId);
+	e.string(crash.fingerprint);
+	e.varint(crash.suppressedBefore);
+	if (crash.signal) {
+		e.zigzag(crash.signal->first);
+		e.varint(uintptr_t(crash.signal->second));
+	}
+	if (crash.uncaughtException) {
+		e.string(crash.uncaughtException->first);
+		e.string(crash.uncaughtException->second);
+	}
+	if (crash.assertViolation) {
+		auto& [func, file, line, condition, explanation] = *crash.assertViolation;
+		e.string(func);
+		e.string(file);
+		e.varint(line);
+		e.string(condition);
+		e.string(explanation);
+	}
+	if (crash.nonFatal) {
+		e.string(crash.nonFatal->level);
+		e.string(crash.nonFatal->message);
+		e.varint(crash.crashedThread);
+		e.varint(crash.nonFatal->kind);
+		e.string(crash.nonFatal->operation);
+	}
+	e.string(crash.context);
+
+	// options used to render the report
+	e.string(options.currentExecutable);
+	e.string(options.command);
+	e.string(options.path);
+	e.string(options.release);
+	e.string(options.dist);
+	e.string(options.environment);
+
+	e.string(crash.hostname);
+	e.string(crash.osName);
+	e.string(crash.osRelease);
+	e.string(crash.machine);
+	e.string(crash.model);
+	e.varint(crash.uid);
+	e.string(crash.username);
+
+	EncodeFrames(e, crash.frames);
+
+	e.varint(crash.breadcrumbs.size());
+	int64_t previousTime = int64_t(crash.timestamp) * 1000000000LL;
+	for (auto& breadcrumb : crash.breadcrumbs) {
+		e.string(breadcrumb.level);
+		e.zigzag(breadcrumb.time - previousTime);
+		previousTime = breadcrumb.time;
+		e.string(breadcrumb.message);
+		e.varint(breadcrumb.tid);
+		e.varint(breadcrumb.data.size());
+		for (auto& [key, value] : breadcrumb.data) {
+			e.string(key);
+			e.string(value);
+		}
+	}
+
+	e.varint(crash.modules.size());
+	for (auto& module : crash.modules) {
+		e.string(module.path);
+		e.string(module.buildId);
+		e.varint(module.base);
+		e.varint(module.size);
+	}
+
+	if (!crash.processMetrics.empty()) {
+		e.varint(crash.processMetrics.size());
+		for (auto& [name, value] : crash.processMetrics) {
+			e.string(name);
+			e.string(value);
+		}
+	}
+
+	if (!crash.threadContexts.empty()) {
+		e.varint(crash.crashedThread);
+		e.varint(crash.threadContexts.size());
+		for (auto& [tid, context] : crash.threadContexts) {
+			e.varint(tid);
+			e.varint(context.size());
+			for (auto& [key, value] : context) {
+				e.string(key);
+				e.string(value);
+			}
+		}
+	}
+
+	if (!crash.flightRecorder.empty()) {
+		e.varint(crash.crashedThread);
+		e.varint(crash.flightRecorderFunctions.size());
+		for (auto& function : crash.flightRecorderFunctions) {
+			e.varint(uintptr_t(function.pc));
+			e.string(function.module);
+			e.varint(function.offsetInFile);
+			e.string(function.functionName);
+			e.string(function.sourceFile);
+			e.varint(function.lineNumber);
+		}
+		e.varint(crash.flightRecorder.size());
+		for (auto& [tid, events] : crash.flightRecorder) {
+			e.varint(tid);
+			e.varint(events.size());
+			int64_t previous = int64_t(crash.timestamp) * 1000000000LL;
+			for (auto& event : events) {
+				e.zigzag(event.time - previous);
+				previous = event.time;
+				e.varint(uint64_t(event.function) << 1 | (event.exit ? 1 : 0));
+			}
+		}
+	}
+	if (!crash.threads.empty()) {
+		e.varint(crash.threads.size());
+		for (auto& thread : crash.threads) {
+			e.varint(thread.tid);
+			e.string(thread.name);
+			EncodeFrames(e, thread.frames);
+		}
+	}
+	return e.finish();
+}
+
+bool DecodeReport(const std::string& data, CrashReport& crash, CrashOptions& options) {
+	Decoder d(data);
+	if (!d.header())
+		return false;
+	uint64_t flags = d.varint();
+	crash.timestamp = time_t(d.zigzag());
+	crash.eventId = d.string();
+	crash.fingerprint = d.string();
+	crash.suppressedBefore = d.varint();
+	if (flags & HAS_SIGNAL) {
+		int sig = int(d.zigzag());
+		crash.signal = {sig, reinterpret_cast<void*>(uintptr_t(d.varint()))};
+	}
+	if (flags & HAS_EXCEPTION) {
+		std::string cause = d.string();
+		crash.uncaughtException = {cause, d.string()};
+	}
+	if (flags & HAS_ASSERT) {
+		std::string func = d.string();
+		std::string file = d.string();
+		uint32_t line = uint32_t(d.varint());
+		std::string condition = d.string();
+		crash.assertViolation = {func, file, line, condition, d.string()};
+	}
+	if (flags & HAS_NON_FATAL) {
+		NonFatalReport nonFatal;
+		nonFatal.level = d.string();
+		nonFatal.message = d.string();
+		crash.crashedThread = uint32_t(d.varint());
+		if (d.version >= 4)
+			nonFatal.kind = NonFatalReport::Kind(d.varint());
+		if (d.version >= 5)
+			nonFatal.operation = d.string();
+		crash.nonFatal = std::move(nonFatal);
+	}
+	crash.context = d.string();
+	options.rawReport = flags & RAW_REPORT;
+
+	options.currentExecutable = d.string();
+	options.command = d.string();
+	options.path = d.string();
+	options.release = d.string();
+	options.dist = d.string();
+	options.environment = d.string();
+
+	crash.hostname = d.string();
+	crash.osName = d.string();
+	crash.osRelease = d.string();
+	crash.machine = d.string();
+	crash.model = d.string();
+	crash.uid = uint32_t(d.varint());
+	crash.username = d.string();
+
+	DecodeFrames(d, crash.frames);
+
+	uint64_t breadcrumbs = d.varint();
+	// unsigned, so damaged times wrap around instead of overflowing (like the frame addresses)
+	uint64_t time = d.version == 1 ? uint64_t(crash.timestamp) : uint64_t(crash.timestamp) * 1000000000ULL;
+	for (uint64_t i = 0; i < breadcrumbs && d.good; ++i) {
+		ReportBreadcrumb breadcrumb;
+		breadcrumb.level = d.string();
+		time += uint64_t(d.zigzag());
+		breadcrumb.time = int64_t(d.version == 1 ? time * 1000000000ULL : time);
+		breadcrumb.message = d.string();
+		if (d.version >= 2) {
+			breadcrumb.tid = uint32_t(d.varint());
+			for (uint64_t n = d.varint(); n > 0 && d.good; --n) {
+				std::string key = d.string();
+				breadcrumb.data.emplace_back(key, d.string());
+			}
+		}
+		crash.breadcrumbs.push_back(std::move(breadcrumb));
+	}
+
+	uint64_t modules = d.varint();
+	for (uint64_t i = 0; i < modules && d.good; ++i) {
+		CrashModule module;
+		module.path = d.string();
+		module.buildId = d.string();
+		module.base = uintptr_t(d.varint());
+		module.size = d.varint();
+		crash.modules.push_back(std::move(module));
+	}
+
+	if (flags & HAS_METRICS) {
+		uint64_t metrics = d.varint();
+		for (uint64_t i = 0; i < metrics && d.good; ++i) {
+			std::string name = d.string();
+			crash.processMetrics.emplace_back(name, d.string());
+		}
+	}
+
+	if (flags & HAS_THREAD_CONTEXTS) {
+		crash.crashedThread = uint32_t(d.varint());
+		uint64_t threads = d.varint();
+		for (uint64_t i = 0; i < threads && d.good; ++i) {
+			uint32_t tid = uint32_t(d.varint());
+			std::vector<std::pair<std::string, std::string>> context;
+			for (uint64_t n = d.varint(); n > 0 && d.good; --n) {
+				std::string key = d.string();
+				context.emplace_back(key, d.string());
+			}
+			crash.threadContexts.emplace_back(tid, std::move(context));
+		}
+	}
+
+	if (flags & HAS_FLIGHT_RECORDER) {
+		crash.crashedThread = uint32_t(d.varint());
+		uint64_t functions = d.varint();
+		for (uint64_t i = 0; i < functions && d.good; ++i) {
+			CrashFrame function;
+			function.pc = reinterpret_cast<void*>(uintptr_t(d.varint()));
+			function.module = d.string();
+			function.offsetInFile = uint32_t(d.varint());
+			function.functionName = d.string();
+			function.sourceFile = d.string();
+			function.lineNumber = uint32_t(d.varint());
+			crash.flightRecorderFunctions.push_back(std::move(function));
+		}
+		uint64_t threads = d.varint();
+		for (uint64_t i = 0; i < threads && d.good; ++i) {
+			uint32_t tid = uint32_t(d.varint());
+			std::vector<FlightRecorderEvent> events;
+			uint64_t time = uint64_t(crash.timestamp) * 1000000000ULL;
+			for (uint64_t n = d.varint(); n > 0 && d.good; --n) {
+				time += uint64_t(d.zigzag());
+				uint64_t function = d.varint();
+				events.push_back({int64_t(time), uint32_t(function >> 1), (function & 1) != 0});
+			}
+			crash.flightRecorder.emplace_back(tid, std::move(events));
+		}
+	}
+	if (flags & HAS_THREADS) {
+		uint64_t threads = d.varint();
+		for (uint64_t i = 0; i < threads && d.good; ++i) {
+			ReportThread thread;
+			thread.tid = uint32_t(d.varint());
+			thread.name = d.string();
+			DecodeFrames(d, thread.frames);
+			crash.threads.push_back(std::move(thread));
+		}
+	}
+	return d.good;
+}
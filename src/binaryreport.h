@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+#include "crashy.h"
+#include "reporter.h"
+
+// compact binary encoding of a report (SendFormat::BINARY_REPORT), decoded by crashy-decode
+// layout: magic "CRBR", format version, string table (all names and messages, each stored once), then the report;
+// integers are LEB128 varints, frame addresses and breadcrumb times are zigzag encoded deltas to the previous one
+std::string EncodeReport(const CrashReport& crash, const CrashOptions& options);
+
+// fills the report and the options needed to render it with FormatReport() (command, path, release, ...)
+// returns false if the data is not a (supported version of a) binary report
+bool DecodeReport(const std::string& data, CrashReport& crash, CrashOptions& options);
@@ -0,0 +1,410 @@
+#include "breadcrumbs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#elif defined(__FreeBSD__)
+#include <pthread_np.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#include <algorithm>
+#include <new>
+#include <string_view>
+
+static BreadcrumbRegion* region = nullptr;
+
+uint32_t CurrentThreadId() {
+#if defined(__linux__)
+	return uint32_t(syscall(SYS_gettid));
+#elif defined(__FreeBSD__)
+	return uint32_t(pthread_getthreadid_np());
+#elif defined(__APPLE__)
+	uint64_t tid = 0;
+	pthread_threadid_np(nullptr, &tid);
+	return uint32_t(tid);
+#else
+	return uint32_t(getpid());
+#endif
+}
+
+uint64_t MonotonicNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return uint64_t(now.tv_sec) * 1000000000ULL + uint64_t(now.tv_nsec);
+}
+
+TickBase CurrentTickBase() {
+	TickBase base;
+	struct timespec realtime;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	base.ticks = Ticks();
+	base.monotonic = MonotonicNow();
+	base.realtimeOffset = int64_t(uint64_t(realtime.tv_sec) * 1000000000ULL + uint64_t(realtime.tv_nsec)) - int64_t(base.monotonic);
+	return base;
+}
+
+TickConverter::TickConverter(const TickBase& base) : base(base) {
+	uint64_t ticks = Ticks() - base.ticks;
+	uint64_t elapsed = MonotonicNow() - base.monotonic;
+	nsPerTick = ticks > 0 && elapsed > 0 ? double(elapsed) / double(ticks) : 1.0;
+}
+
+void CreateBreadcrumbRegion(const CrashOptions& options) {
+	if (options.breadcrumbRings == 0 || options.breadcrumbRingEntries == 0 || region)
+		return;
+	uint32_t entries = 1;
+	while (entries < options.breadcrumbRingEntries)
+		entries *= 2;
+	size_t size = 64 + options.breadcrumbFormats * sizeof(BreadcrumbFormatSlot) + size_t(options.breadcrumbRings) * (BreadcrumbRing::HEADER + entries * sizeof(BreadcrumbEntry));
+	// anonymous memory is zero filled, and only the pages of rings in use become resident
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("crash reporter: breadcrumb rings");
+		return;
+	}
+	region = new (memory) BreadcrumbRegion();
+	region->rings = options.breadcrumbRings;
+	region->entries = entries;
+	region->formats = options.breadcrumbFormats;
+	region->base = CurrentTickBase();
+	for (uint32_t i = 0; i < region->rings; ++i)
+		new (region->ring(i)) BreadcrumbRing();
+}
+
+namespace {
+// releases the ring of a thread when it exits
+struct RingOwnership {
+	BreadcrumbRing* ring = nullptr;
+	~RingOwnership() {
+		if (ring) {
+			// the context is of this thread only, the breadcrumbs remain
+			uint32_t sequence = ring->context.sequence.load(std::memory_order_relaxed);
+			ring->context.sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			memset(ring->context.entries, 0, sizeof(ring->context.entries));
+			ring->context.sequence.store(sequence + 2, std::memory_order_release);
+			ring->owner.store(0, std::memory_order_release);
+		}
+	}
+};
+}
+
+static thread_local BreadcrumbRing* currentRing = nullptr;
+static thread_local uint32_t currentThreadId = 0;
+static thread_local bool noRingAvailable = false;
+static thread_local RingOwnership ownership;
+
+static BreadcrumbRing* ClaimRing() {
+	if (noRingAvailable || !region)
+		return nullptr;
+	currentThreadId = CurrentThreadId();
+	for (uint32_t i = 0; i < region->rings; ++i) {
+		BreadcrumbRing* ring = region->ring(i);
+		uint32_t expected = 0;
+		if (ring->owner.load(std::memory_order_relaxed) == 0 && ring->owner.compare_exchange_strong(expected, currentThreadId)) {
+			ownership.ring = ring;
+			return currentRing = ring;
+		}
+	}
+	noRingAvailable = true;
+	return nullptr;
+}
+
+// copy of at most BREADCRUMB_DATA bytes with fixed size (overlapping) moves: a memcpy with variable length
+// becomes a rep movs, which takes longer than all the rest of a breadcrumb
+static inline void CopyData(char* to, const char* from, size_t n) {
+	if (n >= 16) {
+		for (size_t i = 0; i + 16 < n; i += 16)
+			memcpy(to + i, from + i, 16);
+		memcpy(to + n - 16, from + n - 16, 16);
+	} else if (n >= 8) {
+		memcpy(to, from, 8);
+		memcpy(to + n - 8, from + n - 8, 8);
+	} else if (n >= 4) {
+		memcpy(to, from, 4);
+		memcpy(to + n - 4, from + n - 4, 4);
+	} else {
+		for (size_t i = 0; i < n; ++i)
+			to[i] = from[i];
+	}
+}
+
+void AppendBreadcrumb(uint8_t level, uint8_t flags, const void* data, size_t length) {
+	BreadcrumbRing* ring = currentRing ? currentRing : ClaimRing();
+	if (!ring)
+		return;
+	// only this thread writes head
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	// the entry is not written before the increments of head for the previous ones (see FirstIntactEntry)
+	std::atomic_thread_fence(std::memory_order_release);
+	BreadcrumbEntry& entry = ring->entries()[head & (region->entries - 1)];
+	entry.time = Ticks();
+	entry.tid = currentThreadId;
+	entry.level = level;
+	entry.flags = flags;
+	entry.length = uint16_t(std::min(length, size_t(BREADCRUMB_DATA)));
+	CopyData(entry.data, static_cast<const char*>(data), entry.length);
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+// id of a call site that found the format table full: it is not registered again, and never a valid id
+static const uint32_t FORMAT_TABLE_FULL = UINT32_MAX;
+
+// copies the format of a call site to the shared region, returns its id (FORMAT_TABLE_FULL if the table is full)
+static uint32_t RegisterFormat(const crashy::BreadcrumbFormat& format) {
+	// the counter is not incremented past the size of the table, so it cannot wrap around to used slots
+	uint32_t i = region->formatsUsed.load(std::memory_order_relaxed);
+	do {
+		if (i >= region->formats)
+			return FORMAT_TABLE_FULL;
+	} while (!region->formatsUsed.compare_exchange_weak(i, i + 1, std::memory_order_relaxed));
+	BreadcrumbFormatSlot* slot = region->format(i);
+	slot->level = uint8_t(format.level);
+	slot->argumentCount = 0;
+	while (slot->argumentCount < sizeof(slot->types) && format.types[slot->argumentCount]) {
+		slot->types[slot->argumentCount] = format.types[slot->argumentCount];
+		++slot->argumentCount;
+	}
+	strncpy(slot->text, format.format ? format.format : "", sizeof(slot->text) - 1);
+	// published with the id of the call site (see StructuredBreadcrumb)
+	return i + 1;
+}
+
+void crashy::StructuredBreadcrumb(BreadcrumbFormat& format, char* arguments, size_t length) {
+	if (!region)
+		return;
+	// acquire: the slot written by the thread that registered the format is published with the entries of this
+	// thread
+	uint32_t id = format.id.load(std::memory_order_acquire);
+	if (id == 0) {
+		// concurrent first calls can register the same format twice, which does no harm
+		id = RegisterFormat(format);
+		format.id.store(id, std::memory_order_release);
+	}
+	if (id == FORMAT_TABLE_FULL) {
+		// no room for more formats: the unformatted text is better than nothing
+		AppendBreadcrumb(uint8_t(format.level), 0, format.format, strlen(format.format));
+		return;
+	}
+	memcpy(arguments, &id, sizeof(id));
+	AppendBreadcrumb(uint8_t(format.level), BREADCRUMB_STRUCTURED, arguments, length);
+}
+
+// text of the next argument of a structured breadcrumb, false if the data is cut off
+static bool DecodeArgument(uint8_t type, const char*& p, const char* end, std::string& value) {
+	if (type == crashy::STRING) {
+		if (p == end)
+			return false;
+		size_t length = uint8_t(*p);
+		++p;
+		length = std::min(length, size_t(end - p));
+		value.assign(p, length);
+		p += length;
+		return true;
+	}
+	if (type == crashy::BOOLEAN) {
+		if (p == end)
+			return false;
+		value = *p++ ? "true" : "false";
+		return true;
+	}
+	uint64_t bits;
+	if (end - p < 8)
+		return false;
+	memcpy(&bits, p, sizeof(bits));
+	p += sizeof(bits);
+	char buffer[32];
+	if (type == crashy::INTEGER) {
+		snprintf(buffer, sizeof(buffer), "%lld", (long long)bits);
+	} else if (type == crashy::FLOATING) {
+		double number;
+		memcpy(&number, &bits, sizeof(number));
+		snprintf(buffer, sizeof(buffer), "%g", number);
+	} else if (type == crashy::POINTER) {
+		snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)bits);
+	} else {
+		snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)bits);
+	}
+	value = buffer;
+	return true;
+}
+
+// replaces the placeholders of the format by the arguments; named placeholders become data of the breadcrumb
+static void FormatBreadcrumb(ReportBreadcrumb& breadcrumb, const std::string& data) {
+	uint32_t id = 0;
+	if (data.size() < sizeof(id))
+		return;
+	memcpy(&id, data.data(), sizeof(id));
+	if (id == 0 || id > std::min(region->formats, region->formatsUsed.load())) {
+		breadcrumb.message = "(unknown breadcrumb format)";
+		return;
+	}
+	const BreadcrumbFormatSlot& slot = *region->format(id - 1);
+	const char* format = slot.text;
+	size_t formatLength = strnlen(format, sizeof(slot.text));
+	const char* p = data.data() + sizeof(id);
+	const char* end = data.data() + data.size();
+	uint8_t argument = 0;
+	for (size_t i = 0; i < formatLength; ++i) {
+		char c = format[i];
+		if ((c == '{' || c == '}') && i + 1 < formatLength && format[i + 1] == c) {
+			breadcrumb.message += c;
+			++i;
+			continue;
+		}
+		size_t close = c == '{' ? std::string_view(format, formatLength).find('}', i) : std::string_view::npos;
+		if (close == std::string_view::npos) {
+			breadcrumb.message += c;
+			continue;
+		}
+		std::string value;
+		if (argument >= slot.argumentCount || !DecodeArgument(slot.types[argument], p, end, value))
+			value = "?";
+		++argument;
+		breadcrumb.message += value;
+		if (close > i + 1)
+			breadcrumb.data.emplace_back(std::string(format + i + 1, close - i - 1), value);
+		i = close;
+	}
+}
+
+std::vector<ReportBreadcrumb> ReadBreadcrumbRings(size_t max) {
+	std::vector<ReportBreadcrumb> retval;
+	if (!region)
+		return retval;
+	TickConverter clock(region->base);
+	std::vector<BreadcrumbEntry> copy(region->entries);
+	for (uint32_t i = 0; i < region->rings; ++i) {
+		BreadcrumbRing* ring = region->ring(i);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		if (head == 0)
+			continue;
+		uint64_t first = head > region->entries ? head - region->entries : 0;
+		for (uint64_t n = first; n < head; ++n)
+			memcpy(&copy[n - first], &ring->entries()[n & (region->entries - 1)], sizeof(BreadcrumbEntry));
+		// threads of the crashed process can still be running: entries overwritten while copying are discarded
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t after = ring->head.load(std::memory_order_relaxed);
+		uint64_t valid = FirstIntactEntry(first, after, region->entries);
+		for (uint64_t n = valid; n < head; ++n) {
+			auto& entry = copy[n - first];
+			ReportBreadcrumb breadcrumb;
+			breadcrumb.level = LevelName(entry.level);
+			breadcrumb.time = clock.realtime(entry.time);
+			breadcrumb.tid = entry.tid;
+			std::string data(entry.data, std::min(size_t(entry.length), size_t(BREADCRUMB_DATA)));
+			if (entry.flags & BREADCRUMB_STRUCTURED)
+				FormatBreadcrumb(breadcrumb, data);
+			else
+				breadcrumb.message = std::move(data);
+			retval.push_back(std::move(breadcrumb));
+		}
+	}
+	std::stable_sort(retval.begin(), retval.end(), [](const ReportBreadcrumb& a, const ReportBreadcrumb& b) {
+		return a.time < b.time;
+	});
+	if (retval.size() > max)
+		retval.erase(retval.begin(), retval.end() - ptrdiff_t(max));
+	return retval;
+}
+
+static ContextEntry* FindContext(BreadcrumbRing* ring, const char* key) {
+	for (auto& entry : ring->context.entries)
+		if (entry.key[0] && strncmp(entry.key, key, sizeof(entry.key) - 1) == 0)
+			return &entry;
+	return nullptr;
+}
+
+// a change of the context of the calling thread, between odd and even sequence numbers
+template <typename Change>
+static void ChangeContext(BreadcrumbRing* ring, Change change) {
+	auto& context = ring->context;
+	uint32_t sequence = context.sequence.load(std::memory_order_relaxed);
+	context.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	change();
+	context.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void CrashSetContext(const char* key, std::string_view value) {
+	BreadcrumbRing* ring = currentRing ? currentRing : ClaimRing();
+	if (!ring || !key || !key[0])
+		return;
+	ContextEntry* entry = FindContext(ring, key);
+	for (size_t i = 0; !entry && i < CONTEXT_ENTRIES; ++i)
+		if (!ring->context.entries[i].key[0])
+			entry = &ring->context.entries[i];
+	if (!entry)
+		return;
+	ChangeContext(ring, [&] {
+		if (!entry->key[0])
+			strncpy(entry->key, key, sizeof(entry->key) - 1);
+		size_t length = std::min(value.size(), sizeof(entry->value) - 1);
+		memcpy(entry->value, value.data(), length);
+		entry->value[length] = '\0';
+	});
+}
+
+void CrashClearContext(const char* key) {
+	BreadcrumbRing* ring = currentRing;
+	ContextEntry* entry = ring && key ? FindContext(ring, key) : nullptr;
+	if (entry)
+		ChangeContext(ring, [&] {
+			memset(entry, 0, sizeof(*entry));
+		});
+}
+
+bool CrashGetContext(const char* key, char* value, size_t size) {
+	BreadcrumbRing* ring = currentRing;
+	ContextEntry* entry = ring && key ? FindContext(ring, key) : nullptr;
+	if (!entry || size == 0)
+		return false;
+	size_t length = std::min(strnlen(entry->value, sizeof(entry->value)), size - 1);
+	memcpy(value, entry->value, length);
+	value[length] = '\0';
+	return true;
+}
+
+std::vector<std::pair<uint32_t, std::vector<std::pair<std::string, std::string>>>> ReadThreadContexts() {
+	std::vector<std::pair<uint32_t, std::vector<std::pair<std::string, std::string>>>> retval;
+	if (!region)
+		return retval;
+	for (uint32_t i = 0; i < region->rings; ++i) {
+		BreadcrumbRing* ring = region->ring(i);
+		uint32_t owner = ring->owner.load(std::memory_order_acquire);
+		if (owner == 0)
+			continue;
+		ThreadContext copy;
+		// the thread is possibly changing its context; a crashed thread never finishes its change, so after a
+		// number of tries the copy is used as it is (the strings are bounded anyway)
+		for (int attempt = 0; attempt < 100; ++attempt) {
+			uint32_t before = ring->context.sequence.load(std::memory_order_acquire);
+			memcpy(copy.entries, ring->context.entries, sizeof(copy.entries));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if ((before & 1) == 0 && ring->context.sequence.load(std::memory_order_relaxed) == before)
+				break;
+		}
+		std::vector<std::pair<std::string, std::string>> context;
+		for (auto& entry : copy.entries)
+			if (entry.key[0])
+				context.emplace_back(std::string(entry.key, strnlen(entry.key, sizeof(entry.key))), std::string(entry.value, strnlen(entry.value, sizeof(entry.value))));
+		if (!context.empty())
+			retval.emplace_back(owner, std::move(context));
+	}
+	return retval;
+}
+
+const char* LevelName(uint8_t level) {
+	static const char* names[] = {"debug", "info", "warning", "error", "fatal"};
+	return level < sizeof(names) / sizeof(names[0]) ? names[level] : "info";
+}
+
+void CrashBreadcrumb(CrashLevel level, const char* message, size_t length) {
+	AppendBreadcrumb(uint8_t(level), 0, message, length);
+}
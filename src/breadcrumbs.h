@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "crashy.h"
+#include "reporter.h"
+
+// per-thread breadcrumb rings (CrashBreadcrumb) in a MAP_SHARED region that is created before the crash reporter
+// is forked: after a crash the reporter reads the rings directly, the crashed process does not run anything for it
+//
+// each ring has one writer, its thread; a thread claims a free ring on its first breadcrumb and releases it when
+// it exits (the entries stay, until overwritten by the next thread using the ring)
+// an entry is written in place, and published by incrementing head; the reader copies a ring and afterwards
+// discards the entries that could have been overwritten in the meantime
+//
+// structured breadcrumbs (CRASHY_BREADCRUMB) store the id of their format and the binary arguments; the formats are
+// copied once per call site to a table in the region, and formatted by the reporter
+
+#define BREADCRUMB_DATA 240
+
+struct BreadcrumbEntry {
+	uint64_t time; // in ticks, see BreadcrumbRegion
+	uint32_t tid;
+	uint16_t length;
+	uint8_t level; // CrashLevel
+	uint8_t flags; // BREADCRUMB_STRUCTURED: data is the format id and the arguments, otherwise the message
+	char data[BREADCRUMB_DATA];
+};
+
+enum : uint8_t {
+	BREADCRUMB_STRUCTURED = 1,
+};
+
+#define BREADCRUMB_FORMAT_TEXT 238
+
+struct BreadcrumbFormatSlot {
+	uint8_t level;
+	uint8_t argumentCount;
+	uint8_t types[16]; // crashy::ArgumentType
+	char text[BREADCRUMB_FORMAT_TEXT]; // zero terminated, cut off if longer
+};
+
+// key/value crash context of a thread (CrashSetContext), zero terminated strings
+#define CONTEXT_ENTRIES 8
+struct ContextEntry {
+	char key[32];
+	char value[96];
+};
+
+// written by its thread only: sequence is odd during a change, so the reporter can detect a torn copy
+struct ThreadContext {
+	std::atomic<uint32_t> sequence;
+	ContextEntry entries[CONTEXT_ENTRIES];
+};
+
+// the cheapest monotonic clock: the TSC on x86-64, otherwise CLOCK_MONOTONIC in ns
+uint64_t MonotonicNow();
+inline uint64_t Ticks() {
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	return MonotonicNow();
+#endif
+}
+
+// taken when a region is created; the reporter converts ticks to time with it, and the clocks at the crash
+struct TickBase {
+	uint64_t ticks;
+	uint64_t monotonic; // ns
+	int64_t realtimeOffset; // CLOCK_REALTIME - CLOCK_MONOTONIC, in ns
+};
+TickBase CurrentTickBase();
+
+// ticks to ns since the epoch, with the rate of ticks measured since the base was taken
+class TickConverter {
+	TickBase base;
+	double nsPerTick;
+ public:
+	explicit TickConverter(const TickBase& base);
+	int64_t realtime(uint64_t ticks) const {
+		return int64_t(base.monotonic) + int64_t(double(int64_t(ticks - base.ticks)) * nsPerTick) + base.realtimeOffset;
+	}
+};
+
+struct BreadcrumbRing {
+	std::atomic<uint32_t> owner; // thread id, 0 if free
+	std::atomic<uint64_t> head; // number of entries ever written
+	ThreadContext context;
+	// followed by BreadcrumbRegion::entries entries
+	static constexpr size_t HEADER = (sizeof(std::atomic<uint64_t>) * 2 + sizeof(ThreadContext) + 63) / 64 * 64;
+	BreadcrumbEntry* entries() {
+		return reinterpret_cast<BreadcrumbEntry*>(reinterpret_cast<char*>(this) + HEADER);
+	}
+};
+
+// for the reader of a ring with one writer, which writes the entry at head in place and then increments head (breadcrumbs,
+// flight recorder, profiler): of the entries copied from `first` up to the head read before the copy, the first one
+// that cannot have been overwritten while copying, with `after` read after the copy (and an acquire fence)
+// the writer can be writing the entry `after` already, in the slot of the entry `after - size`
+inline uint64_t FirstIntactEntry(uint64_t first, uint64_t after, uint64_t size) {
+	return after + 1 > size ? std::max(first, after + 1 - size) : first;
+}
+
+struct BreadcrumbRegion {
+	uint32_t rings;
+	uint32_t entries; // per ring, a power of two
+	TickBase base; // entries are timestamped with Ticks()
+	uint32_t formats; // slots in the format table, which follows the header
+	std::atomic<uint32_t> formatsUsed;
+	BreadcrumbFormatSlot* format(uint32_t i) {
+		return reinterpret_cast<BreadcrumbFormatSlot*>(reinterpret_cast<char*>(this) + 64) + i;
+	}
+	BreadcrumbRing* ring(uint32_t i) {
+		return reinterpret_cast<BreadcrumbRing*>(reinterpret_cast<char*>(this) + 64 + formats * sizeof(BreadcrumbFormatSlot) + size_t(i) * (BreadcrumbRing::HEADER + entries * sizeof(BreadcrumbEntry)));
+	}
+};
+
+// in the process to be monitored, before StartReporter(); does nothing if CrashOptions::breadcrumbRings is 0
+void CreateBreadcrumbRegion(const CrashOptions& options);
+
+// appends to the ring of the calling thread; data longer than BREADCRUMB_DATA is cut off
+// if all rings are claimed by other threads, the breadcrumb is dropped
+void AppendBreadcrumb(uint8_t level, uint8_t flags, const void* data, size_t length);
+
+// in the crash reporter: the entries of all rings merged by time, oldest first, at most the last `max` ones,
+// with structured breadcrumbs formatted
+std::vector<ReportBreadcrumb> ReadBreadcrumbRings(size_t max);
+
+// crash contexts of all threads with a ring, read by the crash reporter (empty contexts are left out)
+std::vector<std::pair<uint32_t, std::vector<std::pair<std::string, std::string>>>> ReadThreadContexts();
+
+// id of the calling thread as reported (async-signal-safe)
+uint32_t CurrentThreadId();
+
+// "debug", "info", "warning", "error" or "fatal" (the Sentry level names)
+const char* LevelName(uint8_t level);
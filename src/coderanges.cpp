@@ -0,0 +1,219 @@
+#include "coderanges.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "util.h"
+
+namespace {
+struct CodeRangeTable {
+	size_t sorted = 0;
+	size_t capacity = 0;
+	std::atomic<size_t> count {0};
+	std::unique_ptr<CodeRange*[]> ranges;
+};
+
+struct CodeRangeRegistry {
+	std::mutex mutex;
+	std::unordered_map<uintptr_t, CodeRange*> live;
+	size_t removed = 0; // in the current table
+	// freed once no reader is active
+	std::vector<CodeRangeTable*> retiredTables;
+	std::vector<CodeRange*> retiredRanges;
+};
+}
+
+static std::atomic<CodeRangeTable*> codeRanges {nullptr};
+static std::atomic<int> codeRangeReaders {0};
+
+static CodeRangeRegistry& Registry() {
+	// never destroyed: ranges can be unregistered by static destructors
+	static CodeRangeRegistry* registry = new CodeRangeRegistry;
+	return *registry;
+}
+
+uint32_t CodeRange::line(uintptr_t pc) const {
+	uint32_t offset = uint32_t(pc - begin);
+	auto it = std::upper_bound(lines.begin(), lines.end(), offset, [](uint32_t offset, const CrashCodeLine& line) {
+		return offset < line.offset;
+	});
+	return it == lines.begin() ? 0 : std::prev(it)->line;
+}
+
+CodeRangeReader::CodeRangeReader() {
+	codeRangeReaders.fetch_add(1);
+}
+
+CodeRangeReader::~CodeRangeReader() {
+	codeRangeReaders.fetch_sub(1);
+}
+
+const CodeRange* CodeRangeReader::find(uintptr_t pc) const {
+	CodeRangeTable* table = codeRanges.load();
+	if (!table)
+		return nullptr;
+	size_t count = table->count.load(std::memory_order_acquire);
+	// most recent registrations first: they replace removed ranges at the same address
+	for (size_t i = count; i-- > table->sorted; ) {
+		CodeRange* range = table->ranges[i];
+		if (pc >= range->begin && pc < range->end && !range->removed.load(std::memory_order_relaxed))
+			return range;
+	}
+	size_t low = 0, high = table->sorted;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (table->ranges[middle]->begin <= pc)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	for (size_t i = low, checked = 0; i-- > 0 && checked < CODE_RANGES_BACKTRACK; ++checked) {
+		CodeRange* range = table->ranges[i];
+		if (pc < range->end && !range->removed.load(std::memory_order_relaxed))
+			return range;
+	}
+	return nullptr;
+}
+
+static void FreeRetired(CodeRangeRegistry& registry) {
+	// a reader that starts after this check loads the current table, which references none of the retired ranges
+	if (codeRangeReaders.load() != 0)
+		return;
+	for (auto* table : registry.retiredTables)
+		delete table;
+	for (auto* range : registry.retiredRanges)
+		delete range;
+	registry.retiredTables.clear();
+	registry.retiredRanges.clear();
+}
+
+// merges the recent registrations (and the new range) into a new sorted table, without the removed ranges
+static void Rebuild(CodeRangeRegistry& registry, CodeRange* added) {
+	CodeRangeTable* old = codeRanges.load();
+	std::vector<CodeRange*> sorted, recent;
+	if (old) {
+		size_t count = old->count.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < count; ++i) {
+			CodeRange* range = old->ranges[i];
+			if (range->removed.load(std::memory_order_relaxed))
+				registry.retiredRanges.push_back(range);
+			else
+				(i < old->sorted ? sorted : recent).push_back(range);
+		}
+	}
+	if (added)
+		recent.push_back(added);
+	auto byBegin = [](const CodeRange* a, const CodeRange* b) {
+		return a->begin < b->begin;
+	};
+	std::sort(recent.begin(), recent.end(), byBegin);
+
+	auto* table = new CodeRangeTable;
+	table->sorted = sorted.size() + recent.size();
+	table->capacity = table->sorted + CODE_RANGES_PENDING;
+	table->ranges.reset(new CodeRange*[table->capacity]);
+	std::merge(sorted.begin(), sorted.end(), recent.begin(), recent.end(), table->ranges.get(), byBegin);
+	table->count.store(table->sorted, std::memory_order_relaxed);
+	codeRanges.store(table);
+	registry.removed = 0;
+	if (old)
+		registry.retiredTables.push_back(old);
+	FreeRetired(registry);
+}
+
+void CrashRegisterCodeRange(const void* begin, const void* end, const char* name, const char* sourceFile, const CrashCodeLine* lines, size_t lineCount) {
+	auto* range = new CodeRange;
+	range->begin = uintptr_t(begin);
+	range->end = uintptr_t(end);
+	range->name = name ? name : "";
+	range->sourceFile = sourceFile ? sourceFile : "";
+	if (lines)
+		range->lines.assign(lines, lines + lineCount);
+
+	auto& registry = Registry();
+	std::lock_guard<std::mutex> l(registry.mutex);
+	auto [it, inserted] = registry.live.emplace(range->begin, range);
+	if (!inserted) {
+		// registered again without unregistering: the old range is replaced
+		it->second->removed.store(true, std::memory_order_relaxed);
+		++registry.removed;
+		it->second = range;
+	}
+	CodeRangeTable* table = codeRanges.load();
+	size_t count = table ? table->count.load(std::memory_order_relaxed) : 0;
+	if (table && count < table->capacity) {
+		table->ranges[count] = range;
+		table->count.store(count + 1, std::memory_order_release);
+	} else {
+		Rebuild(registry, range);
+	}
+}
+
+void CrashUnregisterCodeRange(const void* begin) {
+	auto& registry = Registry();
+	std::lock_guard<std::mutex> l(registry.mutex);
+	auto it = registry.live.find(uintptr_t(begin));
+	if (it == registry.live.end())
+		return;
+	it->second->removed.store(true, std::memory_order_relaxed);
+	registry.live.erase(it);
+	// the memory of removed ranges is reclaimed by rebuilding, once they are a large part of the table
+	if (++registry.removed > CODE_RANGES_PENDING && registry.removed > registry.live.size())
+		Rebuild(registry, nullptr);
+}
+
+void ResolvePerfMapFrames(std::vector<CrashFrame>& frames, pid_t pid) {
+	bool unresolved = false;
+	for (auto& frame : frames)
+		unresolved |= frame.module.empty() && !frame.codeRange && frame.functionName.empty();
+	if (!unresolved)
+		return;
+	// one line per symbol: start and size (hex), and the name
+	std::string path = "/tmp/perf-" + std::to_string(pid) + ".map";
+	std::ifstream in(path);
+	if (!in)
+		return;
+	struct Symbol {
+		uintptr_t begin;
+		uintptr_t end;
+		std::string name;
+	};
+	std::vector<Symbol> symbols;
+	std::string line;
+	while (std::getline(in, line)) {
+		char* p = nullptr;
+		uintptr_t begin = uintptr_t(strtoull(line.c_str(), &p, 16));
+		uintptr_t size = uintptr_t(strtoull(p, &p, 16));
+		while (*p == ' ')
+			++p;
+		if (size > 0)
+			symbols.push_back({begin, begin + size, p});
+	}
+	// later lines replace earlier ones for the same address (code is reused)
+	std::stable_sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) {
+		return a.begin < b.begin;
+	});
+	for (auto& frame : frames) {
+		if (!frame.module.empty() || frame.codeRange || !frame.functionName.empty())
+			continue;
+		uintptr_t pc = uintptr_t(frame.pc);
+		auto it = std::upper_bound(symbols.begin(), symbols.end(), pc, [](uintptr_t pc, const Symbol& symbol) {
+			return pc < symbol.begin;
+		});
+		if (it == symbols.begin() || pc >= std::prev(it)->end)
+			continue;
+		--it;
+		frame.codeRange = true;
+		frame.functionName = it->name;
+		frame.symbolName = it->name;
+		frame.library = BaseName(path.c_str());
+		frame.offsetInFile = uint32_t(pc - it->begin);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "crashy.h"
+#include "reporter.h"
+
+// registry of code ranges without ELF image (CrashRegisterCodeRange)
+//
+// readers (the crash handler) load the current table and search it without locks; writers serialize on a mutex
+// a table has a sorted part and up to CODE_RANGES_PENDING recent registrations after it, appended in place and
+// published by incrementing the count; when full, the recent ones are merged into a new sorted table
+// unregistering only marks a range as removed; removed ranges and replaced tables are freed by a later writer,
+// once no reader is active
+
+#define CODE_RANGES_PENDING 64
+// readers check this many ranges before the one found by the binary search, as removed ranges can overlap a live one
+#define CODE_RANGES_BACKTRACK 4
+
+struct CodeRange {
+	uintptr_t begin;
+	uintptr_t end;
+	std::string name;
+	std::string sourceFile;
+	std::vector<CrashCodeLine> lines;
+	std::atomic<bool> removed {false};
+
+	// line of sourceFile for an address in the range, 0 if unknown
+	uint32_t line(uintptr_t pc) const;
+};
+
+// holds off freeing of ranges while it exists, so the returned range stays valid
+class CodeRangeReader {
+ public:
+	CodeRangeReader();
+	~CodeRangeReader();
+	CodeRangeReader(const CodeRangeReader&) = delete;
+	CodeRangeReader& operator=(const CodeRangeReader&) = delete;
+	// async-signal-safe; nullptr if pc is not in a registered range
+	const CodeRange* find(uintptr_t pc) const;
+};
+
+// crash reporter: resolves the frames without module that are in the /tmp/perf-<pid>.map of the crashed process
+// (CrashOptions::readPerfMap)
+void ResolvePerfMapFrames(std::vector<CrashFrame>& frames, pid_t pid);
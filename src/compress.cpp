@@ -0,0 +1,100 @@
+#include "compress.h"
+
+#ifdef CRASHY_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CRASHY_ZSTD
+#include <zstd.h>
+#endif
+
+bool CompressPayload(CrashOptions::Compression compression, const std::string& in [[maybe_unused]], std::string& out) {
+	out.clear();
+#ifdef CRASHY_ZLIB
+	if (compression == CrashOptions::GZIP) {
+		z_stream stream = {};
+		// 15 window bits, +16 for a gzip header instead of a zlib header
+		if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+		out.resize(deflateBound(&stream, uLong(in.size())) + 32);
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+		stream.avail_in = uInt(in.size());
+		stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+		stream.avail_out = uInt(out.size());
+		int result = deflate(&stream, Z_FINISH);
+		out.resize(stream.total_out);
+		deflateEnd(&stream);
+		if (result != Z_STREAM_END) {
+			out.clear();
+			return false;
+		}
+		return true;
+	}
+#endif
+#ifdef CRASHY_ZSTD
+	if (compression == CrashOptions::ZSTD) {
+		out.resize(ZSTD_compressBound(in.size()));
+		size_t size = ZSTD_compress(&out[0], out.size(), in.data(), in.size(), 3);
+		if (ZSTD_isError(size)) {
+			out.clear();
+			return false;
+		}
+		out.resize(size);
+		return true;
+	}
+#endif
+	if (compression != CrashOptions::NO_COMPRESSION)
+		return false;
+	out = in;
+	return true;
+}
+
+CrashOptions::Compression DetectCompression(const std::string& payload) {
+	if (payload.size() >= 2 && uint8_t(payload[0]) == 0x1f && uint8_t(payload[1]) == 0x8b)
+		return CrashOptions::GZIP;
+	if (payload.size() >= 4 && uint8_t(payload[0]) == 0x28 && uint8_t(payload[1]) == 0xb5 && uint8_t(payload[2]) == 0x2f && uint8_t(payload[3]) == 0xfd)
+		return CrashOptions::ZSTD;
+	return CrashOptions::NO_COMPRESSION;
+}
+
+bool DecompressPayload(const std::string& in, std::string& out) {
+	out.clear();
+	auto compression = DetectCompression(in);
+#ifdef CRASHY_ZLIB
+	if (compression == CrashOptions::GZIP) {
+		z_stream stream = {};
+		if (inflateInit2(&stream, 15 + 16) != Z_OK)
+			return false;
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+		stream.avail_in = uInt(in.size());
+		int result = Z_OK;
+		char buffer[64 * 1024];
+		while (result == Z_OK) {
+			stream.next_out = reinterpret_cast<Bytef*>(buffer);
+			stream.avail_out = sizeof(buffer);
+			result = inflate(&stream, Z_NO_FLUSH);
+			out.append(buffer, sizeof(buffer) - stream.avail_out);
+		}
+		inflateEnd(&stream);
+		return result == Z_STREAM_END;
+	}
+#endif
+#ifdef CRASHY_ZSTD
+	if (compression == CrashOptions::ZSTD) {
+		unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+		if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+			return false;
+		out.resize(size_t(size));
+		size_t result = ZSTD_decompress(&out[0], out.size(), in.data(), in.size());
+		if (ZSTD_isError(result)) {
+			out.clear();
+			return false;
+		}
+		out.resize(result);
+		return true;
+	}
+#endif
+	if (compression != CrashOptions::NO_COMPRESSION)
+		return false;
+	out = in;
+	return true;
+}
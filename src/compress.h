@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include "crashy.h"
+
+// compresses a report payload; returns false (and leaves out empty) if the compression is not available in this build
+// gzip output has a full gzip header (Content-Encoding: gzip), zstd output is a single zstd frame
+bool CompressPayload(CrashOptions::Compression compression, const std::string& in, std::string& out);
+
+// compression of a payload based on its magic bytes, so a sender knows which Content-Encoding to use
+CrashOptions::Compression DetectCompression(const std::string& payload);
+
+// reverse of CompressPayload, based on the magic bytes; uncompressed payloads are copied
+// returns false if the payload is corrupt, or the compression is not available in this build
+bool DecompressPayload(const std::string& in, std::string& out);
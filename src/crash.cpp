@@ -86,6 +86,12 @@
 #include "unwinder.h"
 #include "simple-raw.h"
 #include "reporter.h"
+#include "breadcrumbs.h"
+#include "coderanges.h"
+#include "flightrecorder.h"
+#include "nonfatal.h"
+#include "profiler.h"
+#include "watchdog.h"
 #include "util.h"
 
 #define MAX_STACK_TRACE 32
@@ -94,12 +100,23 @@ CrashOptions crashOptions;
 
 using PrintSymbolFunc = void (*)(const char* symbolName, uint32_t offset_in_func, const char*filename, uint32_t offset_in_file, void* pc);
 using PrintPCFunc = void (*)(void* pc);
+using PrintCodeRangeFunc = void (*)(const CodeRange& range, void* pc);
+
+// frame in a range registered with CrashRegisterCodeRange
+static void PrintCodeRange(const CodeRange& range, void* pc) {
+	uint32_t line = range.line(uintptr_t(pc));
+	if (line)
+		fprintf(stderr, "~~> %s+0x%x [%s:%u] (%p)\n", range.name.c_str(), unsigned(uintptr_t(pc) - range.begin), range.sourceFile.c_str(), line, pc);
+	else
+		fprintf(stderr, "~~> %s+0x%x (%p)\n", range.name.c_str(), unsigned(uintptr_t(pc) - range.begin), pc);
+}
 
 struct ToReporterArgs {
 	const char** filter = nullptr;
 	bool skipUntilMatch = true;
 	PrintSymbolFunc printSymbol;
 	PrintPCFunc printPC;
+	PrintCodeRangeFunc printCodeRange = PrintCodeRange;
 	const char* currentExecutable = nullptr;
 	bool display(const char* name) {
 		if (filter) {
@@ -146,10 +163,26 @@ void PrintPCToReporter(void* pc) {
 	WriteBinary(crashReporterLink, uint64_t(pc));
 }
 
+void PrintCodeRangeToReporter(const CodeRange& range, void* pc) {
+	WriteBinary(crashReporterLink, uint32_t(CrashTag::CODE_RANGE));
+	WriteString(range.name.c_str());
+	WriteString(range.sourceFile.c_str());
+	WriteBinary(crashReporterLink, uint32_t(range.line(uintptr_t(pc))));
+	WriteBinary(crashReporterLink, uint32_t(uintptr_t(pc) - range.begin));
+	WriteBinary(crashReporterLink, uint64_t(pc));
+}
+
 bool Process(void* pc, void* _args) {
 	ToReporterArgs* args = static_cast<ToReporterArgs*>(_args);
   if (!args)
     return false;
+	// JIT compiled code has no image for dladdr
+	CodeRangeReader codeRanges;
+	if (auto* range = codeRanges.find(uintptr_t(pc))) {
+		if (args->display(range->name.c_str()))
+			args->printCodeRange(*range, pc);
+		return false;
+	}
 	// on FreeBSD/Linux compile with  -Wl,--export-dynamic
 	Dl_info dyldInfo;
 	if (dladdr(pc, &dyldInfo)) {
@@ -168,6 +201,28 @@ bool Process(void* pc, void* _args) {
 	return false;
 }
 
+thread_local crashy::AsyncFrame* crashy::currentAsyncFrame = nullptr;
+
+// the logical stack of the coroutine running on this thread: its awaiters, innermost first
+// coroutines that are not suspended (resumed by their awaiter) are already part of the physical stack
+static void ProcessAsyncStack(ToReporterArgs& args) {
+	args.filter = nullptr;
+	bool first = true;
+	int depth = 0;
+	for (auto* frame = crashy::currentAsyncFrame; frame && depth < MAX_STACK_TRACE; frame = frame->awaiter, ++depth) {
+		if (!frame->resumeAddress)
+			continue;
+		if (first) {
+			if (crashReporterLink < 0)
+				fprintf(stderr, "--- async stack ---\n");
+			else
+				WriteBinary(crashReporterLink, uint32_t(CrashTag::ASYNC_STACK));
+			first = false;
+		}
+		Process(frame->resumeAddress, &args);
+	}
+}
+
 extern "C" int PrintCurrentCallStack(int max_size) {
 	const char* ThrowHandlers[] = {"PrintCurrentCallStack", NULL};
 	ToReporterArgs args {
@@ -181,6 +236,9 @@ extern "C" int PrintCurrentCallStack(int max_size) {
 [[noreturn]] void FinishReport() {
 	if (crashReporterLink < 0)
 		::_Exit(EXIT_FAILURE);
+	// the reporter reads the crash context of this thread from the shared memory
+	WriteBinary(crashReporterLink, uint32_t(CrashTag::THREAD));
+	WriteBinary(crashReporterLink, CurrentThreadId());
 	if (crashOptions.getContext) {
 		WriteBinary(crashReporterLink, uint32_t(CrashTag::CONTEXT));
 		WriteString(crashOptions.getContext());
@@ -266,11 +324,13 @@ extern "C" [[noreturn]] void SendToReporter(int sig, siginfo_t *si, void *_ucxt)
 #endif
 		.printSymbol = PrintSymbolToReporter,
 		.printPC = PrintPCToReporter,
+		.printCodeRange = PrintCodeRangeToReporter,
 	};
 	if (crashReporterLink < 0) {
 		fprintf(stderr, "=== CRASH ===\n" "%s (%i) on address %p.\n", strsignal(sig), sig, p);
 		args.printSymbol = PrintSymbolRaw;
 		args.printPC = PrintPCRaw;
+		args.printCodeRange = PrintCodeRange;
 	} else {
 		WriteBinary(crashReporterLink, uint32_t(CrashTag::START));
 		WriteBinary(crashReporterLink, uint32_t(CrashTag::SIGNAL));
@@ -279,6 +339,7 @@ extern "C" [[noreturn]] void SendToReporter(int sig, siginfo_t *si, void *_ucxt)
 	}
 
 	StackTraceSignal(Process, &args, _ucxt, MAX_STACK_TRACE);
+	ProcessAsyncStack(args);
 
 	FinishReport();
 }
@@ -296,11 +357,13 @@ extern "C" [[noreturn]] void CrashAssert(const char* func, const char* file, int
 		.filter = ThrowHandlers,
 		.printSymbol = PrintSymbolToReporter,
 		.printPC = PrintPCToReporter,
+		.printCodeRange = PrintCodeRangeToReporter,
 	};
 	if (crashReporterLink < 0) {
 		fprintf(stderr, "=== CRASH ===\n" "Assertion violation in %s [%s:%i]: %s.\n", func, file, line, condition);
 		args.printSymbol = PrintSymbolRaw;
 		args.printPC = PrintPCRaw;
+		args.printCodeRange = PrintCodeRange;
 	} else {
 		WriteBinary(crashReporterLink, uint32_t(CrashTag::START));
 		WriteBinary(crashReporterLink, uint32_t(CrashTag::ASSERT));
@@ -311,6 +374,7 @@ extern "C" [[noreturn]] void CrashAssert(const char* func, const char* file, int
 		WriteString(explanation);
 	}
 	StackTrace(Process, &args, MAX_STACK_TRACE);
+	ProcessAsyncStack(args);
 	FinishReport();
 }
 
@@ -326,6 +390,7 @@ void GenerateDumpOnUncaughtException() {
 			.printPC = PrintPC,
 		};
 		StackTrace(Process, &args, MAX_STACK_TRACE);
+		ProcessAsyncStack(args);
 		return;
 	}
 
@@ -334,16 +399,26 @@ void GenerateDumpOnUncaughtException() {
 		.filter = UncaughtExceptionThrowHandlers,
 		.printSymbol = PrintSymbolToReporter,
 		.printPC = PrintPCToReporter,
+		.printCodeRange = PrintCodeRangeToReporter,
 	};
 	StackTrace(Process, &args, MAX_STACK_TRACE);
+	ProcessAsyncStack(args);
 	FinishReport();
 }
 
 void GenerateDumpOnCrash(CrashOptions&& options) {
   options.currentExecutable = SetCurrentExecutable(options.currentExecutable.c_str());
 
+	// before the reporter is forked, so it shares the rings
+	CreateBreadcrumbRegion(options);
+	CreateFlightRecorder(options);
+	CreateNonFatalQueue(options);
+	CreateProfiler(options);
+	CreateWatchdog(options);
 	std::tie(crashReporterLink, crashReporterProcess, options) = StartReporter(std::move(options));
 	crashOptions = std::move(options);
+	StartProfiler();
+	StartWatchdog(crashReporterProcess);
 
 #ifdef __cplusplus
 	std::set_terminate(GenerateDumpOnUncaughtException);
@@ -0,0 +1,82 @@
+// crashy-decode: converts binary crash reports (CrashOptions::BINARY_REPORT, optionally compressed) to the plain text
+// or Sentry formats
+// usage: crashy-decode [-f plain|sentry|envelope] report...
+//
+// Reports are written to stdout, separated by a newline. Raw reports (CrashOptions::rawReport) decoded to the
+// sentry format can be symbolized with crashy-symbolize.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "binaryreport.h"
+#include "compress.h"
+#include "reporter.h"
+
+static bool ReadFile(const char* filename, std::string& contents) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	contents = buffer.str();
+	return true;
+}
+
+static void Usage(const char* name) {
+	fprintf(stderr, "usage: %s [-f plain|sentry|envelope] report...\n", name);
+	fprintf(stderr, "  -f  output format (default: plain)\n");
+}
+
+int main(int argc, char** argv) {
+	CrashOptions::SendFormat format = CrashOptions::PLAIN_TEXT;
+	int c;
+	while ((c = getopt(argc, argv, "f:h")) != -1) {
+		switch (c) {
+			case 'f':
+				if (strcmp(optarg, "plain") == 0) {
+					format = CrashOptions::PLAIN_TEXT;
+				} else if (strcmp(optarg, "sentry") == 0) {
+					format = CrashOptions::JSON_SENTRY;
+				} else if (strcmp(optarg, "envelope") == 0) {
+					format = CrashOptions::ENVELOPE_SENTRY;
+				} else {
+					Usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				Usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		Usage(argv[0]);
+		return 1;
+	}
+	int retval = 0;
+	for (int i = optind; i < argc; ++i) {
+		std::string contents, data;
+		if (!ReadFile(argv[i], contents)) {
+			perror(argv[i]);
+			retval = 1;
+			continue;
+		}
+		CrashReport crash;
+		CrashOptions options;
+		if (!DecompressPayload(contents, data) || !DecodeReport(data, crash, options)) {
+			fprintf(stderr, "%s: not a binary crash report\n", argv[i]);
+			retval = 1;
+			continue;
+		}
+		std::string report = FormatReport(crash, options, format);
+		fwrite(report.data(), 1, report.size(), stdout);
+		if (report.empty() || report.back() != '\n')
+			fputc('\n', stdout);
+	}
+	return retval;
+}
@@ -0,0 +1,750 @@
+#ifndef __APPLE__
+
+#include "dwarfline.h"
+#include "elfimage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// only the subset of DWARF constants needed to find and decode a line program
+enum DwarfForm : uint16_t {
+	FORM_ADDR = 0x01,
+	FORM_BLOCK2 = 0x03,
+	FORM_BLOCK4 = 0x04,
+	FORM_DATA2 = 0x05,
+	FORM_DATA4 = 0x06,
+	FORM_DATA8 = 0x07,
+	FORM_STRING = 0x08,
+	FORM_BLOCK = 0x09,
+	FORM_BLOCK1 = 0x0a,
+	FORM_DATA1 = 0x0b,
+	FORM_FLAG = 0x0c,
+	FORM_SDATA = 0x0d,
+	FORM_STRP = 0x0e,
+	FORM_UDATA = 0x0f,
+	FORM_REF_ADDR = 0x10,
+	FORM_REF1 = 0x11,
+	FORM_REF2 = 0x12,
+	FORM_REF4 = 0x13,
+	FORM_REF8 = 0x14,
+	FORM_REF_UDATA = 0x15,
+	FORM_INDIRECT = 0x16,
+	FORM_SEC_OFFSET = 0x17,
+	FORM_EXPRLOC = 0x18,
+	FORM_FLAG_PRESENT = 0x19,
+	FORM_STRX = 0x1a,
+	FORM_ADDRX = 0x1b,
+	FORM_REF_SUP4 = 0x1c,
+	FORM_STRP_SUP = 0x1d,
+	FORM_DATA16 = 0x1e,
+	FORM_LINE_STRP = 0x1f,
+	FORM_REF_SIG8 = 0x20,
+	FORM_IMPLICIT_CONST = 0x21,
+	FORM_LOCLISTX = 0x22,
+	FORM_RNGLISTX = 0x23,
+	FORM_REF_SUP8 = 0x24,
+	FORM_STRX1 = 0x25,
+	FORM_STRX2 = 0x26,
+	FORM_STRX3 = 0x27,
+	FORM_STRX4 = 0x28,
+	FORM_ADDRX1 = 0x29,
+	FORM_ADDRX2 = 0x2a,
+	FORM_ADDRX3 = 0x2b,
+	FORM_ADDRX4 = 0x2c,
+	FORM_GNU_ADDR_INDEX = 0x1f01,
+	FORM_GNU_STR_INDEX = 0x1f02,
+	FORM_GNU_REF_ALT = 0x1f20,
+	FORM_GNU_STRP_ALT = 0x1f21,
+};
+
+enum DwarfAttribute : uint16_t {
+	AT_STMT_LIST = 0x10,
+	AT_COMP_DIR = 0x1b,
+	AT_STR_OFFSETS_BASE = 0x72,
+};
+
+enum DwarfUnitType : uint8_t {
+	UT_TYPE = 0x02,
+	UT_SKELETON = 0x04,
+	UT_SPLIT_COMPILE = 0x05,
+	UT_SPLIT_TYPE = 0x06,
+};
+
+enum DwarfLine : uint8_t {
+	LNS_COPY = 1,
+	LNS_ADVANCE_PC = 2,
+	LNS_ADVANCE_LINE = 3,
+	LNS_SET_FILE = 4,
+	LNS_SET_COLUMN = 5,
+	LNS_NEGATE_STMT = 6,
+	LNS_SET_BASIC_BLOCK = 7,
+	LNS_CONST_ADD_PC = 8,
+	LNS_FIXED_ADVANCE_PC = 9,
+	LNE_END_SEQUENCE = 1,
+	LNE_SET_ADDRESS = 2,
+	LNCT_PATH = 1,
+	LNCT_DIRECTORY_INDEX = 2,
+};
+
+// bounds checked reader; on reading past the end `good` is cleared and zeroes are returned
+struct DwarfCursor {
+	const uint8_t* p = nullptr;
+	const uint8_t* end = nullptr;
+	bool good = true;
+
+	DwarfCursor(std::string_view section, uint64_t offset = 0) {
+		p = reinterpret_cast<const uint8_t*>(section.data());
+		end = p + section.size();
+		if (offset > section.size())
+			good = false;
+		else
+			p += offset;
+	}
+	DwarfCursor(const uint8_t* begin, const uint8_t* end) : p(begin), end(end) {
+	}
+	bool need(uint64_t n) {
+		if (good && uint64_t(end - p) >= n)
+			return true;
+		good = false;
+		p = end;
+		return false;
+	}
+	void skip(uint64_t n) {
+		if (need(n))
+			p += n;
+	}
+	// fixed size unsigned number in target (= host) byte order
+	uint64_t fixed(size_t n) {
+		uint64_t retval = 0;
+		if (!need(n))
+			return 0;
+		for (size_t i = 0; i < n; ++i)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			retval |= uint64_t(p[i]) << (8 * i);
+#else
+			retval = (retval << 8) | p[i];
+#endif
+		p += n;
+		return retval;
+	}
+	uint8_t u8() {
+		return uint8_t(fixed(1));
+	}
+	uint16_t u16() {
+		return uint16_t(fixed(2));
+	}
+	uint64_t offset(bool dwarf64) {
+		return fixed(dwarf64 ? 8 : 4);
+	}
+	uint64_t uleb() {
+		uint64_t retval = 0;
+		for (unsigned shift = 0; need(1); shift += 7) {
+			uint8_t b = *p++;
+			if (shift < 64)
+				retval |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				break;
+		}
+		return retval;
+	}
+	int64_t sleb() {
+		int64_t retval = 0;
+		unsigned shift = 0;
+		uint8_t b = 0;
+		while (need(1)) {
+			b = *p++;
+			if (shift < 64)
+				retval |= int64_t(uint64_t(b & 0x7f) << shift);
+			shift += 7;
+			if (!(b & 0x80))
+				break;
+		}
+		if (shift < 64 && (b & 0x40))
+			retval |= -(int64_t(1) << shift);
+		return retval;
+	}
+	const char* cstr() {
+		if (!good)
+			return nullptr;
+		auto terminator = static_cast<const uint8_t*>(memchr(p, '\0', size_t(end - p)));
+		if (!terminator) {
+			good = false;
+			p = end;
+			return nullptr;
+		}
+		auto retval = reinterpret_cast<const char*>(p);
+		p = terminator + 1;
+		return retval;
+	}
+	// initial length field of units; returns the end of the unit
+	const uint8_t* unitLength(bool& dwarf64) {
+		uint64_t length = fixed(4);
+		dwarf64 = length == 0xffffffff;
+		if (dwarf64)
+			length = fixed(8);
+		if (!need(length))
+			return end;
+		return p + length;
+	}
+};
+
+static const char* SectionString(std::string_view section, uint64_t offset) {
+	if (offset >= section.size())
+		return nullptr;
+	if (!memchr(section.data() + offset, '\0', section.size() - offset))
+		return nullptr;
+	return section.data() + offset;
+}
+
+static bool SkipForm(DwarfCursor& c, uint64_t form, bool dwarf64, uint8_t addressSize, uint16_t version) {
+	switch (form) {
+		case FORM_FLAG_PRESENT:
+		case FORM_IMPLICIT_CONST:
+			break;
+		case FORM_DATA1: case FORM_REF1: case FORM_FLAG: case FORM_STRX1: case FORM_ADDRX1:
+			c.skip(1);
+			break;
+		case FORM_DATA2: case FORM_REF2: case FORM_STRX2: case FORM_ADDRX2:
+			c.skip(2);
+			break;
+		case FORM_STRX3: case FORM_ADDRX3:
+			c.skip(3);
+			break;
+		case FORM_DATA4: case FORM_REF4: case FORM_REF_SUP4: case FORM_STRX4: case FORM_ADDRX4:
+			c.skip(4);
+			break;
+		case FORM_DATA8: case FORM_REF8: case FORM_REF_SIG8: case FORM_REF_SUP8:
+			c.skip(8);
+			break;
+		case FORM_DATA16:
+			c.skip(16);
+			break;
+		case FORM_ADDR:
+			c.skip(addressSize);
+			break;
+		case FORM_REF_ADDR:
+			c.skip(version <= 2 ? addressSize : (dwarf64 ? 8 : 4));
+			break;
+		case FORM_STRP: case FORM_LINE_STRP: case FORM_SEC_OFFSET: case FORM_STRP_SUP:
+		case FORM_GNU_REF_ALT: case FORM_GNU_STRP_ALT:
+			c.skip(dwarf64 ? 8 : 4);
+			break;
+		case FORM_SDATA:
+			c.sleb();
+			break;
+		case FORM_UDATA: case FORM_REF_UDATA: case FORM_STRX: case FORM_ADDRX:
+		case FORM_LOCLISTX: case FORM_RNGLISTX: case FORM_GNU_ADDR_INDEX: case FORM_GNU_STR_INDEX:
+			c.uleb();
+			break;
+		case FORM_STRING:
+			c.cstr();
+			break;
+		case FORM_BLOCK1:
+			c.skip(c.fixed(1));
+			break;
+		case FORM_BLOCK2:
+			c.skip(c.fixed(2));
+			break;
+		case FORM_BLOCK4:
+			c.skip(c.fixed(4));
+			break;
+		case FORM_BLOCK: case FORM_EXPRLOC:
+			c.skip(c.uleb());
+			break;
+		case FORM_INDIRECT:
+			return SkipForm(c, c.uleb(), dwarf64, addressSize, version);
+		default:
+			c.good = false;
+	}
+	return c.good;
+}
+
+// reads a string attribute; strx forms are returned as index, to be resolved with DW_AT_str_offsets_base
+static const char* ReadString(const ElfImage& image, DwarfCursor& c, uint64_t form, bool dwarf64, uint64_t* index) {
+	switch (form) {
+		case FORM_STRING:
+			return c.cstr();
+		case FORM_STRP:
+			return SectionString(image.section(".debug_str"), c.offset(dwarf64));
+		case FORM_LINE_STRP:
+			return SectionString(image.section(".debug_line_str"), c.offset(dwarf64));
+		case FORM_STRX: case FORM_GNU_STR_INDEX:
+			*index = c.uleb();
+			return nullptr;
+		case FORM_STRX1: case FORM_STRX2: case FORM_STRX3: case FORM_STRX4:
+			*index = c.fixed(size_t(form - FORM_STRX1 + 1));
+			return nullptr;
+	}
+	return nullptr;
+}
+
+namespace {
+// an address range of a compilation unit, or of a row of a line program
+struct UnitRange {
+	uint64_t low;
+	uint64_t high;
+	uint64_t unit; // offset in .debug_info
+};
+struct LineRange {
+	uint64_t low;
+	uint64_t high;
+	uint32_t file;
+	uint32_t line;
+	uint32_t column;
+};
+}
+
+// the address ranges of all compilation units in .debug_aranges, sorted
+static std::vector<UnitRange> ReadUnitRanges(std::string_view aranges) {
+	std::vector<UnitRange> retval;
+	DwarfCursor c(aranges);
+	while (c.good && c.p < c.end) {
+		const uint8_t* start = c.p;
+		bool dwarf64 = false;
+		const uint8_t* end = c.unitLength(dwarf64);
+		DwarfCursor set(c.p, end);
+		c.p = end;
+		uint16_t version = set.u16();
+		uint64_t offset = set.offset(dwarf64);
+		uint8_t addressSize = set.u8();
+		uint8_t segmentSize = set.u8();
+		if (!set.good || version != 2 || (addressSize != 4 && addressSize != 8))
+			continue;
+		// tuples are aligned to the size of a tuple, counted from the start of the set
+		size_t tupleSize = 2 * addressSize + segmentSize;
+		set.skip((tupleSize - size_t(set.p - start) % tupleSize) % tupleSize);
+		while (set.good) {
+			set.skip(segmentSize);
+			uint64_t low = set.fixed(addressSize);
+			uint64_t length = set.fixed(addressSize);
+			if (!set.good || (low == 0 && length == 0))
+				break;
+			if (length > 0)
+				retval.push_back({low, low + length, offset});
+		}
+	}
+	std::stable_sort(retval.begin(), retval.end(), [](const UnitRange& a, const UnitRange& b) {
+		return a.low < b.low;
+	});
+	return retval;
+}
+
+// the range of a sorted index that contains target; ranges do not overlap, except ranges with the same start (e.g.
+// discarded code, all at 0)
+template <typename Range>
+static const Range* FindRange(const std::vector<Range>& index, uint64_t target) {
+	auto it = std::upper_bound(index.begin(), index.end(), target, [](uint64_t target, const Range& range) {
+		return target < range.low;
+	});
+	if (it == index.begin())
+		return nullptr;
+	// the first range of the group, in the order of the debug information
+	uint64_t low = std::prev(it)->low;
+	auto first = std::lower_bound(index.begin(), it, low, [](const Range& range, uint64_t low) {
+		return range.low < low;
+	});
+	for (; first != it; ++first)
+		if (target < first->high)
+			return &*first;
+	return nullptr;
+}
+
+struct DwarfUnit {
+	bool dwarf64 = false;
+	uint16_t version = 0;
+	uint8_t addressSize = 0;
+	bool hasStatementList = false;
+	uint64_t statementList = 0;
+	const char* compilationDirectory = nullptr;
+};
+
+// reads the attributes of the unit DIE that are needed to decode the line program
+static bool ReadUnit(const ElfImage& image, uint64_t offset, DwarfUnit& unit) {
+	DwarfCursor c(image.section(".debug_info"), offset);
+	c.end = c.unitLength(unit.dwarf64);
+	unit.version = c.u16();
+	uint64_t abbreviationOffset = 0;
+	if (unit.version >= 5) {
+		uint8_t unitType = c.u8();
+		unit.addressSize = c.u8();
+		abbreviationOffset = c.offset(unit.dwarf64);
+		if (unitType == UT_SKELETON || unitType == UT_SPLIT_COMPILE)
+			c.skip(8); // dwo_id
+		else if (unitType == UT_TYPE || unitType == UT_SPLIT_TYPE)
+			c.skip(8 + (unit.dwarf64 ? 8 : 4)); // type signature and type offset
+	} else {
+		abbreviationOffset = c.offset(unit.dwarf64);
+		unit.addressSize = c.u8();
+	}
+	if (!c.good || unit.version < 2 || unit.version > 5)
+		return false;
+	uint64_t code = c.uleb();
+
+	DwarfCursor abbreviation(image.section(".debug_abbrev"), abbreviationOffset);
+	while (abbreviation.good) {
+		uint64_t current = abbreviation.uleb();
+		if (current == 0)
+			return false;
+		abbreviation.uleb(); // tag
+		abbreviation.u8(); // has children
+		if (current == code)
+			break;
+		while (abbreviation.good) {
+			uint64_t attribute = abbreviation.uleb();
+			uint64_t form = abbreviation.uleb();
+			if (form == FORM_IMPLICIT_CONST)
+				abbreviation.sleb();
+			if (attribute == 0 && form == 0)
+				break;
+		}
+	}
+
+	uint64_t stringIndex = ~uint64_t(0);
+	uint64_t stringOffsetsBase = unit.dwarf64 ? 16 : 8; // directly after the header of the first contribution
+	while (abbreviation.good && c.good) {
+		uint64_t attribute = abbreviation.uleb();
+		uint64_t form = abbreviation.uleb();
+		if (form == FORM_IMPLICIT_CONST)
+			abbreviation.sleb();
+		if (attribute == 0 && form == 0)
+			break;
+		if (attribute == AT_STMT_LIST && (form == FORM_SEC_OFFSET || form == FORM_DATA4 || form == FORM_DATA8)) {
+			unit.statementList = form == FORM_DATA8 ? c.fixed(8) : form == FORM_DATA4 ? c.fixed(4) : c.offset(unit.dwarf64);
+			unit.hasStatementList = c.good;
+		} else if (attribute == AT_COMP_DIR) {
+			const uint8_t* before = c.p;
+			unit.compilationDirectory = ReadString(image, c, form, unit.dwarf64, &stringIndex);
+			if (c.p == before && !SkipForm(c, form, unit.dwarf64, unit.addressSize, unit.version))
+				return false;
+		} else if (attribute == AT_STR_OFFSETS_BASE && form == FORM_SEC_OFFSET) {
+			stringOffsetsBase = c.offset(unit.dwarf64);
+		} else if (!SkipForm(c, form, unit.dwarf64, unit.addressSize, unit.version)) {
+			return false;
+		}
+	}
+	if (!unit.compilationDirectory && stringIndex != ~uint64_t(0)) {
+		DwarfCursor offsets(image.section(".debug_str_offsets"), stringOffsetsBase);
+		offsets.skip(stringIndex * (unit.dwarf64 ? 8 : 4));
+		uint64_t stringOffset = offsets.offset(unit.dwarf64);
+		if (offsets.good)
+			unit.compilationDirectory = SectionString(image.section(".debug_str"), stringOffset);
+	}
+	return c.good;
+}
+
+// reads a DWARF 5 directory or file name entry, described by the (content type, form) pairs in `format`
+static bool ReadEntry(const ElfImage& image, DwarfCursor& c, DwarfCursor format, uint8_t formatCount, bool dwarf64, uint8_t addressSize, const char** path, uint64_t* directory) {
+	for (uint8_t i = 0; i < formatCount && c.good; ++i) {
+		uint64_t contentType = format.uleb();
+		uint64_t form = format.uleb();
+		if (contentType == LNCT_PATH) {
+			uint64_t index = 0;
+			const uint8_t* before = c.p;
+			*path = ReadString(image, c, form, dwarf64, &index);
+			if (c.p == before)
+				SkipForm(c, form, dwarf64, addressSize, 5);
+		} else if (contentType == LNCT_DIRECTORY_INDEX && (form == FORM_UDATA || form == FORM_DATA1 || form == FORM_DATA2)) {
+			*directory = form == FORM_UDATA ? c.uleb() : c.fixed(form == FORM_DATA1 ? 1 : 2);
+		} else {
+			SkipForm(c, form, dwarf64, addressSize, 5);
+		}
+	}
+	return c.good;
+}
+
+static char* JoinPath(const char* compilationDirectory, const char* directory, const char* file) {
+	if (file[0] == '/')
+		return strdup(file);
+	const char* parts[3] = {file, nullptr, nullptr};
+	size_t count = 1;
+	if (directory && directory[0]) {
+		parts[count++] = directory;
+		if (directory[0] != '/' && compilationDirectory && compilationDirectory[0])
+			parts[count++] = compilationDirectory;
+	} else if (compilationDirectory && compilationDirectory[0]) {
+		parts[count++] = compilationDirectory;
+	}
+	size_t length = 0;
+	for (size_t i = 0; i < count; ++i)
+		length += strlen(parts[i]) + 1;
+	char* retval = static_cast<char*>(malloc(length));
+	if (!retval)
+		return nullptr;
+	char* current = retval;
+	for (size_t i = count; i-- > 0; ) {
+		size_t partLength = strlen(parts[i]);
+		memcpy(current, parts[i], partLength);
+		current += partLength;
+		*current++ = i ? '/' : '\0';
+	}
+	return retval;
+}
+
+// resolves a file index of the line program to a path (only walking the tables up to that index)
+static char* FileName(const ElfImage& image, DwarfCursor c, const DwarfUnit& unit, uint16_t version, bool dwarf64, uint8_t addressSize, uint64_t file) {
+	if (version >= 5) {
+		uint8_t directoryFormatCount = c.u8();
+		DwarfCursor directoryFormat = c;
+		for (uint8_t i = 0; i < directoryFormatCount; ++i) {
+			c.uleb();
+			c.uleb();
+		}
+		uint64_t directoryCount = c.uleb();
+		DwarfCursor directories = c;
+		for (uint64_t i = 0; i < directoryCount && c.good; ++i) {
+			const char* ignored = nullptr;
+			uint64_t ignoredIndex = 0;
+			ReadEntry(image, c, directoryFormat, directoryFormatCount, dwarf64, addressSize, &ignored, &ignoredIndex);
+		}
+		uint8_t fileFormatCount = c.u8();
+		DwarfCursor fileFormat = c;
+		for (uint8_t i = 0; i < fileFormatCount; ++i) {
+			c.uleb();
+			c.uleb();
+		}
+		uint64_t fileCount = c.uleb();
+		if (file >= fileCount)
+			return nullptr;
+		const char* path = nullptr;
+		uint64_t directoryIndex = 0;
+		for (uint64_t i = 0; i <= file && c.good; ++i)
+			ReadEntry(image, c, fileFormat, fileFormatCount, dwarf64, addressSize, &path, &directoryIndex);
+		if (!c.good || !path)
+			return nullptr;
+		const char* directory = nullptr;
+		uint64_t ignoredIndex = 0;
+		if (directoryIndex < directoryCount) {
+			for (uint64_t i = 0; i <= directoryIndex && directories.good; ++i)
+				ReadEntry(image, directories, directoryFormat, directoryFormatCount, dwarf64, addressSize, &directory, &ignoredIndex);
+		}
+		return JoinPath(unit.compilationDirectory, directory, path);
+	}
+
+	// DWARF 2-4: file and directory indices start at 1, directory 0 is the compilation directory
+	DwarfCursor directories = c;
+	while (c.good) {
+		const char* directory = c.cstr();
+		if (!directory || !directory[0])
+			break;
+	}
+	for (uint64_t i = 1; c.good; ++i) {
+		const char* path = c.cstr();
+		if (!path || !path[0])
+			return nullptr;
+		uint64_t directoryIndex = c.uleb();
+		c.uleb(); // modification time
+		c.uleb(); // length
+		if (i != file)
+			continue;
+		const char* directory = nullptr;
+		for (uint64_t j = 0; j < directoryIndex && directories.good; ++j)
+			directory = directories.cstr();
+		return JoinPath(unit.compilationDirectory, directory && directory[0] ? directory : nullptr, path);
+	}
+	return nullptr;
+}
+
+// the decoded line program of a unit: the address range of each row, sorted, and what is needed for file names
+struct UnitLines {
+	bool valid = false;
+	DwarfUnit unit;
+	uint16_t version = 0;
+	bool dwarf64 = false;
+	uint8_t addressSize = 0;
+	DwarfCursor tables {nullptr, nullptr}; // the directory and file name tables
+	std::vector<LineRange> ranges;
+	std::map<uint32_t, std::string> files; // paths found so far, by file number
+};
+
+static bool DecodeLineProgram(const ElfImage& image, UnitLines& lines) {
+	const DwarfUnit& unit = lines.unit;
+	DwarfCursor c(image.section(".debug_line"), unit.statementList);
+	bool dwarf64 = false;
+	c.end = c.unitLength(dwarf64);
+	const uint8_t* programEnd = c.end;
+	uint16_t version = c.u16();
+	uint8_t addressSize = unit.addressSize;
+	if (version >= 5) {
+		addressSize = c.u8();
+		c.u8(); // segment selector size
+	}
+	uint64_t headerLength = c.offset(dwarf64);
+	if (!c.need(headerLength) || version < 2 || version > 5)
+		return false;
+	const uint8_t* programStart = c.p + headerLength;
+	uint8_t minimumInstructionLength = c.u8();
+	uint8_t maximumOperationsPerInstruction = version >= 4 ? c.u8() : 1;
+	c.u8(); // default_is_stmt
+	int8_t lineBase = int8_t(c.u8());
+	uint8_t lineRange = c.u8();
+	uint8_t opcodeBase = c.u8();
+	const uint8_t* standardOpcodeLengths = c.p;
+	c.skip(opcodeBase ? opcodeBase - 1 : 0);
+	if (!c.good || lineRange == 0 || opcodeBase == 0)
+		return false;
+	lines.version = version;
+	lines.dwarf64 = dwarf64;
+	lines.addressSize = addressSize;
+	lines.tables = DwarfCursor(c.p, programStart);
+
+	// state machine registers (is_stmt, basic_block and friends are not needed for lookups)
+	uint64_t address = 0, operationIndex = 0, file = 1, line = 1, columnNumber = 0;
+	// previous row in the current sequence
+	bool havePrevious = false;
+	uint64_t previousAddress = 0, previousFile = 0, previousLine = 0, previousColumn = 0;
+
+	auto advance = [&](uint64_t operationAdvance) {
+		if (maximumOperationsPerInstruction <= 1) {
+			address += minimumInstructionLength * operationAdvance;
+		} else {
+			address += minimumInstructionLength * ((operationIndex + operationAdvance) / maximumOperationsPerInstruction);
+			operationIndex = (operationIndex + operationAdvance) % maximumOperationsPerInstruction;
+		}
+	};
+	// a row ends the range of the previous row of its sequence
+	auto row = [&](bool endSequence) {
+		if (havePrevious && previousAddress < address)
+			lines.ranges.push_back({previousAddress, address, uint32_t(previousFile), uint32_t(previousLine), uint32_t(previousColumn)});
+		havePrevious = !endSequence;
+		previousAddress = address;
+		previousFile = file;
+		previousLine = line;
+		previousColumn = columnNumber;
+	};
+
+	DwarfCursor program(programStart, programEnd);
+	while (program.good && program.p < program.end) {
+		uint8_t opcode = program.u8();
+		if (opcode >= opcodeBase) {
+			uint8_t adjusted = uint8_t(opcode - opcodeBase);
+			advance(adjusted / lineRange);
+			line += uint64_t(int64_t(lineBase) + adjusted % lineRange);
+			row(false);
+			continue;
+		}
+		switch (opcode) {
+			case 0: {
+				uint64_t length = program.uleb();
+				if (length == 0 || !program.need(length))
+					break;
+				const uint8_t* next = program.p + length;
+				uint8_t extended = program.u8();
+				if (extended == LNE_END_SEQUENCE) {
+					row(true);
+					address = operationIndex = columnNumber = 0;
+					file = line = 1;
+				} else if (extended == LNE_SET_ADDRESS) {
+					size_t size = size_t(length - 1);
+					address = program.fixed(size <= 8 ? size : addressSize);
+					operationIndex = 0;
+				}
+				program.p = next;
+				break;
+			}
+			case LNS_COPY:
+				row(false);
+				break;
+			case LNS_ADVANCE_PC:
+				advance(program.uleb());
+				break;
+			case LNS_ADVANCE_LINE:
+				line += uint64_t(program.sleb());
+				break;
+			case LNS_SET_FILE:
+				file = program.uleb();
+				break;
+			case LNS_SET_COLUMN:
+				columnNumber = program.uleb();
+				break;
+			case LNS_NEGATE_STMT:
+			case LNS_SET_BASIC_BLOCK:
+				break;
+			case LNS_CONST_ADD_PC:
+				advance((255 - opcodeBase) / lineRange);
+				break;
+			case LNS_FIXED_ADVANCE_PC:
+				address += program.u16();
+				operationIndex = 0;
+				break;
+			default:
+				// unknown standard opcode (e.g. prologue_end, set_isa): skip its operands
+				for (uint8_t i = 0; i < standardOpcodeLengths[opcode - 1]; ++i)
+					program.uleb();
+		}
+	}
+	// stable: of rows at the same address, the first one in the line program is found
+	std::stable_sort(lines.ranges.begin(), lines.ranges.end(), [](const LineRange& a, const LineRange& b) {
+		return a.low < b.low;
+	});
+	return true;
+}
+
+namespace {
+// the units of an image and the line programs decoded so far, by offset of the unit in .debug_info
+struct LineIndex {
+	std::shared_ptr<const ElfImage> image; // keeps the address of the image unique
+	std::mutex mutex;
+	std::vector<UnitRange> units;
+	std::map<uint64_t, UnitLines> lines;
+};
+}
+
+// line indexes stay for the lifetime of the reporter, like the images (see OpenElfImage): a line program is decoded
+// once, on its first lookup, and later lookups in the same unit are binary searches
+static std::shared_ptr<LineIndex> OpenLineIndex(std::shared_ptr<const ElfImage> image) {
+	static std::mutex mutex;
+	static std::map<const ElfImage*, std::shared_ptr<LineIndex>> indexes;
+	std::lock_guard<std::mutex> l(mutex);
+	auto& index = indexes[image.get()];
+	if (!index) {
+		index = std::make_shared<LineIndex>();
+		index->units = ReadUnitRanges(image->section(".debug_aranges"));
+		index->image = std::move(image);
+	}
+	return index;
+}
+
+int LookupLine(const char* filename, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column) {
+	auto image = OpenElfImage(filename);
+	if (!image)
+		return -1;
+	if (image->section(".debug_aranges").empty())
+		return -2;
+	auto index = OpenLineIndex(image);
+	std::lock_guard<std::mutex> l(index->mutex);
+	const UnitRange* unit = FindRange(index->units, target);
+	if (!unit)
+		return -3;
+	auto inserted = index->lines.emplace(unit->unit, UnitLines());
+	UnitLines& lines = inserted.first->second;
+	if (inserted.second)
+		lines.valid = ReadUnit(*image, unit->unit, lines.unit) && lines.unit.hasStatementList && DecodeLineProgram(*image, lines);
+	if (!lines.valid)
+		return -4;
+	const LineRange* row = FindRange(lines.ranges, target);
+	if (!row)
+		return -5;
+	auto file = lines.files.find(row->file);
+	if (file == lines.files.end()) {
+		char* path = FileName(*image, lines.tables, lines.unit, lines.version, lines.dwarf64, lines.addressSize, row->file);
+		if (!path)
+			return -5;
+		file = lines.files.emplace(row->file, path).first;
+		free(path);
+	}
+	*sourceFile = strdup(file->second.c_str());
+	*lineNumber = row->line;
+	if (column && row->column >= 1)
+		*column = row->column;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// Address to source line lookup that works directly on the mmap'ed ELF file.
+// Uses .debug_aranges to find the compilation unit, and only decodes the line program of that unit; the decoded
+// rows are kept per file, so later lookups in the same unit are binary searches.
+// Returns 0 if found (sourceFile is malloc'ed, just like Lookup()), and a negative number otherwise
+// (e.g. no .debug_aranges present) so the caller can fall back to libdwarf.
+int LookupLine(const char* filename, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column);
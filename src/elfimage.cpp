@@ -0,0 +1,239 @@
+#ifndef __APPLE__
+
+#include "elfimage.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+#ifndef SHF_COMPRESSED
+#define SHF_COMPRESSED (1 << 11)
+#endif
+
+template <typename T>
+static T Read(const uint8_t* p) {
+	T retval;
+	memcpy(&retval, p, sizeof(T));
+	return retval;
+}
+
+ElfImage::ElfImage(const char* filename) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* mapping = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			data = static_cast<const uint8_t*>(mapping);
+			size = size_t(st.st_size);
+		}
+	}
+	close(fd);
+	if (!data || size < EI_NIDENT || memcmp(data, ELFMAG, SELFMAG) != 0)
+		return;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (data[EI_DATA] != ELFDATA2LSB)
+		return;
+#else
+	if (data[EI_DATA] != ELFDATA2MSB)
+		return;
+#endif
+	is64 = data[EI_CLASS] == ELFCLASS64;
+	uint64_t shoff = 0;
+	size_t shnum = 0;
+	size_t shstrndx = 0;
+	if (is64 && size >= sizeof(Elf64_Ehdr)) {
+		auto header = Read<Elf64_Ehdr>(data);
+		shoff = header.e_shoff;
+		shnum = header.e_shnum;
+		shstrndx = header.e_shstrndx;
+		sectionHeaderSize = sizeof(Elf64_Shdr);
+		programHeaderOffset = header.e_phoff;
+		programHeaderCount = header.e_phnum;
+		fixedAddress = header.e_type == ET_EXEC;
+	} else if (!is64 && data[EI_CLASS] == ELFCLASS32 && size >= sizeof(Elf32_Ehdr)) {
+		auto header = Read<Elf32_Ehdr>(data);
+		shoff = header.e_shoff;
+		shnum = header.e_shnum;
+		shstrndx = header.e_shstrndx;
+		sectionHeaderSize = sizeof(Elf32_Shdr);
+		programHeaderOffset = header.e_phoff;
+		programHeaderCount = header.e_phnum;
+		fixedAddress = header.e_type == ET_EXEC;
+	} else {
+		return;
+	}
+	if (shoff == 0 || shoff >= size || size - shoff < sectionHeaderSize)
+		return;
+	sectionHeaders = data + shoff;
+	sectionCount = 1;
+	uint32_t name, type, link;
+	uint64_t flags, offset, sectionSize;
+	// extended numbering: real values are stored in the first section header
+	if (!sectionHeader(0, name, type, flags, offset, sectionSize, link)) {
+		sectionHeaders = nullptr;
+		return;
+	}
+	if (shnum == 0)
+		shnum = size_t(sectionSize);
+	if (shstrndx == SHN_XINDEX)
+		shstrndx = link;
+	if ((size - shoff) / sectionHeaderSize < shnum) {
+		sectionHeaders = nullptr;
+		return;
+	}
+	sectionCount = shnum;
+	if (!sectionHeader(shstrndx, name, type, flags, offset, sectionSize, link)) {
+		sectionHeaders = nullptr;
+		return;
+	}
+	sectionNames = {reinterpret_cast<const char*>(data + offset), size_t(sectionSize)};
+	gnuBuildId = readBuildId();
+}
+
+ElfImage::~ElfImage() {
+	if (data)
+		munmap(const_cast<uint8_t*>(data), size);
+}
+
+bool ElfImage::sectionHeader(size_t index, uint32_t& name, uint32_t& type, uint64_t& flags, uint64_t& offset, uint64_t& sectionSize, uint32_t& link) const {
+	if (index >= sectionCount)
+		return false;
+	const uint8_t* p = sectionHeaders + index * sectionHeaderSize;
+	if (is64) {
+		auto header = Read<Elf64_Shdr>(p);
+		name = header.sh_name;
+		type = header.sh_type;
+		flags = header.sh_flags;
+		offset = header.sh_offset;
+		sectionSize = header.sh_size;
+		link = header.sh_link;
+	} else {
+		auto header = Read<Elf32_Shdr>(p);
+		name = header.sh_name;
+		type = header.sh_type;
+		flags = header.sh_flags;
+		offset = header.sh_offset;
+		sectionSize = header.sh_size;
+		link = header.sh_link;
+	}
+	return type == SHT_NOBITS || (offset <= size && sectionSize <= size - offset);
+}
+
+std::string_view ElfImage::section(const char* wanted) const {
+	size_t wantedLength = strlen(wanted);
+	for (size_t i = 1; i < sectionCount; ++i) {
+		uint32_t name, type, link;
+		uint64_t flags, offset, sectionSize;
+		if (!sectionHeader(i, name, type, flags, offset, sectionSize, link))
+			continue;
+		if (name >= sectionNames.size() || sectionNames.size() - name <= wantedLength)
+			continue;
+		if (memcmp(sectionNames.data() + name, wanted, wantedLength + 1) != 0)
+			continue;
+		// compressed debug sections (-gz) are left to libdwarf
+		if (type == SHT_NOBITS || (flags & SHF_COMPRESSED))
+			return {};
+		return {reinterpret_cast<const char*>(data + offset), size_t(sectionSize)};
+	}
+	return {};
+}
+
+std::string ElfImage::readBuildId() const {
+	for (size_t i = 1; i < sectionCount; ++i) {
+		uint32_t name, type, link;
+		uint64_t flags, offset, sectionSize;
+		if (!sectionHeader(i, name, type, flags, offset, sectionSize, link) || type != SHT_NOTE)
+			continue;
+		// notes: namesz, descsz, type, name and descriptor (both padded to 4 bytes)
+		const uint8_t* p = data + offset;
+		const uint8_t* end = p + sectionSize;
+		while (size_t(end - p) >= 12) {
+			uint32_t nameSize = Read<uint32_t>(p);
+			uint32_t descriptorSize = Read<uint32_t>(p + 4);
+			uint32_t noteType = Read<uint32_t>(p + 8);
+			p += 12;
+			size_t paddedName = (size_t(nameSize) + 3) & ~size_t(3);
+			size_t paddedDescriptor = (size_t(descriptorSize) + 3) & ~size_t(3);
+			if (size_t(end - p) < paddedName || size_t(end - p) - paddedName < descriptorSize)
+				break;
+			if (noteType == NT_GNU_BUILD_ID && nameSize == 4 && memcmp(p, "GNU", 4) == 0) {
+				static const char hex[] = "0123456789abcdef";
+				std::string retval;
+				for (const uint8_t* b = p + paddedName; b < p + paddedName + descriptorSize; ++b) {
+					retval += hex[*b >> 4];
+					retval += hex[*b & 0xf];
+				}
+				return retval;
+			}
+			if (size_t(end - p) - paddedName < paddedDescriptor)
+				break;
+			p += paddedName + paddedDescriptor;
+		}
+	}
+	return {};
+}
+
+uint64_t ElfImage::imageSize() const {
+	size_t headerSize = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	if (programHeaderOffset >= size || (size - programHeaderOffset) / headerSize < programHeaderCount)
+		return 0;
+	uint64_t low = ~uint64_t(0);
+	uint64_t high = 0;
+	for (size_t i = 0; i < programHeaderCount; ++i) {
+		const uint8_t* p = data + programHeaderOffset + i * headerSize;
+		uint32_t type;
+		uint64_t address, memorySize;
+		if (is64) {
+			auto header = Read<Elf64_Phdr>(p);
+			type = header.p_type;
+			address = header.p_vaddr;
+			memorySize = header.p_memsz;
+		} else {
+			auto header = Read<Elf32_Phdr>(p);
+			type = header.p_type;
+			address = header.p_vaddr;
+			memorySize = header.p_memsz;
+		}
+		if (type != PT_LOAD)
+			continue;
+		low = std::min(low, address);
+		high = std::max(high, address + memorySize);
+	}
+	return high > low ? high - low : 0;
+}
+
+namespace {
+struct CachedImage {
+	dev_t device = 0;
+	ino_t inode = 0;
+	struct timespec modified = {};
+	std::shared_ptr<const ElfImage> image;
+};
+}
+
+std::shared_ptr<const ElfImage> OpenElfImage(const char* filename) {
+	static std::mutex mutex;
+	static std::map<std::string, CachedImage> images;
+	struct stat st;
+	if (stat(filename, &st))
+		return nullptr;
+	std::lock_guard<std::mutex> l(mutex);
+	auto& cached = images[filename];
+	if (!cached.image || cached.device != st.st_dev || cached.inode != st.st_ino ||
+			cached.modified.tv_sec != st.st_mtim.tv_sec || cached.modified.tv_nsec != st.st_mtim.tv_nsec) {
+		// images still in use elsewhere stay mapped until released
+		cached = {st.st_dev, st.st_ino, st.st_mtim, std::make_shared<ElfImage>(filename)};
+	}
+	return cached.image->valid() ? cached.image : nullptr;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// read-only mmap of an ELF file, used to read sections without copying them
+class ElfImage {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	bool is64 = false;
+	bool fixedAddress = false;
+	const uint8_t* sectionHeaders = nullptr;
+	size_t sectionCount = 0;
+	size_t sectionHeaderSize = 0;
+	std::string_view sectionNames;
+	uint64_t programHeaderOffset = 0;
+	size_t programHeaderCount = 0;
+	std::string gnuBuildId;
+
+	bool sectionHeader(size_t index, uint32_t& name, uint32_t& type, uint64_t& flags, uint64_t& offset, uint64_t& size, uint32_t& link) const;
+	std::string readBuildId() const;
+ public:
+	explicit ElfImage(const char* filename);
+	~ElfImage();
+	ElfImage(const ElfImage&) = delete;
+	ElfImage& operator=(const ElfImage&) = delete;
+
+	bool valid() const {
+		return sectionHeaders != nullptr;
+	}
+	// contents of a section; empty if absent, of type NOBITS or compressed
+	std::string_view section(const char* name) const;
+	// GNU build-id note in hex (as used by debuginfod and Sentry as code_id), empty if absent
+	const std::string& buildId() const {
+		return gnuBuildId;
+	}
+	// size of the memory image (all PT_LOAD segments)
+	uint64_t imageSize() const;
+	// non-PIE executable (ET_EXEC): debug info uses run-time addresses instead of offsets from the load address
+	bool isFixedAddress() const {
+		return fixedAddress;
+	}
+};
+
+// images stay mapped for the lifetime of the reporter, so repeated lookups in the same module are cheap; a file
+// replaced since (another inode or modification time, e.g. by an update) is mapped again
+std::shared_ptr<const ElfImage> OpenElfImage(const char* filename);
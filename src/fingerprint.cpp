@@ -0,0 +1,153 @@
+#include "fingerprint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+#include "elfimage.h"
+#include "util.h"
+
+static const size_t FINGERPRINT_FRAMES = 5;
+static const size_t MAX_STORED_FINGERPRINTS = 1024;
+
+// FNV-1a
+static void Hash(uint64_t& hash, const std::string& data) {
+	for (unsigned char c : data) {
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+	hash ^= 0xff; // separator
+	hash *= 0x100000001b3ULL;
+}
+
+std::string CrashFingerprint(const CrashReport& crash, const CrashOptions& options) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	if (crash.signal)
+		Hash(hash, "signal " + std::to_string(crash.signal->first));
+	if (crash.uncaughtException)
+		Hash(hash, "exception " + crash.uncaughtException->second);
+	if (crash.assertViolation)
+		Hash(hash, "assert " + std::get<1>(*crash.assertViolation) + ":" + std::to_string(std::get<2>(*crash.assertViolation)));
+	if (crash.nonFatal)
+		Hash(hash, "nonfatal " + std::to_string(crash.nonFatal->kind) + " " + crash.nonFatal->level);
+	// where a slow operation is interrupted varies: it is the same operation if the name is the same
+	size_t frames = std::min(FINGERPRINT_FRAMES, crash.frames.size());
+	if (crash.nonFatal && crash.nonFatal->kind == NonFatalReport::SLOW_OPERATION) {
+		Hash(hash, "operation " + crash.nonFatal->operation);
+		frames = 0;
+	}
+	std::map<std::string, std::string> buildIds;
+	for (size_t i = 0; i < frames; ++i) {
+		auto& frame = crash.frames[i];
+		// JIT compiled code is at another address in every process
+		if (frame.codeRange) {
+			Hash(hash, frame.functionName + "+" + std::to_string(frame.offsetInFile));
+			continue;
+		}
+		auto it = buildIds.find(frame.module);
+		if (it == buildIds.end()) {
+			std::string path = ModulePath(frame, options);
+			std::string buildId;
+#ifndef __APPLE__
+			if (auto image = OpenElfImage(path.c_str()))
+				buildId = image->buildId();
+#endif
+			// without build-id, the name of the module is the next best thing
+			it = buildIds.emplace(frame.module, buildId.empty() ? BaseName(path.c_str()) : buildId).first;
+		}
+		// frames without module are absolute addresses in a fixed address executable
+		uint64_t offset = frame.module.empty() ? uintptr_t(frame.pc) : frame.offsetInFile;
+		Hash(hash, it->second + "+" + std::to_string(offset));
+	}
+	char retval[17];
+	snprintf(retval, sizeof(retval), "%016llx", (unsigned long long)hash);
+	return retval;
+}
+
+namespace {
+struct Counter {
+	time_t windowStart = 0;
+	uint64_t reported = 0; // in the current window
+	uint64_t suppressed = 0; // since the last report
+};
+}
+
+bool AllowReport(const CrashOptions& options, const std::string& fingerprint, time_t now, uint64_t& suppressed) {
+	suppressed = 0;
+	if (options.maxReportsPerFingerprint == 0)
+		return true;
+	std::string store = options.fingerprintStore;
+	if (store.empty() && !options.persistentCrashReportsDirectory.empty()) {
+		mkdir(options.persistentCrashReportsDirectory.c_str(), 0700);
+		store = options.persistentCrashReportsDirectory + "/.fingerprints";
+	}
+	if (store.empty())
+		return true;
+	int fd = open(store.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		perror(("crash reporter: " + store).c_str());
+		return true;
+	}
+	// concurrent reporters update the store one at a time
+	int result;
+	while ((result = flock(fd, LOCK_EX)) != 0 && errno == EINTR) {
+	}
+	std::string contents;
+	char buffer[16 * 1024];
+	ssize_t n;
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+		if (n > 0)
+			contents.append(buffer, size_t(n));
+
+	// one line per fingerprint: fingerprint, start of window, reported in window, suppressed since last report
+	std::map<std::string, Counter> counters;
+	std::istringstream in(contents);
+	std::string key;
+	Counter counter;
+	long long windowStart;
+	while (in >> key >> windowStart >> counter.reported >> counter.suppressed) {
+		counter.windowStart = time_t(windowStart);
+		counters[key] = counter;
+	}
+
+	auto& current = counters[fingerprint];
+	if (now - current.windowStart >= time_t(options.fingerprintWindow.count())) {
+		current.windowStart = now;
+		current.reported = 0;
+	}
+	bool allowed = current.reported < options.maxReportsPerFingerprint;
+	if (allowed) {
+		++current.reported;
+		suppressed = current.suppressed;
+		current.suppressed = 0;
+	} else {
+		++current.suppressed;
+	}
+
+	// forget fingerprints without pending suppressed crashes, least recent first
+	if (counters.size() > MAX_STORED_FINGERPRINTS) {
+		std::vector<std::pair<time_t, std::string>> candidates;
+		for (auto& [key, counter] : counters)
+			if (counter.suppressed == 0 && key != fingerprint)
+				candidates.emplace_back(counter.windowStart, key);
+		std::sort(candidates.begin(), candidates.end());
+		for (size_t i = 0; i < candidates.size() && counters.size() > MAX_STORED_FINGERPRINTS; ++i)
+			counters.erase(candidates[i].second);
+	}
+
+	std::string output;
+	for (auto& [key, counter] : counters)
+		output += key + " " + std::to_string((long long)counter.windowStart) + " " + std::to_string(counter.reported) + " " + std::to_string(counter.suppressed) + "\n";
+	if (ftruncate(fd, 0) != 0 || pwrite(fd, output.data(), output.size(), 0) != ssize_t(output.size()))
+		perror(("crash reporter: " + store).c_str());
+	flock(fd, LOCK_UN);
+	close(fd);
+	return allowed;
+}
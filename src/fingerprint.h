@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+#include "crashy.h"
+#include "reporter.h"
+
+// stable identification of a crash, computed before symbolization: the kind of crash (signal, exception type or
+// assert location) and the build-id and offset of the top frames; the same on every host running the same binaries
+std::string CrashFingerprint(const CrashReport& crash, const CrashOptions& options);
+
+// applies CrashOptions::maxReportsPerFingerprint, with the counters stored in CrashOptions::fingerprintStore
+// (or in persistentCrashReportsDirectory)
+// returns false if the crash should not be reported (it is counted as suppressed)
+// if true, suppressed is set to the number of crashes suppressed since the previous report with this fingerprint
+bool AllowReport(const CrashOptions& options, const std::string& fingerprint, time_t now, uint64_t& suppressed);
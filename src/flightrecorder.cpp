@@ -0,0 +1,224 @@
+#if !defined(_GNU_SOURCE) && defined(__linux__)
+#define _GNU_SOURCE	// linux needs this for Dl_info
+#endif
+
+#include "flightrecorder.h"
+
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <map>
+#include <new>
+#include <string>
+
+#include "util.h"
+
+static FlightRecorderRegion* recorder = nullptr;
+static std::atomic<bool> recording {false};
+
+// only the instrumentation hooks and CreateFlightRecorder() record: without them, the recorder is never created
+#ifdef CRASHY_FLIGHT_RECORDER
+// executable code of loaded modules, for CrashOptions::flightRecorderModules and flightRecorderExcludeModules
+#define FLIGHT_FILTERS 128
+
+namespace {
+struct FlightFilter {
+	uintptr_t begin;
+	uintptr_t end;
+	bool recorded;
+};
+}
+
+static FlightFilter filters[FLIGHT_FILTERS];
+static size_t filterCount = 0;
+static bool filtering = false;
+static bool recordUnknown = true; // code outside of the filters
+
+static thread_local FlightRing* flightRing = nullptr;
+static thread_local bool noFlightRing = false;
+
+namespace {
+// releases the ring of a thread when it exits
+struct FlightRingOwnership {
+	FlightRing* ring = nullptr;
+	~FlightRingOwnership() {
+		if (ring) {
+			// instrumented code running later in the exit of the thread is not recorded
+			flightRing = nullptr;
+			noFlightRing = true;
+			ring->owner.store(0, std::memory_order_release);
+		}
+	}
+};
+}
+
+static thread_local FlightRingOwnership flightRingOwnership;
+
+static bool Recorded(uintptr_t address) {
+	size_t low = 0, high = filterCount;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (filters[middle].end <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < filterCount && filters[low].begin <= address)
+		return filters[low].recorded;
+	return recordUnknown;
+}
+
+static FlightRing* ClaimFlightRing() {
+	if (noFlightRing)
+		return nullptr;
+	uint32_t tid = CurrentThreadId();
+	for (uint32_t i = 0; i < recorder->rings; ++i) {
+		FlightRing* ring = recorder->ring(i);
+		uint32_t expected = 0;
+		if (ring->owner.load(std::memory_order_relaxed) == 0 && ring->owner.compare_exchange_strong(expected, tid)) {
+			flightRingOwnership.ring = ring;
+			return flightRing = ring;
+		}
+	}
+	noFlightRing = true;
+	return nullptr;
+}
+
+static inline void Record(void* function, uint64_t exit) {
+	if (!recording.load(std::memory_order_relaxed))
+		return;
+	if (filtering && !Recorded(uintptr_t(function)))
+		return;
+	FlightRing* ring = flightRing ? flightRing : ClaimFlightRing();
+	if (!ring)
+		return;
+	// only this thread writes head
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	FlightEvent& event = ring->events()[head & (recorder->events - 1)];
+	event.time = Ticks();
+	event.address = uint64_t(uintptr_t(function)) | exit;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+extern "C" {
+__attribute__((no_instrument_function)) void __cyg_profile_func_enter(void* function, void* caller [[maybe_unused]]) {
+	Record(function, 0);
+}
+__attribute__((no_instrument_function)) void __cyg_profile_func_exit(void* function, void* caller [[maybe_unused]]) {
+	Record(function, FLIGHT_EVENT_EXIT);
+}
+}
+
+static bool Contains(const std::vector<std::string>& modules, const std::string& name) {
+	return std::find(modules.begin(), modules.end(), name) != modules.end();
+}
+
+static void CreateFilters(const CrashOptions& options) {
+	filtering = !options.flightRecorderModules.empty() || !options.flightRecorderExcludeModules.empty();
+	if (!filtering)
+		return;
+	recordUnknown = options.flightRecorderModules.empty();
+	struct Context {
+		const CrashOptions& options;
+		std::string executable;
+	} context {options, BaseName(options.currentExecutable.c_str())};
+	dl_iterate_phdr([](struct dl_phdr_info* info, size_t, void* data) {
+		auto& context = *static_cast<Context*>(data);
+		// the executable has no name
+		std::string name = info->dlpi_name && info->dlpi_name[0] ? BaseName(info->dlpi_name) : context.executable;
+		bool recorded = (context.options.flightRecorderModules.empty() || Contains(context.options.flightRecorderModules, name)) &&
+			!Contains(context.options.flightRecorderExcludeModules, name);
+		for (int i = 0; i < info->dlpi_phnum && filterCount < FLIGHT_FILTERS; ++i) {
+			auto& header = info->dlpi_phdr[i];
+			if (header.p_type == PT_LOAD && (header.p_flags & PF_X))
+				filters[filterCount++] = {uintptr_t(info->dlpi_addr + header.p_vaddr), uintptr_t(info->dlpi_addr + header.p_vaddr + header.p_memsz), recorded};
+		}
+		return 0;
+	}, &context);
+	std::sort(filters, filters + filterCount, [](const FlightFilter& a, const FlightFilter& b) {
+		return a.begin < b.begin;
+	});
+}
+#endif
+
+void CreateFlightRecorder(const CrashOptions& options [[maybe_unused]]) {
+#ifdef CRASHY_FLIGHT_RECORDER
+	if (options.flightRecorderRings == 0 || options.flightRecorderEvents == 0 || recorder)
+		return;
+	uint32_t events = 1;
+	while (events < options.flightRecorderEvents)
+		events *= 2;
+	size_t size = 64 + size_t(options.flightRecorderRings) * (FlightRing::HEADER + events * sizeof(FlightEvent));
+	// anonymous memory is zero filled, and only the pages of rings in use become resident
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("crash reporter: flight recorder");
+		return;
+	}
+	auto* region = new (memory) FlightRecorderRegion();
+	region->rings = options.flightRecorderRings;
+	region->events = events;
+	region->base = CurrentTickBase();
+	for (uint32_t i = 0; i < region->rings; ++i)
+		new (region->ring(i)) FlightRing();
+	CreateFilters(options);
+	recorder = region;
+	recording.store(true);
+#endif
+}
+
+void StopFlightRecorder() {
+	recording.store(false);
+}
+
+void ReadFlightRecorder(CrashReport& crash, const CrashOptions& options) {
+	if (!recorder || options.flightRecorderReportEvents == 0)
+		return;
+	TickConverter clock(recorder->base);
+	size_t max = std::min(size_t(options.flightRecorderReportEvents), size_t(recorder->events));
+	std::map<uint64_t, uint32_t> functions; // address, index in flightRecorderFunctions
+	std::vector<FlightEvent> copy(max);
+	for (uint32_t i = 0; i < recorder->rings; ++i) {
+		FlightRing* ring = recorder->ring(i);
+		uint32_t tid = ring->owner.load(std::memory_order_acquire);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		if (head == 0)
+			continue;
+		uint64_t first = head > max ? head - max : 0;
+		for (uint64_t n = first; n < head; ++n)
+			copy[n - first] = ring->events()[n & (recorder->events - 1)];
+		// threads of the crashed process can still be running: events overwritten while copying are discarded
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t after = ring->head.load(std::memory_order_relaxed);
+		uint64_t valid = FirstIntactEntry(first, after, recorder->events);
+		std::vector<FlightRecorderEvent> events;
+		for (uint64_t n = valid; n < head; ++n) {
+			auto& event = copy[n - first];
+			uint64_t address = event.address & ~FLIGHT_EVENT_EXIT;
+			auto it = functions.emplace(address, uint32_t(functions.size())).first;
+			events.push_back({clock.realtime(event.time), it->second, (event.address & FLIGHT_EVENT_EXIT) != 0});
+		}
+		// rings of exited threads have no owner (0) but keep their events; a ring claimed again can have events of
+		// the previous thread too
+		if (!events.empty())
+			crash.flightRecorder.emplace_back(tid, std::move(events));
+	}
+
+	// the reporter is forked from the crashed process: modules loaded before it started are at the same addresses
+	crash.flightRecorderFunctions.resize(functions.size());
+	for (auto& [address, index] : functions) {
+		CrashFrame& frame = crash.flightRecorderFunctions[index];
+		frame.pc = reinterpret_cast<void*>(uintptr_t(address));
+		Dl_info info;
+		if (dladdr(frame.pc, &info) && info.dli_fname) {
+			frame.symbolName = info.dli_sname ? info.dli_sname : "";
+			frame.module = info.dli_fname;
+			frame.offsetInFile = uint32_t(uintptr_t(address) - uintptr_t(info.dli_fbase));
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "breadcrumbs.h"
+#include "crashy.h"
+#include "reporter.h"
+
+// flight recorder: the __cyg_profile_func_enter/exit hooks of -finstrument-functions append the function address
+// and a timestamp to a ring of the calling thread, in a MAP_SHARED region created before the crash reporter is
+// forked (as the breadcrumb rings); lossy: the reporter discards the events overwritten while it reads a ring
+// the hooks are only defined if the library is built with CRASHY_FLIGHT_RECORDER
+
+// top bit of FlightEvent::address (user space addresses do not use it)
+#define FLIGHT_EVENT_EXIT (uint64_t(1) << 63)
+
+struct FlightEvent {
+	uint64_t time; // Ticks()
+	uint64_t address; // of the function, with FLIGHT_EVENT_EXIT for an exit
+};
+
+struct FlightRing {
+	std::atomic<uint32_t> owner; // thread id, 0 if free
+	std::atomic<uint64_t> head; // number of events ever written
+	static constexpr size_t HEADER = 64;
+	FlightEvent* events() {
+		return reinterpret_cast<FlightEvent*>(reinterpret_cast<char*>(this) + HEADER);
+	}
+};
+
+struct FlightRecorderRegion {
+	uint32_t rings;
+	uint32_t events; // per ring, a power of two
+	TickBase base;
+	FlightRing* ring(uint32_t i) {
+		return reinterpret_cast<FlightRing*>(reinterpret_cast<char*>(this) + 64 + size_t(i) * (FlightRing::HEADER + events * sizeof(FlightEvent)));
+	}
+};
+
+// in the process to be monitored, before StartReporter(); does nothing if the hooks are not built in, or if
+// CrashOptions::flightRecorderRings is 0
+void CreateFlightRecorder(const CrashOptions& options);
+
+// in the forked crash reporter: its own calls of instrumented code (such as a sender) are not recorded
+void StopFlightRecorder();
+
+// in the crash reporter: fills CrashReport::flightRecorder with the last events of each thread, and
+// flightRecorderFunctions with the module and offset of each function (not symbolized)
+void ReadFlightRecorder(CrashReport& crash, const CrashOptions& options);
@@ -0,0 +1,358 @@
+#include "http.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "compress.h"
+
+#define out stderr
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+struct Endpoint {
+	bool https = false;
+	std::string host;
+	uint16_t port = 80;
+	std::string path; // of the URL, or of the Sentry installation (without project id)
+	// Sentry DSN only
+	std::string key;
+	std::string project;
+};
+
+// http[s]://[key@]host[:port][/path]; if a key is given, the last path segment is the Sentry project id
+bool ParseUrl(const std::string& url, Endpoint& endpoint) {
+	size_t p;
+	if (url.compare(0, 7, "http://") == 0) {
+		p = 7;
+	} else if (url.compare(0, 8, "https://") == 0) {
+		endpoint.https = true;
+		endpoint.port = 443;
+		p = 8;
+	} else {
+		return false;
+	}
+	size_t slash = url.find('/', p);
+	std::string authority = url.substr(p, slash == std::string::npos ? std::string::npos : slash - p);
+	endpoint.path = slash == std::string::npos ? "/" : url.substr(slash);
+	size_t at = authority.rfind('@');
+	if (at != std::string::npos) {
+		endpoint.key = authority.substr(0, std::min(at, authority.find(':')));
+		authority = authority.substr(at + 1);
+	}
+	size_t colon = authority.rfind(':');
+	if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+		endpoint.port = uint16_t(atoi(authority.c_str() + colon + 1));
+		authority.resize(colon);
+	}
+	if (authority.size() > 2 && authority.front() == '[' && authority.back() == ']')
+		authority = authority.substr(1, authority.size() - 2);
+	endpoint.host = authority;
+	if (!endpoint.key.empty()) {
+		while (endpoint.path.size() > 1 && endpoint.path.back() == '/')
+			endpoint.path.pop_back();
+		size_t last = endpoint.path.rfind('/');
+		endpoint.project = endpoint.path.substr(last + 1);
+		endpoint.path.resize(last + 1);
+		if (endpoint.project.empty())
+			return false;
+	}
+	return !endpoint.host.empty() && endpoint.port != 0;
+}
+
+std::string Request(const Endpoint& endpoint, CrashOptions::SendFormat format, const std::string& payload) {
+	std::string path = endpoint.path;
+	if (!endpoint.key.empty())
+		path += "api/" + endpoint.project + (format == CrashOptions::ENVELOPE_SENTRY ? "/envelope/" : "/store/");
+	const char* contentType = format == CrashOptions::ENVELOPE_SENTRY ? "application/x-sentry-envelope" :
+		format == CrashOptions::JSON_SENTRY ? "application/json" :
+		format == CrashOptions::BINARY_REPORT ? "application/octet-stream" : "text/plain; charset=utf-8";
+	std::string request;
+	request.reserve(payload.size() + 512);
+	request += "POST " + path + " HTTP/1.1\r\n";
+	request += "Host: " + endpoint.host;
+	if (endpoint.port != (endpoint.https ? 443 : 80))
+		request += ":" + std::to_string(endpoint.port);
+	request += "\r\nUser-Agent: crashy/0.1\r\nContent-Type: ";
+	request += contentType;
+	request += "\r\nContent-Length: " + std::to_string(payload.size()) + "\r\n";
+	auto compression = DetectCompression(payload);
+	if (compression == CrashOptions::GZIP)
+		request += "Content-Encoding: gzip\r\n";
+	else if (compression == CrashOptions::ZSTD)
+		request += "Content-Encoding: zstd\r\n";
+	if (!endpoint.key.empty())
+		request += "X-Sentry-Auth: Sentry sentry_version=7, sentry_client=crashy/0.1, sentry_key=" + endpoint.key + "\r\n";
+	request += "\r\n";
+	request += payload;
+	return request;
+}
+
+// a plain TCP connection, or one provided by CrashOptions::httpsTransport
+class HttpConnection {
+	int fd = -1;
+	std::optional<CrashOptions::Connection> transport;
+	std::string buffer; // received, but not yet parsed
+	std::chrono::milliseconds timeout;
+
+	bool wait(short events) {
+		struct pollfd p = {fd, events, 0};
+		int result;
+		do {
+			result = poll(&p, 1, int(timeout.count()));
+		} while (result < 0 && errno == EINTR);
+		return result > 0;
+	}
+	ssize_t writeSome(const char* data, size_t size) {
+		if (transport)
+			return transport->write(data, size);
+		if (!wait(POLLOUT))
+			return -1;
+		ssize_t n;
+		do {
+			n = send(fd, data, size, MSG_NOSIGNAL);
+		} while (n < 0 && errno == EINTR);
+		return n;
+	}
+	ssize_t readSome(char* data, size_t size) {
+		if (transport)
+			return transport->read(data, size);
+		if (!wait(POLLIN))
+			return -1;
+		ssize_t n;
+		do {
+			n = recv(fd, data, size, 0);
+		} while (n < 0 && errno == EINTR);
+		return n;
+	}
+	// makes sure buffer has at least size bytes
+	bool fill(size_t size) {
+		char chunk[16 * 1024];
+		while (buffer.size() < size) {
+			ssize_t n = readSome(chunk, sizeof(chunk));
+			if (n <= 0)
+				return false;
+			buffer.append(chunk, size_t(n));
+		}
+		return true;
+	}
+	// reads a line (without CRLF)
+	bool line(std::string& result) {
+		size_t end;
+		while ((end = buffer.find("\r\n")) == std::string::npos) {
+			if (buffer.size() > 64 * 1024 || !fill(buffer.size() + 1))
+				return false;
+		}
+		result = buffer.substr(0, end);
+		buffer.erase(0, end + 2);
+		return true;
+	}
+ public:
+	explicit HttpConnection(std::chrono::milliseconds timeout) : timeout(timeout) {
+	}
+	~HttpConnection() {
+		close();
+	}
+	bool isOpen() const {
+		return fd >= 0 || transport;
+	}
+	void close() {
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+		transport.reset();
+		buffer.clear();
+	}
+
+	bool open(const Endpoint& endpoint, const CrashOptions& options) {
+		close();
+		if (endpoint.https) {
+			if (!options.httpsTransport)
+				return false;
+			transport = options.httpsTransport(endpoint.host, endpoint.port);
+			return bool(transport);
+		}
+		struct addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo* addresses = nullptr;
+		if (getaddrinfo(endpoint.host.c_str(), std::to_string(endpoint.port).c_str(), &hints, &addresses) != 0)
+			return false;
+		for (auto* address = addresses; address && fd < 0; address = address->ai_next) {
+			fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (fd < 0)
+				continue;
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+			int error = 0;
+			socklen_t length = sizeof(error);
+			if (connect(fd, address->ai_addr, address->ai_addrlen) == 0 ||
+					(errno == EINPROGRESS && wait(POLLOUT) && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0))
+				break;
+			::close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(addresses);
+		return fd >= 0;
+	}
+
+	bool write(const std::string& data) {
+		for (size_t done = 0; done < data.size(); ) {
+			ssize_t n = writeSome(data.data() + done, data.size() - done);
+			if (n <= 0)
+				return false;
+			done += size_t(n);
+		}
+		return true;
+	}
+
+	// returns status code, or 0 if the connection failed
+	int readResponse(bool& keepAlive, std::chrono::seconds& retryAfter) {
+		std::string status;
+		if (!line(status) || status.compare(0, 5, "HTTP/") != 0)
+			return 0;
+		size_t space = status.find(' ');
+		int code = space == std::string::npos ? 0 : atoi(status.c_str() + space + 1);
+		keepAlive = status.compare(0, 8, "HTTP/1.0") != 0;
+		bool chunked = false;
+		std::optional<size_t> contentLength;
+		std::string header;
+		while (true) {
+			if (!line(header))
+				return 0;
+			if (header.empty())
+				break;
+			size_t colon = header.find(':');
+			if (colon == std::string::npos)
+				continue;
+			std::string name = header.substr(0, colon);
+			const char* value = header.c_str() + colon + 1;
+			while (*value == ' ' || *value == '\t')
+				++value;
+			if (strcasecmp(name.c_str(), "Content-Length") == 0)
+				contentLength = size_t(strtoull(value, nullptr, 10));
+			else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0 && strcasestr(value, "chunked"))
+				chunked = true;
+			else if (strcasecmp(name.c_str(), "Connection") == 0)
+				keepAlive = strcasestr(value, "close") == nullptr;
+			else if (strcasecmp(name.c_str(), "Retry-After") == 0)
+				retryAfter = std::chrono::seconds(atoi(value));
+		}
+		// the body is not used, but has to be read to get to the next response
+		if (code == 204 || code == 304 || (code >= 100 && code < 200)) {
+			// no body
+		} else if (chunked) {
+			std::string size;
+			while (true) {
+				if (!line(size))
+					return 0;
+				size_t chunk = size_t(strtoull(size.c_str(), nullptr, 16));
+				if (chunk == 0)
+					break;
+				if (!fill(chunk + 2))
+					return 0;
+				buffer.erase(0, chunk + 2);
+			}
+			// trailers
+			while (line(size) && !size.empty()) {
+			}
+		} else if (contentLength) {
+			if (!fill(*contentLength))
+				return 0;
+			buffer.erase(0, *contentLength);
+		} else {
+			// body until the connection is closed
+			while (fill(buffer.size() + 1)) {
+			}
+			buffer.clear();
+			keepAlive = false;
+		}
+		return code;
+	}
+};
+
+}
+
+std::vector<bool> UploadReports(const CrashOptions& options, const std::vector<std::pair<CrashOptions::SendFormat, std::string>>& reports) {
+	std::vector<bool> accepted(reports.size(), false);
+	Endpoint endpoint;
+	if (!ParseUrl(options.dsn, endpoint)) {
+		fprintf(out, "crash reporter: invalid upload URL %s\n", options.dsn.c_str());
+		return accepted;
+	}
+	if (endpoint.https && !options.httpsTransport) {
+		fprintf(out, "crash reporter: no transport for https (see CrashOptions::httpsTransport)\n");
+		return accepted;
+	}
+	std::vector<size_t> pending;
+	for (size_t i = 0; i < reports.size(); ++i)
+		pending.push_back(i);
+	HttpConnection connection(options.uploadTimeout);
+	std::chrono::milliseconds backoff {250};
+	std::chrono::seconds retryAfter {0};
+	for (unsigned attempt = 0; !pending.empty(); ) {
+		bool failed = false;
+		std::vector<size_t> retry;
+		if (!connection.isOpen() && !connection.open(endpoint, options)) {
+			failed = true;
+			retry = pending;
+		} else {
+			// pipelining: all requests are written before the responses are read
+			std::string requests;
+			for (size_t i : pending)
+				requests += Request(endpoint, reports[i].first, reports[i].second);
+			bool written = connection.write(requests);
+			if (!written) {
+				connection.close();
+				failed = true;
+				retry = pending;
+			}
+			for (size_t n = 0; written && n < pending.size(); ++n) {
+				bool keepAlive = true;
+				int code = connection.readResponse(keepAlive, retryAfter);
+				if (code >= 200 && code < 300) {
+					accepted[pending[n]] = true;
+				} else if (code == 0 || code == 429 || code >= 500) {
+					failed = true;
+					retry.push_back(pending[n]);
+				} else {
+					fprintf(out, "crash reporter: report rejected with HTTP status %i\n", code);
+				}
+				if (code == 0 || !keepAlive) {
+					// remaining requests were not handled by the server, send them again on a new connection
+					connection.close();
+					retry.insert(retry.end(), pending.begin() + std::ptrdiff_t(n) + 1, pending.end());
+					break;
+				}
+			}
+		}
+		pending = std::move(retry);
+		if (!failed)
+			continue;
+		if (attempt++ >= options.uploadRetries)
+			break;
+		connection.close();
+		auto delay = std::max<std::chrono::milliseconds>(backoff, retryAfter);
+		std::this_thread::sleep_for(std::min<std::chrono::milliseconds>(delay, std::chrono::seconds(60)));
+		backoff *= 2;
+		retryAfter = std::chrono::seconds(0);
+	}
+	return accepted;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crashy.h"
+
+// upload of reports with HTTP/1.1 to CrashOptions::dsn (a Sentry DSN or a plain http:// or https:// URL)
+// all reports are pipelined on one keep-alive connection; reports that failed due to the network, a 5xx or a 429
+// response are retried (up to CrashOptions::uploadRetries times) with exponential backoff
+// returns for each report if it was accepted (2xx response)
+std::vector<bool> UploadReports(const CrashOptions& options, const std::vector<std::pair<CrashOptions::SendFormat, std::string>>& reports);
@@ -0,0 +1,149 @@
+#include "json.h"
+
+#include <charconv>
+
+// CRASHY_JSON_SCALAR leaves out the vector code (the tests check both against each other)
+#if defined(CRASHY_JSON_SCALAR)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// length of the valid UTF-8 sequence at the start of s, or 0 if it is invalid (overlong, surrogate, or > U+10FFFF)
+static size_t ValidUTF8(const uint8_t* s, size_t length) {
+	uint8_t c = s[0];
+	size_t size;
+	uint8_t low = 0x80, high = 0xBF; // allowed range of the second byte
+	if (c >= 0xC2 && c <= 0xDF) {
+		size = 2;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		size = 3;
+		if (c == 0xE0)
+			low = 0xA0;
+		else if (c == 0xED)
+			high = 0x9F;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		size = 4;
+		if (c == 0xF0)
+			low = 0x90;
+		else if (c == 0xF4)
+			high = 0x8F;
+	} else {
+		return 0;
+	}
+	if (length < size || s[1] < low || s[1] > high)
+		return 0;
+	for (size_t i = 2; i < size; ++i)
+		if ((s[i] & 0xC0) != 0x80)
+			return 0;
+	return size;
+}
+
+// number of bytes at the start of s that can be copied as is: printable ASCII except '"' and '\'
+static size_t PlainPrefix(const uint8_t* s, size_t length) {
+	size_t i = 0;
+#if defined(CRASHY_JSON_SCALAR)
+#elif defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(char(0xE0));
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= length; i += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+		// bytes below 0x20 have none of the top three bits set
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_and_si128(chunk, control), zero));
+		// bytes of 0x80 and higher (UTF-8) have the sign bit set
+		int mask = _mm_movemask_epi8(special) | _mm_movemask_epi8(chunk);
+		if (mask)
+			return i + size_t(__builtin_ctz(unsigned(mask)));
+	}
+#elif defined(__aarch64__)
+	const uint8x16_t quote = vdupq_n_u8('"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t control = vdupq_n_u8(0x20);
+	const uint8x16_t utf8 = vdupq_n_u8(0x80);
+	for (; i + 16 <= length; i += 16) {
+		uint8x16_t chunk = vld1q_u8(s + i);
+		uint8x16_t special = vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash));
+		special = vorrq_u8(special, vorrq_u8(vcltq_u8(chunk, control), vcgeq_u8(chunk, utf8)));
+		if (vmaxvq_u8(special))
+			break;
+	}
+#endif
+	for (; i < length; ++i)
+		if (s[i] < 0x20 || s[i] >= 0x80 || s[i] == '"' || s[i] == '\\')
+			break;
+	return i;
+}
+
+void AppendJsonString(std::string& out, std::string_view string) {
+	static const char hex[] = "0123456789abcdef";
+	const uint8_t* s = reinterpret_cast<const uint8_t*>(string.data());
+	size_t length = string.size();
+	out.reserve(out.size() + length + 2);
+	out += '"';
+	while (length > 0) {
+		size_t plain = PlainPrefix(s, length);
+		out.append(reinterpret_cast<const char*>(s), plain);
+		s += plain;
+		length -= plain;
+		if (length == 0)
+			break;
+		uint8_t c = s[0];
+		size_t consumed = 1;
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += char(c);
+		} else if (c == '\n') {
+			out += "\\n";
+		} else if (c == '\t') {
+			out += "\\t";
+		} else if (c == '\r') {
+			out += "\\r";
+		} else if (c < 0x20) {
+			out += "\\u00";
+			out += hex[c >> 4];
+			out += hex[c & 0xf];
+		} else if (size_t valid = ValidUTF8(s, length)) {
+			out.append(reinterpret_cast<const char*>(s), valid);
+			consumed = valid;
+		} else {
+			out += "\xEF\xBF\xBD"; // U+FFFD replacement character
+		}
+		s += consumed;
+		length -= consumed;
+	}
+	out += '"';
+}
+
+JsonWriter& JsonWriter::value(long long number) {
+	separate();
+	char buffer[24];
+	auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), number);
+	out.append(buffer, ec == std::errc() ? size_t(end - buffer) : 0);
+	needsComma = true;
+	return *this;
+}
+
+JsonWriter& JsonWriter::value(unsigned long long number) {
+	separate();
+	char buffer[24];
+	auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), number);
+	out.append(buffer, ec == std::errc() ? size_t(end - buffer) : 0);
+	needsComma = true;
+	return *this;
+}
+
+JsonWriter& JsonWriter::address(uint64_t address) {
+	separate();
+	char buffer[24] = "\"0x";
+	auto [end, ec] = std::to_chars(buffer + 3, buffer + sizeof(buffer) - 1, address, 16);
+	if (ec != std::errc())
+		end = buffer + 3;
+	*end++ = '"';
+	out.append(buffer, size_t(end - buffer));
+	needsComma = true;
+	return *this;
+}
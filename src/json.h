@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+// appends a JSON string (with quotes) to out: control characters, '"' and '\' are escaped,
+// and invalid UTF-8 is replaced by U+FFFD so the result is always valid JSON
+void AppendJsonString(std::string& out, std::string_view string);
+
+// writes JSON into one growable buffer, without locale dependencies or temporary strings per field
+// commas are inserted automatically; the caller is responsible for balancing begin/end
+class JsonWriter {
+	std::string& out;
+	bool needsComma = false;
+
+	void separate() {
+		if (needsComma)
+			out += ',';
+		needsComma = false;
+	}
+ public:
+	explicit JsonWriter(std::string& out) : out(out) {
+	}
+
+	JsonWriter& beginObject() {
+		separate();
+		out += '{';
+		return *this;
+	}
+	JsonWriter& endObject() {
+		out += '}';
+		needsComma = true;
+		return *this;
+	}
+	JsonWriter& beginArray() {
+		separate();
+		out += '[';
+		return *this;
+	}
+	JsonWriter& endArray() {
+		out += ']';
+		needsComma = true;
+		return *this;
+	}
+	JsonWriter& key(std::string_view name) {
+		separate();
+		AppendJsonString(out, name);
+		out += ':';
+		return *this;
+	}
+
+	JsonWriter& value(std::string_view string) {
+		separate();
+		AppendJsonString(out, string);
+		needsComma = true;
+		return *this;
+	}
+	JsonWriter& value(const char* string) {
+		return value(std::string_view(string ? string : ""));
+	}
+	JsonWriter& value(const std::string& string) {
+		return value(std::string_view(string));
+	}
+	JsonWriter& value(bool boolean) {
+		separate();
+		out += boolean ? "true" : "false";
+		needsComma = true;
+		return *this;
+	}
+	JsonWriter& value(long long number);
+	JsonWriter& value(unsigned long long number);
+	JsonWriter& value(int number) {
+		return value((long long)number);
+	}
+	JsonWriter& value(unsigned number) {
+		return value((unsigned long long)number);
+	}
+	JsonWriter& value(long number) {
+		return value((long long)number);
+	}
+	JsonWriter& value(unsigned long number) {
+		return value((unsigned long long)number);
+	}
+	// "0x..." string, as used by Sentry for addresses
+	JsonWriter& address(uint64_t address);
+	// already serialized JSON
+	JsonWriter& raw(std::string_view json) {
+		separate();
+		out += json;
+		needsComma = true;
+		return *this;
+	}
+
+	template <typename T>
+	JsonWriter& member(std::string_view name, const T& v) {
+		key(name);
+		return value(v);
+	}
+};
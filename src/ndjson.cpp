@@ -0,0 +1,73 @@
+#include "ndjson.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json.h"
+
+static int OpenLog(const std::string& path) {
+	return open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+// file -> file.1 -> file.2 ..., the oldest is removed
+static void Rotate(const std::string& path, unsigned files) {
+	if (files == 0) {
+		unlink(path.c_str());
+		return;
+	}
+	for (unsigned i = files; i > 1; --i)
+		rename((path + "." + std::to_string(i - 1)).c_str(), (path + "." + std::to_string(i)).c_str());
+	rename(path.c_str(), (path + ".1").c_str());
+}
+
+bool AppendNdjson(const CrashOptions& options, const char* type, const std::string& event) {
+	if (event.size() < 2 || event[0] != '{')
+		return false;
+	std::string line = "{\"type\":";
+	AppendJsonString(line, type);
+	if (event[1] != '}')
+		line += ',';
+	line.append(event, 1, std::string::npos);
+	// the event is a single line, as written by JsonWriter
+	while (!line.empty() && line.back() == '\n')
+		line.pop_back();
+	line += '\n';
+
+	const std::string& path = options.ndjsonFile;
+	int fd = OpenLog(path);
+	if (fd < 0) {
+		perror(("crash reporter: " + path).c_str());
+		return false;
+	}
+	struct stat st;
+	if (options.ndjsonMaxBytes > 0 && fstat(fd, &st) == 0 && st.st_size > 0 && size_t(st.st_size) + line.size() > options.ndjsonMaxBytes) {
+		// one reporter rotates at a time; appends to the old file during the rotation end up in file.1
+		int result;
+		while ((result = flock(fd, LOCK_EX)) != 0 && errno == EINTR) {
+		}
+		struct stat current;
+		// if the file was already rotated by another reporter, just append to the new one
+		if (stat(path.c_str(), &current) == 0 && current.st_ino == st.st_ino && current.st_dev == st.st_dev)
+			Rotate(path, options.ndjsonMaxFiles);
+		flock(fd, LOCK_UN);
+		close(fd);
+		fd = OpenLog(path);
+		if (fd < 0) {
+			perror(("crash reporter: " + path).c_str());
+			return false;
+		}
+	}
+	ssize_t n;
+	while ((n = write(fd, line.data(), line.size())) < 0 && errno == EINTR) {
+	}
+	close(fd);
+	if (n != ssize_t(line.size())) {
+		perror(("crash reporter: " + path).c_str());
+		return false;
+	}
+	return true;
+}
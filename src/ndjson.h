@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+#include "crashy.h"
+
+// local sink (CrashOptions::ndjsonFile): one report per line, for a log shipping agent on the host
+// the line is the Sentry event with a "type" member in front ("crash", "nonfatal" for non-fatal events, "hang", or
+// "slow" for slow operations), appended with a single O_APPEND write, so lines of concurrent reporters do not
+// interleave
+// the file is rotated (file.1, file.2, ...) before it would grow beyond CrashOptions::ndjsonMaxBytes
+// returns false if the line could not be written completely
+bool AppendNdjson(const CrashOptions& options, const char* type, const std::string& event);
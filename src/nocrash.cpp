@@ -1,8 +1,46 @@
 
 #include "crashy.h"
 
+#include <errno.h>
+
 void GenerateDumpOnCrash(CrashOptions&& options [[maybe_unused]]) {
 }
+void CrashBreadcrumb(CrashLevel level [[maybe_unused]], const char* message [[maybe_unused]], size_t length [[maybe_unused]]) {
+}
+void crashy::StructuredBreadcrumb(BreadcrumbFormat& format [[maybe_unused]], char* arguments [[maybe_unused]], size_t length [[maybe_unused]]) {
+}
+void CrashSetContext(const char* key [[maybe_unused]], std::string_view value [[maybe_unused]]) {
+}
+void CrashClearContext(const char* key [[maybe_unused]]) {
+}
+bool CrashGetContext(const char* key [[maybe_unused]], char* value [[maybe_unused]], size_t size [[maybe_unused]]) {
+	return false;
+}
+thread_local crashy::AsyncFrame* crashy::currentAsyncFrame = nullptr;
+thread_local std::atomic<int64_t>* crashy::deadlineSlot = nullptr;
+thread_local CrashDeadline* crashy::currentDeadline = nullptr;
+std::atomic<int64_t>* crashy::ClaimDeadlineSlot() {
+	static thread_local std::atomic<int64_t> unwatched {0};
+	return deadlineSlot = &unwatched;
+}
+void CrashRegisterCodeRange(const void* begin [[maybe_unused]], const void* end [[maybe_unused]], const char* name [[maybe_unused]], const char* sourceFile [[maybe_unused]], const CrashCodeLine* lines [[maybe_unused]], size_t lineCount [[maybe_unused]]) {
+}
+void CrashUnregisterCodeRange(const void* begin [[maybe_unused]]) {
+}
+void CrashCaptureNonFatal(CrashLevel level [[maybe_unused]], std::string_view message [[maybe_unused]]) {
+}
+bool CrashWriteProfile(const char* path [[maybe_unused]], CrashProfileFormat format [[maybe_unused]]) {
+	errno = ENOTSUP;
+	return false;
+}
+bool CrashWatchThread(const char* name [[maybe_unused]], std::chrono::milliseconds threshold [[maybe_unused]]) {
+	errno = ENOTSUP;
+	return false;
+}
+void CrashHeartbeat() {
+}
+void CrashUnwatchThread() {
+}
 extern "C" int PrintCurrentCallStack(int max_size [[maybe_unused]]) {
 	return -1;
 }
@@ -0,0 +1,273 @@
+#if !defined(_GNU_SOURCE) && defined(__linux__)
+#define _GNU_SOURCE	// linux needs this for Dl_info
+#endif
+
+#include "nonfatal.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <new>
+
+#include "unwinder.h"
+#include "util.h"
+
+static_assert(sizeof(NonFatalQueue) <= NonFatalQueue::HEADER, "header of the non-fatal queue too large");
+static_assert(sizeof(NonFatalSlot) == 832, "size of a non-fatal event as documented");
+
+static NonFatalQueue* queue = nullptr;
+static bool queueing = false;
+
+void CreateNonFatalQueue(const CrashOptions& options) {
+	if (options.nonFatalQueueSize == 0 || queue)
+		return;
+	uint32_t slots = 1;
+	while (slots < options.nonFatalQueueSize)
+		slots *= 2;
+	size_t size = NonFatalQueue::HEADER + size_t(slots) * sizeof(NonFatalSlot);
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("crash reporter: non-fatal events");
+		return;
+	}
+	auto* region = new (memory) NonFatalQueue();
+	region->slots = slots;
+	region->base = CurrentTickBase();
+	for (uint32_t i = 0; i < slots; ++i) {
+		auto* slot = new (region->slot(i)) NonFatalSlot();
+		slot->sequence.store(i, std::memory_order_relaxed);
+	}
+	queue = region;
+	queueing = true;
+}
+
+void StopNonFatalQueue() {
+	queueing = false;
+}
+
+namespace {
+struct Capture {
+	uint64_t pcs[NONFATAL_FRAMES];
+	int count = 0;
+};
+}
+
+static bool CapturePC(void* pc, void* arg) {
+	auto* capture = static_cast<Capture*>(arg);
+	capture->pcs[capture->count++] = uint64_t(uintptr_t(pc));
+	return false;
+}
+
+// the slot at tail, nullptr if the queue is full (the event is dropped)
+static NonFatalSlot* Claim(uint64_t& tail) {
+	tail = queue->tail.load(std::memory_order_relaxed);
+	for (;;) {
+		NonFatalSlot* slot = queue->slot(tail);
+		int64_t available = int64_t(slot->sequence.load(std::memory_order_acquire) - tail);
+		if (available == 0) {
+			if (queue->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				return slot;
+		} else if (available < 0) {
+			// not yet taken by the reporter
+			queue->dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		} else {
+			tail = queue->tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static void Publish(NonFatalSlot* slot, uint64_t tail) {
+	// sequentially consistent, as `waiting` is set by the reporter before it checks for events (see AwaitNonFatal)
+	slot->sequence.store(tail + 1);
+	if (queue->waiting.load() && queue->waiting.exchange(false))
+		NotifyReporter();
+}
+
+static void Enqueue(CrashLevel level, std::string_view message, void* callSite) {
+	if (!queueing)
+		return;
+	// the stack is captured before a slot is claimed, so the reporter does not wait on the unwinder
+	Capture capture;
+	StackTrace(CapturePC, &capture, NONFATAL_FRAMES);
+	uint64_t time = Ticks();
+
+	uint64_t tail;
+	NonFatalSlot* slot = Claim(tail);
+	if (!slot)
+		return;
+	slot->time = time;
+	slot->callSite = uint64_t(uintptr_t(callSite));
+	slot->budget = slot->elapsed = 0;
+	slot->tid = CurrentThreadId();
+	slot->kind = NonFatalReport::NON_FATAL;
+	slot->level = uint8_t(level);
+	slot->length = uint16_t(std::min(message.size(), size_t(NONFATAL_MESSAGE)));
+	memcpy(slot->message, message.data(), slot->length);
+	slot->frames = uint8_t(capture.count);
+	memcpy(slot->pcs, capture.pcs, size_t(capture.count) * sizeof(uint64_t));
+	Publish(slot, tail);
+}
+
+__attribute__((noinline)) void CrashCaptureNonFatal(CrashLevel level, std::string_view message) {
+	Enqueue(level, message, __builtin_return_address(0));
+}
+
+void EnqueueSlowOperation(const char* name, uint64_t budget, uint64_t elapsed, const uint64_t* pcs, int frames) {
+	if (!queueing)
+		return;
+	uint64_t time = Ticks();
+	uint64_t tail;
+	NonFatalSlot* slot = Claim(tail);
+	if (!slot)
+		return;
+	slot->time = time;
+	slot->callSite = 0;
+	slot->budget = budget;
+	slot->elapsed = elapsed;
+	slot->tid = CurrentThreadId();
+	slot->kind = NonFatalReport::SLOW_OPERATION;
+	slot->level = CRASH_WARNING;
+	slot->length = uint16_t(name ? strnlen(name, NONFATAL_MESSAGE) : 0);
+	memcpy(slot->message, name, slot->length);
+	slot->frames = uint8_t(std::min(frames, NONFATAL_FRAMES));
+	memcpy(slot->pcs, pcs, size_t(slot->frames) * sizeof(uint64_t));
+	Publish(slot, tail);
+}
+
+void AwaitNonFatal() {
+	if (queue)
+		queue->waiting.store(true);
+}
+
+bool TakeNonFatal(NonFatalEvent& event) {
+	if (!queue)
+		return false;
+	uint64_t head = queue->head.load(std::memory_order_relaxed);
+	NonFatalSlot* slot = queue->slot(head);
+	if (slot->sequence.load() != head + 1)
+		return false;
+	TickConverter clock(queue->base);
+	event.kind = NonFatalReport::Kind(slot->kind);
+	event.level = CrashLevel(slot->level);
+	event.message.assign(slot->message, std::min(size_t(slot->length), size_t(NONFATAL_MESSAGE)));
+	event.callSite = uintptr_t(slot->callSite);
+	event.tid = slot->tid;
+	event.time = clock.realtime(slot->time);
+	event.budget = slot->budget;
+	event.elapsed = slot->elapsed;
+	event.pcs.clear();
+	// the frames of CrashCaptureNonFatal and the unwinder are left out: the unwinder reports the address before the
+	// return address of a frame
+	int frames = std::min(int(slot->frames), NONFATAL_FRAMES);
+	int first = 0;
+	while (event.kind == NonFatalReport::NON_FATAL && first < frames && slot->pcs[first] != slot->callSite - 1 && slot->pcs[first] != slot->callSite)
+		++first;
+	if (first == frames)
+		first = 0;
+	event.pcs.assign(slot->pcs + first, slot->pcs + frames);
+	slot->sequence.store(head + queue->slots, std::memory_order_release);
+	queue->head.store(head + 1, std::memory_order_relaxed);
+	return true;
+}
+
+uint64_t DroppedNonFatal() {
+	return queue ? queue->dropped.load(std::memory_order_relaxed) : 0;
+}
+
+namespace {
+struct Mapping {
+	uintptr_t begin;
+	uintptr_t end;
+	uintptr_t base; // load address of the module
+	std::string path;
+};
+}
+
+// file backed executable mappings of a process, for modules loaded after the reporter was forked (Linux only)
+static std::vector<Mapping> ReadMappings(pid_t pid) {
+	std::vector<Mapping> mappings;
+	std::ifstream in("/proc/" + std::to_string(pid) + "/maps");
+	std::map<std::string, uintptr_t> bases; // lowest address mapping offset 0 of each file
+	std::string line;
+	while (std::getline(in, line)) {
+		unsigned long long begin, end, offset;
+		char permissions[8];
+		int pathStart = 0;
+		if (sscanf(line.c_str(), "%llx-%llx %7s %llx %*s %*s %n", &begin, &end, permissions, &offset, &pathStart) < 4 || pathStart == 0)
+			continue;
+		std::string path = line.substr(size_t(pathStart));
+		if (path.empty() || path[0] != '/')
+			continue;
+		if (offset == 0)
+			bases.emplace(path, uintptr_t(begin));
+		if (permissions[2] == 'x')
+			mappings.push_back({uintptr_t(begin), uintptr_t(end), 0, path});
+	}
+	for (auto& mapping : mappings)
+		mapping.base = bases.count(mapping.path) ? bases[mapping.path] : mapping.begin;
+	return mappings;
+}
+
+std::vector<CrashFrame> AddressFrames(const std::vector<uintptr_t>& pcs, pid_t pid) {
+	std::vector<CrashFrame> frames(pcs.size());
+	std::vector<Mapping> mappings;
+	bool mappingsRead = false;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		CrashFrame& frame = frames[i];
+		frame.pc = reinterpret_cast<void*>(pcs[i]);
+		Dl_info info;
+		if (dladdr(frame.pc, &info) && info.dli_fname) {
+			frame.symbolName = info.dli_sname ? info.dli_sname : "";
+			frame.module = info.dli_fname;
+			frame.offsetInFile = uint32_t(pcs[i] - uintptr_t(info.dli_fbase));
+			continue;
+		}
+		if (!mappingsRead) {
+			mappings = ReadMappings(pid);
+			mappingsRead = true;
+		}
+		for (auto& mapping : mappings) {
+			if (pcs[i] >= mapping.begin && pcs[i] < mapping.end) {
+				frame.module = mapping.path;
+				frame.offsetInFile = uint32_t(pcs[i] - mapping.base);
+				break;
+			}
+		}
+	}
+	return frames;
+}
+
+namespace {
+struct CallSiteCounter {
+	time_t windowStart = 0;
+	unsigned reported = 0; // in the current window
+	uint64_t suppressed = 0; // since the last report
+};
+}
+
+bool AllowNonFatal(const CrashOptions& options, uintptr_t callSite, time_t now, uint64_t& suppressed) {
+	static std::map<uintptr_t, CallSiteCounter> counters;
+	suppressed = 0;
+	if (options.nonFatalMaxPerCallSite == 0)
+		return true;
+	auto& counter = counters[callSite];
+	if (now - counter.windowStart >= time_t(options.nonFatalWindow.count())) {
+		counter.windowStart = now;
+		counter.reported = 0;
+	}
+	if (counter.reported >= options.nonFatalMaxPerCallSite) {
+		++counter.suppressed;
+		return false;
+	}
+	++counter.reported;
+	suppressed = counter.suppressed;
+	counter.suppressed = 0;
+	return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "breadcrumbs.h"
+#include "crashy.h"
+#include "reporter.h"
+
+// non-fatal events (CrashCaptureNonFatal): the calling thread only captures the return addresses of its stack, and
+// enqueues them in a MAP_SHARED region created before the crash reporter is forked; the reporter is woken with
+// NotifyReporter(), resolves and symbolizes the frames, and sends the report
+//
+// the queue is a bounded multi-producer single-consumer ring (as Vyukov's): each slot has a sequence number; a
+// producer claims the slot at tail if its sequence equals tail (CAS on tail), writes it and publishes it by setting
+// the sequence to tail + 1; the reporter takes the slot at head once its sequence is head + 1, and frees it for the
+// next round by setting the sequence to head + slots
+// if the queue is full, the event is dropped (and counted)
+// slow operations (CrashDeadline) are queued the same way, from the handler of the stack signal
+
+#define NONFATAL_MESSAGE 256
+#define NONFATAL_FRAMES 64
+
+struct alignas(64) NonFatalSlot {
+	std::atomic<uint64_t> sequence;
+	uint64_t time; // Ticks()
+	uint64_t callSite; // return address of CrashCaptureNonFatal
+	uint64_t budget; // of a slow operation, ns
+	uint64_t elapsed; // since the start of a slow operation when its stack was captured, ns
+	uint32_t tid;
+	uint16_t length; // of the message (the name of a slow operation)
+	uint8_t level; // CrashLevel
+	uint8_t frames;
+	uint8_t kind; // NonFatalReport::Kind
+	char message[NONFATAL_MESSAGE];
+	uint64_t pcs[NONFATAL_FRAMES];
+};
+
+struct NonFatalQueue {
+	uint32_t slots; // a power of two
+	TickBase base;
+	alignas(64) std::atomic<uint64_t> tail; // next slot to claim by a producer
+	std::atomic<uint64_t> dropped; // events not queued as the queue was full
+	alignas(64) std::atomic<uint64_t> head; // next slot to take by the reporter
+	std::atomic<bool> waiting; // the reporter waits for a notification
+	NonFatalSlot* slot(uint64_t i) {
+		return reinterpret_cast<NonFatalSlot*>(reinterpret_cast<char*>(this) + HEADER) + (i & (slots - 1));
+	}
+	static constexpr size_t HEADER = 192;
+};
+
+// an event taken from the queue
+struct NonFatalEvent {
+	NonFatalReport::Kind kind = NonFatalReport::NON_FATAL;
+	CrashLevel level = CRASH_ERROR;
+	std::string message;
+	uintptr_t callSite = 0;
+	uint32_t tid = 0;
+	int64_t time = 0; // ns since the epoch
+	std::vector<uintptr_t> pcs; // from the caller of CrashCaptureNonFatal
+	uint64_t budget = 0; // of a slow operation, ns
+	uint64_t elapsed = 0;
+};
+
+// in the process to be monitored, before StartReporter(); does nothing if CrashOptions::nonFatalQueueSize is 0
+void CreateNonFatalQueue(const CrashOptions& options);
+
+// from the handler of the stack signal of a thread past its deadline (async-signal-safe): the stack is captured by
+// the handler, from where the thread was interrupted
+void EnqueueSlowOperation(const char* name, uint64_t budget, uint64_t elapsed, const uint64_t* pcs, int frames);
+
+// in the forked crash reporter: its own events are not queued
+void StopNonFatalQueue();
+
+// in the crash reporter, before the queue is emptied: the next event queued sends a notification
+void AwaitNonFatal();
+// in the crash reporter: takes the oldest event from the queue, false if the queue is empty
+bool TakeNonFatal(NonFatalEvent& event);
+// events dropped so far, as the queue was full
+uint64_t DroppedNonFatal();
+
+// frames of addresses in the monitored process with the symbol name, module and offset (not symbolized); the
+// reporter is forked from it, so modules loaded before it started are found with dladdr, later ones in
+// /proc/<pid>/maps
+std::vector<CrashFrame> AddressFrames(const std::vector<uintptr_t>& pcs, pid_t pid);
+
+// applies CrashOptions::nonFatalMaxPerCallSite, with counters in the crash reporter
+// returns false if the event should not be reported; if true, suppressed is set to the number of events of this call
+// site not reported since the previous report
+bool AllowNonFatal(const CrashOptions& options, uintptr_t callSite, time_t now, uint64_t& suppressed);
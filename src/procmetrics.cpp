@@ -0,0 +1,227 @@
+#include "procmetrics.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <sstream>
+
+#include "json.h"
+
+// most of the /proc files are small, except smaps_rollup and status with many groups
+static std::string ReadProcFile(const std::string& path) {
+	std::string retval;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return retval;
+	char buffer[4096];
+	ssize_t n;
+	while (retval.size() < 64 * 1024 && ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)))
+		if (n > 0)
+			retval.append(buffer, size_t(n));
+	close(fd);
+	return retval;
+}
+
+// value of a "Name:   1234 kB" line, in bytes if the unit is kB
+static bool FindField(const std::string& text, const char* name, unsigned long long& value) {
+	size_t length = strlen(name);
+	for (size_t pos = 0; pos < text.size(); ) {
+		size_t end = text.find('\n', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		if (text.compare(pos, length, name) == 0 && text[pos + length] == ':') {
+			const char* p = text.c_str() + pos + length + 1;
+			char* unit;
+			value = strtoull(p, &unit, 10);
+			if (unit == p)
+				return false;
+			while (*unit == ' ' || *unit == '\t')
+				++unit;
+			if (strncmp(unit, "kB", 2) == 0)
+				value *= 1024;
+			return true;
+		}
+		pos = end + 1;
+	}
+	return false;
+}
+
+// "avg10=" of a line of a pressure stall information file
+static bool FindPressure(const std::string& text, const char* line, std::string& avg10) {
+	size_t pos = text.find(std::string(line) + " avg10=");
+	if (pos == std::string::npos || (pos > 0 && text[pos - 1] != '\n'))
+		return false;
+	pos += strlen(line) + 7;
+	avg10 = text.substr(pos, text.find(' ', pos) - pos);
+	return !avg10.empty();
+}
+
+namespace {
+struct ThreadStat {
+	pid_t tid;
+	std::string name;
+	char state;
+	unsigned long long cpuTicks;
+};
+}
+
+void CaptureProcessMetrics(CrashReport& crash, pid_t pid, const CrashOptions& options) {
+#if defined(__linux__)
+	if (options.processMetricsBudget.count() <= 0)
+		return;
+	auto deadline = std::chrono::steady_clock::now() + options.processMetricsBudget;
+	auto expired = [&] {
+		return std::chrono::steady_clock::now() >= deadline;
+	};
+	auto& metrics = crash.processMetrics;
+	auto number = [&](const char* name, unsigned long long value) {
+		metrics.emplace_back(name, std::to_string(value));
+	};
+	std::string proc = "/proc/" + std::to_string(pid);
+
+	std::string status = ReadProcFile(proc + "/status");
+	unsigned long long value;
+	static const char* const statusFields[][2] = {{"VmPeak", "vm_peak"}, {"VmSize", "vm_size"}, {"VmHWM", "vm_hwm"},
+		{"VmRSS", "vm_rss"}, {"VmSwap", "vm_swap"}, {"Threads", "threads"},
+		{"voluntary_ctxt_switches", "voluntary_ctxt_switches"}, {"nonvoluntary_ctxt_switches", "nonvoluntary_ctxt_switches"}};
+	for (auto& [field, name] : statusFields)
+		if (FindField(status, field, value))
+			number(name, value);
+	if (expired())
+		return;
+
+	std::string rollup = ReadProcFile(proc + "/smaps_rollup");
+	static const char* const rollupFields[][2] = {{"Pss", "pss"}, {"Pss_Anon", "pss_anon"}, {"Private_Dirty", "private_dirty"}, {"SwapPss", "swap_pss"}};
+	for (auto& [field, name] : rollupFields)
+		if (FindField(rollup, field, value))
+			number(name, value);
+	if (expired())
+		return;
+
+	if (DIR* dir = opendir((proc + "/fd").c_str())) {
+		unsigned long long fds = 0;
+		while (struct dirent* entry = readdir(dir))
+			if (entry->d_name[0] != '.')
+				++fds;
+		closedir(dir);
+		number("open_fds", fds);
+	}
+	std::string limits = ReadProcFile(proc + "/limits");
+	size_t pos = limits.find("Max open files");
+	if (pos != std::string::npos && (value = strtoull(limits.c_str() + pos + 14, nullptr, 10)) > 0)
+		number("max_open_fds", value);
+	if (expired())
+		return;
+
+	// per thread: state and CPU time, the busiest threads are listed
+	std::vector<ThreadStat> threads;
+	if (DIR* dir = opendir((proc + "/task").c_str())) {
+		while (struct dirent* entry = readdir(dir)) {
+			if (entry->d_name[0] == '.')
+				continue;
+			if (expired())
+				break;
+			std::string stat = ReadProcFile(proc + "/task/" + entry->d_name + "/stat");
+			// the name can contain spaces and parentheses, the fields after it start after the last ')'
+			size_t open = stat.find('('), close = stat.rfind(')');
+			if (open == std::string::npos || close == std::string::npos || close < open || close + 2 >= stat.size())
+				continue;
+			std::istringstream fields(stat.substr(close + 2));
+			char state;
+			std::string skip;
+			unsigned long long utime = 0, stime = 0;
+			fields >> state;
+			// ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt
+			for (int i = 0; i < 10; ++i)
+				fields >> skip;
+			fields >> utime >> stime;
+			threads.push_back({pid_t(atoi(entry->d_name)), stat.substr(open + 1, close - open - 1), state, utime + stime});
+		}
+		closedir(dir);
+	}
+	if (!threads.empty()) {
+		std::map<char, unsigned> states;
+		for (auto& thread : threads)
+			++states[thread.state];
+		std::string json;
+		JsonWriter writer(json);
+		writer.beginObject();
+		for (auto [state, count] : states)
+			writer.member(std::string_view(&state, 1), count);
+		writer.endObject();
+		metrics.emplace_back("thread_states", json);
+
+		size_t busiest = std::min<size_t>(threads.size(), 5);
+		std::partial_sort(threads.begin(), threads.begin() + busiest, threads.end(), [](const ThreadStat& a, const ThreadStat& b) {
+			return a.cpuTicks > b.cpuTicks;
+		});
+		long ticks = sysconf(_SC_CLK_TCK);
+		json.clear();
+		JsonWriter list(json);
+		list.beginArray();
+		for (size_t i = 0; i < busiest; ++i) {
+			auto& thread = threads[i];
+			list.beginObject().member("tid", thread.tid).member("name", thread.name).member("state", std::string_view(&thread.state, 1));
+			list.member("cpu_ms", ticks > 0 ? thread.cpuTicks * 1000 / (unsigned long long)ticks : 0ULL).endObject();
+		}
+		list.endArray();
+		metrics.emplace_back("busiest_threads", json);
+	}
+	if (expired())
+		return;
+
+	// cgroup v2: "0::/path"
+	std::string cgroup = ReadProcFile(proc + "/cgroup");
+	pos = cgroup.find("0::");
+	if (pos != std::string::npos && (pos == 0 || cgroup[pos - 1] == '\n')) {
+		std::string path = "/sys/fs/cgroup" + cgroup.substr(pos + 3, cgroup.find('\n', pos) - pos - 3);
+		std::string current = ReadProcFile(path + "/memory.current");
+		if (!current.empty())
+			number("cgroup_memory_current", strtoull(current.c_str(), nullptr, 10));
+		std::string max = ReadProcFile(path + "/memory.max");
+		if (!max.empty() && max.compare(0, 3, "max") != 0)
+			number("cgroup_memory_max", strtoull(max.c_str(), nullptr, 10));
+		std::string avg10;
+		std::string memoryPressure = ReadProcFile(path + "/memory.pressure");
+		if (FindPressure(memoryPressure, "some", avg10))
+			metrics.emplace_back("cgroup_memory_pressure_some_avg10", avg10);
+		if (FindPressure(memoryPressure, "full", avg10))
+			metrics.emplace_back("cgroup_memory_pressure_full_avg10", avg10);
+		if (FindPressure(ReadProcFile(path + "/cpu.pressure"), "some", avg10))
+			metrics.emplace_back("cgroup_cpu_pressure_some_avg10", avg10);
+		std::string cpuStat = ReadProcFile(path + "/cpu.stat");
+		for (auto& line : {"nr_throttled", "throttled_usec"}) {
+			size_t at = cpuStat.find(std::string(line) + " ");
+			if (at != std::string::npos && (at == 0 || cpuStat[at - 1] == '\n'))
+				metrics.emplace_back(std::string("cgroup_cpu_") + line, std::to_string(strtoull(cpuStat.c_str() + at + strlen(line) + 1, nullptr, 10)));
+		}
+	}
+	if (expired())
+		return;
+
+	// system
+	std::istringstream load(ReadProcFile("/proc/loadavg"));
+	std::string load1, load5, load15;
+	if (load >> load1 >> load5 >> load15) {
+		metrics.emplace_back("load_1m", load1);
+		metrics.emplace_back("load_5m", load5);
+		metrics.emplace_back("load_15m", load15);
+	}
+	std::string meminfo = ReadProcFile("/proc/meminfo");
+	if (FindField(meminfo, "MemAvailable", value))
+		number("mem_available", value);
+	if (FindField(meminfo, "MemTotal", value))
+		number("mem_total", value);
+#else
+	(void)crash;
+	(void)pid;
+	(void)options;
+#endif
+}
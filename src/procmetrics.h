@@ -0,0 +1,12 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "reporter.h"
+
+// snapshot of the resource state of the crashed process, read from /proc by the crash reporter (Linux only):
+// memory (status, smaps_rollup), open file descriptors, CPU time and state per thread, cgroup memory/CPU usage
+// and pressure, and the system load; fills CrashReport::processMetrics
+// the crashed process is still alive (it waits for the crash reporter), it does not execute anything for this
+// reading stops when CrashOptions::processMetricsBudget is used up
+void CaptureProcessMetrics(CrashReport& crash, pid_t pid, const CrashOptions& options);
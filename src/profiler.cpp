@@ -0,0 +1,447 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	// linux needs this for SIGEV_THREAD_ID
+#endif
+
+#include "profiler.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "breadcrumbs.h"
+#include "coderanges.h"
+#include "compress.h"
+#include "nonfatal.h"
+#include "reporter.h"
+#include "unwinder.h"
+#include "util.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static_assert(sizeof(ProfilerRegion) <= ProfilerRegion::HEADER, "header of the profiler region too large");
+
+static ProfilerRegion* profiler = nullptr;
+
+void CreateProfiler(const CrashOptions& options) {
+	if (options.profilerFrequency == 0 || options.profilerRings == 0 || options.profilerRingSamples == 0 || profiler)
+		return;
+#if defined(__linux__)
+	uint32_t samples = 1;
+	while (samples < options.profilerRingSamples)
+		samples *= 2;
+	size_t size = ProfilerRegion::HEADER + size_t(options.profilerRings) * (ProfileRing::HEADER + samples * sizeof(ProfileSample));
+	// anonymous memory is zero filled, and only the pages of rings in use become resident
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("crash reporter: profiler");
+		return;
+	}
+	auto* region = new (memory) ProfilerRegion();
+	region->rings = options.profilerRings;
+	region->samples = samples;
+	region->frequency = options.profilerFrequency;
+	for (uint32_t i = 0; i < region->rings; ++i)
+		new (region->ring(i)) ProfileRing();
+	profiler = region;
+#else
+	fprintf(stderr, "crash reporter: the profiler is only supported on Linux\n");
+#endif
+}
+
+#if defined(__linux__)
+namespace {
+struct SampleCapture {
+	uint64_t pcs[PROFILE_FRAMES + 8]; // and the frames of the signal handler
+	int count = 0;
+};
+}
+
+static bool CaptureSamplePC(void* pc, void* arg) {
+	auto* capture = static_cast<SampleCapture*>(arg);
+	capture->pcs[capture->count++] = uint64_t(uintptr_t(pc));
+	return false;
+}
+
+static void Sample(int, siginfo_t* info, void* context) {
+	if (!profiler || info->si_code != SI_TIMER || uint32_t(info->si_value.sival_int) >= profiler->rings)
+		return;
+	int savedErrno = errno;
+	SampleCapture capture;
+	StackTraceSignal(CaptureSamplePC, &capture, context, PROFILE_FRAMES + 8);
+	// the interrupted frame is reported as is (not as a return address)
+	uint64_t interrupted = uint64_t(InterruptedPC(context));
+	int first = 0;
+	while (first < capture.count && capture.pcs[first] != interrupted && capture.pcs[first] + 1 != interrupted)
+		++first;
+	if (first == capture.count)
+		first = 0;
+
+	// only the thread of the ring writes to it (the timer of a ring sends its signal to one thread)
+	ProfileRing* ring = profiler->ring(uint32_t(info->si_value.sival_int));
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	ProfileSample& sample = ring->samples()[head & (profiler->samples - 1)];
+	sample.frames = uint64_t(std::min(capture.count - first, PROFILE_FRAMES));
+	memcpy(sample.pcs, capture.pcs + first, size_t(sample.frames) * sizeof(uint64_t));
+	ring->head.store(head + 1, std::memory_order_release);
+	errno = savedErrno;
+}
+
+// CPU clock of a thread of this process, as pthread_getcpuclockid() (CPUCLOCK_PERTHREAD | CPUCLOCK_SCHED)
+static clockid_t ThreadCPUClock(uint32_t tid) {
+	return clockid_t((~tid << 3) | 6);
+}
+
+// creates a timer for each new thread of the process, and deletes the timers of exited threads, once a second
+static void SampleThreads() {
+	struct ThreadTimer {
+		timer_t timer;
+		uint32_t ring;
+	};
+	std::map<uint32_t, ThreadTimer> timers;
+	uint32_t self = CurrentThreadId();
+	long period = 1000000000L / long(profiler->frequency);
+	for (;;) {
+		std::vector<uint32_t> threads;
+		if (DIR* dir = opendir("/proc/self/task")) {
+			while (struct dirent* entry = readdir(dir)) {
+				uint32_t tid = uint32_t(strtoul(entry->d_name, nullptr, 10));
+				if (tid != 0 && tid != self)
+					threads.push_back(tid);
+			}
+			closedir(dir);
+		}
+		std::sort(threads.begin(), threads.end());
+		for (auto it = timers.begin(); it != timers.end(); ) {
+			if (std::binary_search(threads.begin(), threads.end(), it->first)) {
+				++it;
+				continue;
+			}
+			timer_delete(it->second.timer);
+			// the samples stay, until overwritten by the next thread using the ring
+			profiler->ring(it->second.ring)->owner.store(0, std::memory_order_release);
+			it = timers.erase(it);
+		}
+		for (uint32_t tid : threads) {
+			if (timers.count(tid))
+				continue;
+			uint32_t ring = 0;
+			while (ring < profiler->rings && profiler->ring(ring)->owner.load(std::memory_order_relaxed) != 0)
+				++ring;
+			// threads beyond the number of rings are not sampled
+			if (ring == profiler->rings)
+				break;
+			struct sigevent event;
+			memset(&event, 0, sizeof(event));
+			event.sigev_notify = SIGEV_THREAD_ID;
+			event.sigev_signo = SIGPROF;
+			event.sigev_value.sival_int = int(ring);
+			event.sigev_notify_thread_id = pid_t(tid);
+			timer_t timer;
+			// fails if the thread exited in the meantime
+			if (timer_create(ThreadCPUClock(tid), &event, &timer) != 0)
+				continue;
+			profiler->ring(ring)->owner.store(tid, std::memory_order_release);
+			struct itimerspec interval;
+			interval.it_interval.tv_sec = interval.it_value.tv_sec = period / 1000000000L;
+			interval.it_interval.tv_nsec = interval.it_value.tv_nsec = period % 1000000000L;
+			timer_settime(timer, 0, &interval, nullptr);
+			timers[tid] = {timer, ring};
+		}
+		sleep(1);
+	}
+}
+#endif
+
+void StartProfiler() {
+#if defined(__linux__)
+	if (!profiler)
+		return;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_sigaction = Sample;
+	if (sigaction(SIGPROF, &sa, nullptr) == -1) {
+		perror("crash reporter: profiler");
+		return;
+	}
+	std::thread(SampleThreads).detach();
+#endif
+}
+
+bool CrashWriteProfile(const char* path, CrashProfileFormat format) {
+	if (!profiler) {
+		errno = ENOTSUP;
+		return false;
+	}
+	// the crash reporter keeps the working directory the process had when it was started
+	std::string absolute = path;
+	char cwd[PATH_MAX];
+	if (!absolute.empty() && absolute[0] != '/' && getcwd(cwd, sizeof(cwd)))
+		absolute = std::string(cwd) + "/" + absolute;
+	if (absolute.empty() || absolute.size() >= PROFILE_PATH) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> l(mutex);
+	memcpy(profiler->path, absolute.c_str(), absolute.size() + 1);
+	profiler->format = uint8_t(format);
+	uint64_t request = profiler->requested.load() + 1;
+	profiler->requested.store(request);
+	NotifyReporter();
+	for (int waited = 0; profiler->written.load() < request; ++waited) {
+		if (waited >= 6000) {
+			errno = ETIMEDOUT;
+			return false;
+		}
+		usleep(10000);
+	}
+	int result = profiler->result.load();
+	if (result)
+		errno = result;
+	return result == 0;
+}
+
+namespace {
+// the samples aggregated by the crash reporter since the previous profile was written
+struct Profile {
+	std::vector<uint64_t> read; // per ring, samples taken
+	std::map<std::vector<uint64_t>, uint64_t> stacks;
+	uint64_t lost = 0; // overwritten before they were taken
+	int64_t start = 0; // ns since the epoch
+	std::unordered_map<uint64_t, CrashFrame> symbols; // of all profiles, each address is symbolized once
+};
+}
+
+static Profile profile;
+
+static int64_t RealtimeNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return int64_t(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+void CollectProfileSamples() {
+	if (!profiler)
+		return;
+	if (profile.read.empty()) {
+		profile.read.resize(profiler->rings);
+		profile.start = RealtimeNow();
+	}
+	std::vector<ProfileSample> copy(profiler->samples);
+	for (uint32_t i = 0; i < profiler->rings; ++i) {
+		ProfileRing* ring = profiler->ring(i);
+		uint64_t read = profile.read[i];
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		if (head == read)
+			continue;
+		uint64_t first = head - read > profiler->samples ? head - profiler->samples : read;
+		for (uint64_t n = first; n < head; ++n)
+			copy[n - first] = ring->samples()[n & (profiler->samples - 1)];
+		// samples overwritten while copying are discarded
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t after = ring->head.load(std::memory_order_relaxed);
+		// all the samples copied are lost if the last one can have been overwritten; the ones after head are read next
+		// time
+		uint64_t valid = std::min(FirstIntactEntry(first, after, profiler->samples), head);
+		profile.lost += valid - read;
+		for (uint64_t n = valid; n < head; ++n) {
+			auto& sample = copy[n - first];
+			uint64_t frames = std::min(sample.frames, uint64_t(PROFILE_FRAMES));
+			if (frames == 0)
+				continue;
+			++profile.stacks[std::vector<uint64_t>(sample.pcs, sample.pcs + frames)];
+		}
+		profile.read[i] = head;
+	}
+}
+
+// function name if resolved, otherwise module and offset
+static std::string FrameName(const CrashFrame& frame) {
+	if (!frame.functionName.empty())
+		return frame.functionName;
+	char buffer[32];
+	if (frame.module.empty()) {
+		snprintf(buffer, sizeof(buffer), "%p", frame.pc);
+		return buffer;
+	}
+	snprintf(buffer, sizeof(buffer), "+0x%x", frame.offsetInFile);
+	return BaseName(frame.module.c_str()) + std::string(buffer);
+}
+
+// one line per stack, outermost frame first: "main;run;parse 42"; stacks at other addresses in the same functions
+// are merged
+static std::string FoldedProfile() {
+	std::map<std::string, uint64_t> folded;
+	for (auto& [stack, count] : profile.stacks) {
+		std::string line;
+		for (size_t i = stack.size(); i-- > 0; ) {
+			line += FrameName(profile.symbols[stack[i]]);
+			if (i)
+				line += ';';
+		}
+		folded[line] += count;
+	}
+	std::string output;
+	for (auto& [line, count] : folded)
+		output += line + " " + std::to_string(count) + "\n";
+	return output;
+}
+
+namespace {
+// protocol buffer encoding, for the pprof format
+class Protobuf {
+ public:
+	std::string data;
+	void varint(uint64_t value) {
+		while (value >= 0x80) {
+			data += char(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		data += char(value);
+	}
+	// zero is the default value, and left out
+	Protobuf& integer(uint32_t field, uint64_t value) {
+		if (value) {
+			varint(uint64_t(field) << 3);
+			varint(value);
+		}
+		return *this;
+	}
+	Protobuf& bytes(uint32_t field, const std::string& value) {
+		varint(uint64_t(field) << 3 | 2);
+		varint(value.size());
+		data += value;
+		return *this;
+	}
+	Protobuf& message(uint32_t field, const Protobuf& value) {
+		return bytes(field, value.data);
+	}
+	Protobuf& packed(uint32_t field, const std::vector<uint64_t>& values) {
+		Protobuf packed;
+		for (uint64_t value : values)
+			packed.varint(value);
+		return bytes(field, packed.data);
+	}
+};
+}
+
+// profile.proto of pprof: samples (count and CPU time), with a location per address and a function per name
+static std::string PprofProfile(int64_t end) {
+	Protobuf output;
+	std::vector<std::string> strings {""};
+	std::unordered_map<std::string, uint64_t> stringIds {{"", 0}};
+	auto string = [&](const std::string& value) {
+		auto [it, inserted] = stringIds.emplace(value, strings.size());
+		if (inserted)
+			strings.push_back(value);
+		return it->second;
+	};
+	uint64_t period = 1000000000ULL / profiler->frequency;
+	output.message(1, Protobuf().integer(1, string("samples")).integer(2, string("count")));
+	output.message(1, Protobuf().integer(1, string("cpu")).integer(2, string("nanoseconds")));
+
+	std::unordered_map<uint64_t, uint64_t> locations; // address, id
+	std::map<std::tuple<std::string, std::string, std::string>, uint64_t> functions; // name, symbol, file; id
+	Protobuf locationMessages, functionMessages;
+	for (auto& [stack, count] : profile.stacks) {
+		std::vector<uint64_t> ids;
+		for (uint64_t pc : stack) {
+			auto [location, inserted] = locations.emplace(pc, locations.size() + 1);
+			ids.push_back(location->second);
+			if (!inserted)
+				continue;
+			auto& frame = profile.symbols[pc];
+			auto [function, added] = functions.emplace(std::make_tuple(FrameName(frame), frame.symbolName, frame.sourceFile), functions.size() + 1);
+			if (added) {
+				functionMessages.message(5, Protobuf().integer(1, function->second).integer(2, string(FrameName(frame)))
+						.integer(3, string(frame.symbolName)).integer(4, string(frame.sourceFile)));
+			}
+			Protobuf line;
+			line.integer(1, function->second).integer(2, frame.lineNumber);
+			locationMessages.message(4, Protobuf().integer(1, location->second).integer(3, pc).message(4, line));
+		}
+		output.message(2, Protobuf().packed(1, ids).packed(2, {count, count * period}));
+	}
+	output.data += locationMessages.data;
+	output.data += functionMessages.data;
+	uint64_t cpu = string("cpu"), nanoseconds = string("nanoseconds");
+	for (auto& value : strings)
+		output.bytes(6, value);
+	output.integer(9, uint64_t(profile.start));
+	output.integer(10, uint64_t(end - profile.start));
+	output.message(11, Protobuf().integer(1, cpu).integer(2, nanoseconds));
+	output.integer(12, period);
+
+	// pprof reads both compressed and uncompressed profiles
+	std::string compressed;
+	if (CompressPayload(CrashOptions::GZIP, output.data, compressed))
+		return compressed;
+	return output.data;
+}
+
+void WriteRequestedProfile(const CrashOptions& options) {
+	if (!profiler)
+		return;
+	uint64_t requested = profiler->requested.load();
+	if (requested == profiler->written.load())
+		return;
+	CollectProfileSamples();
+	int64_t end = RealtimeNow();
+
+	// only the addresses not in an earlier profile
+	std::vector<uintptr_t> pcs;
+	for (auto& [stack, count] : profile.stacks)
+		for (uint64_t pc : stack)
+			if (profile.symbols.emplace(pc, CrashFrame()).second)
+				pcs.push_back(uintptr_t(pc));
+	std::vector<CrashFrame> frames = AddressFrames(pcs, getppid());
+	if (options.readPerfMap)
+		ResolvePerfMapFrames(frames, getppid());
+	SymbolizeFrames(frames, options);
+	for (auto& frame : frames)
+		profile.symbols[uint64_t(uintptr_t(frame.pc))] = std::move(frame);
+
+	std::string path(profiler->path, strnlen(profiler->path, PROFILE_PATH));
+	std::string output = profiler->format == CRASH_PROFILE_PPROF ? PprofProfile(end) : FoldedProfile();
+	if (profile.lost > 0)
+		fprintf(stderr, "crash reporter: %llu profile samples lost, the rings were full\n", (unsigned long long)profile.lost);
+	// written completely or not at all
+	int result = 0;
+	std::string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file || fwrite(output.data(), 1, output.size(), file) != output.size())
+		result = errno ? errno : EIO;
+	if (file && fclose(file) != 0 && result == 0)
+		result = errno;
+	if (result == 0 && rename(temporary.c_str(), path.c_str()) != 0)
+		result = errno;
+	if (result != 0)
+		unlink(temporary.c_str());
+
+	profile.stacks.clear();
+	profile.lost = 0;
+	profile.start = end;
+	profiler->result.store(result);
+	profiler->written.store(requested);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "crashy.h"
+
+// sampling CPU profiler (CrashOptions::profilerFrequency, Linux only): a thread of the monitored process creates a
+// timer on the CPU clock of each thread (found in /proc/self/task), which sends it SIGPROF; the handler unwinds the
+// interrupted stack and appends the return addresses to the ring of the thread (the index is the value of the
+// timer signal), in a MAP_SHARED region created before the crash reporter is forked
+// the crash reporter regularly drains the rings (samples overwritten before that are lost, and counted) and
+// aggregates them by stack; on request (CrashWriteProfile) each distinct address is symbolized once and the profile
+// is written
+
+#define PROFILE_FRAMES 32
+
+struct ProfileSample {
+	uint64_t frames;
+	uint64_t pcs[PROFILE_FRAMES]; // innermost first
+};
+
+struct ProfileRing {
+	std::atomic<uint32_t> owner; // thread id, 0 if free (assigned by the thread creating the timers)
+	std::atomic<uint64_t> head; // number of samples ever written
+	static constexpr size_t HEADER = 64;
+	ProfileSample* samples() {
+		return reinterpret_cast<ProfileSample*>(reinterpret_cast<char*>(this) + HEADER);
+	}
+};
+
+#define PROFILE_PATH 256
+
+struct ProfilerRegion {
+	uint32_t rings;
+	uint32_t samples; // per ring, a power of two
+	uint32_t frequency; // per second of CPU time of a thread
+	// the last request of CrashWriteProfile, and the result of the crash reporter (0 or an errno value)
+	std::atomic<uint64_t> requested;
+	std::atomic<uint64_t> written;
+	std::atomic<int> result;
+	uint8_t format; // CrashProfileFormat
+	char path[PROFILE_PATH];
+	static constexpr size_t HEADER = 320;
+	ProfileRing* ring(uint32_t i) {
+		return reinterpret_cast<ProfileRing*>(reinterpret_cast<char*>(this) + HEADER + size_t(i) * (ProfileRing::HEADER + samples * sizeof(ProfileSample)));
+	}
+};
+
+// in the process to be monitored, before StartReporter(); does nothing if CrashOptions::profilerFrequency is 0
+void CreateProfiler(const CrashOptions& options);
+// in the process to be monitored, after StartReporter(): starts sampling
+void StartProfiler();
+
+// in the crash reporter: adds the samples written since the previous call to the profile
+void CollectProfileSamples();
+// in the crash reporter: writes the profile if CrashWriteProfile requested it, and starts a new one
+void WriteRequestedProfile(const CrashOptions& options);
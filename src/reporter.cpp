@@ -4,15 +4,44 @@
 #include <string.h>
 #include <sys/utsname.h>
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
 #include <ctime>
 #include <sstream>
-#include <iomanip>
 #include <random>
 #include <charconv>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include "reporter.h"
+#include "elfimage.h"
+#include "json.h"
+#include "compress.h"
+#include "binaryreport.h"
+#include "http.h"
+#include "spool.h"
+#include "ndjson.h"
+#include "sinks.h"
+#include "fingerprint.h"
+#include "sourcecontext.h"
+#include "procmetrics.h"
+#include "coderanges.h"
+#include "flightrecorder.h"
+#include "nonfatal.h"
+#include "profiler.h"
+#include "watchdog.h"
+#include "breadcrumbs.h"
 #include "tosourcecode.h"
 #include "simple-raw.h"
 #include "util.h"
@@ -24,27 +53,235 @@
 #define out stderr
 #define loggerTerminal isatty(STDERR_FILENO)
 
-void ReadCrash(int in, CrashOptions&& options [[maybe_unused]]) {
-	bool good = true;
-	
-	uint32_t startTag = ReadBinary(in, uint32_t(), good);
-	if (startTag != CrashTag::START)
-		return;
+// keeps what the crashed process sent: the dladdr symbol name, or only module and offset
+static void DegradeFrame(CrashFrame& frame, const CrashOptions& options) {
+	frame.library = frame.module.empty() ? options.currentExecutable : frame.module;
+	frame.sourceFile.clear();
+	frame.lineNumber = 0;
+	frame.column = 0;
+	if (!frame.symbolName.empty()) {
+		std::unique_ptr<char, Free> retainer;
+		frame.functionName = Demangle(frame.symbolName.c_str(), retainer);
+		frame.detail = CrashFrame::SYMBOL_ONLY;
+	} else {
+		frame.functionName.clear();
+		frame.detail = CrashFrame::MODULE_OFFSET;
+	}
+}
 
-	std::time_t t = std::time(nullptr);
-	char timebuffer[100];
-	if (!std::strftime(timebuffer, sizeof(timebuffer), " [%F %T %z]", std::localtime(&t))) {
-		timebuffer[0] = '\0';
+// resident memory of the crash reporter; the peak where the current size is not available
+static size_t MemoryUsage() {
+#if defined(__linux__)
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		unsigned long long size = 0, resident = 0;
+		int fields = fscanf(statm, "%llu %llu", &size, &resident);
+		fclose(statm);
+		if (fields == 2)
+			return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
 	}
-	fprintf(out, loggerTerminal ? TERMINAL_COLOR_RED "\n\n" BAR TERMINAL_RESET " CRASH " TERMINAL_COLOR_RED BAR TERMINAL_DIM "%s" TERMINAL_RESET "\n" : "\n\n" BAR " CRASH " BAR "%s\n", timebuffer);
+#endif
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+#ifdef __APPLE__
+	return size_t(usage.ru_maxrss);
+#else
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
 
-	const char* spacing = "       ";
-	std::optional<std::pair<int,void*>> signal;
-	std::optional<std::pair<std::string,std::string>> uncaughtException;
-	std::optional<std::tuple<std::string,std::string,uint32_t,std::string,std::string>> assertViolation; // func, file, line, condition, explanation
-	std::string context;
-	std::vector<std::tuple<std::string, std::string, std::string, uint32_t, uint32_t>> frames;
-	std::vector<std::tuple<std::string, time_t, std::string>> breadcrumbs;
+namespace {
+// a worker still resolving a frame when the budget was exceeded: it stops after that frame
+struct AbandonedWorker {
+	std::thread thread;
+	std::shared_ptr<std::atomic<bool>> exited;
+};
+}
+
+// never destroyed: the reporter can exit while workers are still running
+static std::mutex abandonedMutex;
+static std::vector<AbandonedWorker>& abandonedWorkers = *new std::vector<AbandonedWorker>();
+
+// joins the abandoned workers that have stopped since
+static void ReapAbandonedWorkers() {
+	std::lock_guard<std::mutex> l(abandonedMutex);
+	auto exited = std::partition(abandonedWorkers.begin(), abandonedWorkers.end(), [](const AbandonedWorker& worker) {
+		return !worker.exited->load();
+	});
+	for (auto it = exited; it != abandonedWorkers.end(); ++it)
+		it->thread.join();
+	abandonedWorkers.erase(exited, abandonedWorkers.end());
+}
+
+std::chrono::steady_clock::time_point SymbolizationDeadline(const CrashOptions& options) {
+	if (options.symbolizationTimeout.count() <= 0)
+		return std::chrono::steady_clock::time_point::max();
+	return std::chrono::steady_clock::now() + options.symbolizationTimeout;
+}
+
+void SymbolizeFrames(std::vector<CrashFrame>& frames, const CrashOptions& options) {
+	SymbolizeFrames(frames, options, SymbolizationDeadline(options));
+}
+
+void SymbolizeFrames(std::vector<CrashFrame>& frames, const CrashOptions& options, std::chrono::steady_clock::time_point deadline) {
+	ReapAbandonedWorkers();
+	// workers still busy when the budget is exceeded are abandoned (they stop after their current frame, and are
+	// joined by a later call), so everything they touch is owned by this shared state
+	struct State {
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t finishedModules = 0;
+		std::vector<std::vector<size_t>> work;
+		std::vector<CrashFrame> input;
+		std::vector<std::optional<CrashFrame>> results;
+		std::atomic<size_t> next {0};
+		std::atomic<bool> stop {false};
+		std::string currentExecutable;
+	};
+	auto state = std::make_shared<State>();
+	state->input = frames;
+	state->results.resize(frames.size());
+	state->currentExecutable = options.currentExecutable;
+
+	// frames of the same module are resolved by the same worker, so each module is loaded and indexed once
+	std::map<std::string, std::vector<size_t>> modules;
+	for (size_t i = 0; i < frames.size(); ++i)
+		if (!frames[i].codeRange)
+			modules[frames[i].module].push_back(i);
+	for (auto& [module, moduleFrames] : modules)
+		state->work.push_back(std::move(moduleFrames));
+
+	auto worker = [state] {
+		for (size_t i; !state->stop && (i = state->next++) < state->work.size(); ) {
+			for (size_t index : state->work[i]) {
+				if (state->stop)
+					return;
+				CrashFrame frame = state->input[index];
+				if (frame.module.empty()) {
+					std::tie(frame.functionName, frame.sourceFile, frame.lineNumber, frame.column) = RetrieveSourceCodeInfo(frame.pc, state->currentExecutable.c_str());
+					frame.library = state->currentExecutable;
+				} else {
+					std::tie(frame.functionName, frame.library, frame.sourceFile, frame.lineNumber, frame.column) = RetrieveSourceCodeInfo(frame.symbolName.empty() ? nullptr : frame.symbolName.c_str(), frame.module.c_str(), frame.offsetInFile, frame.pc, state->currentExecutable.c_str());
+				}
+				std::lock_guard<std::mutex> l(state->mutex);
+				state->results[index] = std::move(frame);
+			}
+			std::lock_guard<std::mutex> l(state->mutex);
+			++state->finishedModules;
+			state->finished.notify_all();
+		}
+	};
+	size_t threads = options.symbolizationThreads ? options.symbolizationThreads : std::max(1U, std::thread::hardware_concurrency());
+	// nothing is started once the budget is used up (by an earlier part of the same report)
+	if (std::chrono::steady_clock::now() >= deadline)
+		threads = 0;
+	threads = std::min(threads, state->work.size());
+	std::vector<AbandonedWorker> pool;
+	for (size_t i = 0; i < threads; ++i) {
+		auto exited = std::make_shared<std::atomic<bool>>(false);
+		pool.push_back({std::thread([worker, exited] {
+			worker();
+			exited->store(true);
+		}), exited});
+	}
+
+	bool exceeded = false;
+	{
+		std::unique_lock<std::mutex> l(state->mutex);
+		while (state->finishedModules < state->work.size()) {
+			if (std::chrono::steady_clock::now() >= deadline)
+				exceeded = true;
+			if (options.symbolizationMemoryLimit > 0 && MemoryUsage() > options.symbolizationMemoryLimit)
+				exceeded = true;
+			if (exceeded)
+				break;
+			state->finished.wait_for(l, std::chrono::milliseconds(10));
+		}
+		state->stop = true;
+		for (size_t i = 0; i < frames.size(); ++i) {
+			if (state->results[i])
+				frames[i] = std::move(*state->results[i]);
+			else if (!frames[i].codeRange)
+				DegradeFrame(frames[i], options);
+		}
+	}
+	if (exceeded) {
+		std::lock_guard<std::mutex> l(abandonedMutex);
+		std::move(pool.begin(), pool.end(), std::back_inserter(abandonedWorkers));
+	} else {
+		for (auto& worker : pool)
+			worker.thread.join();
+	}
+}
+
+std::string ModulePath(const CrashFrame& frame, const CrashOptions& options) {
+	const std::string& name = frame.module.empty() ? options.currentExecutable : frame.module;
+	char result[PATH_MAX+1] = {0};
+	if (realpath(name.c_str(), result))
+		return result;
+#if defined(__linux__)
+	// the reporter is forked from the crashed process, so it runs the same executable
+	if (name == options.currentExecutable && readlink("/proc/self/exe", result, PATH_MAX) > 0)
+		return result;
+#endif
+	return name;
+}
+
+void CollectModules(CrashReport& crash, const CrashOptions& options) {
+	std::map<std::string, std::string> fullPaths;
+	// of the frames of the crashed thread, and of the other threads (hang reports)
+	std::vector<std::vector<CrashFrame>*> stacks {&crash.frames};
+	for (auto& thread : crash.threads)
+		stacks.push_back(&thread.frames);
+	for (auto* frames : stacks) {
+		for (auto& frame : *frames) {
+			auto& path = fullPaths[frame.module];
+			if (path.empty())
+				path = ModulePath(frame, options);
+			frame.library = path;
+			uintptr_t base = frame.module.empty() ? 0 : uintptr_t(frame.pc) - frame.offsetInFile;
+			auto it = std::find_if(crash.modules.begin(), crash.modules.end(), [&](const CrashModule& module) {
+				return module.path == path && module.base == base;
+			});
+			if (it != crash.modules.end())
+				continue;
+			CrashModule module;
+			module.path = path;
+			module.base = base;
+#ifndef __APPLE__
+			if (auto image = OpenElfImage(path.c_str())) {
+				module.buildId = image->buildId();
+				module.size = image->imageSize();
+			}
+#endif
+			crash.modules.push_back(std::move(module));
+		}
+	}
+}
+
+std::string DebugId(const std::string& buildId) {
+	static const char hex[] = "0123456789abcdef";
+	uint8_t bytes[16] = {0};
+	for (size_t i = 0; i < 16 && 2*i+1 < buildId.size(); ++i)
+		bytes[i] = uint8_t((strchr(hex, buildId[2*i]) - hex) << 4 | (strchr(hex, buildId[2*i+1]) - hex));
+	std::swap(bytes[0], bytes[3]);
+	std::swap(bytes[1], bytes[2]);
+	std::swap(bytes[4], bytes[5]);
+	std::swap(bytes[6], bytes[7]);
+	std::string retval;
+	for (size_t i = 0; i < 16; ++i) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			retval += '-';
+		retval += hex[bytes[i] >> 4];
+		retval += hex[bytes[i] & 0xf];
+	}
+	return retval;
+}
+
+bool ReadCrashReport(int in, CrashReport& crash) {
+	bool good = true;
+	bool asyncStack = false;
 	while (good) {
 		uint32_t tag = ReadBinary(in, uint32_t(), good);
 		if (tag == CrashTag::FINISH) {
@@ -55,11 +292,7 @@ void ReadCrash(int in, CrashOptions&& options [[maybe_unused]]) {
 			void* p = reinterpret_cast<void*>(uintptr_t(ReadBinary(in, uint64_t(0), good)));
 			if (!good)
 				break;
-			fprintf(out, loggerTerminal ? 
-					"%s " TERMINAL_DIM "(%i) on address " TERMINAL_RESET "%p" TERMINAL_DIM "." TERMINAL_RESET "\n" :
-					"%s (%i) on address %p.\n",
-					strsignal(sig), sig, p);
-			signal = {sig, p};
+			crash.signal = {sig, p};
 		} else if (tag == CrashTag::UNCAUGHT_EXCEPTION) {
 			std::string cause = ReadBinary(in, std::string(), good);
 			std::string exceptionType = ReadBinary(in, std::string(), good);
@@ -67,11 +300,7 @@ void ReadCrash(int in, CrashOptions&& options [[maybe_unused]]) {
 				break;
 			std::unique_ptr<char, Free> retainer;
 			std::string typeDescription = exceptionType.size() > 0 ? Demangle(exceptionType.c_str(), retainer, true) : "unknown";
-			uncaughtException = {cause, typeDescription};
-			fprintf(out, loggerTerminal ?
-					"%s " TERMINAL_DIM "exception: " TERMINAL_RESET "%s" TERMINAL_DIM "." TERMINAL_RESET "\n" :
-					"%s exception: %s.\n",
-					typeDescription.c_str(), cause.c_str());
+			crash.uncaughtException = {cause, typeDescription};
 		} else if (tag == CrashTag::ASSERT) {
 			std::string func = ReadBinary(in, std::string(), good);
 			std::string file = ReadBinary(in, std::string(), good);
@@ -80,238 +309,981 @@ void ReadCrash(int in, CrashOptions&& options [[maybe_unused]]) {
 			std::string explanation = ReadBinary(in, std::string(), good);
 			if (!good)
 				break;
-			std::unique_ptr<char, Free> retainer;
-			std::string typeDescription = func.size() > 0 ? Demangle(func.c_str(), retainer, true) : "unknown";
-			assertViolation = {func, file, line, condition, explanation};
-			fprintf(out, loggerTerminal ?
-					TERMINAL_DIM "Assertion violation in " TERMINAL_FULL "%s" TERMINAL_DIM " [%s:%i]: " TERMINAL_RESET "%s.\n" TERMINAL_DIM "This is due to: " TERMINAL_RESET "%s" TERMINAL_DIM "." TERMINAL_RESET "\n" :
-					"Assertion violation in %s [%s:%i]: %s.\nThis is due to: %s\n",
-					func.c_str(), file.c_str(), line, condition.c_str(), explanation.c_str());
+			crash.assertViolation = {func, file, line, condition, explanation};
 		} else if (tag == CrashTag::LIBRARY) {
-			std::string symbolName = ReadBinary(in, std::string(), good);
-			std::string filename = ReadBinary(in, std::string(), good);
-			uint32_t offset_in_file = ReadBinary(in, 0U, good);
-			void* pc = reinterpret_cast<void*>(uintptr_t(ReadBinary(in, uint64_t(0), good)));
+			CrashFrame frame;
+			frame.symbolName = ReadBinary(in, std::string(), good);
+			frame.module = ReadBinary(in, std::string(), good);
+			frame.offsetInFile = ReadBinary(in, 0U, good);
+			frame.pc = reinterpret_cast<void*>(uintptr_t(ReadBinary(in, uint64_t(0), good)));
 			if (!good)
 				break;
-      auto [functionName, library, sourceFile, lineNumber, columnOffset] = RetrieveAndPrintSymbol(symbolName.empty() ? nullptr : symbolName.c_str(), 0, filename.c_str(), offset_in_file, pc, options.currentExecutable.c_str());
-			frames.emplace_back(functionName, library, sourceFile, lineNumber, columnOffset);
+			frame.async = asyncStack;
+			crash.frames.push_back(std::move(frame));
 		} else if (tag == CrashTag::PC) {
-			void* pc = reinterpret_cast<void*>(uintptr_t(ReadBinary(in, uint64_t(0), good)));
+			CrashFrame frame;
+			frame.pc = reinterpret_cast<void*>(uintptr_t(ReadBinary(in, uint64_t(0), good)));
+			if (!good)
+				break;
+			frame.async = asyncStack;
+			crash.frames.push_back(std::move(frame));
+		} else if (tag == CrashTag::CODE_RANGE) {
+			CrashFrame frame;
+			frame.codeRange = true;
+			frame.functionName = ReadBinary(in, std::string(), good);
+			frame.sourceFile = ReadBinary(in, std::string(), good);
+			frame.lineNumber = ReadBinary(in, 0U, good);
+			frame.offsetInFile = ReadBinary(in, 0U, good);
+			frame.pc = reinterpret_cast<void*>(uintptr_t(ReadBinary(in, uint64_t(0), good)));
+			if (!good)
+				break;
+			if (frame.lineNumber == 0)
+				frame.sourceFile.clear();
+			frame.symbolName = frame.functionName;
+			frame.library = "[jit]";
+			frame.async = asyncStack;
+			crash.frames.push_back(std::move(frame));
+		} else if (tag == CrashTag::ASYNC_STACK) {
+			asyncStack = true;
+		} else if (tag == CrashTag::THREAD) {
+			crash.crashedThread = ReadBinary(in, uint32_t(0), good);
 			if (!good)
 				break;
-			auto [functionName, sourceFile, lineNumber, columnOffset] = RetrieveAndPrintPC(pc, options.currentExecutable.c_str());
-			frames.emplace_back(functionName, options.currentExecutable.c_str(), sourceFile, lineNumber, columnOffset);
 		} else if (tag == CrashTag::CONTEXT) {
-			context = ReadBinary(in, std::string(), good);
+			crash.context = ReadBinary(in, std::string(), good);
 			if (!good)
 				break;
-			fprintf(out, loggerTerminal ?
-          TERMINAL_CONTEXT TERMINAL_FULL "%s" TERMINAL_RESET "\n" TERMINAL_COMMANDLINE TERMINAL_FULL " %s\n    " TERMINAL_DIM "in" TERMINAL_RESET " %s\n    " TERMINAL_DIM "of" TERMINAL_RESET " %s/%s [%s]\n" :
-					"<~> %s\n||= %s\n    in %s\n" TERMINAL_DIM "of" TERMINAL_RESET " %s/%s [%s]\n",
-          context.c_str(), options.command.c_str(), options.path.c_str(),
-          options.environment.c_str(), options.dist.c_str(), options.release.c_str());
 		} else if (tag == CrashTag::BREADCRUMB) {
 			std::string level = ReadBinary(in, std::string(), good);
 			time_t time = time_t(ReadBinary(in, uint64_t(0), good));
 			std::string description = ReadBinary(in, std::string(), good);
 			if (!good)
 				break;
-			breadcrumbs.emplace_back(level, time, description);
-			if (!std::strftime(timebuffer, sizeof(timebuffer), "%F %T", std::localtime(&time))) {
-				timebuffer[0] = '\0';
-			}
-			fprintf(out, loggerTerminal ?
-					TERMINAL_LOG "%s%s [%s] " TERMINAL_RESET "%s" "\n" TERMINAL_RESET :
-					"<+> %s%s [%s] %s\n", timebuffer, &spacing[std::min(size_t(7), level.size())], level.c_str(), description.c_str());
+			ReportBreadcrumb breadcrumb;
+			breadcrumb.level = std::move(level);
+			breadcrumb.time = int64_t(time) * 1000000000LL;
+			breadcrumb.message = std::move(description);
+			crash.breadcrumbs.push_back(std::move(breadcrumb));
 		}
 	}
+	return good;
+}
 
-	if (!good)
-		return;
+// local time of a breadcrumb, with microseconds if it has sub-second precision
+static void BreadcrumbTime(char* buffer, size_t size, int64_t time) {
+	time_t seconds = time_t(time / 1000000000LL);
+	size_t length = std::strftime(buffer, size, "%F %T", std::localtime(&seconds));
+	if (length == 0)
+		buffer[0] = '\0';
+	else if (time % 1000000000LL != 0)
+		snprintf(buffer + length, size - length, ".%06lld", (long long)(time % 1000000000LL / 1000));
+}
 
-	std::stringstream report;
-	if (options.sendFormat == CrashOptions::PLAIN_TEXT) {
-		report << "=== CRASH === " << timebuffer << "\n";
-		if (signal) {
-			auto [sig, p] = *signal;
-			report << strsignal(sig) << " (" << sig << ") on address " << p << ".\n";
-		} else if (uncaughtException) {
-			auto [cause, typeDescription] = *uncaughtException;
-			report << typeDescription << " exception: " << cause << ".\n";
-		} else if (assertViolation) {
-			auto [func, file, lineno, condition, explanation] = *assertViolation;
-			report << "Assertion violation in " << func << " [" << file << ":" << lineno << "]: " << condition << ".\n";
-			if (!explanation.empty())
-				report << "This is due to " << explanation << ".\n";
+// function of a flight recorder event: name and source location if resolved, otherwise module and offset
+static std::string FlightRecorderFunction(const CrashReport& crash, const FlightRecorderEvent& event) {
+	if (event.function >= crash.flightRecorderFunctions.size())
+		return "(unknown)";
+	auto& frame = crash.flightRecorderFunctions[event.function];
+	if (!frame.functionName.empty() && !frame.sourceFile.empty())
+		return frame.functionName + " [" + frame.sourceFile + ":" + std::to_string(frame.lineNumber) + "]";
+	if (!frame.functionName.empty())
+		return frame.functionName;
+	char buffer[32];
+	if (frame.module.empty()) {
+		snprintf(buffer, sizeof(buffer), "%p", frame.pc);
+		return buffer;
+	}
+	snprintf(buffer, sizeof(buffer), "+0x%x", frame.offsetInFile);
+	return BaseName(frame.module.c_str()) + std::string(buffer);
+}
+
+// "Non-fatal error", "Hang", ...
+static std::string NonFatalTitle(const NonFatalReport& nonFatal) {
+	if (nonFatal.kind == NonFatalReport::HANG)
+		return "Hang";
+	if (nonFatal.kind == NonFatalReport::SLOW_OPERATION)
+		return "Slow operation";
+	return "Non-fatal " + nonFatal.level;
+}
+
+// returns the number of frames not fully resolved
+static size_t PrintFrames(const std::vector<CrashFrame>& frames, const CrashOptions& options) {
+	size_t degraded = 0;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		auto& frame = frames[i];
+		if (frame.async && (i == 0 || !frames[i - 1].async))
+			fprintf(out, loggerTerminal ? TERMINAL_DIM "--- async stack ---" TERMINAL_RESET "\n" : "--- async stack ---\n");
+		if (frame.detail != CrashFrame::FULL)
+			++degraded;
+		if (frame.codeRange)
+			PrintSymbolInfo(frame.functionName, frame.library, frame.sourceFile, frame.lineNumber, frame.column, frame.library.c_str(), frame.offsetInFile, frame.pc);
+		else if (frame.module.empty())
+			PrintPCInfo(frame.functionName, frame.sourceFile, frame.lineNumber, frame.column, frame.pc, options.currentExecutable.c_str());
+		else
+			PrintSymbolInfo(frame.functionName, frame.library, frame.sourceFile, frame.lineNumber, frame.column, frame.module.c_str(), frame.offsetInFile, frame.pc);
+	}
+	return degraded;
+}
+
+void PrintCrashReport(const CrashReport& crash, const CrashOptions& options) {
+	const char* spacing = "       ";
+	char timebuffer[100];
+	if (crash.signal) {
+		auto [sig, p] = *crash.signal;
+		fprintf(out, loggerTerminal ? 
+				"%s " TERMINAL_DIM "(%i) on address " TERMINAL_RESET "%p" TERMINAL_DIM "." TERMINAL_RESET "\n" :
+				"%s (%i) on address %p.\n",
+				strsignal(sig), sig, p);
+	}
+	if (crash.uncaughtException) {
+		auto& [cause, typeDescription] = *crash.uncaughtException;
+		fprintf(out, loggerTerminal ?
+				"%s " TERMINAL_DIM "exception: " TERMINAL_RESET "%s" TERMINAL_DIM "." TERMINAL_RESET "\n" :
+				"%s exception: %s.\n",
+				typeDescription.c_str(), cause.c_str());
+	}
+	if (crash.assertViolation) {
+		auto& [func, file, line, condition, explanation] = *crash.assertViolation;
+		fprintf(out, loggerTerminal ?
+				TERMINAL_DIM "Assertion violation in " TERMINAL_FULL "%s" TERMINAL_DIM " [%s:%i]: " TERMINAL_RESET "%s.\n" TERMINAL_DIM "This is due to: " TERMINAL_RESET "%s" TERMINAL_DIM "." TERMINAL_RESET "\n" :
+				"Assertion violation in %s [%s:%i]: %s.\nThis is due to: %s\n",
+				func.c_str(), file.c_str(), line, condition.c_str(), explanation.c_str());
+	}
+	if (crash.nonFatal) {
+		fprintf(out, loggerTerminal ?
+				TERMINAL_DIM "%s: " TERMINAL_RESET "%s" TERMINAL_DIM "." TERMINAL_RESET "\n" :
+				"%s: %s.\n",
+				NonFatalTitle(*crash.nonFatal).c_str(), crash.nonFatal->message.c_str());
+	}
+	size_t degraded = PrintFrames(crash.frames, options);
+	for (auto& thread : crash.threads) {
+		fprintf(out, loggerTerminal ? TERMINAL_DIM "Thread %u (%s):" TERMINAL_RESET "\n" : "Thread %u (%s):\n", thread.tid, thread.name.c_str());
+		degraded += PrintFrames(thread.frames, options);
+	}
+	if (degraded > 0) {
+		fprintf(out, loggerTerminal ?
+				TERMINAL_DIM "(%zu frames not fully resolved: symbolization budget exceeded)" TERMINAL_RESET "\n" :
+				"(%zu frames not fully resolved: symbolization budget exceeded)\n",
+				degraded);
+	}
+	if (!crash.context.empty()) {
+		fprintf(out, loggerTerminal ?
+        TERMINAL_CONTEXT TERMINAL_FULL "%s" TERMINAL_RESET "\n" TERMINAL_COMMANDLINE TERMINAL_FULL " %s\n    " TERMINAL_DIM "in" TERMINAL_RESET " %s\n    " TERMINAL_DIM "of" TERMINAL_RESET " %s/%s [%s]\n" :
+				"<~> %s\n||= %s\n    in %s\n" TERMINAL_DIM "of" TERMINAL_RESET " %s/%s [%s]\n",
+        crash.context.c_str(), options.command.c_str(), options.path.c_str(),
+        options.environment.c_str(), options.dist.c_str(), options.release.c_str());
+	}
+	for (auto& breadcrumb : crash.breadcrumbs) {
+		BreadcrumbTime(timebuffer, sizeof(timebuffer), breadcrumb.time);
+		auto& level = breadcrumb.level;
+		fprintf(out, loggerTerminal ?
+				TERMINAL_LOG "%s%s [%s] " TERMINAL_RESET "%s" "\n" TERMINAL_RESET :
+				"<+> %s%s [%s] %s\n", timebuffer, &spacing[std::min(size_t(7), level.size())], level.c_str(), breadcrumb.message.c_str());
+	}
+	for (auto& [tid, events] : crash.flightRecorder) {
+		fprintf(out, loggerTerminal ? TERMINAL_DIM "Flight recorder of thread %u%s:" TERMINAL_RESET "\n" : "Flight recorder of thread %u%s:\n",
+				tid, tid == crash.crashedThread ? " (crashed)" : "");
+		for (auto& event : events) {
+			BreadcrumbTime(timebuffer, sizeof(timebuffer), event.time);
+			fprintf(out, "  %s %s %s\n", timebuffer, event.exit ? "<-" : "->", FlightRecorderFunction(crash, event).c_str());
 		}
-		if (!frames.empty()) {
-			for (size_t i = 0; i < frames.size(); i++) {
-				auto [functionName, library, sourceFile, lineNumber, columnOffset] = frames[i];
-				if (!sourceFile.empty()) {
-					report << "  at " << functionName << " [" << sourceFile << ":" << lineNumber << "]\n";
-				} else if (!functionName.empty()) {
-					report << "  at " << functionName << "\n";
-				} else {
-					report << "  at (unknown)\n";
-				}
-			}
+	}
+}
+
+static void PlainTextFrames(std::stringstream& report, const std::vector<CrashFrame>& frames, const CrashOptions& options) {
+	for (size_t i = 0; i < frames.size(); ++i) {
+		auto& frame = frames[i];
+		if (frame.async && (i == 0 || !frames[i - 1].async))
+			report << "  --- async stack ---\n";
+		if (options.rawReport) {
+			report << "  at " << frame.library << "+0x" << std::hex << (frame.module.empty() && !frame.codeRange ? uintptr_t(frame.pc) : frame.offsetInFile) << std::dec;
+			if (!frame.functionName.empty())
+				report << " (" << frame.functionName << ")";
+			report << "\n";
+		} else if (!frame.sourceFile.empty()) {
+			report << "  at " << frame.functionName << " [" << frame.sourceFile << ":" << frame.lineNumber << "]\n";
+		} else if (!frame.functionName.empty()) {
+			report << "  at " << frame.functionName << (frame.detail == CrashFrame::SYMBOL_ONLY ? " (degraded: symbol only)" : "") << "\n";
+		} else if (frame.detail == CrashFrame::MODULE_OFFSET) {
+			report << "  at " << BaseName(frame.library.c_str()) << "+0x" << std::hex << (frame.module.empty() ? uintptr_t(frame.pc) : frame.offsetInFile) << std::dec << " (degraded: module and offset only)\n";
+		} else {
+			report << "  at (unknown)\n";
 		}
+	}
+}
+
+static std::string PlainTextReport(const CrashReport& crash, const CrashOptions& options) {
+	const char* spacing = "       ";
+	char timebuffer[100];
+	if (!std::strftime(timebuffer, sizeof(timebuffer), " [%F %T %z]", std::localtime(&crash.timestamp))) {
+		timebuffer[0] = '\0';
+	}
+	std::stringstream report;
+	if (!crash.nonFatal)
+		report << "=== CRASH === ";
+	else if (crash.nonFatal->kind == NonFatalReport::HANG)
+		report << "=== HANG === ";
+	else if (crash.nonFatal->kind == NonFatalReport::SLOW_OPERATION)
+		report << "=== SLOW OPERATION === ";
+	else
+		report << "=== NON-FATAL === ";
+	report << timebuffer << "\n";
+	if (crash.signal) {
+		auto [sig, p] = *crash.signal;
+		report << strsignal(sig) << " (" << sig << ") on address " << p << ".\n";
+	} else if (crash.uncaughtException) {
+		auto [cause, typeDescription] = *crash.uncaughtException;
+		report << typeDescription << " exception: " << cause << ".\n";
+	} else if (crash.assertViolation) {
+		auto [func, file, lineno, condition, explanation] = *crash.assertViolation;
+		report << "Assertion violation in " << func << " [" << file << ":" << lineno << "]: " << condition << ".\n";
+		if (!explanation.empty())
+			report << "This is due to " << explanation << ".\n";
+	} else if (crash.nonFatal) {
+		report << NonFatalTitle(*crash.nonFatal) << ": " << crash.nonFatal->message << ".\n";
+	}
+	PlainTextFrames(report, crash.frames, options);
+	for (auto& thread : crash.threads) {
+		report << "Thread " << thread.tid << " (" << thread.name << "):\n";
+		PlainTextFrames(report, thread.frames, options);
+	}
+	for (auto& module : crash.modules)
+		report << "Module: " << module.path << " build-id " << (module.buildId.empty() ? "(unknown)" : module.buildId) << " at 0x" << std::hex << module.base << std::dec << "\n";
+	report << std::endl;
+	if (!crash.fingerprint.empty()) {
+		report << "Fingerprint: " << crash.fingerprint;
+		if (crash.suppressedBefore > 0 && crash.nonFatal)
+			report << " (" << crash.suppressedBefore << " events of this call site not reported before this one)";
+		else if (crash.suppressedBefore > 0)
+			report << " (" << crash.suppressedBefore << " similar crashes not reported before this one)";
 		report << std::endl;
-		report << "Command: " << options.command << std::endl;
-		report << "   Path: " << options.path << std::endl;
+	}
+	for (auto& [tid, context] : crash.threadContexts) {
+		report << (tid == crash.crashedThread ? "Context:" : "Context of thread " + std::to_string(tid) + ":");
+		for (auto& [key, value] : context)
+			report << " " << key << "=" << value;
 		report << std::endl;
-		for (auto& [level, time, string] : breadcrumbs) {
-			if (!std::strftime(timebuffer, sizeof(timebuffer), "%F %T", std::localtime(&time))) {
-				timebuffer[0] = '\0';
-			}
-			report << timebuffer << &spacing[std::min(size_t(7), level.size())] << " [" << level << "] " << string << std::endl;
+	}
+	if (!crash.processMetrics.empty()) {
+		report << "Metrics:";
+		for (auto& [name, value] : crash.processMetrics)
+			report << " " << name << "=" << value;
+		report << std::endl;
+	}
+	report << "Command: " << options.command << std::endl;
+	report << "   Path: " << options.path << std::endl;
+	report << std::endl;
+	for (auto& breadcrumb : crash.breadcrumbs) {
+		BreadcrumbTime(timebuffer, sizeof(timebuffer), breadcrumb.time);
+		auto& level = breadcrumb.level;
+		report << timebuffer << &spacing[std::min(size_t(7), level.size())] << " [" << level << "] " << breadcrumb.message << std::endl;
+	}
+	for (auto& [tid, events] : crash.flightRecorder) {
+		report << std::endl << "Flight recorder of thread " << tid << (tid == crash.crashedThread ? " (crashed)" : "") << ":" << std::endl;
+		for (auto& event : events) {
+			BreadcrumbTime(timebuffer, sizeof(timebuffer), event.time);
+			report << "  " << timebuffer << (event.exit ? " <- " : " -> ") << FlightRecorderFunction(crash, event) << std::endl;
 		}
-	} 
-	if (options.sendFormat == CrashOptions::JSON_SENTRY) {
-		static std::random_device rd("/dev/urandom"); // win32 ignores argument for random_device
-		uint32_t id[4] = {0};
-		for (auto& i : id)
-			i = rd();
-		report << "{";
-		std::ios state(NULL);
-		state.copyfmt(report);
-		report << "\"event_id\": \"" << std::setfill('0') << std::hex << std::setw(8) << id[0] << std::setw(8) << id[1] << std::setw(8) << id[2] << std::setw(8) << id[3] << "\"";
-		report.copyfmt(state);
-		report << ",\"contexts\": {";
-		struct utsname version;
-		uname(&version);
-		{
-			report << "\"os\": {";
-			{
-				report << "\"name\": " << std::quoted(version.sysname);
-				report << ",\"version\": " << std::quoted(std::string(version.release) + " " + version.machine);
-			}
-			report << "}";
-			report << ",\"device\": {";
-			{
-				report << "\"name\": " << std::quoted(version.nodename);
-				auto model = GetMachineModel();
-				if (!model.empty())
-					report << ",\"model\": " << std::quoted(model);
-				report << ",\"arch\": " << std::quoted(version.machine);
+	}
+	return report.str();
+}
+
+static std::string NewEventId() {
+	static std::random_device rd("/dev/urandom"); // win32 ignores argument for random_device
+	static const char hex[] = "0123456789abcdef";
+	std::string eventId(32, '0');
+	for (size_t i = 0; i < eventId.size(); i += 8) {
+		uint32_t id = rd();
+		for (size_t j = 0; j < 8; ++j)
+			eventId[i + j] = hex[(id >> (28 - 4 * j)) & 0xf];
+	}
+	return eventId;
+}
+
+// stacktrace interface of sentry, oldest frame first; frames of an async stack have "async" in their data
+static void SentryStacktrace(JsonWriter& report, const std::vector<CrashFrame>& frames, const CrashOptions& options) {
+	report.key("stacktrace").beginObject().key("frames").beginArray();
+	for (auto i = frames.size(); i-- > 0; ) {
+		const auto& frame = frames[i];
+		// degraded frames are marked, so it is clear the lack of detail is not due to missing debug info
+		bool degraded = !options.rawReport && frame.sourceFile.empty() && frame.detail != CrashFrame::FULL;
+		if (!options.rawReport && frame.sourceFile.empty() && !degraded && frame.functionName.empty())
+			continue;
+		report.beginObject();
+		if (options.rawReport) {
+			// symbolized later by the image in debug_meta that contains instruction_addr
+			report.key("instruction_addr").address(uintptr_t(frame.pc));
+			report.member("package", frame.library);
+			if (!frame.symbolName.empty())
+				report.member("symbol", frame.symbolName);
+		} else if (!frame.sourceFile.empty()) {
+			report.member("function", frame.functionName).member("package", frame.library).member("filename", frame.sourceFile).member("lineno", frame.lineNumber);
+			if (!frame.contextLine.empty() || !frame.preContext.empty()) {
+				report.member("context_line", frame.contextLine);
+				report.key("pre_context").beginArray();
+				for (auto& line : frame.preContext)
+					report.value(line);
+				report.endArray();
+				report.key("post_context").beginArray();
+				for (auto& line : frame.postContext)
+					report.value(line);
+				report.endArray();
 			}
-			report << "}";
+		} else if (degraded) {
+			if (!frame.functionName.empty())
+				report.member("function", frame.functionName);
+			report.member("package", frame.library);
+			report.key("instruction_addr").address(uintptr_t(frame.pc));
+		} else {
+			report.member("function", frame.functionName);
 		}
-		report << "}";
-		report << ",\"tags\": {\"path\": " << std::quoted(options.path) << ", \"commandline\": " << std::quoted(options.command) << "}";
-		report << ",\"timestamp\": " << t;
-		report << ",\"platform\": \"c\"";
-		report << ",\"logger\": \"indigo_crash\"";
-		if (!options.release.empty())
-			report << ",\"release\": " << std::quoted(options.release);
-		if (!options.dist.empty())
-			report << ",\"dist\": " << std::quoted(options.dist);
-		report << ",\"environment\": " << std::quoted(options.environment);
-		report << ",\"level\": \"fatal\"";
-		report << ",\"server_name\": " << std::quoted(version.nodename);
-		report << ",\"exception\": {\"values\":[{";
-		if (signal) {
-			auto [sig, p] = *signal;
-			char ptr[17];
-			auto [pString, ec] = std::to_chars(ptr, ptr + sizeof(ptr), uintptr_t(p), 16);
-			if (ec != std::errc())
-				pString = ptr;
-			if (sig == SIGSEGV || sig == SIGBUS) {
-				report << "\"mechanism\": { \"type\": \"signalhandler\", \"handled\": false, \"data\": { \"relevant_address\": \"0x" << std::string(ptr, size_t(pString - ptr)) << "\"}, \"meta\": { \"signal\": { \"number\": " << sig << "} } }";
-			} else {
-				report << "\"mechanism\": { \"type\": \"signalhandler\", \"handled\": false, \"meta\": { \"signal\": { \"number\": " << sig << "} } }";
-			}
-			report << ",\"type\": " << std::quoted(std::string(strsignal(sig)));
-			report << ",\"value\": " << std::quoted(std::string(strsignal(sig)) + " (" + std::to_string(sig) + ") on address 0x" + std::string(ptr, size_t(pString - ptr)) + ".");
-		} else if (uncaughtException) {
-			auto [cause, typeDescription] = *uncaughtException;
-			report << "\"mechanism\": { \"type\": \"UncaughtExceptionHandler\", \"handled\": false }";
-			report << ",\"type\": " << std::quoted(typeDescription);
-			report << ",\"value\": " << std::quoted(typeDescription + " exception: " + cause + ".");
-		} else if (assertViolation) {
-			auto [func, file, lineno, condition, explanation] = *assertViolation;
-			report << "\"mechanism\": { \"type\": \"AssertionViolation\", \"handled\": false }";
-			report << ",\"type\": \"assert\"";
-			report << ",\"value\": " << std::quoted(std::string("assertion ") + condition + " in " + func + " [" + file + ":" + std::to_string(lineno) + "] violated, due to " + explanation + ".");
+		if (degraded || frame.async) {
+			report.key("data").beginObject();
+			if (degraded)
+				report.member("degraded", frame.detail == CrashFrame::SYMBOL_ONLY ? "symbol_only" : "module_offset");
+			if (frame.async)
+				report.member("async", true);
+			report.endObject();
 		}
-		if (!context.empty()) {
-			report << ",\"thread_id\":" << std::quoted(context);
+		report.endObject();
+	}
+	report.endArray().endObject(); // end stacktrace
+}
+
+static std::string SentryReport(const CrashReport& crash, const CrashOptions& options) {
+	std::string payload;
+	// most of a report are the breadcrumbs and frames, so grow the buffer once
+	payload.reserve(2048 + crash.breadcrumbs.size() * 128 + crash.frames.size() * 256);
+	JsonWriter report(payload);
+
+	report.beginObject();
+	report.member("event_id", crash.eventId.empty() ? NewEventId() : crash.eventId);
+	report.key("contexts").beginObject();
+	{
+		report.key("os").beginObject();
+		report.member("name", crash.osName);
+		report.member("version", crash.osRelease + " " + crash.machine);
+		report.endObject();
+		report.key("device").beginObject();
+		report.member("name", crash.hostname);
+		if (!crash.model.empty())
+			report.member("model", crash.model);
+		report.member("arch", crash.machine);
+		report.endObject();
+		if (!crash.processMetrics.empty()) {
+			report.key("process_metrics").beginObject();
+			for (auto& [name, value] : crash.processMetrics)
+				report.key(name).raw(value);
+			report.endObject();
 		}
-		if (!frames.empty()) {
-			report << ",\"stacktrace\":{\"frames\":[";
-			const char* sep = "";
-			for (auto i = frames.size(); i-- > 0; ) {
-				auto [functionName, library, sourceFile, lineNumber, columnOffset] = frames[i];
-				if (!sourceFile.empty()) {
-					report << sep << "{\"function\": " << std::quoted(functionName) << ", \"package\": " << std::quoted(library) << ",\"filename\": " << std::quoted(sourceFile) << ", \"lineno\": " << lineNumber << "}";
-					sep = ",";
-				} else if (!functionName.empty()) {
-					report << sep << "{\"function\": " << std::quoted(!functionName.empty() ? functionName : "(unknown)") << "}";
-					sep = ",";
+		// of the threads that did not crash; the crash context of the crashed thread are tags
+		bool otherThreads = false;
+		for (auto& [tid, context] : crash.threadContexts) {
+			if (tid == crash.crashedThread)
+				continue;
+			if (!otherThreads)
+				report.key("thread_contexts").beginObject();
+			otherThreads = true;
+			report.key(std::to_string(tid)).beginObject();
+			for (auto& [key, value] : context)
+				report.member(key, value);
+			report.endObject();
+		}
+		if (otherThreads)
+			report.endObject();
+		if (!crash.flightRecorder.empty()) {
+			report.key("flight_recorder").beginObject();
+			for (auto& [tid, events] : crash.flightRecorder) {
+				report.key(std::to_string(tid)).beginArray();
+				for (auto& event : events) {
+					char timestamp[32];
+					snprintf(timestamp, sizeof(timestamp), "%.6f", double(event.time) / 1e9);
+					report.beginObject().key("timestamp").raw(timestamp);
+					report.member("type", event.exit ? "exit" : "enter").member("function", FlightRecorderFunction(crash, event)).endObject();
 				}
+				report.endArray();
 			}
-			report << "]}"; // end stacktrace object
+			report.endObject();
+		}
+	}
+	report.endObject(); // end contexts
+	report.key("tags").beginObject().member("path", options.path).member("commandline", options.command);
+	if (!crash.fingerprint.empty())
+		report.member("crash_fingerprint", crash.fingerprint);
+	if (crash.nonFatal && !crash.nonFatal->operation.empty())
+		report.member("operation", crash.nonFatal->operation);
+	for (auto& [tid, context] : crash.threadContexts)
+		if (tid == crash.crashedThread)
+			for (auto& [key, value] : context)
+				report.member(key, value);
+	report.endObject();
+	if (crash.suppressedBefore > 0)
+		report.key("extra").beginObject().member(crash.nonFatal ? "suppressed_call_site_events" : "suppressed_similar_crashes", (unsigned long long)crash.suppressedBefore).endObject();
+	report.member("timestamp", (long long)crash.timestamp);
+	report.member("platform", "c");
+	report.member("logger", "indigo_crash");
+	if (!options.release.empty())
+		report.member("release", options.release);
+	if (!options.dist.empty())
+		report.member("dist", options.dist);
+	report.member("environment", options.environment);
+	report.member("level", crash.nonFatal ? crash.nonFatal->level : "fatal");
+	report.member("server_name", crash.hostname);
+	report.key("exception").beginObject().key("values").beginArray().beginObject();
+	if (crash.signal) {
+		auto [sig, p] = *crash.signal;
+		report.key("mechanism").beginObject();
+		report.member("type", "signalhandler").member("handled", false);
+		if (sig == SIGSEGV || sig == SIGBUS)
+			report.key("data").beginObject().key("relevant_address").address(uintptr_t(p)).endObject();
+		report.key("meta").beginObject().key("signal").beginObject().member("number", sig).endObject().endObject();
+		report.endObject(); // end mechanism
+		char ptr[17];
+		auto [pString, ec] = std::to_chars(ptr, ptr + sizeof(ptr), uintptr_t(p), 16);
+		if (ec != std::errc())
+			pString = ptr;
+		report.member("type", strsignal(sig));
+		report.member("value", std::string(strsignal(sig)) + " (" + std::to_string(sig) + ") on address 0x" + std::string(ptr, size_t(pString - ptr)) + ".");
+	} else if (crash.uncaughtException) {
+		auto& [cause, typeDescription] = *crash.uncaughtException;
+		report.key("mechanism").beginObject().member("type", "UncaughtExceptionHandler").member("handled", false).endObject();
+		report.member("type", typeDescription);
+		report.member("value", typeDescription + " exception: " + cause + ".");
+	} else if (crash.assertViolation) {
+		auto& [func, file, lineno, condition, explanation] = *crash.assertViolation;
+		report.key("mechanism").beginObject().member("type", "AssertionViolation").member("handled", false).endObject();
+		report.member("type", "assert");
+		report.member("value", "assertion " + condition + " in " + func + " [" + file + ":" + std::to_string(lineno) + "] violated, due to " + explanation + ".");
+	} else if (crash.nonFatal && crash.nonFatal->kind == NonFatalReport::HANG) {
+		report.key("mechanism").beginObject().member("type", "Watchdog").member("handled", false).endObject();
+		report.member("type", "Hang");
+		report.member("value", crash.nonFatal->message);
+	} else if (crash.nonFatal && crash.nonFatal->kind == NonFatalReport::SLOW_OPERATION) {
+		report.key("mechanism").beginObject().member("type", "CrashDeadline").member("handled", true).endObject();
+		report.member("type", "SlowOperation");
+		report.member("value", crash.nonFatal->message);
+	} else if (crash.nonFatal) {
+		report.key("mechanism").beginObject().member("type", "CrashCaptureNonFatal").member("handled", true).endObject();
+		report.member("type", "NonFatal");
+		report.member("value", crash.nonFatal->message);
+	}
+	if (!crash.context.empty())
+		report.member("thread_id", crash.context);
+	if (!crash.frames.empty())
+		SentryStacktrace(report, crash.frames, options);
+	{
+		report.key("user").beginObject();
+		report.member("id", crash.uid);
+		if (!crash.username.empty())
+			report.member("username", crash.username);
+		report.endObject(); // end user
+	}
+	report.endObject().endArray().endObject(); // end exception
+
+	if (!crash.threads.empty()) {
+		report.key("threads").beginObject().key("values").beginArray();
+		for (auto& thread : crash.threads) {
+			report.beginObject().member("id", thread.tid).member("name", thread.name).member("crashed", false);
+			if (!thread.frames.empty())
+				SentryStacktrace(report, thread.frames, options);
+			report.endObject();
 		}
-		{
-			auto uid = getuid();
-			report << ",\"user\": {";
-			report << "\"id\": " << uid;
-
-      // sometimes this code crashes the crash reporter, due to getpwuid_r() triggering a dl_open that generates a segfault.
-      if (options.reportUsername) {
-        char buffer[256];
-        struct passwd _pw;
-        struct passwd *pw;
-        if (getpwuid_r(uid, &_pw, buffer, sizeof(buffer), &pw) == 0) {
-          report << ",\"username\": \"" << pw->pw_name << "\"";
-        }
-      }
-			report << "}"; // end user
+		report.endArray().endObject(); // end threads
+	}
+
+	if (!crash.modules.empty()) {
+		report.key("debug_meta").beginObject().key("images").beginArray();
+		for (auto& module : crash.modules) {
+			report.beginObject();
+			report.member("type", "elf").member("code_file", module.path);
+			if (!module.buildId.empty())
+				report.member("code_id", module.buildId).member("debug_id", DebugId(module.buildId));
+			report.key("image_addr").address(module.base);
+			if (module.size > 0)
+				report.member("image_size", (unsigned long long)module.size);
+			report.endObject();
 		}
-		report << "}]}"; // end exception
-
-		report << ",\"breadcrumbs\":{\"values\":[";
-		const char* sep = "";
-		for (auto& [level, time, string] : breadcrumbs) {
-			report << sep;
-			report << "{\"message\":" << std::quoted(string);
-			report << ",\"timestamp\":" << time;
-			if (!level.empty())
-				report << ",\"level\":" << std::quoted(level);
-			report << "}";
-			sep = ",";
+		report.endArray().endObject(); // end debug_meta
+	}
+
+	report.key("breadcrumbs").beginObject().key("values").beginArray();
+	for (auto& breadcrumb : crash.breadcrumbs) {
+		report.beginObject();
+		report.member("message", breadcrumb.message);
+		// seconds, with the precision of the breadcrumb
+		char timestamp[32];
+		if (breadcrumb.time % 1000000000LL == 0)
+			snprintf(timestamp, sizeof(timestamp), "%lld", (long long)(breadcrumb.time / 1000000000LL));
+		else
+			snprintf(timestamp, sizeof(timestamp), "%.6f", double(breadcrumb.time) / 1e9);
+		report.key("timestamp").raw(timestamp);
+		if (!breadcrumb.level.empty())
+			report.member("level", breadcrumb.level);
+		if (breadcrumb.tid || !breadcrumb.data.empty()) {
+			report.key("data").beginObject();
+			if (breadcrumb.tid)
+				report.member("thread", breadcrumb.tid);
+			for (auto& [key, value] : breadcrumb.data)
+				report.member(key, value);
+			report.endObject();
 		}
-		report << "]}"; // end breadcrumbs
+		report.endObject();
+	}
+	report.endArray().endObject(); // end breadcrumbs
+
+	report.endObject(); // end main object
+	return payload;
+}
+
+// reads at most maxBytes of the end of a file (the most recent part of a log file)
+static bool ReadAttachment(const std::string& path, size_t maxBytes, std::string& contents) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	size_t size = std::min(size_t(st.st_size), maxBytes);
+	contents.resize(size);
+	ssize_t n = pread(fd, &contents[0], size, off_t(st.st_size) - off_t(size));
+	close(fd);
+	if (n < 0)
+		return false;
+	contents.resize(size_t(n));
+	return true;
+}
 
-		report << "}"; // end main object
+// items are a JSON header line followed by the payload; lengths are given, so payloads can be binary
+static std::string EnvelopeReport(const CrashReport& crash, const CrashOptions& options) {
+	std::string eventId = crash.eventId.empty() ? NewEventId() : crash.eventId;
+	CrashReport withId = crash;
+	withId.eventId = eventId;
+	std::string event = SentryReport(withId, options);
+
+	std::string envelope;
+	envelope.reserve(event.size() + 256);
+	char timebuffer[32];
+	if (!std::strftime(timebuffer, sizeof(timebuffer), "%FT%TZ", std::gmtime(&crash.timestamp)))
+		timebuffer[0] = '\0';
+	JsonWriter(envelope).beginObject().member("event_id", eventId).member("sent_at", timebuffer).endObject();
+	envelope += '\n';
+	JsonWriter(envelope).beginObject().member("type", "event").member("length", event.size()).endObject();
+	envelope += '\n';
+	envelope += event;
+	envelope += '\n';
+	for (auto& path : options.attachments) {
+		std::string contents;
+		if (!ReadAttachment(path, options.attachmentMaxBytes, contents))
+			continue;
+		const char* extension = strrchr(path.c_str(), '.');
+		bool text = extension && (strcmp(extension, ".log") == 0 || strcmp(extension, ".txt") == 0);
+		JsonWriter(envelope).beginObject()
+			.member("type", "attachment")
+			.member("length", contents.size())
+			.member("filename", BaseName(path.c_str()))
+			.member("content_type", text ? "text/plain" : "application/octet-stream")
+			.endObject();
+		envelope += '\n';
+		envelope += contents;
+		envelope += '\n';
+	}
+	return envelope;
+}
+
+// the host the crash occurred on, so the report can also be rendered elsewhere (e.g. by crashy-decode)
+static void CaptureHost(CrashReport& crash, const CrashOptions& options) {
+	struct utsname version;
+	if (uname(&version) == 0) {
+		crash.osName = version.sysname;
+		crash.osRelease = version.release;
+		crash.machine = version.machine;
+		crash.hostname = version.nodename;
+	}
+	crash.model = GetMachineModel();
+	crash.uid = getuid();
+
+  // sometimes this code crashes the crash reporter, due to getpwuid_r() triggering a dl_open that generates a segfault.
+  if (options.reportUsername) {
+    char buffer[256];
+    struct passwd _pw;
+    struct passwd *pw;
+    if (getpwuid_r(crash.uid, &_pw, buffer, sizeof(buffer), &pw) == 0 && pw) {
+      crash.username = pw->pw_name;
+    }
+  }
+}
+
+std::string FormatReport(const CrashReport& crash, const CrashOptions& options, CrashOptions::SendFormat format) {
+	if (format == CrashOptions::PLAIN_TEXT)
+		return PlainTextReport(crash, options);
+	if (format == CrashOptions::JSON_SENTRY)
+		return SentryReport(crash, options);
+	if (format == CrashOptions::ENVELOPE_SENTRY)
+		return EnvelopeReport(crash, options);
+	if (format == CrashOptions::BINARY_REPORT)
+		return EncodeReport(crash, options);
+	return {};
+}
+
+// symbolization, or for raw reports only the demangled symbol names and the build-ids
+static void ResolveFrames(CrashReport& crash, const CrashOptions& options) {
+	if (options.rawReport) {
+		// symbolization is left to crashy-symbolize: only report what the crashed process sent, and the build-ids
+		CollectModules(crash, options);
+		std::vector<std::vector<CrashFrame>*> stacks {&crash.frames, &crash.flightRecorderFunctions};
+		for (auto& thread : crash.threads)
+			stacks.push_back(&thread.frames);
+		for (auto* frames : stacks) {
+			for (auto& frame : *frames) {
+				std::unique_ptr<char, Free> retainer;
+				if (!frame.symbolName.empty())
+					frame.functionName = Demangle(frame.symbolName.c_str(), retainer);
+			}
+		}
+	} else {
+		// frames are resolved after the crashed process sent everything, the output order is the order of arrival
+		// the budget is for all the frames of the report together
+		auto deadline = SymbolizationDeadline(options);
+		SymbolizeFrames(crash.frames, options, deadline);
+		if (!crash.flightRecorderFunctions.empty())
+			SymbolizeFrames(crash.flightRecorderFunctions, options, deadline);
+		if (!crash.threads.empty()) {
+			// the stacks of the other threads together, so each address is symbolized in the same pass
+			std::vector<CrashFrame> frames;
+			for (auto& thread : crash.threads)
+				std::move(thread.frames.begin(), thread.frames.end(), std::back_inserter(frames));
+			SymbolizeFrames(frames, options, deadline);
+			auto next = frames.begin();
+			for (auto& thread : crash.threads) {
+				std::move(next, next + ptrdiff_t(thread.frames.size()), thread.frames.begin());
+				next += ptrdiff_t(thread.frames.size());
+			}
+		}
+		// the budget of source context is for all the stacks together, the crashed thread first
+		std::vector<std::vector<CrashFrame>*> stacks {&crash.frames};
+		for (auto& thread : crash.threads)
+			stacks.push_back(&thread.frames);
+		AddSourceContext(stacks, options);
 	}
+}
+
+static bool HasDestination(const CrashOptions& options) {
+	return options.sender || !options.dsn.empty() || !options.ndjsonFile.empty() || !options.sinks.empty();
+}
+
+// to `sender` or `dsn` (through the spool), the sinks and the NDJSON file; type is the type of the NDJSON line
+static void SendReport(const CrashReport& crash, const CrashOptions& options, const char* type) {
+	// each format is rendered (and compressed) once, for `sender` and all sinks
+	std::map<CrashOptions::SendFormat, std::string> rendered, payloads;
+	auto render = [&](CrashOptions::SendFormat format) -> const std::string& {
+		auto it = rendered.find(format);
+		if (it == rendered.end())
+			it = rendered.emplace(format, FormatReport(crash, options, format)).first;
+		return it->second;
+	};
+	auto payload = [&](CrashOptions::SendFormat format) -> const std::string& {
+		auto it = payloads.find(format);
+		if (it != payloads.end())
+			return it->second;
+		std::string report = render(format);
+		if (options.compression != CrashOptions::NO_COMPRESSION && !report.empty()) {
+			std::string compressed;
+			if (CompressPayload(options.compression, report, compressed))
+				report = std::move(compressed);
+			else
+				fprintf(out, "crash reporter: compression not available, sending uncompressed report\n");
+		}
+		return payloads.emplace(format, std::move(report)).first->second;
+	};
+	for (auto& sink : options.sinks)
+		payload(sink.format);
+	SinkFanOut sinks(options, payloads);
+
+	if (!options.ndjsonFile.empty())
+		AppendNdjson(options, type, render(CrashOptions::JSON_SENTRY));
+	const std::string& report = payload(options.sendFormat);
 
 	// after sending crash report, close
-	if (options.sender) {
-		if (!options.sender(options.sendFormat, report.str()))
+	bool canSend = options.sender || !options.dsn.empty();
+	if (canSend && !options.persistentCrashReportsDirectory.empty() && SpoolReports(options, {{options.sendFormat, report}})) {
+		// sends this report, and the ones that failed before
+		DrainSpool(options, true);
+	} else if (options.sender) {
+		if (!options.sender(options.sendFormat, report))
 			std::cerr << "Failed to send crash report." << std::endl;
-	} else {
-		std::cerr << report.str() << std::endl;
+	} else if (!options.dsn.empty()) {
+		if (!UploadReports(options, {{options.sendFormat, report}})[0])
+			std::cerr << "Failed to send crash report." << std::endl;
+	} else if (!HasDestination(options)) {
+		std::cerr << report << std::endl;
 	}
+	sinks.wait();
+}
+
+void ReadCrash(int in, const CrashOptions& options) {
+	bool good = true;
+	
+	uint32_t startTag = ReadBinary(in, uint32_t(), good);
+	if (startTag != CrashTag::START)
+		return;
+
+	CrashReport crash;
+	crash.timestamp = std::time(nullptr);
+	crash.eventId = NewEventId();
+	CaptureHost(crash, options);
+	char timebuffer[100];
+	if (!std::strftime(timebuffer, sizeof(timebuffer), " [%F %T %z]", std::localtime(&crash.timestamp))) {
+		timebuffer[0] = '\0';
+	}
+	fprintf(out, loggerTerminal ? TERMINAL_COLOR_RED "\n\n" BAR TERMINAL_RESET " CRASH " TERMINAL_COLOR_RED BAR TERMINAL_DIM "%s" TERMINAL_RESET "\n" : "\n\n" BAR " CRASH " BAR "%s\n", timebuffer);
+
+	good = ReadCrashReport(in, crash);
+	// the reporter is forked by the crashed process, which waits for it: its state is still there to be read
+	if (good) {
+		CaptureProcessMetrics(crash, getppid(), options);
+		for (auto& breadcrumb : ReadBreadcrumbRings(options.maxRingBreadcrumbs))
+			crash.breadcrumbs.push_back(std::move(breadcrumb));
+		crash.threadContexts = ReadThreadContexts();
+		ReadFlightRecorder(crash, options);
+		// the crashed thread first
+		std::stable_partition(crash.flightRecorder.begin(), crash.flightRecorder.end(), [&](const auto& thread) {
+			return thread.first == crash.crashedThread;
+		});
+	}
+	// duplicates are dropped before the expensive part: symbolization and sending
+	crash.fingerprint = CrashFingerprint(crash, options);
+	if (good && !AllowReport(options, crash.fingerprint, crash.timestamp, crash.suppressedBefore)) {
+		fprintf(out, "Crash with fingerprint %s not reported: more than %u reports in %llds.\n",
+				crash.fingerprint.c_str(), options.maxReportsPerFingerprint, (long long)options.fingerprintWindow.count());
+		return;
+	}
+	if (good && options.readPerfMap)
+		ResolvePerfMapFrames(crash.frames, getppid());
+	ResolveFrames(crash, options);
+	PrintCrashReport(crash, options);
+
+	if (!good)
+		return;
+	SendReport(crash, options, "crash");
+}
+
+// "50 ms", "0.25 ms"
+static std::string Milliseconds(uint64_t ns) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), ns % 1000000 == 0 ? "%.0f ms" : "%.3g ms", double(ns) / 1e6);
+	return buffer;
+}
+
+// non-fatal events (and slow operations) queued by the monitored process, until the queue is empty
+static void ReportNonFatalEvents(const CrashOptions& options) {
+	static uint64_t dropped = 0;
+	if (uint64_t now = DroppedNonFatal(); now != dropped) {
+		fprintf(out, "crash reporter: %llu non-fatal events dropped, the queue was full\n", (unsigned long long)(now - dropped));
+		dropped = now;
+	}
+	NonFatalEvent event;
+	while (TakeNonFatal(event)) {
+		CrashReport crash;
+		crash.timestamp = time_t(event.time / 1000000000LL);
+		bool slow = event.kind == NonFatalReport::SLOW_OPERATION;
+		// before resolving anything: events of a call site in a loop are common; slow operations are limited per name
+		uintptr_t callSite = slow ? uintptr_t(std::hash<std::string>()(event.message)) : event.callSite;
+		if (!AllowNonFatal(options, callSite, crash.timestamp, crash.suppressedBefore))
+			continue;
+		crash.eventId = NewEventId();
+		CaptureHost(crash, options);
+		if (slow) {
+			crash.nonFatal = NonFatalReport {NonFatalReport::SLOW_OPERATION, LevelName(event.level), event.message +
+					" did not end within " + Milliseconds(event.budget) + " (stack captured after " + Milliseconds(event.elapsed) + ")", event.message};
+		} else {
+			crash.nonFatal = NonFatalReport {NonFatalReport::NON_FATAL, LevelName(event.level), event.message, ""};
+		}
+		crash.crashedThread = event.tid;
+		crash.frames = AddressFrames(event.pcs, getppid());
+		// the breadcrumbs up to the event; the crash context of the thread is not reported, as it could have changed
+		for (auto& breadcrumb : ReadBreadcrumbRings(options.maxRingBreadcrumbs))
+			if (breadcrumb.time <= event.time)
+				crash.breadcrumbs.push_back(std::move(breadcrumb));
+		crash.fingerprint = CrashFingerprint(crash, options);
+		if (options.readPerfMap)
+			ResolvePerfMapFrames(crash.frames, getppid());
+		ResolveFrames(crash, options);
+		if (HasDestination(options))
+			SendReport(crash, options, slow ? "slow" : "nonfatal");
+		else
+			PrintCrashReport(crash, options);
+	}
+}
+
+// CrashOptions::watchdogRestartCommand, in its own session: it outlives the reporter
+static void RunDetached(const std::string& command) {
+	pid_t child = fork();
+	if (child == 0) {
+		setsid();
+		// the reporter closed stdin and stdout
+		int null = open("/dev/null", O_RDWR);
+		if (null >= 0) {
+			dup2(null, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+		}
+		execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+		::_exit(127);
+	}
+	if (child < 0)
+		perror("crash reporter: restart");
+}
+
+// watched threads without heartbeat: each stall is reported with the stacks of all threads
+static void ReportHangs(const CrashOptions& options) {
+	HungThread hang;
+	while (FindHang(hang)) {
+		pid_t pid = getppid();
+		CrashReport crash;
+		crash.timestamp = std::time(nullptr);
+		crash.eventId = NewEventId();
+		CaptureHost(crash, options);
+		std::string message = "thread " + std::to_string(hang.tid) + " (" + hang.name + ") sent no heartbeat for " +
+				std::to_string(hang.stalled / 1000000) + " ms (threshold " + std::to_string(hang.threshold / 1000000) + " ms)";
+		crash.nonFatal = NonFatalReport {NonFatalReport::HANG, options.watchdogKill ? "fatal" : "error", message, ""};
+		crash.crashedThread = hang.tid;
+		for (auto& thread : DumpThreadStacks(pid)) {
+			if (thread.tid == hang.tid)
+				crash.frames = std::move(thread.frames);
+			else
+				crash.threads.push_back(std::move(thread));
+		}
+		CaptureProcessMetrics(crash, pid, options);
+		for (auto& breadcrumb : ReadBreadcrumbRings(options.maxRingBreadcrumbs))
+			crash.breadcrumbs.push_back(std::move(breadcrumb));
+		crash.threadContexts = ReadThreadContexts();
+		ReadFlightRecorder(crash, options);
+		std::stable_partition(crash.flightRecorder.begin(), crash.flightRecorder.end(), [&](const auto& thread) {
+			return thread.first == crash.crashedThread;
+		});
+		crash.fingerprint = CrashFingerprint(crash, options);
+		if (AllowReport(options, crash.fingerprint, crash.timestamp, crash.suppressedBefore)) {
+			if (options.readPerfMap) {
+				ResolvePerfMapFrames(crash.frames, pid);
+				for (auto& thread : crash.threads)
+					ResolvePerfMapFrames(thread.frames, pid);
+			}
+			ResolveFrames(crash, options);
+			char timebuffer[100];
+			if (!std::strftime(timebuffer, sizeof(timebuffer), " [%F %T %z]", std::localtime(&crash.timestamp)))
+				timebuffer[0] = '\0';
+			fprintf(out, loggerTerminal ? TERMINAL_COLOR_RED "\n\n" BAR TERMINAL_RESET " HANG " TERMINAL_COLOR_RED BAR TERMINAL_DIM "%s" TERMINAL_RESET "\n" : "\n\n" BAR " HANG " BAR "%s\n", timebuffer);
+			PrintCrashReport(crash, options);
+			if (HasDestination(options))
+				SendReport(crash, options, "hang");
+		} else {
+			fprintf(out, "Hang with fingerprint %s not reported: more than %u reports in %llds.\n",
+					crash.fingerprint.c_str(), options.maxReportsPerFingerprint, (long long)options.fingerprintWindow.count());
+		}
+		if (options.watchdogKill) {
+			// the closed crash pipe ends the reporter afterwards
+			kill(pid, SIGKILL);
+			if (!options.watchdogRestartCommand.empty())
+				RunDetached(options.watchdogRestartCommand);
+			return;
+		}
+	}
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// a socket, not a pipe: notifying a reporter that is gone must not raise SIGPIPE
+static int notifySockets[2] = {-1, -1}; // reporter side, process side
+
+void NotifyReporter() {
+	char wake = 0;
+	if (notifySockets[1] >= 0)
+		(void)!send(notifySockets[1], &wake, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// waits for a crash (or the exit of the monitored process); in the meantime reports the non-fatal events and hangs,
+// and collects the samples of the profiler
+static void RunReporter(int in, const CrashOptions& options) {
+	int notify = notifySockets[0];
+	for (;;) {
+		// an event queued after this is either taken below, or sends a notification
+		AwaitNonFatal();
+		ReportNonFatalEvents(options);
+		ReportHangs(options);
+		CollectProfileSamples();
+		WriteRequestedProfile(options);
+		struct pollfd fds[2] = {{in, POLLIN, 0}, {notify, POLLIN, 0}};
+		// the timeout is a safety net for a missed notification, the interval of taking profile samples, and of checking
+		// the heartbeats of watched threads
+		int timeout = WatchingThreads() ? int(std::clamp<long long>(options.watchdogInterval.count(), 1, 1000)) : 1000;
+		if (poll(fds, 2, timeout) < 0 && errno != EINTR)
+			break;
+		if (fds[1].revents & POLLIN) {
+			char buffer[64];
+			while (read(notify, buffer, sizeof(buffer)) > 0) {
+			}
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+			break;
+	}
+	// the crash first, as the crashed process waits for it; afterwards the events queued before it
+	ReadCrash(in, options);
+	ReportNonFatalEvents(options);
 }
 
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 
 std::tuple<int,pid_t,CrashOptions> StartReporter(CrashOptions&& options) {
 	int pipefd[2];
 	if (pipe(pipefd))
 		return {-1, 0, std::move(options)};
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, notifySockets) == 0) {
+		for (int fd : notifySockets) {
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		}
+	} else {
+		perror("crash reporter: socketpair");
+	}
 	pid_t reporterPid = fork();
 	if (reporterPid == 0) {
+		StopFlightRecorder();
+		StopNonFatalQueue();
+		if (notifySockets[1] >= 0)
+			close(notifySockets[1]);
+		notifySockets[1] = -1;
 		close(STDIN_FILENO);
 		close(STDOUT_FILENO);
 		close(pipefd[1]);
+		// lower the priority of the reporter, so a crash does not take the capacity of a loaded host
+		if (options.reporterNice > 0 && nice(options.reporterNice) == -1)
+			perror("crash reporter: nice");
+#if defined(__linux__) && defined(SYS_ioprio_set)
+		if (options.reporterIdleIO) {
+			const int IOPRIO_WHO_PROCESS = 1;
+			const int IOPRIO_CLASS_IDLE = 3;
+			const int IOPRIO_CLASS_SHIFT = 13;
+			if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1)
+				perror("crash reporter: ioprio_set");
+		}
+#endif
 		if (options.prepare)
 			options.prepare(options.sendFormat);
-		ReadCrash(pipefd[0], std::move(options));
+		// reports of earlier crashes that could not be sent at the time
+		if (!options.persistentCrashReportsDirectory.empty())
+			std::thread([options] { DrainSpool(options, false); }).detach();
+		RunReporter(pipefd[0], options);
 		::_exit(0);
 	}
 	close(pipefd[0]);
+	if (notifySockets[0] >= 0)
+		close(notifySockets[0]);
+	notifySockets[0] = -1;
 	return {pipefd[1], reporterPid, std::move(options)};
 }
@@ -1,8 +1,140 @@
+#pragma once
+
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
 #include "crashy.h"
 
 // returns a file descriptor to write in binary form a crash report
 // and returns a process id of the crash reporter that will finish if it has sent out the crash report
 std::tuple<int,pid_t,CrashOptions> StartReporter(CrashOptions&& options);
+
+// wakes the crash reporter when it waits for non-fatal events or requests of the monitored process
+// (async-signal-safe; does nothing before StartReporter())
+void NotifyReporter();
+
+// a frame of the stack trace, as sent by the crashed process (CrashTag::LIBRARY or CrashTag::PC), and after symbolization
+struct CrashFrame {
+	std::string symbolName; // from dladdr, can be empty
+	std::string module; // empty for CrashTag::PC frames
+	uint32_t offsetInFile = 0;
+	void* pc = nullptr;
+
+	std::string functionName;
+	std::string library;
+	std::string sourceFile;
+	uint32_t lineNumber = 0;
+	uint32_t column = 0;
+	// less detail if the symbolization budget was exceeded
+	enum Detail : uint8_t {FULL=0, SYMBOL_ONLY=1, MODULE_OFFSET=2};
+	Detail detail = FULL;
+	// source code around lineNumber (CrashOptions::sourceContextLines)
+	std::vector<std::string> preContext;
+	std::string contextLine;
+	std::vector<std::string> postContext;
+	// a suspended coroutine awaiting the crashed one (CrashTag::ASYNC_STACK), after the physical frames
+	bool async = false;
+	// in a range registered with CrashRegisterCodeRange (or in the perf map): resolved without debug info,
+	// offsetInFile is the offset in the range
+	bool codeRange = false;
+};
+
+// an executable or shared library of the stack trace (CrashOptions::rawReport), so the frames can be symbolized offline
+struct CrashModule {
+	std::string path;
+	std::string buildId; // hex, empty if unknown
+	uintptr_t base = 0; // load address; 0 for frames without module (fixed address executables)
+	uint64_t size = 0;
+};
+
+// a breadcrumb of a report: from CrashOptions::getBreadcrumbs (with second precision) or from the breadcrumb rings
+struct ReportBreadcrumb {
+	std::string level;
+	int64_t time = 0; // ns since the epoch
+	std::string message;
+	uint32_t tid = 0; // thread, 0 if unknown
+	std::vector<std::pair<std::string, std::string>> data; // named arguments of CRASHY_BREADCRUMB
+};
+
+// a function entry or exit recorded by the flight recorder (CrashOptions::flightRecorderRings)
+struct FlightRecorderEvent {
+	int64_t time = 0; // ns since the epoch
+	uint32_t function = 0; // index in CrashReport::flightRecorderFunctions
+	bool exit = false;
+};
+
+// a report of a process that did not crash
+struct NonFatalReport {
+	enum Kind : uint8_t {NON_FATAL=0, HANG=1, SLOW_OPERATION=2};
+	// CrashCaptureNonFatal, a watched thread without heartbeat (CrashWatchThread), or a scope past its deadline
+	// (CrashDeadline)
+	Kind kind = NON_FATAL;
+	std::string level; // as breadcrumbs: "warning", "error", ...
+	std::string message;
+	std::string operation; // name of the CrashDeadline of a slow operation
+};
+
+// stack of another thread than the reported one (a hang report has the stacks of all threads)
+struct ReportThread {
+	uint32_t tid = 0;
+	std::string name;
+	std::vector<CrashFrame> frames; // empty if the stack could not be captured
+};
+
+struct CrashReport {
+	std::optional<std::pair<int,void*>> signal;
+	std::optional<std::pair<std::string,std::string>> uncaughtException;
+	std::optional<std::tuple<std::string,std::string,uint32_t,std::string,std::string>> assertViolation; // func, file, line, condition, explanation
+	std::optional<NonFatalReport> nonFatal;
+	std::string context;
+	std::vector<CrashFrame> frames;
+	std::vector<ReportBreadcrumb> breadcrumbs;
+	std::vector<CrashModule> modules; // only filled for raw reports
+	time_t timestamp = 0;
+	std::string eventId; // 32 hex digits
+	std::string fingerprint; // see CrashFingerprint()
+	uint64_t suppressedBefore = 0; // similar crashes (or non-fatal events of the call site) not reported due to the rate limit, since the previous report
+	// host the crash occurred on
+	std::string hostname;
+	std::string osName;
+	std::string osRelease;
+	std::string machine;
+	std::string model;
+	uint32_t uid = 0;
+	std::string username; // only with CrashOptions::reportUsername
+	uint32_t crashedThread = 0; // 0 if unknown; for a non-fatal event the thread reporting it
+	// key/value crash context of each thread (CrashSetContext), by thread id
+	std::vector<std::pair<uint32_t, std::vector<std::pair<std::string, std::string>>>> threadContexts;
+	// resource state of the crashed process, see CaptureProcessMetrics()
+	std::vector<std::pair<std::string, std::string>> processMetrics; // name, value as JSON
+	// last events of the flight recorder by thread id, oldest first; the functions are resolved as frames
+	std::vector<std::pair<uint32_t, std::vector<FlightRecorderEvent>>> flightRecorder;
+	std::vector<CrashFrame> flightRecorderFunctions;
+	std::vector<ReportThread> threads;
+};
+
+// resolves function names and source locations of all frames; frames of different modules are resolved in parallel
+// frames that are not resolved within the budget of CrashOptions are degraded (see CrashFrame::Detail)
+void SymbolizeFrames(std::vector<CrashFrame>& frames, const CrashOptions& options);
+// the same, with the time budget ending at deadline, so it can be shared by several calls for one report
+void SymbolizeFrames(std::vector<CrashFrame>& frames, const CrashOptions& options, std::chrono::steady_clock::time_point deadline);
+// the end of the time budget (CrashOptions::symbolizationTimeout) starting now, time_point::max() if unlimited
+std::chrono::steady_clock::time_point SymbolizationDeadline(const CrashOptions& options);
+
+// renders a (symbolized) report in the given format, empty for SendFormat::NONE
+std::string FormatReport(const CrashReport& crash, const CrashOptions& options, CrashOptions::SendFormat format);
+
+// full path of the module of a frame (the crashed process sends the names as returned by dladdr)
+std::string ModulePath(const CrashFrame& frame, const CrashOptions& options);
+
+// fills CrashReport::modules and sets CrashFrame::library to the full path of the module, without symbolizing
+void CollectModules(CrashReport& crash, const CrashOptions& options);
+
+// Sentry debug_id of an ELF build-id: the first 16 bytes as a little endian GUID
+std::string DebugId(const std::string& buildId);
@@ -0,0 +1,83 @@
+#include "sinks.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "http.h"
+
+#define out stderr
+
+struct SinkFanOut::State {
+	std::string name;
+	std::chrono::steady_clock::time_point deadline;
+	bool hasDeadline;
+	std::mutex mutex;
+	std::condition_variable finished;
+	bool done = false;
+	bool sent = false;
+};
+
+// one attempt, and retries with exponential backoff as long as the deadline allows
+static bool Send(const CrashOptions& options, const CrashOptions::Sink& sink, const std::string& payload, const SinkFanOut::State& state) {
+	if (!sink.dsn.empty()) {
+		// the built-in sender has its own retries and timeouts
+		CrashOptions upload = options;
+		upload.dsn = sink.dsn;
+		upload.uploadRetries = sink.retries;
+		if (sink.timeout.count() > 0)
+			upload.uploadTimeout = std::min(upload.uploadTimeout, sink.timeout);
+		return UploadReports(upload, {{sink.format, payload}})[0];
+	}
+	auto backoff = std::chrono::milliseconds(100);
+	for (unsigned attempt = 0; ; ++attempt) {
+		if (sink.sender(sink.format, payload))
+			return true;
+		if (attempt >= sink.retries || (state.hasDeadline && std::chrono::steady_clock::now() + backoff >= state.deadline))
+			return false;
+		std::this_thread::sleep_for(backoff);
+		backoff *= 2;
+	}
+}
+
+SinkFanOut::SinkFanOut(const CrashOptions& options, const std::map<CrashOptions::SendFormat, std::string>& payloads) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < options.sinks.size(); ++i) {
+		auto& sink = options.sinks[i];
+		auto payload = payloads.find(sink.format);
+		if ((!sink.sender && sink.dsn.empty()) || payload == payloads.end())
+			continue;
+		auto state = std::make_shared<State>();
+		state->name = sink.name.empty() ? "sink " + std::to_string(i) : sink.name;
+		state->hasDeadline = sink.timeout.count() > 0;
+		state->deadline = start + sink.timeout;
+		states.push_back(state);
+		// the thread has its own copies, it can outlive the fan-out if it times out
+		std::thread([options, sink, data = payload->second, state] {
+			bool sent = Send(options, sink, data, *state);
+			std::lock_guard<std::mutex> l(state->mutex);
+			state->sent = sent;
+			state->done = true;
+			state->finished.notify_all();
+		}).detach();
+	}
+}
+
+void SinkFanOut::wait() {
+	for (auto& state : states) {
+		std::unique_lock<std::mutex> l(state->mutex);
+		if (state->hasDeadline)
+			state->finished.wait_until(l, state->deadline, [&] { return state->done; });
+		else
+			state->finished.wait(l, [&] { return state->done; });
+		if (!state->done)
+			fprintf(out, "crash reporter: %s timed out, report not sent\n", state->name.c_str());
+		else if (!state->sent)
+			fprintf(out, "crash reporter: %s failed to send the report\n", state->name.c_str());
+	}
+	states.clear();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "crashy.h"
+
+// delivery of a report to all CrashOptions::sinks at the same time: a thread per sink, each with its own retries,
+// so a slow sink does not delay the others; a sink that did not finish within its timeout is abandoned
+// (the crash reporter exits without waiting for it)
+class SinkFanOut {
+ public:
+	// payloads: the report rendered (and compressed) once per distinct format of the sinks
+	SinkFanOut(const CrashOptions& options, const std::map<CrashOptions::SendFormat, std::string>& payloads);
+	// waits for the sinks, each at most until its timeout, and reports the sinks that failed or timed out
+	void wait();
+
+	struct State;
+ private:
+	std::vector<std::shared_ptr<State>> states;
+};
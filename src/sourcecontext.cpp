@@ -0,0 +1,118 @@
+#include "sourcecontext.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// long lines (e.g. minified or generated code) are cut off
+#define MAX_CONTEXT_LINE 256
+
+struct SourceFile {
+	const char* data = nullptr;
+	size_t size = 0;
+	// start offset of each line, computed on first use
+	std::vector<size_t> lines;
+
+	explicit SourceFile(const std::string& path) {
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void* mapping = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				data = static_cast<const char*>(mapping);
+				size = size_t(st.st_size);
+			}
+		}
+		close(fd);
+	}
+	~SourceFile() {
+		if (data)
+			munmap(const_cast<char*>(data), size);
+	}
+	SourceFile(const SourceFile&) = delete;
+	SourceFile& operator=(const SourceFile&) = delete;
+
+	// line numbers start at 1
+	std::string line(uint32_t number) {
+		if (lines.empty()) {
+			lines.push_back(0);
+			// no empty line after the newline that ends the file
+			for (const char* p = data; (p = static_cast<const char*>(memchr(p, '\n', size_t(data + size - p)))) && ++p < data + size; )
+				lines.push_back(size_t(p - data));
+		}
+		if (number == 0 || number > lines.size())
+			return {};
+		size_t begin = lines[number - 1];
+		size_t end = number < lines.size() ? lines[number] - 1 : size;
+		std::string retval(data + begin, std::min(end - begin, size_t(MAX_CONTEXT_LINE)));
+		// tabs and other control characters are not wanted in the report
+		for (auto& c : retval) {
+			if (static_cast<unsigned char>(c) < 0x20)
+				c = ' ';
+		}
+		while (!retval.empty() && retval.back() == ' ')
+			retval.pop_back();
+		return retval;
+	}
+};
+
+static SourceFile* FindSourceFile(std::map<std::string, std::unique_ptr<SourceFile>>& cache, const std::string& sourceFile, const CrashOptions& options) {
+	auto it = cache.find(sourceFile);
+	if (it != cache.end())
+		return it->second->data ? it->second.get() : nullptr;
+	std::unique_ptr<SourceFile> file;
+	if (sourceFile[0] == '/')
+		file = std::make_unique<SourceFile>(sourceFile);
+	for (auto root = options.sourceRoots.begin(); (!file || !file->data) && root != options.sourceRoots.end(); ++root)
+		file = std::make_unique<SourceFile>(*root + "/" + sourceFile);
+	if (!file)
+		file = std::make_unique<SourceFile>(std::string());
+	auto retval = file->data ? file.get() : nullptr;
+	cache[sourceFile] = std::move(file);
+	return retval;
+}
+
+void AddSourceContext(const std::vector<std::vector<CrashFrame>*>& stacks, const CrashOptions& options) {
+	if (options.sourceContextLines == 0)
+		return;
+	std::map<std::string, std::unique_ptr<SourceFile>> cache;
+	size_t budget = options.sourceContextMaxBytes;
+	for (auto* frames : stacks) {
+		for (auto& frame : *frames) {
+			if (frame.sourceFile.empty() || frame.lineNumber == 0)
+				continue;
+			SourceFile* file = FindSourceFile(cache, frame.sourceFile, options);
+			if (!file)
+				continue;
+			std::string contextLine = file->line(frame.lineNumber);
+			std::vector<std::string> preContext;
+			std::vector<std::string> postContext;
+			size_t bytes = contextLine.size();
+			uint32_t first = frame.lineNumber > options.sourceContextLines ? frame.lineNumber - options.sourceContextLines : 1;
+			for (uint32_t i = first; i < frame.lineNumber; ++i) {
+				preContext.push_back(file->line(i));
+				bytes += preContext.back().size();
+			}
+			for (uint32_t i = frame.lineNumber + 1; i <= frame.lineNumber + options.sourceContextLines && i < file->lines.size() + 1; ++i) {
+				postContext.push_back(file->line(i));
+				bytes += postContext.back().size();
+			}
+			// stacks and their frames are in order of relevance (innermost first), so the most relevant frames get context
+			if (bytes > budget)
+				return;
+			budget -= bytes;
+			frame.contextLine = std::move(contextLine);
+			frame.preContext = std::move(preContext);
+			frame.postContext = std::move(postContext);
+		}
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <vector>
+
+#include "reporter.h"
+
+// adds the source code lines around each resolved frame of the stacks (CrashOptions::sourceContextLines), by looking
+// up the source files in CrashOptions::sourceRoots; each file is mapped once per report, and the stacks share
+// CrashOptions::sourceContextMaxBytes in their order (the crashed thread first)
+void AddSourceContext(const std::vector<std::vector<CrashFrame>*>& stacks, const CrashOptions& options);
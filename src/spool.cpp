@@ -0,0 +1,237 @@
+#include "spool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "http.h"
+
+#define out stderr
+
+static const char* Extension(CrashOptions::SendFormat format) {
+	switch (format) {
+		case CrashOptions::PLAIN_TEXT: return ".txt";
+		case CrashOptions::JSON_SENTRY: return ".json";
+		case CrashOptions::ENVELOPE_SENTRY: return ".envelope";
+		case CrashOptions::BINARY_REPORT: return ".bin";
+		default: return ".report";
+	}
+}
+
+static CrashOptions::SendFormat FormatOf(const std::string& name) {
+	for (auto format : {CrashOptions::PLAIN_TEXT, CrashOptions::JSON_SENTRY, CrashOptions::ENVELOPE_SENTRY, CrashOptions::BINARY_REPORT}) {
+		const char* extension = Extension(format);
+		size_t length = strlen(extension);
+		if (name.size() > length && name.compare(name.size() - length, length, extension) == 0)
+			return format;
+	}
+	return CrashOptions::NONE;
+}
+
+static bool WriteAll(int fd, const std::string& data) {
+	for (size_t done = 0; done < data.size(); ) {
+		ssize_t n = write(fd, data.data() + done, data.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += size_t(n);
+	}
+	return true;
+}
+
+static bool ReadAll(const std::string& path, std::string& data) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	char buffer[64 * 1024];
+	ssize_t n;
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+		if (n > 0)
+			data.append(buffer, size_t(n));
+	close(fd);
+	return n == 0;
+}
+
+struct SpooledReport {
+	std::string name;
+	off_t size;
+};
+
+// stored reports, oldest first (names start with the time they were stored)
+static std::vector<SpooledReport> ListSpool(const std::string& directory) {
+	std::vector<SpooledReport> retval;
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return retval;
+	while (struct dirent* entry = readdir(dir)) {
+		// temporary files start with a dot
+		if (entry->d_name[0] == '.' || FormatOf(entry->d_name) == CrashOptions::NONE)
+			continue;
+		struct stat st;
+		if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode))
+			retval.push_back({entry->d_name, st.st_size});
+	}
+	closedir(dir);
+	std::sort(retval.begin(), retval.end(), [](const SpooledReport& a, const SpooledReport& b) {
+		return a.name < b.name;
+	});
+	return retval;
+}
+
+bool SpoolReports(const CrashOptions& options, const std::vector<std::pair<CrashOptions::SendFormat, std::string>>& reports) {
+	const std::string& directory = options.persistentCrashReportsDirectory;
+	mkdir(directory.c_str(), 0700);
+	int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directoryFd < 0) {
+		perror(("crash reporter: spool " + directory).c_str());
+		return false;
+	}
+	static std::atomic<unsigned> sequence {0};
+	bool retval = true;
+	std::vector<std::pair<std::string, std::string>> written; // temporary name, final name
+	std::vector<int> files;
+	for (auto& [format, payload] : reports) {
+		auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		char name[96];
+		snprintf(name, sizeof(name), "%020lld-%d-%u%s", (long long)now, int(getpid()), sequence++, Extension(format));
+		std::string temporary = std::string(".tmp-") + name;
+		int fd = openat(directoryFd, temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (fd < 0 || !WriteAll(fd, payload)) {
+			if (fd >= 0) {
+				close(fd);
+				unlinkat(directoryFd, temporary.c_str(), 0);
+			}
+			perror("crash reporter: spool write");
+			retval = false;
+			continue;
+		}
+		files.push_back(fd);
+		written.emplace_back(temporary, name);
+	}
+	// only the files are flushed (not the whole file system, which can take seconds on a busy host), the data without
+	// the metadata where possible; the renames are flushed with one sync of the directory
+	for (size_t i = 0; i < written.size(); ++i) {
+#if defined(__linux__)
+		if (fdatasync(files[i]) != 0)
+#else
+		if (fsync(files[i]) != 0)
+#endif
+			retval = false;
+		close(files[i]);
+		if (renameat(directoryFd, written[i].first.c_str(), directoryFd, written[i].second.c_str()) != 0) {
+			unlinkat(directoryFd, written[i].first.c_str(), 0);
+			retval = false;
+		}
+	}
+	if (!written.empty())
+		fsync(directoryFd);
+
+	// evict oldest reports first
+	auto spooled = ListSpool(directory);
+	size_t totalBytes = 0;
+	for (auto& report : spooled)
+		totalBytes += size_t(report.size);
+	for (size_t i = 0; i < spooled.size(); ++i) {
+		bool overCount = options.spoolMaxReports > 0 && spooled.size() - i > options.spoolMaxReports;
+		bool overBytes = options.spoolMaxBytes > 0 && totalBytes > options.spoolMaxBytes;
+		if (!overCount && !overBytes)
+			break;
+		if (unlinkat(directoryFd, spooled[i].name.c_str(), 0) == 0)
+			totalBytes -= size_t(spooled[i].size);
+	}
+	close(directoryFd);
+	return retval;
+}
+
+void DrainSpool(const CrashOptions& options, bool wait) {
+	const std::string& directory = options.persistentCrashReportsDirectory;
+	if (directory.empty() || (!options.sender && options.dsn.empty()))
+		return;
+	// lock file, so concurrent reporters (e.g. during a crash storm) do not upload the same reports
+	int lockFd = open((directory + "/.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (lockFd < 0)
+		return;
+	int result;
+	while ((result = flock(lockFd, LOCK_EX | (wait ? 0 : LOCK_NB))) != 0 && errno == EINTR) {
+	}
+	if (result != 0) {
+		close(lockFd);
+		return;
+	}
+
+	// temporary files left behind by a reporter that did not finish writing
+	if (DIR* dir = opendir(directory.c_str())) {
+		time_t now = time(nullptr);
+		while (struct dirent* entry = readdir(dir)) {
+			struct stat st;
+			if (strncmp(entry->d_name, ".tmp-", 5) == 0 && fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && now - st.st_mtime > 3600)
+				unlinkat(dirfd(dir), entry->d_name, 0);
+		}
+		closedir(dir);
+	}
+
+	auto spooled = ListSpool(directory);
+	std::atomic<size_t> next {0};
+	std::mutex mutex;
+	size_t failed = 0;
+	// with the built-in sender, a worker uploads a batch of reports pipelined on one connection
+	const size_t batchSize = options.sender ? 1 : 8;
+	// if nothing of a batch could be sent (e.g. network down), the remaining reports are not tried now
+	std::atomic<bool> stop {false};
+	auto worker = [&] {
+		for (size_t first; !stop && (first = next.fetch_add(batchSize)) < spooled.size(); ) {
+			size_t last = std::min(first + batchSize, spooled.size());
+			std::vector<std::pair<CrashOptions::SendFormat, std::string>> batch;
+			std::vector<std::string> paths;
+			for (size_t i = first; i < last; ++i) {
+				std::string path = directory + "/" + spooled[i].name;
+				std::string payload;
+				if (!ReadAll(path, payload))
+					continue;
+				batch.emplace_back(FormatOf(spooled[i].name), std::move(payload));
+				paths.push_back(std::move(path));
+			}
+			std::vector<bool> sent;
+			if (options.sender) {
+				for (auto& [format, payload] : batch)
+					sent.push_back(options.sender(format, payload));
+			} else {
+				sent = UploadReports(options, batch);
+			}
+			if (std::find(sent.begin(), sent.end(), true) == sent.end())
+				stop = true;
+			for (size_t i = 0; i < sent.size(); ++i) {
+				if (sent[i]) {
+					unlink(paths[i].c_str());
+				} else {
+					std::lock_guard<std::mutex> l(mutex);
+					++failed;
+				}
+			}
+		}
+	};
+	size_t threads = std::min<size_t>(std::max(1U, options.uploadConcurrency), (spooled.size() + batchSize - 1) / batchSize);
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& thread : pool)
+		thread.join();
+	if (failed > 0 || stop)
+		fprintf(out, "crash reporter: not all stored crash reports are sent, will retry later\n");
+
+	flock(lockFd, LOCK_UN);
+	close(lockFd);
+}
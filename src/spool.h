@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crashy.h"
+
+// on-disk spool of reports (CrashOptions::persistentCrashReportsDirectory), so reports survive failed uploads
+
+// stores reports atomically (each written to a temporary file, renamed when flushed to disk; the directory is
+// flushed once after all renames), then evicts the oldest reports above the spoolMaxReports/spoolMaxBytes caps
+// returns false if (some of) the reports could not be stored
+bool SpoolReports(const CrashOptions& options, const std::vector<std::pair<CrashOptions::SendFormat, std::string>>& reports);
+
+// sends stored reports, oldest first, with at most CrashOptions::uploadConcurrency uploads at the same time;
+// reports are removed when sent successfully
+// only one process drains the spool at a time: if wait is false and another process is draining, returns directly
+void DrainSpool(const CrashOptions& options, bool wait);
@@ -0,0 +1,485 @@
+// crashy-symbolize: symbolizes raw crash reports (CrashOptions::rawReport with the JSON_SENTRY format) offline
+// usage: crashy-symbolize [-d directory]... [-j threads] [-o output-directory] report...
+//
+// Modules are found by build-id: in /usr/lib/debug/.build-id, in the directories given with -d (searched
+// recursively), or at the path the module had on the crashed host. All frames of all reports are gathered first,
+// identical frames are resolved once and frames of the same module by the same worker, so each debug file is
+// loaded and indexed once for the whole batch.
+// Symbolized reports are written to the output directory (with the same file name), or to stdout (one per line).
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "elfimage.h"
+#include "json.h"
+#include "reporter.h"
+#include "util.h"
+
+// just enough JSON to read and rewrite a report: numbers are kept as text, order of members is retained
+struct Json {
+	enum Type : uint8_t {NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT};
+	Type type = NUL;
+	std::string value; // text of a boolean, number or string
+	std::vector<std::pair<std::string, Json>> members; // object members, or array items (with an empty key)
+
+	Json* find(const char* key) {
+		for (auto& [name, member] : members)
+			if (name == key)
+				return &member;
+		return nullptr;
+	}
+	Json& operator[](const char* key) {
+		if (Json* member = find(key))
+			return *member;
+		type = OBJECT;
+		members.emplace_back(key, Json());
+		return members.back().second;
+	}
+};
+
+static void SkipSpace(std::string_view& in) {
+	while (!in.empty() && (in[0] == ' ' || in[0] == '\t' || in[0] == '\n' || in[0] == '\r'))
+		in.remove_prefix(1);
+}
+
+static void AppendUTF8(std::string& out, uint32_t c) {
+	if (c < 0x80) {
+		out += char(c);
+	} else if (c < 0x800) {
+		out += char(0xC0 | (c >> 6));
+		out += char(0x80 | (c & 0x3F));
+	} else if (c < 0x10000) {
+		out += char(0xE0 | (c >> 12));
+		out += char(0x80 | ((c >> 6) & 0x3F));
+		out += char(0x80 | (c & 0x3F));
+	} else {
+		out += char(0xF0 | (c >> 18));
+		out += char(0x80 | ((c >> 12) & 0x3F));
+		out += char(0x80 | ((c >> 6) & 0x3F));
+		out += char(0x80 | (c & 0x3F));
+	}
+}
+
+static bool ParseHex4(std::string_view& in, uint32_t& c) {
+	if (in.size() < 4)
+		return false;
+	c = 0;
+	for (size_t i = 0; i < 4; ++i) {
+		char h = in[i];
+		c <<= 4;
+		if (h >= '0' && h <= '9')
+			c |= uint32_t(h - '0');
+		else if (h >= 'a' && h <= 'f')
+			c |= uint32_t(h - 'a' + 10);
+		else if (h >= 'A' && h <= 'F')
+			c |= uint32_t(h - 'A' + 10);
+		else
+			return false;
+	}
+	in.remove_prefix(4);
+	return true;
+}
+
+static bool ParseString(std::string_view& in, std::string& out) {
+	if (in.empty() || in[0] != '"')
+		return false;
+	in.remove_prefix(1);
+	while (!in.empty() && in[0] != '"') {
+		if (in[0] != '\\') {
+			out += in[0];
+			in.remove_prefix(1);
+			continue;
+		}
+		if (in.size() < 2)
+			return false;
+		char escape = in[1];
+		in.remove_prefix(2);
+		switch (escape) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				uint32_t c;
+				if (!ParseHex4(in, c))
+					return false;
+				uint32_t low;
+				if (c >= 0xD800 && c < 0xDC00 && in.size() >= 6 && in[0] == '\\' && in[1] == 'u') {
+					std::string_view next = in.substr(2);
+					if (ParseHex4(next, low) && low >= 0xDC00 && low < 0xE000) {
+						c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+						in = next;
+					}
+				}
+				AppendUTF8(out, c);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	if (in.empty())
+		return false;
+	in.remove_prefix(1);
+	return true;
+}
+
+static bool ParseJson(std::string_view& in, Json& value, int depth = 0) {
+	if (depth > 256)
+		return false;
+	SkipSpace(in);
+	if (in.empty())
+		return false;
+	char c = in[0];
+	if (c == '{' || c == '[') {
+		value.type = c == '{' ? Json::OBJECT : Json::ARRAY;
+		char close = c == '{' ? '}' : ']';
+		in.remove_prefix(1);
+		SkipSpace(in);
+		if (!in.empty() && in[0] == close) {
+			in.remove_prefix(1);
+			return true;
+		}
+		while (true) {
+			std::string key;
+			if (value.type == Json::OBJECT) {
+				SkipSpace(in);
+				if (!ParseString(in, key))
+					return false;
+				SkipSpace(in);
+				if (in.empty() || in[0] != ':')
+					return false;
+				in.remove_prefix(1);
+			}
+			value.members.emplace_back(std::move(key), Json());
+			if (!ParseJson(in, value.members.back().second, depth + 1))
+				return false;
+			SkipSpace(in);
+			if (in.empty())
+				return false;
+			if (in[0] == close) {
+				in.remove_prefix(1);
+				return true;
+			}
+			if (in[0] != ',')
+				return false;
+			in.remove_prefix(1);
+		}
+	}
+	if (c == '"') {
+		value.type = Json::STRING;
+		return ParseString(in, value.value);
+	}
+	for (const char* literal : {"true", "false", "null"}) {
+		if (in.substr(0, strlen(literal)) == literal) {
+			value.type = literal[0] == 'n' ? Json::NUL : Json::BOOLEAN;
+			value.value = literal;
+			in.remove_prefix(strlen(literal));
+			return true;
+		}
+	}
+	size_t length = 0;
+	while (length < in.size() && strchr("+-0123456789.eE", in[length]))
+		++length;
+	if (length == 0)
+		return false;
+	value.type = Json::NUMBER;
+	value.value = in.substr(0, length);
+	in.remove_prefix(length);
+	return true;
+}
+
+static void WriteJson(std::string& out, const Json& value) {
+	switch (value.type) {
+		case Json::NUL:
+			out += "null";
+			break;
+		case Json::BOOLEAN:
+		case Json::NUMBER:
+			out += value.value;
+			break;
+		case Json::STRING:
+			AppendJsonString(out, value.value);
+			break;
+		case Json::ARRAY:
+		case Json::OBJECT: {
+			out += value.type == Json::OBJECT ? '{' : '[';
+			const char* sep = "";
+			for (auto& [key, member] : value.members) {
+				out += sep;
+				if (value.type == Json::OBJECT) {
+					AppendJsonString(out, key);
+					out += ':';
+				}
+				WriteJson(out, member);
+				sep = ",";
+			}
+			out += value.type == Json::OBJECT ? '}' : ']';
+			break;
+		}
+	}
+}
+
+// a file with debug info is preferred over a stripped one with the same build-id
+static bool HasDebugInfo(const ElfImage& image) {
+	return !image.section(".debug_info").empty() || !image.section(".debug_line").empty();
+}
+
+static void AddToIndex(const std::string& path, std::map<std::string, std::pair<std::string, bool>>& index) {
+	ElfImage image(path.c_str());
+	if (!image.valid())
+		return;
+	std::string buildId = image.buildId();
+	if (buildId.empty())
+		return;
+	bool debugInfo = HasDebugInfo(image);
+	auto& entry = index[buildId];
+	if (entry.first.empty() || (debugInfo && !entry.second))
+		entry = {path, debugInfo};
+}
+
+static void IndexDirectory(const std::string& directory, std::map<std::string, std::pair<std::string, bool>>& index) {
+	DIR* dir = opendir(directory.c_str());
+	if (!dir) {
+		perror(directory.c_str());
+		return;
+	}
+	while (struct dirent* entry = readdir(dir)) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		std::string path = directory + "/" + entry->d_name;
+		struct stat st;
+		// symbolic links to directories are not followed, to avoid cycles
+		if (lstat(path.c_str(), &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			IndexDirectory(path, index);
+		else if ((S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))) && st.st_size > 0)
+			AddToIndex(path, index);
+	}
+	closedir(dir);
+}
+
+// returns path of the file with the best debug info for this build-id, or empty if not found
+static std::string FindModule(const std::string& buildId, const std::string& codeFile, std::map<std::string, std::pair<std::string, bool>>& index) {
+	std::vector<std::string> candidates;
+	if (buildId.size() > 2)
+		candidates.push_back("/usr/lib/debug/.build-id/" + buildId.substr(0, 2) + "/" + buildId.substr(2) + ".debug");
+	candidates.push_back(codeFile);
+	for (auto& candidate : candidates)
+		if (access(candidate.c_str(), R_OK) == 0)
+			AddToIndex(candidate, index);
+	auto it = index.find(buildId);
+	return it != index.end() ? it->second.first : std::string();
+}
+
+static bool ReadFile(const char* filename, std::string& contents) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	contents = buffer.str();
+	return true;
+}
+
+static void Usage(const char* name) {
+	fprintf(stderr, "usage: %s [-d directory]... [-j threads] [-o output-directory] report...\n", name);
+	fprintf(stderr, "  -d  directory with executables, shared libraries or debug files, searched recursively by build-id\n");
+	fprintf(stderr, "  -j  number of threads (default: number of cores)\n");
+	fprintf(stderr, "  -o  directory to write the symbolized reports to (default: stdout, one report per line)\n");
+}
+
+int main(int argc, char** argv) {
+	std::vector<std::string> directories;
+	std::string outputDirectory;
+	CrashOptions options;
+	int c;
+	while ((c = getopt(argc, argv, "d:j:o:h")) != -1) {
+		switch (c) {
+			case 'd': directories.push_back(optarg); break;
+			case 'j': options.symbolizationThreads = unsigned(atoi(optarg)); break;
+			case 'o': outputDirectory = optarg; break;
+			default:
+				Usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		Usage(argv[0]);
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	int retval = 0;
+
+	std::vector<std::pair<const char*, Json>> reports;
+	for (int i = optind; i < argc; ++i) {
+		std::string contents;
+		if (!ReadFile(argv[i], contents)) {
+			perror(argv[i]);
+			retval = 1;
+			continue;
+		}
+		std::string_view in = contents;
+		Json report;
+		if (!ParseJson(in, report) || report.type != Json::OBJECT) {
+			fprintf(stderr, "%s: not a JSON crash report\n", argv[i]);
+			retval = 1;
+			continue;
+		}
+		reports.emplace_back(argv[i], std::move(report));
+	}
+
+	std::map<std::string, std::pair<std::string, bool>> index; // build-id -> path, has debug info
+	for (auto& directory : directories)
+		IndexDirectory(directory, index);
+
+	// all frames of all reports, identical frames only once
+	struct Image {
+		bool searched = false;
+		std::string path;
+		uintptr_t base = 0;
+		uint64_t size = 0;
+		bool fixedAddress = false;
+	};
+	std::map<std::string, Image> images; // by build-id
+	std::map<std::tuple<std::string, uint32_t, std::string>, size_t> unique;
+	std::vector<CrashFrame> frames;
+	std::vector<std::pair<Json*, size_t>> references;
+	size_t total = 0;
+	for (auto& [filename, report] : reports) {
+		Json* exceptions = report.find("exception") ? report["exception"].find("values") : nullptr;
+		Json* debugMeta = report.find("debug_meta") ? report["debug_meta"].find("images") : nullptr;
+		if (!exceptions || !debugMeta)
+			continue;
+		std::vector<std::pair<std::string, Image>> reportImages; // code_file -> image
+		for (auto& [key, image] : debugMeta->members) {
+			Json* codeFile = image.find("code_file");
+			Json* codeId = image.find("code_id");
+			Json* imageAddr = image.find("image_addr");
+			if (!codeFile || !codeId || !imageAddr)
+				continue;
+			auto& module = images[codeId->value];
+			if (!module.searched) {
+				module.searched = true;
+				module.path = FindModule(codeId->value, codeFile->value, index);
+				if (module.path.empty())
+					fprintf(stderr, "%s: no file found for %s (build-id %s)\n", filename, codeFile->value.c_str(), codeId->value.c_str());
+				else if (auto elf = OpenElfImage(module.path.c_str()))
+					module.fixedAddress = elf->isFixedAddress();
+			}
+			if (module.path.empty())
+				continue;
+			Image reportImage = module;
+			reportImage.base = uintptr_t(strtoull(imageAddr->value.c_str(), nullptr, 16));
+			if (Json* imageSize = image.find("image_size"))
+				reportImage.size = strtoull(imageSize->value.c_str(), nullptr, 10);
+			reportImages.emplace_back(codeFile->value, std::move(reportImage));
+		}
+		// of the exception, and of the other threads (hang reports)
+		std::vector<Json*> stacktraces;
+		for (auto& [key, exception] : exceptions->members)
+			stacktraces.push_back(exception.find("stacktrace"));
+		if (Json* threads = report.find("threads") ? report["threads"].find("values") : nullptr)
+			for (auto& [key, thread] : threads->members)
+				stacktraces.push_back(thread.find("stacktrace"));
+		for (Json* stacktrace : stacktraces) {
+			Json* stackFrames = stacktrace ? stacktrace->find("frames") : nullptr;
+			if (!stackFrames)
+				continue;
+			for (auto& [key, frame] : stackFrames->members) {
+				Json* instructionAddr = frame.find("instruction_addr");
+				if (!instructionAddr || frame.find("filename"))
+					continue;
+				++total;
+				uintptr_t pc = uintptr_t(strtoull(instructionAddr->value.c_str(), nullptr, 16));
+				Json* package = frame.find("package");
+				const Image* image = nullptr;
+				for (auto& [codeFile, candidate] : reportImages) {
+					if (package ? package->value == codeFile : pc >= candidate.base && pc - candidate.base < candidate.size) {
+						image = &candidate;
+						break;
+					}
+				}
+				if (!image)
+					continue;
+				// debug info of a non-PIE executable uses run-time addresses, otherwise offsets from the load address
+				uint32_t offset = uint32_t(image->fixedAddress ? pc : pc - image->base);
+				Json* symbol = frame.find("symbol");
+				auto frameKey = std::make_tuple(image->path, offset, symbol ? symbol->value : std::string());
+				auto [it, inserted] = unique.emplace(frameKey, frames.size());
+				if (inserted) {
+					CrashFrame crashFrame;
+					crashFrame.module = image->path;
+					crashFrame.offsetInFile = offset;
+					crashFrame.pc = reinterpret_cast<void*>(pc);
+					crashFrame.symbolName = std::get<2>(frameKey);
+					frames.push_back(std::move(crashFrame));
+				}
+				references.emplace_back(&frame, it->second);
+			}
+		}
+	}
+
+	SymbolizeFrames(frames, options);
+
+	for (auto& [frame, i] : references) {
+		auto& resolved = frames[i];
+		if (!resolved.functionName.empty()) {
+			Json& function = (*frame)["function"];
+			function.type = Json::STRING;
+			function.value = resolved.functionName;
+		}
+		if (!resolved.sourceFile.empty()) {
+			Json& filename = (*frame)["filename"];
+			filename.type = Json::STRING;
+			filename.value = resolved.sourceFile;
+			Json& lineno = (*frame)["lineno"];
+			lineno.type = Json::NUMBER;
+			lineno.value = std::to_string(resolved.lineNumber);
+			if (resolved.column > 0) {
+				Json& colno = (*frame)["colno"];
+				colno.type = Json::NUMBER;
+				colno.value = std::to_string(resolved.column);
+			}
+		}
+	}
+
+	for (auto& [filename, report] : reports) {
+		std::string output;
+		WriteJson(output, report);
+		if (outputDirectory.empty()) {
+			output += '\n';
+			fwrite(output.data(), 1, output.size(), stdout);
+			continue;
+		}
+		std::string path = outputDirectory + "/" + BaseName(filename);
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (!out.write(output.data(), std::streamsize(output.size()))) {
+			perror(path.c_str());
+			retval = 1;
+		}
+	}
+	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	fprintf(stderr, "symbolized %zu frames (%zu unique, %zu modules) of %zu reports in %lld ms\n",
+			total, frames.size(), images.size(), reports.size(), (long long)duration.count());
+	return retval;
+}
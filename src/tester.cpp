@@ -38,19 +38,7 @@ int main(int argc, char** argv) {
 	/*
 	CrashOptions options;
 	options.sendFormat = CrashOptions::JSON_SENTRY;
-	options.sender = [](CrashOptions::SendFormat format, const std::string& payload) -> bool{
-			if (format == CrashOptions::JSON_SENTRY) {
-				std::string auth = "auth";
-				std::string url = "url";
-				std::stringstream commandBuilder;
-				commandBuilder << "curl --silent --data " << std::quoted(payload) << " -H \"Content-Type: application/json\" -H " << std::quoted("X-Sentry-Auth: Sentry sentry_version=7, sentry_key=" + auth + ", sentry_client=indigo_crash/0.1") << " " << std::quoted(url);
-				std::string command = commandBuilder.str();
-				std::cerr << command << std::endl;
-				return system(command.c_str()) == 0;
-			}
-			std::cerr << payload << std::endl;
-			return true;
-		};
+	options.dsn = "http://key@localhost:9000/1";
 	/*/
 	CrashOptions options;
   options.setCommandLineOptions(argc, argv);
@@ -8,26 +8,42 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <dwarf.h>
 #include <libdwarf.h>
 
+#include "dwarfline.h"
+#include "elfimage.h"
+#include "tosourcecode.h"
+
 int LookupSource(Dwarf_Debug dbg, Dwarf_Die the_die, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column) {
 	Dwarf_Line* lines = NULL;
+	Dwarf_Line_Context lineContext = NULL;
 	Dwarf_Error err;
 	Dwarf_Signed lineCount = 0;
+	Dwarf_Unsigned lineVersion = 0;
+	Dwarf_Small tableCount = 0;
 
 	// selection based on attributes low_pc and high_pc does not work correctly on FreeBSD 12.1 / GCC 9.4
   //fprintf(stderr, "LookupSource(%lx)\n", target);
-	
-	int retval = dwarf_srclines(the_die, &lines, &lineCount, &err);
+
+	// dwarf_srclines_b also handles DWARF 5 line tables (with file names in .debug_line_str)
+	int retval = dwarf_srclines_b(the_die, &lineVersion, &tableCount, &lineContext, &err);
 	if (retval != DW_DLV_OK)
 		// this entry has no source lines, maybe next entry does
 		return 0;
 
-	if (lineCount == 0)
+	if (dwarf_srclines_from_linecontext(lineContext, &lines, &lineCount, &err) != DW_DLV_OK || lineCount == 0) {
+		dwarf_srclines_dealloc_b(lineContext);
 		return 0;
+	}
 
 	int match = -1;
   Dwarf_Addr matchDistance = 0;
@@ -50,6 +66,12 @@ int LookupSource(Dwarf_Debug dbg, Dwarf_Die the_die, uint64_t target, char** sou
       //break;
 		}
 
+		// an end_sequence row only terminates the previous segment
+		Dwarf_Bool endSequence = 0;
+		if (dwarf_lineendsequence(lines[n], &endSequence, &err) == DW_DLV_OK && endSequence) {
+			prev = -1;
+			continue;
+		}
 		prevlineaddr = lineaddr;
 		prev = n;
 	}
@@ -79,187 +101,382 @@ int LookupSource(Dwarf_Debug dbg, Dwarf_Die the_die, uint64_t target, char** sou
 		}
 	}
 
-	dwarf_srclines_dealloc(dbg, lines, lineCount);
+	dwarf_srclines_dealloc_b(lineContext);
 	return 0;
 }
 
-int LookupFunctionName(Dwarf_Die the_die, uint64_t target, char** functionName, uint32_t* offset) {
-	assert(functionName);
+namespace {
+struct AddressRange {
+	Dwarf_Addr low;
+	Dwarf_Addr high;
+};
+}
+
+// DWARF 2-4 range lists (.debug_ranges), entries are relative to the base address of the CU
+static void CollectRanges(Dwarf_Debug dbg, Dwarf_Die the_die, Dwarf_Attribute attr, Dwarf_Addr base, std::vector<AddressRange>& ranges) {
 	Dwarf_Error err;
-	Dwarf_Half tag = 0;
+	Dwarf_Off offset = 0;
+	if (dwarf_global_formref(attr, &offset, &err) != DW_DLV_OK)
+		return;
+	Dwarf_Ranges* entries = NULL;
+	Dwarf_Signed count = 0;
+	Dwarf_Unsigned bytes = 0;
+	if (dwarf_get_ranges_a(dbg, offset, the_die, &entries, &count, &bytes, &err) != DW_DLV_OK)
+		return;
+	for (Dwarf_Signed i = 0; i < count; ++i) {
+		if (entries[i].dwr_type == DW_RANGES_END)
+			break;
+		if (entries[i].dwr_type == DW_RANGES_ADDRESS_SELECTION) {
+			base = entries[i].dwr_addr2;
+			continue;
+		}
+		if (entries[i].dwr_addr1 < entries[i].dwr_addr2)
+			ranges.push_back({base + entries[i].dwr_addr1, base + entries[i].dwr_addr2});
+	}
+	dwarf_ranges_dealloc(dbg, entries, count);
+}
 
-	if (dwarf_tag(the_die, &tag, &err) != DW_DLV_OK)
-		return -31;
+// DWARF 5 range lists (.debug_rnglists), libdwarf resolves the entries to absolute ("cooked") addresses
+static void CollectRngLists(Dwarf_Attribute attr, Dwarf_Half form, std::vector<AddressRange>& ranges) {
+	Dwarf_Error err;
+	Dwarf_Unsigned value = 0;
+	if (form == DW_FORM_rnglistx) {
+		if (dwarf_formudata(attr, &value, &err) != DW_DLV_OK)
+			return;
+	} else {
+		Dwarf_Off offset = 0;
+		if (dwarf_global_formref(attr, &offset, &err) != DW_DLV_OK)
+			return;
+		value = offset;
+	}
+	Dwarf_Rnglists_Head head = NULL;
+	Dwarf_Unsigned count = 0;
+	Dwarf_Unsigned globalOffset = 0;
+	if (dwarf_rnglists_get_rle_head(attr, form, value, &head, &count, &globalOffset, &err) != DW_DLV_OK)
+		return;
+	for (Dwarf_Unsigned i = 0; i < count; ++i) {
+		unsigned entryLength = 0;
+		unsigned kind = 0;
+		Dwarf_Unsigned raw1 = 0, raw2 = 0, low = 0, high = 0;
+		Dwarf_Bool addrUnavailable = 0;
+		if (dwarf_get_rnglists_entry_fields_a(head, i, &entryLength, &kind, &raw1, &raw2, &addrUnavailable, &low, &high, &err) != DW_DLV_OK)
+			break;
+		if (kind == DW_RLE_end_of_list)
+			break;
+		if (addrUnavailable || kind == DW_RLE_base_address || kind == DW_RLE_base_addressx)
+			continue;
+		if (low < high)
+			ranges.push_back({low, high});
+	}
+	dwarf_dealloc_rnglists_head(head);
+}
 
-	/* Only interested in subprogram DIEs here */
-	if (tag != DW_TAG_subprogram)
-		return 0;
+// the address ranges of a DIE (low_pc/high_pc or ranges); false if the DIE has no address information
+// dwarf_lowpc/dwarf_highpc_b also resolve DW_FORM_addrx through .debug_addr (of the skeleton unit for split DWARF)
+static bool DieRanges(Dwarf_Debug dbg, Dwarf_Die the_die, Dwarf_Half version, Dwarf_Addr base, std::vector<AddressRange>& ranges) {
+	Dwarf_Error err;
+	Dwarf_Addr lowpc = 0;
+	if (dwarf_lowpc(the_die, &lowpc, &err) == DW_DLV_OK) {
+		Dwarf_Addr highpc = 0;
+		Dwarf_Half form = 0;
+		enum Dwarf_Form_Class formClass = DW_FORM_CLASS_UNKNOWN;
+		if (dwarf_highpc_b(the_die, &highpc, &form, &formClass, &err) == DW_DLV_OK) {
+			if (formClass == DW_FORM_CLASS_CONSTANT)
+				highpc += lowpc;
+			if (lowpc < highpc)
+				ranges.push_back({lowpc, highpc});
+			return true;
+		}
+	}
+	Dwarf_Attribute attr = NULL;
+	if (dwarf_attr(the_die, DW_AT_ranges, &attr, &err) != DW_DLV_OK)
+		return false;
+	Dwarf_Half form = 0;
+	if (dwarf_whatform(attr, &form, &err) == DW_DLV_OK) {
+		if (version >= 5 || form == DW_FORM_rnglistx)
+			CollectRngLists(attr, form, ranges);
+		else
+			CollectRanges(dbg, the_die, attr, base, ranges);
+	}
+	dwarf_dealloc(dbg, attr, DW_DLA_ATTR);
+	return true;
+}
 
-	char* die_name = 0;
-	int rc = dwarf_diename(the_die, &die_name, &err);
-	if (rc == DW_DLV_ERROR)
-		return -30;
-	if (rc == DW_DLV_NO_ENTRY)
-		return 0;
+// out-of-line definitions (e.g. C++ methods) have no name, but refer to their declaration
+static char* DieName(Dwarf_Debug dbg, Dwarf_Die the_die, int depth = 0) {
+	Dwarf_Error err;
+	char* name = NULL;
+	if (dwarf_diename(the_die, &name, &err) == DW_DLV_OK)
+		return strdup(name);
+	if (depth >= 4)
+		return NULL;
+	for (Dwarf_Half attrcode : {Dwarf_Half(DW_AT_specification), Dwarf_Half(DW_AT_abstract_origin)}) {
+		Dwarf_Attribute attr = NULL;
+		if (dwarf_attr(the_die, attrcode, &attr, &err) != DW_DLV_OK)
+			continue;
+		Dwarf_Off offset = 0;
+		int rc = dwarf_global_formref(attr, &offset, &err);
+		dwarf_dealloc(dbg, attr, DW_DLA_ATTR);
+		if (rc != DW_DLV_OK)
+			continue;
+		Dwarf_Die origin = NULL;
+		if (dwarf_offdie_b(dbg, offset, 1, &origin, &err) != DW_DLV_OK)
+			continue;
+		char* retval = DieName(dbg, origin, depth + 1);
+		dwarf_dealloc(dbg, origin, DW_DLA_DIE);
+		if (retval)
+			return retval;
+	}
+	return NULL;
+}
+
+// split DWARF (-gsplit-dwarf): a skeleton unit refers to the .dwo file containing the DIEs of the unit
+static std::string SplitDwarfPath(Dwarf_Die cu_die) {
+	Dwarf_Error err;
+	char* name = NULL;
+	if (dwarf_die_text(cu_die, DW_AT_dwo_name, &name, &err) != DW_DLV_OK &&
+			dwarf_die_text(cu_die, DW_AT_GNU_dwo_name, &name, &err) != DW_DLV_OK)
+		return {};
+	std::string path = name;
+	char* compDir = NULL;
+	if (!path.empty() && path[0] != '/' && dwarf_die_text(cu_die, DW_AT_comp_dir, &compDir, &err) == DW_DLV_OK)
+		path = std::string(compDir) + "/" + path;
+	return path;
+}
+
+namespace {
+struct UnitRange {
+	Dwarf_Addr low;
+	Dwarf_Addr high;
+	Dwarf_Off die; // offset of the unit DIE
+};
+
+struct FunctionRange {
+	Dwarf_Addr low;
+	Dwarf_Addr high;
+	std::string name;
+};
+
+// the libdwarf handle of a module, opened once, and the address ranges of its units and (top-level) functions,
+// indexed on first use: a lookup finds its unit and function by binary search instead of walking all DIEs
+// libdwarf handles are not thread-safe: lookups in the same module are serialized by mutex
+struct DwarfModule {
+	std::mutex mutex;
+	int fd = -1;
+	Dwarf_Debug dbg = 0;
+	bool indexed = false;
+	std::vector<UnitRange> units; // sorted by low
+	std::vector<Dwarf_Off> unitsWithoutRanges; // searched for every address
+	std::vector<FunctionRange> functions; // sorted by low
+	~DwarfModule() {
+		Dwarf_Error err;
+		if (dbg)
+			dwarf_finish(dbg, &err);
+		if (fd >= 0)
+			close(fd);
+	}
+};
+}
 
-	/* Grab the DIEs attributes for display */
-	Dwarf_Attribute* attrs = NULL;
-	Dwarf_Signed attrcount;
-	if (dwarf_attrlist(the_die, &attrs, &attrcount, &err) != DW_DLV_OK)
-		return -33;
+// adds the units and functions of all units of dbg to the index; for a .dwo or .dwp file (split) only the functions,
+// the units are those of the skeletons in the module itself
+static void IndexUnits(DwarfModule& module, Dwarf_Debug dbg, bool split, std::vector<std::string>& splitUnits) {
+	Dwarf_Unsigned cu_header_length, next_cu_header = 0, type_offset = 0;
+	Dwarf_Off abbrev_offset = 0;
+	Dwarf_Half version_stamp = 0, address_size = 0, length_size = 0, extension_size = 0, unit_type = 0;
+	Dwarf_Sig8 signature;
+	Dwarf_Error err;
+	std::vector<AddressRange> ranges;
 
-	Dwarf_Addr lowpc = 0, highpc = 0;
-	for (Dwarf_Signed i = 0; i < attrcount; ++i) {
-		Dwarf_Half attrcode;
-		if (dwarf_whatattr(attrs[i], &attrcode, &err) != DW_DLV_OK)
+	while (dwarf_next_cu_header_d(dbg, 1, &cu_header_length, &version_stamp, &abbrev_offset, &address_size, &length_size,
+			&extension_size, &signature, &type_offset, &next_cu_header, &unit_type, &err) == DW_DLV_OK) {
+		// the unit DIE is the first sibling of the unit
+		Dwarf_Die cu_die = NULL;
+		if (dwarf_siblingof(dbg, NULL, &cu_die, &err) != DW_DLV_OK)
+			continue;
+		Dwarf_Half tag = 0;
+		// FIXME: DW_TAG_partial_unit??
+		if (dwarf_tag(cu_die, &tag, &err) != DW_DLV_OK || (tag != DW_TAG_compile_unit && tag != DW_TAG_skeleton_unit)) {
+			dwarf_dealloc(dbg, cu_die, DW_DLA_DIE);
 			continue;
+		}
+		Dwarf_Addr base = 0;
+		dwarf_lowpc(cu_die, &base, &err);
+
+		Dwarf_Off offset = 0;
+		if (!split && dwarf_dieoffset(cu_die, &offset, &err) == DW_DLV_OK) {
+			ranges.clear();
+			if (!DieRanges(dbg, cu_die, version_stamp, base, ranges))
+				module.unitsWithoutRanges.push_back(offset);
+			for (auto& range : ranges)
+				module.units.push_back({range.low, range.high, offset});
+		}
 
-		/* We only take some of the attributes for display here.
-		 ** More can be picked with appropriate tag constants.
-		 */
-		if (attrcode == DW_AT_low_pc) {
-			Dwarf_Half form;
-			dwarf_whatform(attrs[i], &form, &err);
-			if (form == DW_FORM_addr) {
-				dwarf_formaddr(attrs[i], &lowpc, &err);
-			} else {
-				abort();
-			}
-		} else if (attrcode == DW_AT_high_pc) {
-			Dwarf_Half form;
-			dwarf_whatform(attrs[i], &form, &err);
-			if (form == DW_FORM_addr) {
-				dwarf_formaddr(attrs[i], &highpc, &err);
-			} else if (form == DW_FORM_udata || form == DW_FORM_data1 || form == DW_FORM_data2 || form == DW_FORM_data4 || form == DW_FORM_data8) {
-				dwarf_formudata(attrs[i], &highpc, &err);
-				highpc += lowpc;
-			} else if (form == DW_FORM_sdata) {
-				Dwarf_Signed s = 0;
-				dwarf_formsdata(attrs[i], &s, &err);
-				highpc = static_cast<Dwarf_Unsigned>(static_cast<Dwarf_Signed>(lowpc) + s);
-			} else {
-				abort();
+		Dwarf_Die child = NULL;
+		int rc = dwarf_child(cu_die, &child, &err);
+		if (rc == DW_DLV_NO_ENTRY && !split) {
+			// skeleton unit: the subprograms are in the .dwo file
+			std::string dwo = SplitDwarfPath(cu_die);
+			if (!dwo.empty())
+				splitUnits.push_back(dwo);
+		}
+		while (rc == DW_DLV_OK) {
+			if (dwarf_tag(child, &tag, &err) == DW_DLV_OK && tag == DW_TAG_subprogram) {
+				ranges.clear();
+				DieRanges(dbg, child, version_stamp, base, ranges);
+				char* name = ranges.empty() ? NULL : DieName(dbg, child);
+				if (name) {
+					for (auto& range : ranges)
+						module.functions.push_back({range.low, range.high, name});
+					free(name);
+				}
 			}
+			Dwarf_Die sibling = NULL;
+			rc = dwarf_siblingof(dbg, child, &sibling, &err);
+			dwarf_dealloc(dbg, child, DW_DLA_DIE);
+			child = sibling;
 		}
+		dwarf_dealloc(dbg, cu_die, DW_DLA_DIE);
 	}
+}
 
-  // if (lowpc)
-  //fprintf(stderr, "0x%08llx - 0x%08llx (%s)\n", lowpc, highpc, die_name);
-	if (lowpc > target || !highpc || target >= highpc)
-		return 0;
-
-	*functionName = strdup(die_name);
-	if (offset)
-		*offset = uint32_t(target - lowpc);
+// the functions of the .dwo or .dwp file of skeleton units, tied to the module (for .debug_addr and the skeletons)
+static void IndexSplitFile(DwarfModule& module, const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return;
+	Dwarf_Debug dbg = 0;
+	Dwarf_Error err;
+	if (dwarf_init(fd, DW_DLC_READ, 0, 0, &dbg, &err) == DW_DLV_OK) {
+		std::vector<std::string> none;
+		if (dwarf_set_tied_dbg(dbg, module.dbg, &err) == DW_DLV_OK)
+			IndexUnits(module, dbg, true, none);
+		dwarf_finish(dbg, &err);
+	}
+	close(fd);
+}
 
-	return 0;
+static void IndexModule(DwarfModule& module, const char* filename) {
+	std::vector<std::string> splitUnits;
+	IndexUnits(module, module.dbg, false, splitUnits);
+	if (!splitUnits.empty()) {
+		// a package file (made by dwp) next to the binary takes precedence over the individual .dwo files
+		std::string package = std::string(filename) + ".dwp";
+		if (access(package.c_str(), R_OK) == 0) {
+			IndexSplitFile(module, package.c_str());
+		} else {
+			std::sort(splitUnits.begin(), splitUnits.end());
+			splitUnits.erase(std::unique(splitUnits.begin(), splitUnits.end()), splitUnits.end());
+			for (auto& split : splitUnits)
+				IndexSplitFile(module, split.c_str());
+		}
+	}
+	std::sort(module.units.begin(), module.units.end(), [](const UnitRange& a, const UnitRange& b) {
+		return a.low < b.low;
+	});
+	std::stable_sort(module.functions.begin(), module.functions.end(), [](const FunctionRange& a, const FunctionRange& b) {
+		return a.low < b.low;
+	});
+	module.indexed = true;
 }
 
-int ProcessFile(Dwarf_Debug dbg, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column, char** functionName, uint32_t* offset)
-{
-  int rc = 0;
-  if (functionName)
-    *functionName = NULL;
-  if (sourceFile)
-    *sourceFile = NULL;
-  Dwarf_Unsigned cu_header_length, abbrev_offset, next_cu_header = 0;
-  Dwarf_Half version_stamp, address_size = 0;
-  Dwarf_Error err;
-
-  Dwarf_Die no_die = NULL;
-
-  /* Find compilation unit header */
-  while (rc == 0 &&
-      ((sourceFile && !*sourceFile) || (functionName && !*functionName)) &&
-      dwarf_next_cu_header(
-        dbg,
-        &cu_header_length,
-        &version_stamp,
-        &abbrev_offset,
-        &address_size,
-        &next_cu_header,
-        &err) == DW_DLV_OK) {
-
-    if (no_die != NULL)
-      dwarf_dealloc(dbg, no_die, DW_DLA_DIE);
-    no_die = 0;
-    Dwarf_Die cu_die;
-    Dwarf_Die child_die;
-    // Expect the CU to have a single sibling - a DIE 
-    while (dwarf_siblingof(dbg, no_die, &cu_die, &err) == DW_DLV_OK) {
-      if (no_die != NULL)
-        dwarf_dealloc(dbg, no_die, DW_DLA_DIE);
-      no_die = cu_die;
-      Dwarf_Half tag;
-      if (dwarf_tag(no_die, &tag, &err) != DW_DLV_OK) {
-        cu_die = nullptr;
-        break;
-      }
-
-      // FIXME: DW_TAG_partial_unit??
-      if (tag == DW_TAG_compile_unit)
-        break;
-    }
-    if (!cu_die) {
-      continue;
-      //return -20;
-    }
-
-    if (sourceFile && !*sourceFile) {
-      rc = LookupSource(dbg, cu_die, target, sourceFile, lineNumber, column);
-    }
-
-    if (functionName && !*functionName) {
-      // Expect the CU DIE to have children 
-      rc = dwarf_child(cu_die, &child_die, &err);
-      if (rc != DW_DLV_OK) {
-        rc = -21;
-        break;
-      }
-
-      // Now go over all children DIEs
-      while (functionName && !*functionName) {
-        LookupFunctionName(child_die, target, functionName, offset);
-
-        rc = dwarf_siblingof(dbg, child_die, &child_die, &err);
-        if (rc == DW_DLV_ERROR) {
-          rc = -22;
-          break;
-        } else if (rc == DW_DLV_NO_ENTRY)
-          break; // done
-      }
-    }
-  }
-
-  if (no_die != NULL)
-    dwarf_dealloc(dbg, no_die, DW_DLA_DIE);
-
-  return rc;
+// modules stay open for the lifetime of the reporter, like their images (see OpenElfImage), by GNU build-id: the
+// same build at another path (e.g. a copy, or the debug file) shares them, a rebuilt file at the same path does not
+// a file that libdwarf cannot read (e.g. stripped) is remembered by its path, so another file with the same
+// build-id can still be read
+static std::shared_ptr<DwarfModule> OpenDwarfModule(const char* filename) {
+	static std::mutex mutex;
+	static std::map<std::string, std::shared_ptr<DwarfModule>> modules;
+	auto image = OpenElfImage(filename);
+	std::string key = image && !image->buildId().empty() ? image->buildId() : std::string();
+	std::lock_guard<std::mutex> l(mutex);
+	if (!key.empty()) {
+		auto it = modules.find(key);
+		if (it != modules.end())
+			return it->second;
+	}
+	auto& module = modules[key + ":" + filename];
+	if (!module) {
+		module = std::make_shared<DwarfModule>();
+		module->fd = open(filename, O_RDONLY);
+		Dwarf_Error err;
+		if (module->fd >= 0 && dwarf_init(module->fd, DW_DLC_READ, 0, 0, &module->dbg, &err) != DW_DLV_OK)
+			module->dbg = 0;
+		if (module->dbg && !key.empty())
+			modules[key] = module;
+	}
+	return module->dbg ? module : nullptr;
 }
 
+// the entry of an index sorted by low that contains target; entries do not overlap, except entries with the same
+// start (e.g. discarded code, all at 0)
+template <typename Range>
+static const Range* FindRange(const std::vector<Range>& index, uint64_t target) {
+	auto it = std::upper_bound(index.begin(), index.end(), target, [](uint64_t target, const Range& range) {
+		return target < range.low;
+	});
+	if (it == index.begin())
+		return nullptr;
+	Dwarf_Addr low = std::prev(it)->low;
+	while (it != index.begin() && std::prev(it)->low == low) {
+		--it;
+		if (target < it->high)
+			return &*it;
+	}
+	return nullptr;
+}
 
 int Lookup(const char* filename, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column, char** functionName, uint32_t* offset) {
-	int fd = open(filename, O_RDONLY);
-
-	if (fd < 0)
-		return -1;
+	if (functionName)
+		*functionName = NULL;
+	// hot path: native line table reader, only falling back to libdwarf if needed (e.g. no .debug_aranges)
+	if (sourceFile && LookupLine(filename, target, sourceFile, lineNumber, column) == 0) {
+		if (!functionName)
+			return 0;
+		// line information is already known
+		sourceFile = NULL;
+	}
+	return LookupDwarf(filename, target, sourceFile, lineNumber, column, functionName, offset);
+}
 
-	Dwarf_Debug dbg = 0;
-	Dwarf_Error err;
-	if (dwarf_init(fd, DW_DLC_READ, 0, 0, &dbg, &err) != DW_DLV_OK) {
+int LookupDwarf(const char* filename, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column, char** functionName, uint32_t* offset) {
+	if (functionName)
+		*functionName = NULL;
+	if (sourceFile)
+		*sourceFile = NULL;
+	auto module = OpenDwarfModule(filename);
+	if (!module)
 		return -2;
+	std::lock_guard<std::mutex> l(module->mutex);
+	if (!module->indexed)
+		IndexModule(*module, filename);
+
+	if (functionName) {
+		if (const FunctionRange* function = FindRange(module->functions, target)) {
+			*functionName = strdup(function->name.c_str());
+			if (offset)
+				*offset = uint32_t(target - function->low);
+		}
 	}
 
-	int rc = ProcessFile(dbg, target, sourceFile, lineNumber, column, functionName, offset);
-	//fprintf(stderr, "look for source code info of %lx in %s -> %i (%s, %s)\n", target, filename, rc, sourceFile && *sourceFile ? *sourceFile : "-", functionName && *functionName ? *functionName : "-");
-
-	if (dwarf_finish(dbg, &err) != DW_DLV_OK) {
-		return -3;
+	if (sourceFile) {
+		// the unit containing target, otherwise the units without address information
+		std::vector<Dwarf_Off> candidates;
+		if (const UnitRange* unit = FindRange(module->units, target))
+			candidates.push_back(unit->die);
+		candidates.insert(candidates.end(), module->unitsWithoutRanges.begin(), module->unitsWithoutRanges.end());
+		for (Dwarf_Off candidate : candidates) {
+			Dwarf_Die cu_die = NULL;
+			Dwarf_Error err;
+			if (dwarf_offdie_b(module->dbg, candidate, 1, &cu_die, &err) != DW_DLV_OK)
+				continue;
+			LookupSource(module->dbg, cu_die, target, sourceFile, lineNumber, column);
+			dwarf_dealloc(module->dbg, cu_die, DW_DLA_DIE);
+			if (*sourceFile)
+				break;
+		}
 	}
-
-	close(fd);
-	return rc;
+	return 0;
 }
 
 #endif
-
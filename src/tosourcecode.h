@@ -1,4 +1,9 @@
+#include <stdint.h>
 
 #ifndef __APPLE__
+// source file, line and function name of an address (an offset in the file, or the address for fixed address
+// executables); the strings are malloc'ed, NULL if not found
 int Lookup(const char* filename, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column, char** functionName, uint32_t* offset);
+// the same with libdwarf only, without the native line table reader (see LookupLine)
+int LookupDwarf(const char* filename, uint64_t target, char** sourceFile, uint32_t* lineNumber, uint32_t* column, char** functionName, uint32_t* offset);
 #endif
@@ -8,6 +8,7 @@
 #endif
 #include <ucontext.h>
 
+#include <stdint.h>
 #include <stdio.h>
 
 #if __FreeBSD__
@@ -97,6 +98,28 @@ int StackTrace(bool (*report)(void *pc, void* arg), void* reportArg, int max_siz
 	return arg.left;
 }
 
+uintptr_t InterruptedPC(void* _ucxt) {
+	ucontext_t* ucxt = static_cast<ucontext_t*>(_ucxt);
+#if defined(__linux__) && defined(__amd64__)
+	return uintptr_t(ucxt->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__linux__) && defined(__i386__)
+	return uintptr_t(ucxt->uc_mcontext.gregs[REG_EIP]);
+#elif defined(__linux__) && defined(__aarch64__)
+	return uintptr_t(ucxt->uc_mcontext.pc);
+#elif defined(__linux__) && defined(__arm__)
+	return uintptr_t(ucxt->uc_mcontext.arm_pc);
+#elif defined(__APPLE__) && defined(__amd64__)
+	return uintptr_t(ucxt->uc_mcontext->__ss.__rip);
+#elif defined(__FreeBSD__) && defined(__amd64__)
+	return uintptr_t(ucxt->uc_mcontext.mc_rip);
+#elif defined(__FreeBSD__) && defined(__i386__)
+	return uintptr_t(ucxt->uc_mcontext.mc_eip);
+#else
+	(void)ucxt;
+	return 0;
+#endif
+}
+
 void StackTraceSignal(bool (*report)(void* pc, void* arg), void* reportArg, void* _ucxt [[maybe_unused]], int max_size) {
 #ifdef MANUAL
 	ucontext_t* ucxt = static_cast<ucontext_t*>(_ucxt);
@@ -1,3 +1,7 @@
+#include <stdint.h>
 
 void StackTraceSignal(bool (*report)(void* pc, void* arg), void* arg, void* _ucxt, int max_size);
 int StackTrace(bool (*report)(void *pc, void* arg), void* arg, int max_size);
+// address where the thread was interrupted by a signal (0 if not supported), to leave out the frames of the signal
+// handler from StackTraceSignal
+uintptr_t InterruptedPC(void* _ucxt);
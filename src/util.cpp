@@ -294,9 +294,7 @@ void PrintLine(const std::string& functionName, const std::string& module, uint6
 			functionName.c_str(), BaseName(module.c_str()), static_cast<long long unsigned int>(offset), sourceFileDirectory.c_str(), sourceFileBase, lineNumber);
 }
 
-std::tuple<std::string, std::string, std::string, uint32_t, uint32_t> RetrieveAndPrintSymbol(const char* symbolName, uint32_t offset_in_func [[maybe_unused]], const char* filename, uint32_t offset_in_file, void* pc, const char* currentExecutable) {
-  auto [functionName, library, sourceFile, lineNumber, columnOffset] = RetrieveSourceCodeInfo(symbolName, filename, offset_in_file, pc, currentExecutable);
-
+void PrintSymbolInfo(const std::string& functionName, const std::string& library, const std::string& sourceFile, uint32_t lineNumber, uint32_t columnOffset, const char* filename, uint32_t offset_in_file, void* pc) {
 	if (!sourceFile.empty()) {
 		PrintLine(functionName, library, uintptr_t(offset_in_file), sourceFile, lineNumber, columnOffset);
 	} else {
@@ -306,6 +304,11 @@ std::tuple<std::string, std::string, std::string, uint32_t, uint32_t> RetrieveAn
 				SYMBOL_BULLET "%s in %s+0x%x (%p)\n",
 				functionName.c_str(), BaseName(filename), offset_in_file, pc);
 	}
+}
+
+std::tuple<std::string, std::string, std::string, uint32_t, uint32_t> RetrieveAndPrintSymbol(const char* symbolName, uint32_t offset_in_func [[maybe_unused]], const char* filename, uint32_t offset_in_file, void* pc, const char* currentExecutable) {
+  auto [functionName, library, sourceFile, lineNumber, columnOffset] = RetrieveSourceCodeInfo(symbolName, filename, offset_in_file, pc, currentExecutable);
+	PrintSymbolInfo(functionName, library, sourceFile, lineNumber, columnOffset, filename, offset_in_file, pc);
 	return {functionName, library, sourceFile, lineNumber, columnOffset};
 }
 void PrintSymbol(const char* symbolName, uint32_t offset_in_func, const char* filename, uint32_t offset_in_file, void* pc) {
@@ -321,9 +324,7 @@ void PrintSymbolRaw(const char* symbolName, uint32_t offset_in_func [[maybe_unus
 			Demangle(symbolName, retainer), offset_in_func, BaseName(filename), offset_in_file, pc);
 }
 
-std::tuple<std::string, std::string, uint32_t, uint32_t> RetrieveAndPrintPC(void* pc, const char* currentExecutable) {
-	auto [functionName, sourceFile, lineNumber, columnOffset] = RetrieveSourceCodeInfo(pc, currentExecutable);
-
+void PrintPCInfo(const std::string& functionName, const std::string& sourceFile, uint32_t lineNumber, uint32_t columnOffset, void* pc, const char* currentExecutable) {
 	if (!functionName.empty()) {
 		PrintLine(functionName, currentExecutable, uintptr_t(pc), sourceFile, lineNumber, columnOffset);
 	} else if (!sourceFile.empty()) {
@@ -339,6 +340,11 @@ std::tuple<std::string, std::string, uint32_t, uint32_t> RetrieveAndPrintPC(void
         SYMBOL_BULLET "%p\n",
         pc);
 	}
+}
+
+std::tuple<std::string, std::string, uint32_t, uint32_t> RetrieveAndPrintPC(void* pc, const char* currentExecutable) {
+	auto [functionName, sourceFile, lineNumber, columnOffset] = RetrieveSourceCodeInfo(pc, currentExecutable);
+	PrintPCInfo(functionName, sourceFile, lineNumber, columnOffset, pc, currentExecutable);
 	return {functionName, sourceFile, lineNumber, columnOffset};
 }
 void PrintPC(void* pc) {
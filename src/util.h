@@ -11,6 +11,9 @@ enum CrashTag : uint8_t {
 	BREADCRUMB,
 	CONTEXT,
 	FINISH,
+	THREAD,
+	ASYNC_STACK, // the frames after it are the awaiting coroutines (crashy::AsyncFrame)
+	CODE_RANGE, // frame in a range registered with CrashRegisterCodeRange
 };
 struct Free {
 	void operator()(char* ptr) {
@@ -33,6 +36,10 @@ std::tuple<std::string, std::string, std::string, uint32_t, uint32_t> RetrieveAn
 std::tuple<std::string, std::string, uint32_t, uint32_t> RetrieveAndPrintPC(void* pc, const char* currentExecutable);
 
 
+// printing of already retrieved source code info (same output as RetrieveAndPrintSymbol/RetrieveAndPrintPC)
+void PrintSymbolInfo(const std::string& functionName, const std::string& library, const std::string& sourceFile, uint32_t lineNumber, uint32_t columnOffset, const char* filename, uint32_t offset_in_file, void* pc);
+void PrintPCInfo(const std::string& functionName, const std::string& sourceFile, uint32_t lineNumber, uint32_t columnOffset, void* pc, const char* currentExecutable);
+
 void PrintSymbol(const char* symbolName, uint32_t offset_in_func, const char* filename, uint32_t offset_in_file, void* pc);
 void PrintSymbolRaw(const char* symbolName, uint32_t offset_in_func, const char* filename, uint32_t offset_in_file, void* pc);
 
@@ -0,0 +1,424 @@
+#include "watchdog.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "nonfatal.h"
+#include "unwinder.h"
+
+static_assert(sizeof(WatchdogRegion) <= WatchdogRegion::HEADER, "header of the watchdog region too large");
+
+static WatchdogRegion* watchdog = nullptr;
+static pid_t reporterPid = 0;
+static int stackSignal = 0;
+
+namespace {
+struct alignas(64) DeadlineSlot {
+	std::atomic<int64_t> deadline; // see crashy::deadlineSlot
+	std::atomic<uint32_t> owner; // thread id, 0 if free
+	int64_t signaled = 0; // the last deadline the thread was signaled for (by the thread checking deadlines)
+};
+}
+
+static DeadlineSlot* deadlineSlots = nullptr;
+static uint32_t deadlineSlotCount = 0;
+static std::atomic<uint32_t> deadlineSlotsUsed {0}; // highest index claimed + 1
+static std::chrono::milliseconds deadlineCheckInterval {5};
+
+thread_local std::atomic<int64_t>* crashy::deadlineSlot = nullptr;
+thread_local CrashDeadline* crashy::currentDeadline = nullptr;
+
+static thread_local WatchSlot* watchSlot = nullptr;
+
+namespace {
+// releases the slot of a thread when it exits
+struct WatchSlotOwnership {
+	~WatchSlotOwnership() {
+		CrashUnwatchThread();
+	}
+};
+}
+
+static thread_local WatchSlotOwnership watchSlotOwnership;
+
+namespace {
+// releases the deadline slot of a thread when it exits
+struct DeadlineSlotOwnership {
+	DeadlineSlot* slot = nullptr;
+	~DeadlineSlotOwnership() {
+		if (slot) {
+			slot->deadline.store(0, std::memory_order_relaxed);
+			slot->owner.store(0, std::memory_order_release);
+		}
+	}
+};
+}
+
+static thread_local DeadlineSlotOwnership deadlineSlotOwnership;
+// of threads without deadline slot: guards only store to it
+static thread_local std::atomic<int64_t> unwatchedDeadline {0};
+
+void CreateWatchdog(const CrashOptions& options) {
+#if defined(__linux__)
+	int signal = options.stackSignal ? options.stackSignal : SIGRTMIN + 5;
+	stackSignal = signal;
+	if (options.deadlineSlots > 0 && !deadlineSlots) {
+		deadlineSlots = new DeadlineSlot[options.deadlineSlots]();
+		deadlineSlotCount = options.deadlineSlots;
+		deadlineCheckInterval = std::max(options.deadlineCheckInterval, std::chrono::milliseconds(1));
+	}
+	if (options.watchdogSlots == 0 || watchdog)
+		return;
+	size_t size = WatchdogRegion::HEADER + size_t(options.watchdogSlots) * sizeof(WatchSlot) + WATCHDOG_STACKS * sizeof(DumpedStack);
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("crash reporter: watchdog");
+		return;
+	}
+	auto* region = new (memory) WatchdogRegion();
+	region->slots = options.watchdogSlots;
+	region->signal = signal;
+	region->base = CurrentTickBase();
+	for (uint32_t i = 0; i < region->slots; ++i)
+		new (region->slot(i)) WatchSlot();
+	for (uint32_t i = 0; i < WATCHDOG_STACKS; ++i)
+		new (region->stack(i)) DumpedStack();
+	watchdog = region;
+#endif
+}
+
+void StartWatchdog(pid_t reporter) {
+	reporterPid = reporter;
+}
+
+#if defined(__linux__)
+namespace {
+struct StackCapture {
+	uint64_t pcs[WATCHDOG_FRAMES + 8]; // and the frames of the signal handler
+	int count = 0;
+};
+}
+
+static bool CaptureStackPC(void* pc, void* arg) {
+	auto* capture = static_cast<StackCapture*>(arg);
+	capture->pcs[capture->count++] = uint64_t(uintptr_t(pc));
+	return false;
+}
+
+static int64_t SteadyNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return int64_t(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+// a thread past its deadline: the stack from where it was interrupted is queued as a slow operation
+static void CaptureSlowOperation(uint32_t index, void* context) {
+	if (index >= deadlineSlotCount || crashy::deadlineSlot != &deadlineSlots[index].deadline)
+		return;
+	int64_t now = SteadyNow();
+	// the innermost guard past its own deadline (the slot has the earliest deadline of the nested guards)
+	CrashDeadline* guard = crashy::currentDeadline;
+	while (guard && (guard->deadline > now || guard->reported))
+		guard = guard->previous;
+	if (!guard)
+		return;
+	guard->reported = true;
+	StackCapture capture;
+	StackTraceSignal(CaptureStackPC, &capture, context, WATCHDOG_FRAMES + 8);
+	uint64_t interrupted = uint64_t(InterruptedPC(context));
+	int first = 0;
+	while (first < capture.count && capture.pcs[first] != interrupted && capture.pcs[first] + 1 != interrupted)
+		++first;
+	if (first == capture.count)
+		first = 0;
+	EnqueueSlowOperation(guard->name, uint64_t(guard->deadline - guard->start), uint64_t(now - guard->start), capture.pcs + first, std::min(capture.count - first, WATCHDOG_FRAMES));
+}
+
+// the stack signal, as sent by the crash reporter (si_value is the index of the stack slot), or by the thread
+// checking deadlines (si_value is the index of the deadline slot)
+static void DumpStack(int, siginfo_t* info, void* context) {
+	if (info->si_code != SI_QUEUE)
+		return;
+	if (info->si_pid == getpid()) {
+		int savedErrno = errno;
+		CaptureSlowOperation(uint32_t(info->si_value.sival_int), context);
+		errno = savedErrno;
+		return;
+	}
+	if (!watchdog || info->si_pid != reporterPid || uint32_t(info->si_value.sival_int) >= WATCHDOG_STACKS)
+		return;
+	DumpedStack* stack = watchdog->stack(uint32_t(info->si_value.sival_int));
+	uint64_t request = stack->requested.load(std::memory_order_acquire);
+	// a signal of an earlier request can arrive late
+	if (stack->tid.load(std::memory_order_relaxed) != CurrentThreadId() || stack->written.load(std::memory_order_relaxed) == request)
+		return;
+	int savedErrno = errno;
+	StackCapture capture;
+	StackTraceSignal(CaptureStackPC, &capture, context, WATCHDOG_FRAMES + 8);
+	// the interrupted frame is reported as is (not as a return address)
+	uint64_t interrupted = uint64_t(InterruptedPC(context));
+	int first = 0;
+	while (first < capture.count && capture.pcs[first] != interrupted && capture.pcs[first] + 1 != interrupted)
+		++first;
+	if (first == capture.count)
+		first = 0;
+	stack->frames = uint32_t(std::min(capture.count - first, WATCHDOG_FRAMES));
+	memcpy(stack->pcs, capture.pcs + first, stack->frames * sizeof(uint64_t));
+	stack->written.store(request, std::memory_order_release);
+	errno = savedErrno;
+}
+
+static void InstallStackSignal() {
+	static std::once_flag installed;
+	std::call_once(installed, [] {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sa.sa_sigaction = DumpStack;
+		if (sigaction(stackSignal, &sa, nullptr) == -1) {
+			perror("crash reporter: watchdog");
+			return;
+		}
+		if (watchdog)
+			watchdog->handling.store(true);
+	});
+}
+
+// sends the stack signal once to each thread past its deadline
+static void CheckDeadlines() {
+	pid_t pid = getpid();
+	for (;;) {
+		std::this_thread::sleep_for(deadlineCheckInterval);
+		int64_t now = SteadyNow();
+		uint32_t used = deadlineSlotsUsed.load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < used; ++i) {
+			DeadlineSlot& slot = deadlineSlots[i];
+			uint32_t owner = slot.owner.load(std::memory_order_acquire);
+			int64_t deadline = slot.deadline.load(std::memory_order_relaxed);
+			// a later guard has a later deadline than the one signaled, as it started after that deadline passed
+			if (owner == 0 || deadline == 0 || deadline > now || deadline <= slot.signaled)
+				continue;
+			slot.signaled = deadline;
+			siginfo_t info;
+			memset(&info, 0, sizeof(info));
+			info.si_signo = stackSignal;
+			info.si_code = SI_QUEUE;
+			info.si_pid = pid;
+			info.si_uid = getuid();
+			info.si_value.sival_int = int(i);
+			syscall(SYS_rt_tgsigqueueinfo, pid, pid_t(owner), stackSignal, &info);
+		}
+	}
+}
+#endif
+
+std::atomic<int64_t>* crashy::ClaimDeadlineSlot() {
+#if defined(__linux__)
+	if (deadlineSlots) {
+		static std::once_flag started;
+		std::call_once(started, [] {
+			// the handler is installed before a thread is signaled: the default action of a real-time signal is to
+			// terminate
+			InstallStackSignal();
+			std::thread(CheckDeadlines).detach();
+		});
+		uint32_t tid = CurrentThreadId();
+		for (uint32_t i = 0; i < deadlineSlotCount; ++i) {
+			uint32_t expected = 0;
+			DeadlineSlot& slot = deadlineSlots[i];
+			if (slot.owner.load(std::memory_order_relaxed) == 0 && slot.owner.compare_exchange_strong(expected, tid)) {
+				slot.deadline.store(0, std::memory_order_relaxed);
+				uint32_t used = deadlineSlotsUsed.load(std::memory_order_relaxed);
+				while (used < i + 1 && !deadlineSlotsUsed.compare_exchange_weak(used, i + 1)) {
+				}
+				deadlineSlotOwnership.slot = &slot;
+				return deadlineSlot = &slot.deadline;
+			}
+		}
+	}
+#endif
+	// disabled, or all slots are claimed: deadlines of this thread are not checked
+	return deadlineSlot = &unwatchedDeadline;
+}
+
+bool CrashWatchThread(const char* name, std::chrono::milliseconds threshold) {
+#if defined(__linux__)
+	if (!watchdog || threshold.count() <= 0) {
+		errno = watchdog ? EINVAL : ENOTSUP;
+		return false;
+	}
+	// the handler is installed before a thread is watched: the default action of a real-time signal is to terminate
+	InstallStackSignal();
+	WatchSlot* slot = watchSlot;
+	for (uint32_t i = 0; !slot && i < watchdog->slots; ++i) {
+		uint32_t expected = 0;
+		if (watchdog->slot(i)->owner.load(std::memory_order_relaxed) == 0 && watchdog->slot(i)->owner.compare_exchange_strong(expected, CurrentThreadId()))
+			slot = watchdog->slot(i);
+	}
+	if (!slot) {
+		errno = ENOSPC;
+		return false;
+	}
+	// the reporter skips the slot until the heartbeat is set
+	slot->heartbeat.store(0);
+	strncpy(slot->name, name ? name : "", WATCH_NAME - 1);
+	slot->name[WATCH_NAME - 1] = '\0';
+	slot->threshold.store(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count()), std::memory_order_relaxed);
+	slot->heartbeat.store(Ticks(), std::memory_order_release);
+	// the reporter checks the heartbeats more often from now on
+	if (!watchSlot)
+		NotifyReporter();
+	watchSlot = slot;
+	(void)watchSlotOwnership;
+	return true;
+#else
+	(void)name;
+	(void)threshold;
+	errno = ENOTSUP;
+	return false;
+#endif
+}
+
+void CrashHeartbeat() {
+	if (WatchSlot* slot = watchSlot)
+		slot->heartbeat.store(Ticks(), std::memory_order_relaxed);
+}
+
+void CrashUnwatchThread() {
+	if (WatchSlot* slot = watchSlot) {
+		watchSlot = nullptr;
+		slot->heartbeat.store(0);
+		slot->owner.store(0, std::memory_order_release);
+	}
+}
+
+bool WatchingThreads() {
+	if (!watchdog)
+		return false;
+	for (uint32_t i = 0; i < watchdog->slots; ++i)
+		if (watchdog->slot(i)->owner.load(std::memory_order_relaxed) != 0)
+			return true;
+	return false;
+}
+
+bool FindHang(HungThread& hang) {
+	// per slot, the heartbeat of the stall reported last
+	static std::map<uint32_t, std::pair<uint32_t, uint64_t>> reported;
+	if (!watchdog)
+		return false;
+	TickConverter clock(watchdog->base);
+	int64_t now = clock.realtime(Ticks());
+	for (uint32_t i = 0; i < watchdog->slots; ++i) {
+		WatchSlot* slot = watchdog->slot(i);
+		uint32_t owner = slot->owner.load(std::memory_order_acquire);
+		uint64_t heartbeat = slot->heartbeat.load(std::memory_order_acquire);
+		if (owner == 0 || heartbeat == 0)
+			continue;
+		uint64_t threshold = slot->threshold.load(std::memory_order_relaxed);
+		int64_t stalled = now - clock.realtime(heartbeat);
+		if (stalled <= int64_t(threshold))
+			continue;
+		auto stall = std::make_pair(owner, heartbeat);
+		auto it = reported.find(i);
+		if (it != reported.end() && it->second == stall)
+			continue;
+		reported[i] = stall;
+		hang.tid = owner;
+		hang.name.assign(slot->name, strnlen(slot->name, WATCH_NAME));
+		hang.stalled = uint64_t(stalled);
+		hang.threshold = threshold;
+		return true;
+	}
+	return false;
+}
+
+#if defined(__linux__)
+static std::string ThreadName(pid_t pid, uint32_t tid) {
+	std::ifstream in("/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/comm");
+	std::string name;
+	std::getline(in, name);
+	return name;
+}
+#endif
+
+std::vector<ReportThread> DumpThreadStacks(pid_t pid) {
+	std::vector<ReportThread> threads;
+#if defined(__linux__)
+	if (!watchdog)
+		return threads;
+	std::string task = "/proc/" + std::to_string(pid) + "/task";
+	if (DIR* dir = opendir(task.c_str())) {
+		while (struct dirent* entry = readdir(dir)) {
+			uint32_t tid = uint32_t(strtoul(entry->d_name, nullptr, 10));
+			if (tid != 0) {
+				threads.emplace_back();
+				threads.back().tid = tid;
+			}
+		}
+		closedir(dir);
+	}
+	std::sort(threads.begin(), threads.end(), [](const ReportThread& a, const ReportThread& b) {
+		return a.tid < b.tid;
+	});
+	if (threads.size() > WATCHDOG_STACKS)
+		threads.resize(WATCHDOG_STACKS);
+	// without the handler, the signal would terminate the process
+	bool signaling = watchdog->handling.load();
+	static uint64_t sequence = 0;
+	std::vector<uint64_t> requests(threads.size(), 0);
+	for (size_t i = 0; i < threads.size() && signaling; ++i) {
+		DumpedStack* stack = watchdog->stack(uint32_t(i));
+		requests[i] = ++sequence;
+		stack->tid.store(threads[i].tid, std::memory_order_relaxed);
+		stack->requested.store(requests[i], std::memory_order_release);
+		siginfo_t info;
+		memset(&info, 0, sizeof(info));
+		info.si_signo = watchdog->signal;
+		info.si_code = SI_QUEUE;
+		info.si_pid = getpid();
+		info.si_uid = getuid();
+		info.si_value.sival_int = int(i);
+		// fails if the thread exited in the meantime
+		if (syscall(SYS_rt_tgsigqueueinfo, pid, pid_t(threads[i].tid), watchdog->signal, &info) != 0)
+			requests[i] = 0;
+	}
+	// threads blocked in a system call handle the signal as well; a stopped thread or one that blocks the signal does not
+	for (int waited = 0; signaling && waited < 1000; ++waited) {
+		bool all = true;
+		for (size_t i = 0; i < threads.size() && all; ++i)
+			all = requests[i] == 0 || watchdog->stack(uint32_t(i))->written.load(std::memory_order_acquire) == requests[i];
+		if (all)
+			break;
+		usleep(1000);
+	}
+	for (size_t i = 0; i < threads.size(); ++i) {
+		auto& thread = threads[i];
+		thread.name = ThreadName(pid, thread.tid);
+		DumpedStack* stack = watchdog->stack(uint32_t(i));
+		if (requests[i] == 0 || stack->written.load(std::memory_order_acquire) != requests[i])
+			continue;
+		uint32_t frames = std::min(stack->frames, uint32_t(WATCHDOG_FRAMES));
+		thread.frames = AddressFrames(std::vector<uintptr_t>(stack->pcs, stack->pcs + frames), pid);
+	}
+#else
+	(void)pid;
+#endif
+	return threads;
+}
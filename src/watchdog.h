@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "breadcrumbs.h"
+#include "crashy.h"
+#include "reporter.h"
+
+// hang watchdog (CrashOptions::watchdogSlots, Linux only): a thread registered with CrashWatchThread stores the time of
+// its last heartbeat in a slot of a MAP_SHARED region created before the crash reporter is forked; the reporter
+// checks the slots every CrashOptions::watchdogInterval, and reports a thread without heartbeat for longer than its
+// threshold, once per stall
+// for the report, the reporter captures the stack of each thread of the process: it sends each thread the stack
+// signal (CrashOptions::stackSignal) with the index of a stack slot, the handler unwinds the interrupted stack into
+// that slot; threads that do not handle the signal in time (blocked, or stopped) are reported without stack
+//
+// deadlines (CrashDeadline, CrashOptions::deadlineSlots) are checked within the process: a thread started with the
+// first guard compares the deadline slot of each thread with the time, and sends the stack signal once to a thread
+// past its deadline, with the index of its deadline slot; the handler unwinds the stack and queues it as a slow
+// operation (see EnqueueSlowOperation), so the thread is only stopped for the time of unwinding
+
+#define WATCH_NAME 32
+#define WATCHDOG_STACKS 256
+#define WATCHDOG_FRAMES 64
+
+struct WatchSlot {
+	std::atomic<uint32_t> owner; // thread id, 0 if free
+	std::atomic<uint64_t> heartbeat; // Ticks() of the last heartbeat, 0 while the slot is (re)assigned
+	std::atomic<uint64_t> threshold; // ns
+	char name[WATCH_NAME];
+};
+
+struct DumpedStack {
+	std::atomic<uint32_t> tid; // the thread that should handle the request
+	std::atomic<uint64_t> requested; // sequence number of the last request of the reporter
+	std::atomic<uint64_t> written; // sequence number of the request of the stack written
+	uint32_t frames;
+	uint64_t pcs[WATCHDOG_FRAMES]; // innermost first
+};
+
+struct WatchdogRegion {
+	uint32_t slots;
+	int signal; // the stack signal
+	TickBase base;
+	std::atomic<bool> handling; // the handler of the stack signal is installed
+	static constexpr size_t HEADER = 64;
+	WatchSlot* slot(uint32_t i) {
+		return reinterpret_cast<WatchSlot*>(reinterpret_cast<char*>(this) + HEADER) + i;
+	}
+	DumpedStack* stack(uint32_t i) {
+		return reinterpret_cast<DumpedStack*>(reinterpret_cast<char*>(this) + HEADER + slots * sizeof(WatchSlot)) + i;
+	}
+};
+
+// in the process to be monitored, before StartReporter(); the watchdog region only if CrashOptions::watchdogSlots
+// is not 0, and the deadline slots (not shared) only if CrashOptions::deadlineSlots is not 0
+void CreateWatchdog(const CrashOptions& options);
+// in the process to be monitored, after StartReporter(): only the stack signal of this process is handled
+void StartWatchdog(pid_t reporter);
+
+// in the crash reporter: whether any thread is watched (the reporter then checks every watchdogInterval)
+bool WatchingThreads();
+
+struct HungThread {
+	uint32_t tid = 0;
+	std::string name;
+	uint64_t stalled = 0; // ns since the last heartbeat
+	uint64_t threshold = 0; // ns
+};
+// in the crash reporter: a watched thread without heartbeat for longer than its threshold, not reported before for
+// this stall
+bool FindHang(HungThread& hang);
+
+// in the crash reporter: the stacks of all threads of the process (frames not symbolized, see AddressFrames), with
+// the names of the threads
+std::vector<ReportThread> DumpThreadStacks(pid_t pid);
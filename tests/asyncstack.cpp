@@ -0,0 +1,107 @@
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "crashy.h"
+
+// a lazy task, awaited by its creator: the final suspend point resumes the awaiter
+struct Task {
+	struct promise_type : crashy::AsyncStackPromise {
+		std::coroutine_handle<> continuation = std::noop_coroutine();
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		auto initial_suspend() {
+			return Track(std::suspend_always{});
+		}
+		struct FinalAwaiter {
+			bool await_ready() noexcept {
+				return false;
+			}
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+				return handle.promise().continuation;
+			}
+			void await_resume() noexcept {
+			}
+		};
+		auto final_suspend() noexcept {
+			return Track(FinalAwaiter{});
+		}
+		void return_void() {
+		}
+		void unhandled_exception() {
+			std::terminate();
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {
+	}
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {
+	}
+	~Task() {
+		if (handle)
+			handle.destroy();
+	}
+	bool await_ready() noexcept {
+		return false;
+	}
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+		handle.promise().continuation = awaiter;
+		return handle;
+	}
+	void await_resume() noexcept {
+	}
+};
+
+// the logical stack as reported after a crash: the running coroutine, then its awaiters, all of them suspended
+static std::vector<size_t> depths;
+static bool suspended = true;
+
+static void RecordChain() {
+	size_t depth = 0;
+	for (auto* frame = crashy::currentAsyncFrame; frame; frame = frame->awaiter, ++depth)
+		suspended = suspended && (depth == 0 ? frame->resumeAddress == nullptr : frame->resumeAddress != nullptr);
+	depths.push_back(depth);
+}
+
+static Task Leaf() {
+	RecordChain();
+	co_return;
+}
+
+static Task Nested() {
+	RecordChain();
+	co_await Leaf();
+	RecordChain();
+}
+
+static Task Parent() {
+	RecordChain();
+	// siblings created before either is awaited
+	Task first = Nested();
+	Task second = Leaf();
+	RecordChain();
+	co_await std::move(first);
+	co_await std::move(second);
+	Task third = Leaf();
+	co_await std::move(third);
+	RecordChain();
+}
+
+int main() {
+	{
+		Task parent = Parent();
+		parent.handle.resume();
+		CHECK(parent.handle.done());
+	}
+	// parent, parent after creating its children, first child, its child, first child again, second child, third
+	// child, parent again
+	CHECK(depths == std::vector<size_t>({1, 1, 2, 3, 2, 2, 2, 1}));
+	CHECK(suspended);
+	CHECK(crashy::currentAsyncFrame == nullptr);
+	return failures;
+}
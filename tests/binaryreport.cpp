@@ -0,0 +1,253 @@
+#include <signal.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "binaryreport.h"
+#include "check.h"
+
+static CrashFrame Frame(uintptr_t pc, const char* function) {
+	CrashFrame frame;
+	frame.pc = reinterpret_cast<void*>(pc);
+	frame.symbolName = function;
+	frame.functionName = function;
+	return frame;
+}
+
+// a report with every part the encoding has
+static void FillReport(CrashReport& crash, CrashOptions& options) {
+	crash.timestamp = 1760000000;
+	crash.eventId = "0123456789abcdef0123456789abcdef";
+	crash.fingerprint = "fedcba9876543210";
+	crash.suppressedBefore = 3;
+	crash.signal = std::make_pair(SIGSEGV, reinterpret_cast<void*>(uintptr_t(0x10)));
+	crash.uncaughtException = std::make_pair(std::string("std::runtime_error"), std::string("what"));
+	crash.assertViolation = std::make_tuple(std::string("main"), std::string("main.cpp"), uint32_t(12), std::string("x > 0"), std::string("x is \"-1\""));
+	NonFatalReport nonFatal;
+	nonFatal.kind = NonFatalReport::SLOW_OPERATION;
+	nonFatal.level = "warning";
+	nonFatal.message = "slow";
+	nonFatal.operation = "query";
+	crash.nonFatal = nonFatal;
+	crash.crashedThread = 4321;
+	crash.context = "context";
+	crash.hostname = "host";
+	crash.osName = "Linux";
+	crash.osRelease = "6.1";
+	crash.machine = "x86_64";
+	crash.model = "model";
+	crash.uid = 1000;
+	crash.username = "user";
+
+	// addresses up and down the stack, up to the top of the address space
+	CrashFrame full = Frame(0x7f0000001234, "Crash()");
+	full.module = "libcrash.so";
+	full.offsetInFile = 0x1234;
+	full.library = "/usr/lib/libcrash.so";
+	full.sourceFile = "crash.cpp";
+	full.lineNumber = 42;
+	full.column = 7;
+	full.preContext = {"int Crash() {", "\tint* p = nullptr;"};
+	full.contextLine = "\treturn *p;";
+	full.postContext = {"}"};
+	crash.frames.push_back(full);
+	CrashFrame degraded = Frame(0x401000, "main");
+	degraded.detail = CrashFrame::SYMBOL_ONLY;
+	crash.frames.push_back(degraded);
+	CrashFrame range = Frame(0x7f0000000010, "jit");
+	range.codeRange = true;
+	range.offsetInFile = 0x10;
+	crash.frames.push_back(range);
+	CrashFrame async = Frame(UINTPTR_MAX, "");
+	async.async = true;
+	async.detail = CrashFrame::MODULE_OFFSET;
+	crash.frames.push_back(async);
+
+	ReportBreadcrumb breadcrumb;
+	breadcrumb.level = "info";
+	breadcrumb.time = int64_t(crash.timestamp) * 1000000000LL - 1500000000LL;
+	breadcrumb.message = "request 7";
+	breadcrumb.tid = 4321;
+	breadcrumb.data = {{"id", "7"}};
+	crash.breadcrumbs.push_back(breadcrumb);
+	// earlier than the previous one (another thread)
+	breadcrumb.time -= 3;
+	breadcrumb.tid = 1;
+	breadcrumb.data.clear();
+	crash.breadcrumbs.push_back(breadcrumb);
+
+	crash.modules = {{"/usr/lib/libcrash.so", "a1b2c3", 0x7f0000000000, 0x20000}, {"/bin/app", "", 0, 0x1000}};
+	crash.processMetrics = {{"rss", "1024"}, {"threads", "[1,2]"}};
+	crash.threadContexts = {{4321, {{"request", "7"}, {"user", "u"}}}, {1, {}}};
+	crash.flightRecorderFunctions = {Frame(0x7f0000001000, "Enter"), Frame(0x7f0000002000, "Leave")};
+	crash.flightRecorderFunctions[0].module = "libcrash.so";
+	crash.flightRecorderFunctions[0].sourceFile = "crash.cpp";
+	crash.flightRecorderFunctions[0].lineNumber = 3;
+	crash.flightRecorder = {{4321, {{breadcrumb.time, 0, false}, {breadcrumb.time + 10, 1, false}, {breadcrumb.time + 5, 1, true}}}};
+	ReportThread thread;
+	thread.tid = 1;
+	thread.name = "worker";
+	thread.frames = {Frame(0x7f0000003000, "Wait()"), Frame(0x7f0000002000, "Run()")};
+	crash.threads.push_back(thread);
+	crash.threads.push_back(ReportThread());
+
+	options.rawReport = true;
+	options.currentExecutable = "/bin/app";
+	options.command = "app --crash";
+	options.path = "/tmp";
+	options.release = "1.0";
+	options.dist = "2";
+	options.environment = "test";
+}
+
+static bool SameFrames(const std::vector<CrashFrame>& a, const std::vector<CrashFrame>& b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].symbolName != b[i].symbolName || a[i].module != b[i].module || a[i].offsetInFile != b[i].offsetInFile ||
+				a[i].pc != b[i].pc || a[i].functionName != b[i].functionName || a[i].library != b[i].library ||
+				a[i].sourceFile != b[i].sourceFile || a[i].lineNumber != b[i].lineNumber || a[i].column != b[i].column ||
+				a[i].detail != b[i].detail || a[i].preContext != b[i].preContext || a[i].contextLine != b[i].contextLine ||
+				a[i].postContext != b[i].postContext || a[i].async != b[i].async || a[i].codeRange != b[i].codeRange)
+			return false;
+	}
+	return true;
+}
+
+static void TestRoundTrip() {
+	CrashReport crash;
+	CrashOptions options;
+	FillReport(crash, options);
+	std::string data = EncodeReport(crash, options);
+	CrashReport decoded;
+	CrashOptions decodedOptions;
+	CHECK(DecodeReport(data, decoded, decodedOptions));
+
+	CHECK_EQUAL(decoded.timestamp, crash.timestamp);
+	CHECK_EQUAL(decoded.eventId, crash.eventId);
+	CHECK_EQUAL(decoded.fingerprint, crash.fingerprint);
+	CHECK_EQUAL(decoded.suppressedBefore, crash.suppressedBefore);
+	CHECK(decoded.signal == crash.signal);
+	CHECK(decoded.uncaughtException == crash.uncaughtException);
+	CHECK(decoded.assertViolation == crash.assertViolation);
+	CHECK(decoded.nonFatal.has_value());
+	if (decoded.nonFatal) {
+		CHECK_EQUAL(decoded.nonFatal->kind, crash.nonFatal->kind);
+		CHECK_EQUAL(decoded.nonFatal->level, crash.nonFatal->level);
+		CHECK_EQUAL(decoded.nonFatal->message, crash.nonFatal->message);
+		CHECK_EQUAL(decoded.nonFatal->operation, crash.nonFatal->operation);
+	}
+	CHECK_EQUAL(decoded.crashedThread, crash.crashedThread);
+	CHECK_EQUAL(decoded.context, crash.context);
+	CHECK_EQUAL(decoded.hostname, crash.hostname);
+	CHECK_EQUAL(decoded.osName, crash.osName);
+	CHECK_EQUAL(decoded.osRelease, crash.osRelease);
+	CHECK_EQUAL(decoded.machine, crash.machine);
+	CHECK_EQUAL(decoded.model, crash.model);
+	CHECK_EQUAL(decoded.uid, crash.uid);
+	CHECK_EQUAL(decoded.username, crash.username);
+	CHECK(SameFrames(decoded.frames, crash.frames));
+
+	CHECK_EQUAL(decoded.breadcrumbs.size(), crash.breadcrumbs.size());
+	for (size_t i = 0; i < decoded.breadcrumbs.size() && i < crash.breadcrumbs.size(); ++i) {
+		CHECK_EQUAL(decoded.breadcrumbs[i].level, crash.breadcrumbs[i].level);
+		CHECK_EQUAL(decoded.breadcrumbs[i].time, crash.breadcrumbs[i].time);
+		CHECK_EQUAL(decoded.breadcrumbs[i].message, crash.breadcrumbs[i].message);
+		CHECK_EQUAL(decoded.breadcrumbs[i].tid, crash.breadcrumbs[i].tid);
+		CHECK(decoded.breadcrumbs[i].data == crash.breadcrumbs[i].data);
+	}
+	CHECK_EQUAL(decoded.modules.size(), crash.modules.size());
+	for (size_t i = 0; i < decoded.modules.size() && i < crash.modules.size(); ++i) {
+		CHECK_EQUAL(decoded.modules[i].path, crash.modules[i].path);
+		CHECK_EQUAL(decoded.modules[i].buildId, crash.modules[i].buildId);
+		CHECK_EQUAL(decoded.modules[i].base, crash.modules[i].base);
+		CHECK_EQUAL(decoded.modules[i].size, crash.modules[i].size);
+	}
+	CHECK(decoded.processMetrics == crash.processMetrics);
+	CHECK(decoded.threadContexts == crash.threadContexts);
+
+	// only what the flight recorder needs of its functions is kept
+	CHECK_EQUAL(decoded.flightRecorderFunctions.size(), crash.flightRecorderFunctions.size());
+	for (size_t i = 0; i < decoded.flightRecorderFunctions.size() && i < crash.flightRecorderFunctions.size(); ++i) {
+		CHECK_EQUAL(decoded.flightRecorderFunctions[i].pc, crash.flightRecorderFunctions[i].pc);
+		CHECK_EQUAL(decoded.flightRecorderFunctions[i].module, crash.flightRecorderFunctions[i].module);
+		CHECK_EQUAL(decoded.flightRecorderFunctions[i].functionName, crash.flightRecorderFunctions[i].functionName);
+		CHECK_EQUAL(decoded.flightRecorderFunctions[i].sourceFile, crash.flightRecorderFunctions[i].sourceFile);
+		CHECK_EQUAL(decoded.flightRecorderFunctions[i].lineNumber, crash.flightRecorderFunctions[i].lineNumber);
+	}
+	CHECK_EQUAL(decoded.flightRecorder.size(), crash.flightRecorder.size());
+	for (size_t i = 0; i < decoded.flightRecorder.size() && i < crash.flightRecorder.size(); ++i) {
+		CHECK_EQUAL(decoded.flightRecorder[i].first, crash.flightRecorder[i].first);
+		auto& events = decoded.flightRecorder[i].second;
+		auto& expected = crash.flightRecorder[i].second;
+		CHECK_EQUAL(events.size(), expected.size());
+		for (size_t j = 0; j < events.size() && j < expected.size(); ++j) {
+			CHECK_EQUAL(events[j].time, expected[j].time);
+			CHECK_EQUAL(events[j].function, expected[j].function);
+			CHECK_EQUAL(events[j].exit, expected[j].exit);
+		}
+	}
+	CHECK_EQUAL(decoded.threads.size(), crash.threads.size());
+	for (size_t i = 0; i < decoded.threads.size() && i < crash.threads.size(); ++i) {
+		CHECK_EQUAL(decoded.threads[i].tid, crash.threads[i].tid);
+		CHECK_EQUAL(decoded.threads[i].name, crash.threads[i].name);
+		CHECK(SameFrames(decoded.threads[i].frames, crash.threads[i].frames));
+	}
+
+	CHECK_EQUAL(decodedOptions.rawReport, options.rawReport);
+	CHECK_EQUAL(decodedOptions.currentExecutable, options.currentExecutable);
+	CHECK_EQUAL(decodedOptions.command, options.command);
+	CHECK_EQUAL(decodedOptions.path, options.path);
+	CHECK_EQUAL(decodedOptions.release, options.release);
+	CHECK_EQUAL(decodedOptions.dist, options.dist);
+	CHECK_EQUAL(decodedOptions.environment, options.environment);
+
+	// crashy-decode renders the decoded report: the same as the report rendered by the reporter
+	for (auto format : {CrashOptions::PLAIN_TEXT, CrashOptions::JSON_SENTRY})
+		CHECK_EQUAL(FormatReport(decoded, decodedOptions, format), FormatReport(crash, options, format));
+}
+
+static void TestEmptyReport() {
+	CrashReport crash, decoded;
+	CrashOptions options, decodedOptions;
+	CHECK(DecodeReport(EncodeReport(crash, options), decoded, decodedOptions));
+	CHECK(!decoded.signal && !decoded.uncaughtException && !decoded.assertViolation && !decoded.nonFatal);
+	CHECK(decoded.frames.empty() && decoded.breadcrumbs.empty() && decoded.threads.empty());
+	CHECK(!decodedOptions.rawReport);
+}
+
+static void TestDamaged() {
+	CrashReport crash;
+	CrashOptions options;
+	FillReport(crash, options);
+	std::string data = EncodeReport(crash, options);
+	// every truncation is detected
+	for (size_t size = 0; size < data.size(); ++size) {
+		CrashReport decoded;
+		CrashOptions decodedOptions;
+		if (DecodeReport(data.substr(0, size), decoded, decodedOptions)) {
+			CHECK(!"truncated report decoded");
+			break;
+		}
+	}
+	// changed bytes are decoded to something, or rejected, without reading out of bounds
+	for (size_t i = 0; i < data.size(); ++i) {
+		for (uint8_t x : {uint8_t(0x01), uint8_t(0x80), uint8_t(0xFF)}) {
+			std::string damaged = data;
+			damaged[i] = char(damaged[i] ^ x);
+			CrashReport decoded;
+			CrashOptions decodedOptions;
+			DecodeReport(damaged, decoded, decodedOptions);
+		}
+	}
+	CrashReport decoded;
+	CHECK(!DecodeReport("CRBX" + data.substr(4), decoded, options));
+}
+
+int main() {
+	TestRoundTrip();
+	TestEmptyReport();
+	TestDamaged();
+	return failures;
+}
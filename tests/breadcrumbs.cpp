@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "breadcrumbs.h"
+#include "check.h"
+
+#define ENTRIES 16
+
+// a message of the whole entry, all of it derived from the number, so an entry overwritten while copied is detected
+static std::string Message(uint64_t n) {
+	char number[24];
+	snprintf(number, sizeof(number), "%llu:", (unsigned long long)n);
+	std::string message(BREADCRUMB_DATA, char('a' + n % 26));
+	message.replace(0, strlen(number), number);
+	return message;
+}
+
+static bool Intact(const std::string& message, uint64_t& n) {
+	n = strtoull(message.c_str(), nullptr, 10);
+	return message == Message(n);
+}
+
+static void TestFullRing() {
+	// a full ring without a writer: the oldest slot is the next one written, it is not reported
+	std::thread writer([] {
+		for (uint64_t n = 0; n < ENTRIES + 10; ++n) {
+			std::string message = Message(n);
+			CrashBreadcrumb(CRASH_INFO, message.data(), message.size());
+		}
+	});
+	writer.join();
+	auto breadcrumbs = ReadBreadcrumbRings(1000);
+	CHECK_EQUAL(breadcrumbs.size(), size_t(ENTRIES - 1));
+	for (size_t i = 0; i < breadcrumbs.size(); ++i) {
+		uint64_t n;
+		CHECK(Intact(breadcrumbs[i].message, n));
+		CHECK_EQUAL(n, uint64_t(10 + 1 + i));
+		CHECK_EQUAL(breadcrumbs[i].level, std::string("info"));
+	}
+}
+
+static void TestStructured() {
+	CRASHY_BREADCRUMB(CRASH_ERROR, "request {id} done in {} us: {{{}}}", 7, 1.5, "ok");
+	// the string is cut off at the end of the entry, the arguments after it are missing
+	CRASHY_BREADCRUMB(CRASH_ERROR, "{name} {} {}", std::string(300, 'x'), -42, true);
+	std::vector<ReportBreadcrumb> breadcrumbs;
+	for (auto& breadcrumb : ReadBreadcrumbRings(1000))
+		if (breadcrumb.level == "error")
+			breadcrumbs.push_back(breadcrumb);
+	CHECK_EQUAL(breadcrumbs.size(), size_t(2));
+	if (breadcrumbs.size() != 2)
+		return;
+	CHECK_EQUAL(breadcrumbs[0].message, std::string("request 7 done in 1.5 us: {ok}"));
+	CHECK_EQUAL(breadcrumbs[0].data.size(), size_t(1));
+	CHECK(breadcrumbs[0].data[0] == std::make_pair(std::string("id"), std::string("7")));
+	std::string cut(BREADCRUMB_DATA - 4 - 1, 'x');
+	CHECK_EQUAL(breadcrumbs[1].message, cut + " ? ?");
+	CHECK(breadcrumbs[1].data[0] == std::make_pair(std::string("name"), cut));
+}
+
+static void TestFormatTableFull() {
+	// TestStructured registered 2 of the 4 formats
+	static const uint8_t types[] = {crashy::INTEGER, 0};
+	crashy::BreadcrumbFormat formats[] = {{"a {}", CRASH_DEBUG, types}, {"b {}", CRASH_DEBUG, types}, {"c {}", CRASH_DEBUG, types}};
+	for (auto& format : formats)
+		crashy::Breadcrumb(format, 1);
+	CHECK_EQUAL(formats[0].id.load(), uint32_t(3));
+	CHECK_EQUAL(formats[1].id.load(), uint32_t(4));
+	// not registered again, the table keeps its formats
+	CHECK_EQUAL(formats[2].id.load(), uint32_t(UINT32_MAX));
+	for (int i = 0; i < 1000; ++i)
+		crashy::Breadcrumb(formats[2], i);
+	crashy::Breadcrumb(formats[0], 2);
+	crashy::Breadcrumb(formats[1], 3);
+	std::vector<std::string> messages;
+	for (auto& breadcrumb : ReadBreadcrumbRings(1000))
+		if (breadcrumb.level == "debug")
+			messages.push_back(breadcrumb.message);
+	CHECK(messages.size() >= 3);
+	if (messages.size() >= 3) {
+		// the unformatted text of the call site that found the table full
+		CHECK_EQUAL(messages[messages.size() - 3], std::string("c {}"));
+		CHECK_EQUAL(messages[messages.size() - 2], std::string("a 2"));
+		CHECK_EQUAL(messages[messages.size() - 1], std::string("b 3"));
+	}
+}
+
+static void TestWrapWhileReading() {
+	// the ring of a thread that keeps writing wraps many times while it is read
+	std::atomic<bool> stop {false};
+	std::thread writer([&] {
+		for (uint64_t n = 0; !stop.load(std::memory_order_relaxed); ++n) {
+			std::string message = Message(n);
+			CrashBreadcrumb(CRASH_WARNING, message.data(), message.size());
+		}
+	});
+	size_t read = 0;
+	for (int i = 0; i < 20000; ++i) {
+		auto breadcrumbs = ReadBreadcrumbRings(1000);
+		bool first = true;
+		uint64_t previous = 0;
+		for (size_t j = 0; j < breadcrumbs.size(); ++j) {
+			if (breadcrumbs[j].level != "warning")
+				continue; // the ring of the first test
+			uint64_t n;
+			if (!Intact(breadcrumbs[j].message, n)) {
+				CHECK(!"torn breadcrumb");
+				break;
+			}
+			// consecutive, oldest first
+			if (!first)
+				CHECK_EQUAL(n, previous + 1);
+			first = false;
+			previous = n;
+			++read;
+		}
+	}
+	stop.store(true);
+	writer.join();
+	CHECK(read > 0);
+}
+
+int main() {
+	CrashOptions options;
+	options.breadcrumbRings = 4;
+	options.breadcrumbRingEntries = ENTRIES;
+	options.breadcrumbFormats = 4;
+	CreateBreadcrumbRegion(options);
+	TestFullRing();
+	TestStructured();
+	TestFormatTableFull();
+	TestWrapWhileReading();
+	return failures;
+}
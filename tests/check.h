@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+
+// minimal checks for the test programs: a failed check is printed and counted, main() returns the count
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++failures; \
+		} \
+	} while (false)
+
+#define CHECK_EQUAL(a, b) \
+	do { \
+		auto&& checkA = (a); \
+		auto&& checkB = (b); \
+		if (!(checkA == checkB)) { \
+			fprintf(stderr, "%s:%d: check failed: %s == %s\n", __FILE__, __LINE__, #a, #b); \
+			++failures; \
+		} \
+	} while (false)
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "coderanges.h"
+
+// addresses of code that does not exist: the ranges are only looked up
+#define SLOT 0x1000
+static const uintptr_t BASE = 0x10000000;
+
+static std::map<uintptr_t, std::pair<uintptr_t, std::string>> live; // begin, end and name
+static std::vector<uintptr_t> gone;
+
+static uintptr_t Begin(size_t slot) {
+	return BASE + slot * SLOT;
+}
+
+static void Register(size_t slot, const std::string& name, uintptr_t size = SLOT / 2) {
+	uintptr_t begin = Begin(slot);
+	CrashRegisterCodeRange(reinterpret_cast<const void*>(begin), reinterpret_cast<const void*>(begin + size), name.c_str());
+	live[begin] = {begin + size, name};
+	gone.erase(std::remove(gone.begin(), gone.end(), begin), gone.end());
+}
+
+static void Unregister(size_t slot) {
+	uintptr_t begin = Begin(slot);
+	CrashUnregisterCodeRange(reinterpret_cast<const void*>(begin));
+	live.erase(begin);
+	gone.push_back(begin);
+}
+
+// each live range is found at its first and last address, not after its end; removed ranges are not found
+static bool Consistent() {
+	CodeRangeReader reader;
+	for (auto& [begin, range] : live) {
+		for (uintptr_t pc : {begin, range.first - 1}) {
+			const CodeRange* found = reader.find(pc);
+			if (!found || found->begin != begin || found->end != range.first || found->name != range.second)
+				return false;
+		}
+		if (reader.find(range.first))
+			return false;
+	}
+	for (uintptr_t begin : gone)
+		if (reader.find(begin))
+			return false;
+	return true;
+}
+
+static void TestRegister() {
+	// the first registration creates the table, the next ones are appended after its sorted part until it is
+	// rebuilt: several times, in reverse order of address
+	bool consistent = true;
+	for (size_t i = 0; i < 4 * (CODE_RANGES_PENDING + 1); ++i) {
+		Register(4 * (CODE_RANGES_PENDING + 1) - i, "r" + std::to_string(i));
+		consistent = consistent && Consistent();
+	}
+	CHECK(consistent);
+	CodeRangeReader reader;
+	CHECK(!reader.find(Begin(0)));
+	CHECK(!reader.find(Begin(0) - 1));
+	CHECK(!reader.find(Begin(4 * (CODE_RANGES_PENDING + 1) + 1)));
+}
+
+static void TestUnregister() {
+	// removed ranges stay in the table until it is rebuilt: when they are more than the live ones
+	bool consistent = true;
+	for (size_t slot = 1; slot <= 4 * (CODE_RANGES_PENDING + 1); slot += 3) {
+		Unregister(slot);
+		consistent = consistent && Consistent();
+	}
+	for (size_t slot = 2; slot <= 4 * (CODE_RANGES_PENDING + 1); slot += 3) {
+		Unregister(slot);
+		consistent = consistent && Consistent();
+	}
+	CHECK(consistent);
+	// not registered
+	CrashUnregisterCodeRange(reinterpret_cast<const void*>(Begin(1)));
+	CrashUnregisterCodeRange(reinterpret_cast<const void*>(Begin(1) + 1));
+	CHECK(Consistent());
+}
+
+static void TestReuse() {
+	// the same begin address registered again after removal, while the removed range is still in the table: in the
+	// sorted part, in the recent registrations, then after rebuilds
+	bool consistent = true;
+	for (size_t round = 0; round < 3; ++round) {
+		for (size_t slot = 1; slot <= 4 * (CODE_RANGES_PENDING + 1); slot += 3) {
+			Register(slot, "again" + std::to_string(round), SLOT / 4 * (1 + (slot + round) % 3));
+			consistent = consistent && Consistent();
+			Unregister(slot);
+			consistent = consistent && Consistent();
+			Register(slot, "reused" + std::to_string(round));
+			consistent = consistent && Consistent();
+		}
+	}
+	CHECK(consistent);
+
+	// registered again without unregistering: the new range replaces the old one; the old one is not freed while a
+	// reader could use it, even when the table is rebuilt
+	{
+		CodeRangeReader reader;
+		const CodeRange* old = reader.find(Begin(1));
+		Register(1, "replaced");
+		CHECK(Consistent());
+		for (size_t i = 0; i <= CODE_RANGES_PENDING; ++i)
+			Register(1, "replaced");
+		CHECK(Consistent());
+		CHECK(old && old->name == "reused2" && old->removed.load());
+	}
+	Register(1, "replaced");
+	CHECK(Consistent());
+}
+
+static void TestOverlap() {
+	// ranges inside a larger one: the innermost is found; up to CODE_RANGES_BACKTRACK - 1 removed ranges before the
+	// address do not hide the larger one
+	uintptr_t outer = BASE / 2;
+	auto pointer = [](uintptr_t address) {
+		return reinterpret_cast<const void*>(address);
+	};
+	CrashRegisterCodeRange(pointer(outer), pointer(outer + 16 * SLOT), "outer");
+	for (uintptr_t i = 1; i < CODE_RANGES_BACKTRACK; ++i)
+		CrashRegisterCodeRange(pointer(outer + i * SLOT), pointer(outer + i * SLOT + SLOT / 2), ("inner" + std::to_string(i)).c_str());
+	auto name = [](uintptr_t pc) {
+		CodeRangeReader reader;
+		const CodeRange* range = reader.find(pc);
+		return range ? range->name : std::string("(none)");
+	};
+	for (int sorted = 0; sorted < 2; ++sorted) {
+		CHECK_EQUAL(name(outer), std::string("outer"));
+		CHECK_EQUAL(name(outer + SLOT), std::string("inner1"));
+		CHECK_EQUAL(name(outer + 3 * SLOT + SLOT / 2 - 1), std::string("inner3"));
+		CHECK_EQUAL(name(outer + 3 * SLOT + SLOT / 2), std::string("outer"));
+		CHECK_EQUAL(name(outer + 16 * SLOT - 1), std::string("outer"));
+		CHECK_EQUAL(name(outer + 16 * SLOT), std::string("(none)"));
+		// into the sorted part of a rebuilt table
+		for (size_t i = 0; i <= CODE_RANGES_PENDING; ++i)
+			Register(1, "filler");
+	}
+	for (uintptr_t i = 1; i < CODE_RANGES_BACKTRACK; ++i)
+		CrashUnregisterCodeRange(pointer(outer + i * SLOT));
+	CHECK_EQUAL(name(outer + SLOT), std::string("outer"));
+	CHECK_EQUAL(name(outer + 3 * SLOT), std::string("outer"));
+	CHECK_EQUAL(name(outer + 3 * SLOT + SLOT / 2), std::string("outer"));
+	CrashUnregisterCodeRange(pointer(outer));
+	CHECK_EQUAL(name(outer + SLOT), std::string("(none)"));
+	CHECK(Consistent());
+}
+
+int main() {
+	TestRegister();
+	TestUnregister();
+	TestReuse();
+	TestOverlap();
+	return failures;
+}
@@ -0,0 +1,19 @@
+#include "dwarf-sample.h"
+
+__attribute__((noinline)) static void Capture(SampleLocation& location, int line) {
+	location.pc = uintptr_t(__builtin_return_address(0));
+	location.line = line;
+}
+
+__attribute__((noinline)) SampleLocation SampleFunction() {
+	SampleLocation location;
+	Capture(location, __LINE__);
+	return location;
+}
+
+// out of line: the definition has no name, it refers to the declaration
+__attribute__((noinline)) SampleLocation SampleClass::Method() {
+	SampleLocation location;
+	Capture(location, __LINE__);
+	return location;
+}
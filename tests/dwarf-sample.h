@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// code resolved by the dwarf tests, compiled with the debug info options of each variant
+struct SampleLocation {
+	uintptr_t pc = 0; // a return address in the function
+	int line = 0; // of the call
+};
+
+SampleLocation SampleFunction();
+
+struct SampleClass {
+	static SampleLocation Method();
+};
@@ -0,0 +1,69 @@
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "check.h"
+#include "dwarf-sample.h"
+#include "dwarfline.h"
+#include "elfimage.h"
+#include "tosourcecode.h"
+
+// "lines": file and line with the native line table reader; "functions": function names with libdwarf, skipped
+// (77) if libdwarf cannot read the test at all
+#define SKIPPED 77
+
+static bool EndsWith(const char* s, const char* suffix) {
+	return s && strlen(s) >= strlen(suffix) && strcmp(s + strlen(s) - strlen(suffix), suffix) == 0;
+}
+
+int main(int argc, char** argv) {
+	bool functions = argc > 1 && strcmp(argv[1], "functions") == 0;
+	char executable[PATH_MAX + 1] = {0};
+	if (readlink("/proc/self/exe", executable, PATH_MAX) <= 0)
+		return 1;
+	auto image = OpenElfImage(executable);
+	CHECK(image != nullptr);
+	if (!image)
+		return failures;
+
+	struct {
+		SampleLocation location;
+		const char* name;
+	} samples[] = {{SampleFunction(), "SampleFunction"}, {SampleClass::Method(), "Method"}};
+	for (auto& sample : samples) {
+		// the call, not the instruction after it
+		uintptr_t pc = sample.location.pc - 1;
+		Dl_info info;
+		CHECK(dladdr(reinterpret_cast<void*>(pc), &info) != 0);
+		uint64_t target = image->isFixedAddress() ? pc : pc - uintptr_t(info.dli_fbase);
+		char* sourceFile = NULL;
+		uint32_t lineNumber = 0;
+		uint32_t column = 0;
+		if (!functions) {
+			CHECK_EQUAL(LookupLine(executable, target, &sourceFile, &lineNumber, &column), 0);
+			CHECK(EndsWith(sourceFile, "dwarf-sample.cpp"));
+			CHECK_EQUAL(lineNumber, uint32_t(sample.location.line));
+			free(sourceFile);
+			continue;
+		}
+		char* functionName = NULL;
+		uint32_t offset = 0;
+		int rc = Lookup(executable, target, &sourceFile, &lineNumber, &column, &functionName, &offset);
+		if (rc == -2) {
+			fprintf(stderr, "libdwarf cannot read %s, function names are not checked\n", executable);
+			return failures ? failures : SKIPPED;
+		}
+		CHECK_EQUAL(rc, 0);
+		CHECK(functionName && strcmp(functionName, sample.name) == 0);
+		CHECK(offset > 0);
+		CHECK(EndsWith(sourceFile, "dwarf-sample.cpp"));
+		CHECK_EQUAL(lineNumber, uint32_t(sample.location.line));
+		free(functionName);
+		free(sourceFile);
+	}
+	return failures;
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "elfimage.h"
+
+static bool Copy(const char* from, const std::string& to) {
+	std::ifstream in(from, std::ios::binary);
+	std::ofstream out(to, std::ios::binary | std::ios::trunc);
+	return bool(out << in.rdbuf());
+}
+
+int main() {
+	char directory[] = "/tmp/crashy-elfimage-XXXXXX";
+	if (!mkdtemp(directory))
+		return 1;
+	std::string path = std::string(directory) + "/module";
+
+	// an image is cached by path, as long as the file is not replaced
+	CHECK(Copy("/proc/self/exe", path));
+	auto image = OpenElfImage(path.c_str());
+	CHECK(image != nullptr);
+	if (image) {
+		CHECK(image->valid());
+		CHECK_EQUAL(image->buildId().size(), size_t(40));
+		CHECK(OpenElfImage(path.c_str()) == image);
+	}
+
+	// an update at the same path (a new inode) is read again, with its own build-id
+	std::string update = path + ".new";
+	CHECK(Copy("/bin/sh", update));
+	CHECK(rename(update.c_str(), path.c_str()) == 0);
+	auto updated = OpenElfImage(path.c_str());
+	CHECK(updated != nullptr);
+	CHECK(updated != image);
+	if (image && updated)
+		CHECK(updated->buildId() != image->buildId());
+
+	// a file that is not an ELF image
+	CHECK(Copy("/proc/self/cmdline", update));
+	CHECK(OpenElfImage(update.c_str()) == nullptr);
+	CHECK(OpenElfImage((path + ".missing").c_str()) == nullptr);
+
+	unlink(update.c_str());
+	unlink(path.c_str());
+	rmdir(directory);
+	return failures;
+}
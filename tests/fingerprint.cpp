@@ -0,0 +1,121 @@
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "fingerprint.h"
+
+static CrashFrame Frame(const std::string& module, uint32_t offset, uintptr_t pc) {
+	CrashFrame frame;
+	frame.module = module;
+	frame.offsetInFile = offset;
+	frame.pc = reinterpret_cast<void*>(pc);
+	return frame;
+}
+
+static CrashReport Crash(int signal, const std::string& module, uintptr_t base) {
+	CrashReport crash;
+	crash.signal = std::make_pair(signal, nullptr);
+	for (uint32_t offset : {0x1200u, 0x3400u, 0x5600u, 0x7800u, 0x9a00u, 0xbc00u})
+		crash.frames.push_back(Frame(module, offset, base + offset));
+	return crash;
+}
+
+static void TestGolden() {
+	// the counters of AllowReport are kept across versions: the fingerprint of a crash must not change
+	CrashOptions options;
+	CrashReport crash = Crash(SIGSEGV, "/nonexistent/libgone.so", 0x7f0000000000);
+	CrashFrame jit;
+	jit.codeRange = true;
+	jit.functionName = "compiled";
+	jit.offsetInFile = 0x40;
+	crash.frames.insert(crash.frames.begin(), jit);
+	CHECK_EQUAL(CrashFingerprint(crash, options), std::string("3228a7e488a408e4"));
+}
+
+static void TestStable() {
+	char executable[PATH_MAX + 1] = {0};
+	CHECK(readlink("/proc/self/exe", executable, PATH_MAX) > 0);
+	CrashOptions options;
+	std::string fingerprint = CrashFingerprint(Crash(SIGSEGV, executable, 0x555500000000), options);
+	CHECK_EQUAL(fingerprint.size(), size_t(16));
+
+	// another load address
+	CHECK_EQUAL(CrashFingerprint(Crash(SIGSEGV, executable, 0x560000000000), options), fingerprint);
+	// frames below the top ones
+	CrashReport deeper = Crash(SIGSEGV, executable, 0x555500000000);
+	deeper.frames.back().offsetInFile += 4;
+	CHECK_EQUAL(CrashFingerprint(deeper, options), fingerprint);
+	// the same binary (build-id) at another path
+	std::string copy = "/tmp/crashy-fingerprint-" + std::to_string(getpid());
+	{
+		std::ifstream in(executable, std::ios::binary);
+		std::ofstream out(copy, std::ios::binary);
+		out << in.rdbuf();
+	}
+	CHECK_EQUAL(CrashFingerprint(Crash(SIGSEGV, copy, 0x555500000000), options), fingerprint);
+	unlink(copy.c_str());
+
+	// another crash
+	CHECK(CrashFingerprint(Crash(SIGBUS, executable, 0x555500000000), options) != fingerprint);
+	CrashReport other = Crash(SIGSEGV, executable, 0x555500000000);
+	other.frames[4].offsetInFile += 4;
+	CHECK(CrashFingerprint(other, options) != fingerprint);
+	// without build-id, the name of the module counts
+	CHECK(CrashFingerprint(Crash(SIGSEGV, "/nonexistent/liba.so", 0), options) !=
+		CrashFingerprint(Crash(SIGSEGV, "/nonexistent/libb.so", 0), options));
+	CHECK_EQUAL(CrashFingerprint(Crash(SIGSEGV, "/nonexistent/liba.so", 0), options),
+		CrashFingerprint(Crash(SIGSEGV, "/elsewhere/liba.so", 0), options));
+
+	// slow operations: the name of the operation, not where it was interrupted
+	CrashReport slow = Crash(0, executable, 0), slowElsewhere = Crash(0, executable, 0);
+	slow.signal.reset();
+	slowElsewhere.signal.reset();
+	slowElsewhere.frames[0].offsetInFile += 4;
+	NonFatalReport nonFatal;
+	nonFatal.kind = NonFatalReport::SLOW_OPERATION;
+	nonFatal.level = "warning";
+	nonFatal.operation = "query";
+	slow.nonFatal = slowElsewhere.nonFatal = nonFatal;
+	CHECK_EQUAL(CrashFingerprint(slow, options), CrashFingerprint(slowElsewhere, options));
+	slowElsewhere.nonFatal->operation = "commit";
+	CHECK(CrashFingerprint(slow, options) != CrashFingerprint(slowElsewhere, options));
+}
+
+static void TestAllowReport() {
+	CrashOptions options;
+	options.maxReportsPerFingerprint = 2;
+	options.fingerprintWindow = std::chrono::seconds(60);
+	options.fingerprintStore = "/tmp/crashy-fingerprints-" + std::to_string(getpid());
+	uint64_t suppressed = 99;
+	time_t now = 1000;
+	CHECK(AllowReport(options, "a", now, suppressed));
+	CHECK_EQUAL(suppressed, uint64_t(0));
+	CHECK(AllowReport(options, "a", now + 1, suppressed));
+	CHECK(!AllowReport(options, "a", now + 2, suppressed));
+	CHECK(!AllowReport(options, "a", now + 3, suppressed));
+	// other fingerprints are counted on their own
+	CHECK(AllowReport(options, "b", now + 3, suppressed));
+	// the next window reports the crashes suppressed since the previous report
+	CHECK(AllowReport(options, "a", now + 60, suppressed));
+	CHECK_EQUAL(suppressed, uint64_t(2));
+	CHECK(AllowReport(options, "a", now + 61, suppressed));
+	CHECK_EQUAL(suppressed, uint64_t(0));
+	unlink(options.fingerprintStore.c_str());
+
+	// no limit
+	options.maxReportsPerFingerprint = 0;
+	for (int i = 0; i < 5; ++i)
+		CHECK(AllowReport(options, "a", now, suppressed));
+}
+
+int main() {
+	TestGolden();
+	TestStable();
+	TestAllowReport();
+	return failures;
+}
@@ -0,0 +1,209 @@
+#include <dlfcn.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "flightrecorder.h"
+#include "util.h"
+
+// built with -finstrument-functions, and the hooks of flightrecorder.cpp (which is not instrumented)
+extern "C" {
+__attribute__((noinline)) void FlightLeaf() {
+	asm volatile("");
+}
+__attribute__((noinline)) void FlightInner() {
+	FlightLeaf();
+}
+__attribute__((noinline)) void FlightOuter() {
+	FlightInner();
+	FlightInner();
+}
+}
+
+static std::string executable;
+
+static CrashOptions Options() {
+	CrashOptions options;
+	options.currentExecutable = executable;
+	options.flightRecorderRings = 4;
+	options.flightRecorderEvents = 1000; // rounded up to 1024
+	options.flightRecorderReportEvents = 1024;
+	return options;
+}
+
+// the events of the ring of the thread, by function address
+static std::vector<std::pair<uintptr_t, bool>> Events(const CrashReport& crash, uint32_t tid) {
+	std::vector<std::pair<uintptr_t, bool>> events;
+	for (auto& thread : crash.flightRecorder) {
+		if (thread.first != tid)
+			continue;
+		for (auto& event : thread.second)
+			events.emplace_back(uintptr_t(crash.flightRecorderFunctions[event.function].pc), event.exit);
+	}
+	return events;
+}
+
+static void TestOrder() {
+	CrashOptions options = Options();
+	CrashReport crash;
+	FlightOuter();
+	ReadFlightRecorder(crash, options);
+	auto events = Events(crash, CurrentThreadId());
+	CHECK(events.size() <= size_t(options.flightRecorderReportEvents));
+	auto outer = uintptr_t(&FlightOuter), inner = uintptr_t(&FlightInner), leaf = uintptr_t(&FlightLeaf);
+	std::vector<std::pair<uintptr_t, bool>> expected {{outer, false}, {inner, false}, {leaf, false}, {leaf, true},
+		{inner, true}, {inner, false}, {leaf, false}, {leaf, true}, {inner, true}, {outer, true}};
+	// the last events, the earlier ones are from the functions of the test
+	CHECK(events.size() >= expected.size());
+	if (events.size() >= expected.size())
+		events.erase(events.begin(), events.end() - ptrdiff_t(expected.size()));
+	CHECK(events == expected);
+
+	// each function once in flightRecorderFunctions, with its module (not symbolized)
+	size_t found = 0;
+	for (size_t i = 0; i < crash.flightRecorderFunctions.size(); ++i) {
+		auto& frame = crash.flightRecorderFunctions[i];
+		for (size_t j = 0; j < i; ++j)
+			CHECK(crash.flightRecorderFunctions[j].pc != frame.pc);
+		if (frame.pc == reinterpret_cast<void*>(leaf)) {
+			++found;
+			CHECK_EQUAL(frame.symbolName, std::string("FlightLeaf"));
+			CHECK_EQUAL(std::string(BaseName(frame.module.c_str())), std::string(BaseName(executable.c_str())));
+			CHECK(frame.offsetInFile != 0);
+			CHECK(frame.functionName.empty());
+		}
+	}
+	CHECK_EQUAL(found, size_t(1));
+	for (auto& thread : crash.flightRecorder)
+		for (size_t i = 1; i < thread.second.size(); ++i)
+			CHECK(thread.second[i - 1].time <= thread.second[i].time);
+}
+
+static void TestWrap() {
+	// many rounds through the ring: the most recent events, in order
+	CrashOptions options = Options();
+	CrashReport crash, all;
+	for (int i = 0; i < 3000; ++i)
+		FlightLeaf();
+	options.flightRecorderReportEvents = 64;
+	ReadFlightRecorder(crash, options);
+	options.flightRecorderReportEvents = 4096;
+	ReadFlightRecorder(all, options);
+	auto events = Events(crash, CurrentThreadId());
+	CHECK_EQUAL(events.size(), size_t(64));
+	bool alternating = true;
+	for (size_t i = 0; i < events.size(); ++i)
+		alternating = alternating && events[i].first == uintptr_t(&FlightLeaf) && events[i].second == (i % 2 == 1);
+	CHECK(alternating);
+	// at most the size of the ring, less the entry the writer could be writing (FirstIntactEntry)
+	events = Events(all, CurrentThreadId());
+	CHECK_EQUAL(events.size(), size_t(1023));
+	alternating = true;
+	for (size_t i = 0; i < events.size(); ++i)
+		alternating = alternating && events[i].first == uintptr_t(&FlightLeaf) && events[i].second == (i % 2 == 0);
+	CHECK(alternating);
+}
+
+static void TestConcurrent() {
+	// a thread recording while its ring is read: the events overwritten during the copy are discarded, so the events
+	// read are in the order they were recorded
+	std::atomic<bool> stop {false};
+	std::atomic<uint32_t> tid {0};
+	std::thread writer([&] {
+		tid = CurrentThreadId();
+		while (!stop)
+			FlightLeaf();
+	});
+	while (tid == 0)
+		;
+	CrashOptions options = Options();
+	bool ordered = true;
+	size_t reads = 0;
+	for (int i = 0; i < 2000; ++i) {
+		CrashReport crash;
+		ReadFlightRecorder(crash, options);
+		for (auto& thread : crash.flightRecorder) {
+			if (thread.first != tid)
+				continue;
+			++reads;
+			// FlightLeaf enters and exits in turn, after the start of the thread
+			auto& events = thread.second;
+			uint32_t leaf = events.back().function;
+			for (size_t j = 1; j < events.size(); ++j)
+				ordered = ordered && events[j - 1].time <= events[j].time && (events[j - 1].function != leaf || events[j - 1].exit != events[j].exit);
+		}
+	}
+	stop = true;
+	writer.join();
+	CHECK(ordered);
+	CHECK(reads > 0);
+}
+
+static uintptr_t LibcFunction() {
+	void* libc = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+	return libc ? uintptr_t(dlsym(libc, "free")) : 0;
+}
+
+// CrashOptions::flightRecorderModules and flightRecorderExcludeModules: the filters are set when the recorder is
+// created, once per process
+static void TestModules(bool exclude) {
+	CrashOptions options = Options();
+	if (exclude)
+		options.flightRecorderExcludeModules = {"libc.so.6"};
+	else
+		options.flightRecorderModules = {"unknown.so", std::string(BaseName(executable.c_str()))};
+	CreateFlightRecorder(options);
+	uintptr_t libc = LibcFunction(), unknown = 0x1000;
+	CHECK(libc != 0);
+	FlightLeaf();
+	__cyg_profile_func_enter(reinterpret_cast<void*>(libc), nullptr);
+	__cyg_profile_func_enter(reinterpret_cast<void*>(unknown), nullptr);
+	__cyg_profile_func_exit(reinterpret_cast<void*>(unknown), nullptr);
+	__cyg_profile_func_exit(reinterpret_cast<void*>(libc), nullptr);
+	CrashReport crash;
+	ReadFlightRecorder(crash, options);
+	auto events = Events(crash, CurrentThreadId());
+	auto has = [&](uintptr_t address) {
+		for (auto& event : events)
+			if (event.first == address)
+				return true;
+		return false;
+	};
+	CHECK(has(uintptr_t(&FlightLeaf)));
+	CHECK(!has(libc));
+	// code outside of the loaded modules is recorded unless only some modules are
+	CHECK_EQUAL(has(unknown), exclude);
+	StopFlightRecorder();
+}
+
+int main(int argc, char** argv) {
+	char path[PATH_MAX + 1] = {0};
+	if (readlink("/proc/self/exe", path, PATH_MAX) <= 0)
+		return 1;
+	executable = path;
+	if (argc > 1 && strcmp(argv[1], "modules") == 0) {
+		TestModules(false);
+	} else if (argc > 1 && strcmp(argv[1], "exclude-modules") == 0) {
+		TestModules(true);
+	} else {
+		CreateFlightRecorder(Options());
+		TestOrder();
+		TestWrap();
+		TestConcurrent();
+		// not recorded any more
+		CrashReport before, after;
+		CrashOptions options = Options();
+		ReadFlightRecorder(before, options);
+		StopFlightRecorder();
+		FlightOuter();
+		ReadFlightRecorder(after, options);
+		CHECK(Events(before, CurrentThreadId()) == Events(after, CurrentThreadId()));
+	}
+	return failures;
+}
@@ -0,0 +1,274 @@
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "http.h"
+
+namespace {
+struct ReceivedRequest {
+	size_t connection = 0;
+	std::string line;
+	std::vector<std::pair<std::string, std::string>> headers;
+	std::string body;
+
+	std::string header(const char* name) const {
+		for (auto& header : headers)
+			if (strcasecmp(header.first.c_str(), name) == 0)
+				return header.second;
+		return "(none)";
+	}
+};
+
+// an HTTP server on a loopback port, handling one connection at a time: respond(request, connection) gives the
+// response to each request, an empty one closes the connection without a response; so does a response with
+// "Connection: close", after it
+class LoopbackServer {
+	int listener = -1;
+	std::atomic<bool> stop {false};
+	std::thread thread;
+	std::function<std::string (size_t request, size_t connection)> respond;
+
+	static bool ReadRequest(int fd, std::string& buffer, ReceivedRequest& request) {
+		char chunk[4096];
+		size_t end;
+		while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+			ssize_t n = read(fd, chunk, sizeof(chunk));
+			if (n <= 0)
+				return false;
+			buffer.append(chunk, size_t(n));
+		}
+		std::string head = buffer.substr(0, end + 2);
+		buffer.erase(0, end + 4);
+		size_t lineEnd = head.find("\r\n");
+		request.line = head.substr(0, lineEnd);
+		size_t length = 0;
+		for (size_t p = lineEnd + 2; p < head.size(); ) {
+			size_t next = head.find("\r\n", p);
+			std::string header = head.substr(p, next - p);
+			p = next + 2;
+			size_t colon = header.find(": ");
+			if (colon == std::string::npos)
+				continue;
+			request.headers.emplace_back(header.substr(0, colon), header.substr(colon + 2));
+			if (strcasecmp(request.headers.back().first.c_str(), "Content-Length") == 0)
+				length = size_t(atol(request.headers.back().second.c_str()));
+		}
+		while (buffer.size() < length) {
+			ssize_t n = read(fd, chunk, sizeof(chunk));
+			if (n <= 0)
+				return false;
+			buffer.append(chunk, size_t(n));
+		}
+		request.body = buffer.substr(0, length);
+		buffer.erase(0, length);
+		return true;
+	}
+
+	void serve() {
+		while (!stop) {
+			struct pollfd p = {listener, POLLIN, 0};
+			if (poll(&p, 1, 50) <= 0)
+				continue;
+			int fd = accept(listener, nullptr, nullptr);
+			if (fd < 0)
+				continue;
+			std::string buffer;
+			ReceivedRequest request;
+			while (ReadRequest(fd, buffer, request)) {
+				request.connection = connections;
+				std::string response = respond(requests.size(), connections);
+				requests.push_back(std::move(request));
+				request = ReceivedRequest();
+				if (response.empty())
+					break;
+				if (write(fd, response.data(), response.size()) != ssize_t(response.size()) ||
+						response.find("Connection: close\r\n") != std::string::npos)
+					break;
+			}
+			close(fd);
+			++connections;
+		}
+	}
+ public:
+	uint16_t port = 0;
+	// valid after finish()
+	std::vector<ReceivedRequest> requests;
+	size_t connections = 0;
+
+	explicit LoopbackServer(std::function<std::string (size_t request, size_t connection)> respond) : respond(std::move(respond)) {
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(address);
+		if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 4) != 0 ||
+				getsockname(listener, reinterpret_cast<struct sockaddr*>(&address), &length) != 0) {
+			CHECK(!"no loopback listener");
+			return;
+		}
+		port = ntohs(address.sin_port);
+		thread = std::thread([this] { serve(); });
+	}
+	~LoopbackServer() {
+		finish();
+	}
+	void finish() {
+		stop = true;
+		if (thread.joinable())
+			thread.join();
+		if (listener >= 0)
+			close(listener);
+		listener = -1;
+	}
+};
+}
+
+static const std::string OK = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+static CrashOptions Options(const std::string& dsn) {
+	CrashOptions options;
+	options.dsn = dsn;
+	options.uploadTimeout = std::chrono::milliseconds(5000);
+	options.uploadRetries = 2;
+	return options;
+}
+
+static void TestSentry() {
+	// two reports pipelined on one connection, with the responses in different framings
+	LoopbackServer server([](size_t request, size_t) {
+		return request == 0 ? OK : "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nok\r\n0\r\n\r\n";
+	});
+	std::string dsn = "http://public@127.0.0.1:" + std::to_string(server.port) + "/sentry/42";
+	auto accepted = UploadReports(Options(dsn), {{CrashOptions::ENVELOPE_SENTRY, "{}\n{\"type\":\"event\"}\n{}"},
+		{CrashOptions::JSON_SENTRY, "{\"event_id\":\"1\"}"}});
+	server.finish();
+	CHECK(accepted == std::vector<bool>({true, true}));
+	CHECK_EQUAL(server.connections, size_t(1));
+	CHECK_EQUAL(server.requests.size(), size_t(2));
+	if (server.requests.size() != 2)
+		return;
+	auto& envelope = server.requests[0];
+	CHECK_EQUAL(envelope.line, std::string("POST /sentry/api/42/envelope/ HTTP/1.1"));
+	CHECK_EQUAL(envelope.header("Host"), "127.0.0.1:" + std::to_string(server.port));
+	CHECK_EQUAL(envelope.header("Content-Type"), std::string("application/x-sentry-envelope"));
+	CHECK_EQUAL(envelope.header("Content-Length"), std::to_string(envelope.body.size()));
+	CHECK_EQUAL(envelope.header("X-Sentry-Auth"), std::string("Sentry sentry_version=7, sentry_client=crashy/0.1, sentry_key=public"));
+	CHECK_EQUAL(envelope.header("Content-Encoding"), std::string("(none)"));
+	CHECK_EQUAL(envelope.body, std::string("{}\n{\"type\":\"event\"}\n{}"));
+	auto& event = server.requests[1];
+	CHECK_EQUAL(event.line, std::string("POST /sentry/api/42/store/ HTTP/1.1"));
+	CHECK_EQUAL(event.header("Content-Type"), std::string("application/json"));
+	CHECK_EQUAL(event.body, std::string("{\"event_id\":\"1\"}"));
+}
+
+static void TestPlainUrl() {
+	LoopbackServer server([](size_t request, size_t) {
+		return request == 0 ? "HTTP/1.1 204 No Content\r\n\r\n" : "HTTP/1.1 202 Accepted\r\nContent-Length: 0\r\n\r\n";
+	});
+	std::string binary("\0\1\2\r\n\r\n", 7);
+	auto accepted = UploadReports(Options("http://127.0.0.1:" + std::to_string(server.port) + "/upload"),
+		{{CrashOptions::PLAIN_TEXT, "crash"}, {CrashOptions::BINARY_REPORT, binary}});
+	server.finish();
+	CHECK(accepted == std::vector<bool>({true, true}));
+	CHECK_EQUAL(server.requests.size(), size_t(2));
+	if (server.requests.size() != 2)
+		return;
+	CHECK_EQUAL(server.requests[0].line, std::string("POST /upload HTTP/1.1"));
+	CHECK_EQUAL(server.requests[0].header("Content-Type"), std::string("text/plain; charset=utf-8"));
+	CHECK_EQUAL(server.requests[0].header("X-Sentry-Auth"), std::string("(none)"));
+	CHECK_EQUAL(server.requests[1].header("Content-Type"), std::string("application/octet-stream"));
+	CHECK_EQUAL(server.requests[1].body, binary);
+}
+
+static void TestRetry() {
+	// 503 and 429 are retried on a new connection, the accepted report is not sent again
+	LoopbackServer server([](size_t, size_t connection) {
+		static size_t responses = 0;
+		if (connection == 0)
+			return responses++ == 0 ? std::string("HTTP/1.1 503 Service Unavailable\r\nRetry-After: 0\r\nContent-Length: 0\r\n\r\n") : OK;
+		if (connection == 1)
+			return std::string("HTTP/1.1 429 Too Many Requests\r\nContent-Length: 0\r\n\r\n");
+		return OK;
+	});
+	auto accepted = UploadReports(Options("http://127.0.0.1:" + std::to_string(server.port) + "/"),
+		{{CrashOptions::PLAIN_TEXT, "first"}, {CrashOptions::PLAIN_TEXT, "second"}});
+	server.finish();
+	CHECK(accepted == std::vector<bool>({true, true}));
+	CHECK_EQUAL(server.connections, size_t(3));
+	CHECK_EQUAL(server.requests.size(), size_t(4));
+	for (size_t i = 2; i < server.requests.size(); ++i)
+		CHECK_EQUAL(server.requests[i].body, std::string("first"));
+}
+
+static void TestRejected() {
+	// a 4xx response is final
+	LoopbackServer server([](size_t request, size_t) {
+		return request == 0 ? std::string("HTTP/1.1 400 Bad Request\r\nContent-Length: 3\r\n\r\nbad") : OK;
+	});
+	auto accepted = UploadReports(Options("http://127.0.0.1:" + std::to_string(server.port) + "/"),
+		{{CrashOptions::PLAIN_TEXT, "first"}, {CrashOptions::PLAIN_TEXT, "second"}});
+	server.finish();
+	CHECK(accepted == std::vector<bool>({false, true}));
+	CHECK_EQUAL(server.requests.size(), size_t(2));
+}
+
+static void TestConnectionClosed() {
+	// the server closes the connection after the first response, then without a response: the remaining reports are
+	// sent again on new connections
+	LoopbackServer server([](size_t, size_t connection) {
+		if (connection == 0)
+			return std::string("HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+		if (connection == 1)
+			return std::string();
+		return OK;
+	});
+	auto accepted = UploadReports(Options("http://127.0.0.1:" + std::to_string(server.port) + "/"),
+		{{CrashOptions::PLAIN_TEXT, "first"}, {CrashOptions::PLAIN_TEXT, "second"}});
+	server.finish();
+	CHECK(accepted == std::vector<bool>({true, true}));
+	CHECK_EQUAL(server.connections, size_t(3));
+	CHECK_EQUAL(server.requests.size(), size_t(3));
+	if (server.requests.size() == 3)
+		CHECK_EQUAL(server.requests[2].body, std::string("second"));
+}
+
+static void TestFailure() {
+	// the retries run out
+	LoopbackServer server([](size_t, size_t) {
+		return std::string("HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+	});
+	auto accepted = UploadReports(Options("http://127.0.0.1:" + std::to_string(server.port) + "/"), {{CrashOptions::PLAIN_TEXT, "crash"}});
+	server.finish();
+	CHECK(accepted == std::vector<bool>({false}));
+	CHECK_EQUAL(server.requests.size(), size_t(3));
+
+	// nothing listening on the port any more
+	accepted = UploadReports(Options("http://127.0.0.1:" + std::to_string(server.port) + "/"), {{CrashOptions::PLAIN_TEXT, "crash"}});
+	CHECK(accepted == std::vector<bool>({false}));
+
+	// not an http URL
+	accepted = UploadReports(Options("ftp://127.0.0.1/"), {{CrashOptions::PLAIN_TEXT, "crash"}});
+	CHECK(accepted == std::vector<bool>({false}));
+}
+
+int main() {
+	TestSentry();
+	TestPlainUrl();
+	TestRetry();
+	TestRejected();
+	TestConnectionClosed();
+	TestFailure();
+	return failures;
+}
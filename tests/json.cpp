@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "json.h"
+
+// pieces of strings with their escaped form; each starts with a byte that cannot continue the piece before it
+static const std::vector<std::pair<std::string, std::string>> pieces = {
+	{"x", "x"},
+	{"\"", "\\\""},
+	{"\\", "\\\\"},
+	{"\n", "\\n"},
+	{"\t", "\\t"},
+	{"\r", "\\r"},
+	{std::string(1, '\0'), "\\u0000"},
+	{"\x1f", "\\u001f"},
+	{" ", " "},
+	{"\x7f", "\x7f"},
+	{"\xC3\xA9", "\xC3\xA9"}, // U+00E9
+	{"\xE2\x82\xAC", "\xE2\x82\xAC"}, // U+20AC
+	{"\xF0\x9F\x98\x80", "\xF0\x9F\x98\x80"}, // U+1F600
+	{"\xF4\x8F\xBF\xBF", "\xF4\x8F\xBF\xBF"}, // U+10FFFF
+	{"\x80", "\xEF\xBF\xBD"}, // continuation byte without a start
+	{"\xC0\xAF", "\xEF\xBF\xBD\xEF\xBF\xBD"}, // overlong
+	{"\xED\xA0\x80", "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD"}, // surrogate
+	{"\xF4\x90\x80\x80", "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD"}, // above U+10FFFF
+	{"\xE2\x82", "\xEF\xBF\xBD\xEF\xBF\xBD"}, // cut off
+	{"\xFF", "\xEF\xBF\xBD"},
+};
+
+static std::string Escape(const std::string& string) {
+	std::string out;
+	AppendJsonString(out, string);
+	return out;
+}
+
+static void TestEveryPosition() {
+	// each piece at each position of the vector chunks, in the middle and at the end of the string
+	for (auto& piece : pieces) {
+		for (size_t before = 0; before <= 40; ++before) {
+			for (size_t after : {size_t(0), size_t(1), size_t(17)}) {
+				std::string string = std::string(before, 'a') + piece.first + std::string(after, 'b');
+				std::string expected = "\"" + std::string(before, 'a') + piece.second + std::string(after, 'b') + "\"";
+				CHECK_EQUAL(Escape(string), expected);
+			}
+		}
+	}
+	CHECK_EQUAL(Escape(""), std::string("\"\""));
+}
+
+static void TestRandom() {
+	// long strings of random pieces between runs of plain characters
+	srand(1);
+	for (int i = 0; i < 2000; ++i) {
+		std::string string, expected = "\"";
+		bool cut = false;
+		while (string.size() < 200) {
+			std::string plain(size_t(rand() % 24), char('0' + rand() % 10));
+			auto& piece = pieces[size_t(rand()) % pieces.size()];
+			// a cut off sequence followed by a continuation byte would be a valid one
+			if (cut && plain.empty() && (piece.first[0] & 0xC0) == 0x80)
+				continue;
+			cut = piece.first == "\xE2\x82";
+			string += plain + piece.first;
+			expected += plain + piece.second;
+		}
+		CHECK_EQUAL(Escape(string), expected + "\"");
+	}
+}
+
+static void TestWriter() {
+	std::string out;
+	JsonWriter json(out);
+	json.beginObject();
+	json.member("name", "a\"b");
+	json.member("min", (long long)INT64_MIN);
+	json.member("max", (unsigned long long)UINT64_MAX);
+	json.member("flag", true);
+	json.key("address").address(0xdeadbeef);
+	json.key("list").beginArray().value(1).value("two").raw("{}").endArray();
+	json.member("empty", (const char*)nullptr);
+	json.endObject();
+	CHECK_EQUAL(out, std::string("{\"name\":\"a\\\"b\",\"min\":-9223372036854775808,\"max\":18446744073709551615,"
+		"\"flag\":true,\"address\":\"0xdeadbeef\",\"list\":[1,\"two\",{}],\"empty\":\"\"}"));
+}
+
+int main() {
+	TestEveryPosition();
+	TestRandom();
+	TestWriter();
+	return failures;
+}
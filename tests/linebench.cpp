@@ -0,0 +1,76 @@
+#include <link.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "dwarfline.h"
+#include "elfimage.h"
+#include "tosourcecode.h"
+
+// benchmark of address to line lookups: the native line table reader (LookupLine) against libdwarf (LookupDwarf),
+// for addresses spread over the code of this program; not run by ctest
+//   bench-lines [addresses]
+
+namespace {
+struct Code {
+	uint64_t begin = 0;
+	uint64_t end = 0;
+};
+}
+
+template <typename Resolve>
+static void Measure(const char* name, const std::vector<uint64_t>& targets, Resolve resolve) {
+	size_t found = 0;
+	// the first round maps, reads and indexes the file
+	for (int round = 0; round < 2; ++round) {
+		auto start = std::chrono::steady_clock::now();
+		found = 0;
+		for (uint64_t target : targets)
+			found += resolve(target);
+		double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		printf("%-9s %-5s %8.0f ns per address, %zu of %zu found\n", name, round ? "warm" : "cold", ns / double(targets.size()), found, targets.size());
+		if (!found)
+			break;
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? size_t(atol(argv[1])) : 10000;
+	char executable[PATH_MAX + 1] = {0};
+	if (readlink("/proc/self/exe", executable, PATH_MAX) <= 0 || !count)
+		return 1;
+	// executable segment of the program, as offsets from its load address (or addresses if not PIE)
+	Code code;
+	dl_iterate_phdr([](struct dl_phdr_info* info, size_t, void* data) {
+		if (info->dlpi_name && info->dlpi_name[0])
+			return 0;
+		for (int i = 0; i < info->dlpi_phnum; ++i)
+			if (info->dlpi_phdr[i].p_type == PT_LOAD && (info->dlpi_phdr[i].p_flags & PF_X))
+				*static_cast<Code*>(data) = {info->dlpi_phdr[i].p_vaddr, info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz};
+		return 1;
+	}, &code);
+	std::vector<uint64_t> targets;
+	for (size_t i = 0; i < count; ++i)
+		targets.push_back(code.begin + (code.end - code.begin) * i / count);
+
+	Measure("native", targets, [&](uint64_t target) {
+		char* sourceFile = NULL;
+		uint32_t lineNumber = 0, column = 0;
+		bool found = LookupLine(executable, target, &sourceFile, &lineNumber, &column) == 0;
+		free(sourceFile);
+		return found;
+	});
+	Measure("libdwarf", targets, [&](uint64_t target) {
+		char* sourceFile = NULL;
+		uint32_t lineNumber = 0, column = 0;
+		LookupDwarf(executable, target, &sourceFile, &lineNumber, &column, NULL, NULL);
+		bool found = sourceFile != NULL;
+		free(sourceFile);
+		return found;
+	});
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "ndjson.h"
+
+static std::string directory;
+
+static std::vector<std::string> Lines(const std::string& path) {
+	std::vector<std::string> lines;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line))
+		lines.push_back(line);
+	return lines;
+}
+
+static bool Exists(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+static void Remove(const std::string& path) {
+	unlink(path.c_str());
+	for (int i = 1; i <= 4; ++i)
+		unlink((path + "." + std::to_string(i)).c_str());
+}
+
+static void TestLines() {
+	CrashOptions options;
+	options.ndjsonFile = directory + "/lines.ndjson";
+	CHECK(AppendNdjson(options, "crash", "{\"event_id\":\"1\"}"));
+	CHECK(AppendNdjson(options, "slow", "{}"));
+	CHECK(AppendNdjson(options, "hang", "{\"a\":[1,2]}\n"));
+	// not a JSON object
+	CHECK(!AppendNdjson(options, "crash", "[]"));
+	CHECK(!AppendNdjson(options, "crash", "{"));
+	auto lines = Lines(options.ndjsonFile);
+	CHECK(lines == std::vector<std::string>({"{\"type\":\"crash\",\"event_id\":\"1\"}", "{\"type\":\"slow\"}", "{\"type\":\"hang\",\"a\":[1,2]}"}));
+	Remove(options.ndjsonFile);
+
+	// a directory that does not exist
+	options.ndjsonFile = directory + "/missing/lines.ndjson";
+	CHECK(!AppendNdjson(options, "crash", "{}"));
+}
+
+static void TestRotation() {
+	CrashOptions options;
+	options.ndjsonFile = directory + "/rotated.ndjson";
+	std::string event = "{\"n\":" + std::string(80, '0') + "}";
+	size_t line = std::string("{\"type\":\"crash\",").size() + event.size(); // with the newline
+	// three lines per file
+	options.ndjsonMaxBytes = 3 * line;
+	options.ndjsonMaxFiles = 2;
+	for (int i = 0; i < 10; ++i)
+		CHECK(AppendNdjson(options, "crash", event));
+	// lines 10, 7-9 and 4-6; 1-3 were removed with the oldest file
+	CHECK_EQUAL(Lines(options.ndjsonFile).size(), size_t(1));
+	CHECK_EQUAL(Lines(options.ndjsonFile + ".1").size(), size_t(3));
+	CHECK_EQUAL(Lines(options.ndjsonFile + ".2").size(), size_t(3));
+	CHECK(!Exists(options.ndjsonFile + ".3"));
+	Remove(options.ndjsonFile);
+
+	// a line larger than the limit is still written, to a file of its own
+	options.ndjsonMaxBytes = line / 2;
+	for (int i = 0; i < 2; ++i)
+		CHECK(AppendNdjson(options, "crash", event));
+	CHECK_EQUAL(Lines(options.ndjsonFile).size(), size_t(1));
+	CHECK_EQUAL(Lines(options.ndjsonFile + ".1").size(), size_t(1));
+	Remove(options.ndjsonFile);
+
+	// no files kept
+	options.ndjsonMaxBytes = line;
+	options.ndjsonMaxFiles = 0;
+	for (int i = 0; i < 3; ++i)
+		CHECK(AppendNdjson(options, "crash", event));
+	CHECK_EQUAL(Lines(options.ndjsonFile).size(), size_t(1));
+	CHECK(!Exists(options.ndjsonFile + ".1"));
+	Remove(options.ndjsonFile);
+}
+
+static void TestConcurrent() {
+	// concurrent reporters, while the file is rotated: lines are never interleaved
+	CrashOptions options;
+	options.ndjsonFile = directory + "/concurrent.ndjson";
+	options.ndjsonMaxBytes = 64 * 1024;
+	options.ndjsonMaxFiles = 4;
+	const int writers = 4, events = 200;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < writers; ++t) {
+		threads.emplace_back([&, t] {
+			std::string event = "{\"writer\":" + std::to_string(t) + ",\"data\":\"" + std::string(size_t(100 + t * 300), char('a' + t)) + "\"}";
+			for (int i = 0; i < events; ++i)
+				CHECK(AppendNdjson(options, "crash", event));
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	size_t total = 0;
+	for (const std::string& path : {options.ndjsonFile, options.ndjsonFile + ".1", options.ndjsonFile + ".2", options.ndjsonFile + ".3", options.ndjsonFile + ".4"}) {
+		for (auto& line : Lines(path)) {
+			int t = atoi(line.c_str() + std::string("{\"type\":\"crash\",\"writer\":").size());
+			std::string expected = "{\"type\":\"crash\",\"writer\":" + std::to_string(t) + ",\"data\":\"" + std::string(size_t(100 + t * 300), char('a' + t)) + "\"}";
+			if (line != expected) {
+				CHECK(!"interleaved line");
+				break;
+			}
+			++total;
+		}
+	}
+	// the oldest files were removed: each file holds at most ndjsonMaxBytes
+	CHECK(total > 0 && total <= size_t(writers * events));
+	CHECK(!Exists(options.ndjsonFile + ".5"));
+	Remove(options.ndjsonFile);
+}
+
+int main() {
+	char pattern[] = "/tmp/crashy-ndjson-XXXXXX";
+	if (!mkdtemp(pattern))
+		return 1;
+	directory = pattern;
+	TestLines();
+	TestRotation();
+	TestConcurrent();
+	rmdir(directory.c_str());
+	return failures;
+}
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "nonfatal.h"
+
+#define SLOTS 8
+
+static std::vector<NonFatalEvent> TakeAll() {
+	std::vector<NonFatalEvent> events;
+	NonFatalEvent event;
+	while (TakeNonFatal(event))
+		events.push_back(event);
+	return events;
+}
+
+__attribute__((noinline)) static void Capture(CrashLevel level, const std::string& message, uintptr_t& callSite) {
+	CrashCaptureNonFatal(level, message);
+	callSite = uintptr_t(__builtin_return_address(0));
+}
+
+static void TestOrder() {
+	uintptr_t callSite = 0;
+	Capture(CRASH_WARNING, "first", callSite);
+	Capture(CRASH_ERROR, std::string(300, 'x'), callSite);
+	auto events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(2));
+	if (events.size() != 2)
+		return;
+	CHECK_EQUAL(events[0].kind, NonFatalReport::NON_FATAL);
+	CHECK_EQUAL(events[0].level, CRASH_WARNING);
+	CHECK_EQUAL(events[0].message, std::string("first"));
+	CHECK_EQUAL(events[1].level, CRASH_ERROR);
+	CHECK_EQUAL(events[1].message, std::string(NONFATAL_MESSAGE, 'x'));
+	CHECK(events[0].tid != 0 && events[0].tid == events[1].tid);
+	CHECK(events[0].time > 0 && events[0].time <= events[1].time);
+	// the stack starts at the caller of CrashCaptureNonFatal, whose caller is this function
+	CHECK(events[0].callSite != 0 && events[0].callSite == events[1].callSite);
+	// (callSite is the return address of the second call)
+	CHECK(events[1].pcs.size() >= 2);
+	if (events[1].pcs.size() >= 2) {
+		CHECK(events[1].pcs[0] + 1 == events[1].callSite || events[1].pcs[0] == events[1].callSite);
+		CHECK(events[1].pcs[1] + 1 == callSite || events[1].pcs[1] == callSite);
+	}
+}
+
+static void TestFull() {
+	// many rounds through the ring: a full queue drops events until the reporter takes one
+	uint64_t dropped = DroppedNonFatal();
+	for (int round = 0; round < 100; ++round) {
+		for (int i = 0; i < SLOTS + 3; ++i)
+			CrashCaptureNonFatal(CRASH_INFO, std::to_string(i));
+		CHECK_EQUAL(DroppedNonFatal(), dropped + 3);
+		dropped = DroppedNonFatal();
+		NonFatalEvent event;
+		CHECK(TakeNonFatal(event) && event.message == "0");
+		CrashCaptureNonFatal(CRASH_INFO, "again");
+		auto events = TakeAll();
+		CHECK_EQUAL(events.size(), size_t(SLOTS));
+		for (size_t i = 0; i + 1 < events.size(); ++i)
+			CHECK_EQUAL(events[i].message, std::to_string(i + 1));
+		if (!events.empty())
+			CHECK_EQUAL(events.back().message, std::string("again"));
+		CHECK_EQUAL(DroppedNonFatal(), dropped);
+	}
+}
+
+static void TestSlowOperation() {
+	uint64_t pcs[NONFATAL_FRAMES + 1];
+	for (int i = 0; i <= NONFATAL_FRAMES; ++i)
+		pcs[i] = uint64_t(0x1000 + i);
+	EnqueueSlowOperation("query", 1000000, 2500000, pcs, NONFATAL_FRAMES + 1);
+	std::string name(NONFATAL_MESSAGE + 10, 'n');
+	EnqueueSlowOperation(name.c_str(), 1, 2, pcs, 3);
+	auto events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(2));
+	if (events.size() != 2)
+		return;
+	CHECK_EQUAL(events[0].kind, NonFatalReport::SLOW_OPERATION);
+	CHECK_EQUAL(events[0].level, CRASH_WARNING);
+	CHECK_EQUAL(events[0].message, std::string("query"));
+	CHECK_EQUAL(events[0].budget, uint64_t(1000000));
+	CHECK_EQUAL(events[0].elapsed, uint64_t(2500000));
+	CHECK_EQUAL(events[0].callSite, uintptr_t(0));
+	// all frames, the interrupted one first
+	CHECK_EQUAL(events[0].pcs.size(), size_t(NONFATAL_FRAMES));
+	CHECK(!events[0].pcs.empty() && events[0].pcs.front() == 0x1000 && events[0].pcs.back() == 0x1000 + NONFATAL_FRAMES - 1);
+	CHECK_EQUAL(events[1].message, std::string(NONFATAL_MESSAGE, 'n'));
+	CHECK(events[1].pcs == std::vector<uintptr_t>({0x1000, 0x1001, 0x1002}));
+}
+
+static void TestConcurrent() {
+	// producers on several threads while the reporter takes events: each event is taken once, complete, and in the
+	// order of its producer, or counted as dropped
+	const int producers = 4, events = 20000;
+	uint64_t dropped = DroppedNonFatal();
+	std::atomic<int> running {producers};
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			for (int i = 0; i < events; ++i)
+				CrashCaptureNonFatal(CrashLevel(CRASH_DEBUG + p % 3), std::to_string(p) + ":" + std::to_string(i) + ":" + std::string(size_t(i % 200), 'p'));
+			--running;
+		});
+	}
+	std::vector<int> next(producers, 0);
+	size_t taken = 0;
+	bool intact = true, ordered = true;
+	NonFatalEvent event;
+	for (;;) {
+		// read before taking: what the producers queued before they finished is taken before the loop ends
+		bool finished = running == 0;
+		if (!TakeNonFatal(event)) {
+			if (finished)
+				break;
+			continue;
+		}
+		int p = atoi(event.message.c_str());
+		int i = atoi(event.message.c_str() + event.message.find(':') + 1);
+		std::string expected = std::to_string(p) + ":" + std::to_string(i) + ":" + std::string(size_t(i % 200), 'p');
+		intact = intact && p >= 0 && p < producers && event.message == expected && event.level == CrashLevel(CRASH_DEBUG + p % 3);
+		if (intact) {
+			ordered = ordered && i >= next[size_t(p)];
+			next[size_t(p)] = i + 1;
+		}
+		++taken;
+	}
+	for (auto& thread : threads)
+		thread.join();
+	CHECK(intact);
+	CHECK(ordered);
+	CHECK(taken > 0);
+	CHECK_EQUAL(taken + (DroppedNonFatal() - dropped), size_t(producers * events));
+}
+
+static void TestAllowNonFatal() {
+	CrashOptions options;
+	options.nonFatalMaxPerCallSite = 2;
+	options.nonFatalWindow = std::chrono::seconds(60);
+	uint64_t suppressed = 99;
+	CHECK(AllowNonFatal(options, 0x10, 1000, suppressed));
+	CHECK_EQUAL(suppressed, uint64_t(0));
+	CHECK(AllowNonFatal(options, 0x10, 1001, suppressed));
+	CHECK(!AllowNonFatal(options, 0x10, 1002, suppressed));
+	CHECK(AllowNonFatal(options, 0x20, 1002, suppressed));
+	CHECK(AllowNonFatal(options, 0x10, 1060, suppressed));
+	CHECK_EQUAL(suppressed, uint64_t(1));
+}
+
+int main() {
+	CrashOptions options;
+	options.nonFatalQueueSize = SLOTS - 1; // rounded up to a power of two
+	CreateNonFatalQueue(options);
+	TestOrder();
+	TestFull();
+	TestSlowOperation();
+	TestConcurrent();
+	TestAllowNonFatal();
+	return failures;
+}
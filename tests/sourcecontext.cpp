@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "sourcecontext.h"
+
+static std::string directory;
+
+static CrashFrame Frame(const std::string& sourceFile, uint32_t lineNumber) {
+	CrashFrame frame;
+	frame.sourceFile = sourceFile;
+	frame.lineNumber = lineNumber;
+	return frame;
+}
+
+static void TestContext() {
+	CrashOptions options;
+	options.sourceContextLines = 2;
+	options.sourceRoots = {directory};
+	std::vector<CrashFrame> frames {Frame("a.cpp", 1), Frame("a.cpp", 5), Frame("missing.cpp", 3), Frame("a.cpp", 0), Frame("", 2)};
+	AddSourceContext({&frames}, options);
+	CHECK_EQUAL(frames[0].contextLine, std::string("line 1"));
+	CHECK(frames[0].preContext.empty());
+	CHECK(frames[0].postContext == std::vector<std::string>({"line 2", "line 3"}));
+	CHECK_EQUAL(frames[1].contextLine, std::string("line 5"));
+	CHECK(frames[1].preContext == std::vector<std::string>({"line 3", "line 4"}));
+	// the end of the file
+	CHECK(frames[1].postContext == std::vector<std::string>({"line 6"}));
+	for (size_t i = 2; i < frames.size(); ++i)
+		CHECK(frames[i].contextLine.empty() && frames[i].preContext.empty() && frames[i].postContext.empty());
+
+	// an absolute path
+	std::vector<CrashFrame> absolute {Frame(directory + "/a.cpp", 3)};
+	options.sourceRoots.clear();
+	AddSourceContext({&absolute}, options);
+	CHECK_EQUAL(absolute[0].contextLine, std::string("line 3"));
+
+	// disabled
+	std::vector<CrashFrame> disabled {Frame(directory + "/a.cpp", 3)};
+	options.sourceContextLines = 0;
+	AddSourceContext({&disabled}, options);
+	CHECK(disabled[0].contextLine.empty());
+}
+
+static void TestBudget() {
+	// each frame takes 5 lines of 6 bytes: the budget is shared by all stacks, in their order
+	CrashOptions options;
+	options.sourceContextLines = 2;
+	options.sourceRoots = {directory};
+	options.sourceContextMaxBytes = 3 * 30;
+	std::vector<CrashFrame> crashed {Frame("a.cpp", 3), Frame("a.cpp", 4)};
+	std::vector<CrashFrame> other {Frame("a.cpp", 3), Frame("a.cpp", 4)};
+	std::vector<CrashFrame> last {Frame("a.cpp", 3)};
+	AddSourceContext({&crashed, &other, &last}, options);
+	CHECK(!crashed[0].contextLine.empty() && !crashed[1].contextLine.empty());
+	CHECK(!other[0].contextLine.empty());
+	CHECK(other[1].contextLine.empty() && other[1].preContext.empty());
+	CHECK(last[0].contextLine.empty());
+}
+
+int main() {
+	char pattern[] = "/tmp/crashy-sourcecontext-XXXXXX";
+	if (!mkdtemp(pattern))
+		return 1;
+	directory = pattern;
+	{
+		std::ofstream out(directory + "/a.cpp");
+		for (int i = 1; i <= 6; ++i)
+			out << "line " << i << "\t\n";
+	}
+	TestContext();
+	TestBudget();
+	unlink((directory + "/a.cpp").c_str());
+	rmdir(directory.c_str());
+	return failures;
+}
@@ -0,0 +1,79 @@
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "spool.h"
+
+static std::vector<std::string> Files(const std::string& directory) {
+	std::vector<std::string> files;
+	if (DIR* dir = opendir(directory.c_str())) {
+		while (struct dirent* entry = readdir(dir))
+			if (std::string(entry->d_name) != "." && std::string(entry->d_name) != "..")
+				files.push_back(entry->d_name);
+		closedir(dir);
+	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+int main() {
+	char pattern[] = "/tmp/crashy-spool-XXXXXX";
+	if (!mkdtemp(pattern))
+		return 1;
+	CrashOptions options;
+	options.persistentCrashReportsDirectory = pattern;
+	options.spoolMaxReports = 3;
+
+	// stored under their final names, without temporary files left behind
+	CHECK(SpoolReports(options, {{CrashOptions::JSON_SENTRY, "{\"n\":1}"}, {CrashOptions::PLAIN_TEXT, "2"}}));
+	auto files = Files(pattern);
+	CHECK_EQUAL(files.size(), size_t(2));
+	for (auto& file : files)
+		CHECK(file[0] != '.');
+	// the oldest reports above the cap are evicted
+	CHECK(SpoolReports(options, {{CrashOptions::BINARY_REPORT, "3"}, {CrashOptions::ENVELOPE_SENTRY, "4"}}));
+	CHECK_EQUAL(Files(pattern).size(), size_t(3));
+	CHECK(SpoolReports(options, {}));
+
+	// sent oldest first, and removed when sent; after a report that could not be sent, the others are left for later
+	std::mutex mutex;
+	std::vector<std::pair<CrashOptions::SendFormat, std::string>> sent;
+	options.uploadConcurrency = 1;
+	options.sender = [&](CrashOptions::SendFormat format, const std::string& data) {
+		std::lock_guard<std::mutex> l(mutex);
+		sent.emplace_back(format, data);
+		return data != "3";
+	};
+	DrainSpool(options, true);
+	std::vector<std::pair<CrashOptions::SendFormat, std::string>> expected = {{CrashOptions::PLAIN_TEXT, "2"},
+		{CrashOptions::BINARY_REPORT, "3"}};
+	CHECK(sent == expected);
+	// the lock file and the reports not sent
+	files = Files(pattern);
+	CHECK_EQUAL(files.size(), size_t(3));
+	if (files.size() == 3) {
+		CHECK_EQUAL(files[0], std::string(".lock"));
+		CHECK(files[1].find(".bin") != std::string::npos && files[2].find(".envelope") != std::string::npos);
+	}
+
+	sent.clear();
+	options.sender = [&](CrashOptions::SendFormat format, const std::string& data) {
+		sent.emplace_back(format, data);
+		return true;
+	};
+	DrainSpool(options, true);
+	expected = {{CrashOptions::BINARY_REPORT, "3"}, {CrashOptions::ENVELOPE_SENTRY, "4"}};
+	CHECK(sent == expected);
+	CHECK(Files(pattern) == std::vector<std::string>({".lock"}));
+
+	for (auto& file : Files(pattern))
+		unlink((std::string(pattern) + "/" + file).c_str());
+	rmdir(pattern);
+	return failures;
+}
@@ -0,0 +1,84 @@
+#include <dirent.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "nonfatal.h"
+#include "reporter.h"
+
+extern "C" __attribute__((noinline)) int SymbolizationTarget(int n) {
+	asm volatile("" ::: "memory");
+	return n * 3 + 1;
+}
+
+static std::vector<CrashFrame> TargetFrames(size_t count) {
+	std::vector<uintptr_t> pcs(count, uintptr_t(&SymbolizationTarget) + 4);
+	return AddressFrames(pcs, getpid());
+}
+
+static bool EndsWith(const std::string& s, const std::string& suffix) {
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static size_t ThreadCount() {
+	size_t count = 0;
+	DIR* tasks = opendir("/proc/self/task");
+	if (!tasks)
+		return 0;
+	while (struct dirent* entry = readdir(tasks))
+		if (entry->d_name[0] != '.')
+			++count;
+	closedir(tasks);
+	return count;
+}
+
+static void TestResolved(const CrashOptions& options) {
+	std::vector<CrashFrame> frames = TargetFrames(1);
+	SymbolizeFrames(frames, options);
+	CHECK_EQUAL(frames[0].detail, CrashFrame::FULL);
+	CHECK_EQUAL(frames[0].functionName, std::string("SymbolizationTarget"));
+	CHECK(EndsWith(frames[0].sourceFile, "symbolization.cpp"));
+	// in the lines of the function (13 to 16)
+	CHECK(frames[0].lineNumber >= 13 && frames[0].lineNumber <= 16);
+}
+
+static void TestBudgetUsedUp(const CrashOptions& options) {
+	// a deadline shared with earlier parts of a report that used it up: only what the process sent is reported
+	std::vector<CrashFrame> frames = TargetFrames(3);
+	SymbolizeFrames(frames, options, std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+	for (auto& frame : frames) {
+		CHECK_EQUAL(frame.detail, CrashFrame::SYMBOL_ONLY);
+		CHECK_EQUAL(frame.functionName, std::string("SymbolizationTarget"));
+		CHECK(frame.sourceFile.empty());
+	}
+}
+
+static void TestAbandonedWorkersJoined(CrashOptions options) {
+	// workers abandoned as the budget ends are joined by later calls, the long-lived reporter does not collect them
+	size_t before = ThreadCount();
+	options.symbolizationThreads = 4;
+	for (int i = 0; i < 50; ++i) {
+		std::vector<CrashFrame> frames = TargetFrames(64);
+		SymbolizeFrames(frames, options, std::chrono::steady_clock::now() + std::chrono::microseconds(1));
+	}
+	auto start = std::chrono::steady_clock::now();
+	while (ThreadCount() > before && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		std::vector<CrashFrame> none;
+		SymbolizeFrames(none, options);
+	}
+	CHECK_EQUAL(ThreadCount(), before);
+}
+
+int main() {
+	CrashOptions options;
+	options.currentExecutable = "/proc/self/exe";
+	TestResolved(options);
+	TestBudgetUsedUp(options);
+	TestAbandonedWorkersJoined(options);
+	return failures;
+}
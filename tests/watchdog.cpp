@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "nonfatal.h"
+#include "watchdog.h"
+
+static CrashOptions options;
+
+static std::vector<NonFatalEvent> TakeAll() {
+	std::vector<NonFatalEvent> events;
+	NonFatalEvent event;
+	while (TakeNonFatal(event))
+		events.push_back(event);
+	return events;
+}
+
+// running, not blocked: the thread checking deadlines interrupts it
+static void Busy(std::chrono::milliseconds duration) {
+	auto end = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < end)
+		;
+}
+
+static void TestDeadline() {
+	// the inner guard expires: reported once, while the thread stays past the deadline
+	{
+		CrashDeadline outer(std::chrono::seconds(10), "outer");
+		CrashDeadline inner(std::chrono::milliseconds(20), "inner");
+		Busy(std::chrono::milliseconds(200));
+	}
+	auto events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(1));
+	if (events.size() == 1) {
+		CHECK_EQUAL(events[0].kind, NonFatalReport::SLOW_OPERATION);
+		CHECK_EQUAL(events[0].message, std::string("inner"));
+		CHECK_EQUAL(events[0].budget, uint64_t(20000000));
+		CHECK(events[0].elapsed >= events[0].budget);
+		CHECK(events[0].tid == CurrentThreadId());
+		CHECK(!events[0].pcs.empty());
+	}
+
+	// the outer guard expires while the inner one has time left: the outer one is reported
+	{
+		CrashDeadline outer(std::chrono::milliseconds(20), "outer");
+		CrashDeadline inner(std::chrono::seconds(10), "inner");
+		Busy(std::chrono::milliseconds(200));
+	}
+	events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(1));
+	if (events.size() == 1)
+		CHECK_EQUAL(events[0].message, std::string("outer"));
+
+	// both expire, the inner one first: each is reported once
+	{
+		CrashDeadline outer(std::chrono::milliseconds(100), "outer");
+		{
+			CrashDeadline inner(std::chrono::milliseconds(20), "inner");
+			Busy(std::chrono::milliseconds(60));
+		}
+		Busy(std::chrono::milliseconds(200));
+	}
+	events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(2));
+	if (events.size() == 2) {
+		CHECK_EQUAL(events[0].message, std::string("inner"));
+		CHECK_EQUAL(events[1].message, std::string("outer"));
+	}
+
+	// guards that end in time are not reported, the next one past its deadline is
+	for (int i = 0; i < 100; ++i)
+		CrashDeadline guard(std::chrono::milliseconds(50), "fast");
+	Busy(std::chrono::milliseconds(20));
+	{
+		CrashDeadline guard(std::chrono::milliseconds(10), "again");
+		Busy(std::chrono::milliseconds(100));
+	}
+	events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(1));
+	if (events.size() == 1)
+		CHECK_EQUAL(events[0].message, std::string("again"));
+
+	// other threads have their own slot
+	std::thread thread([] {
+		CrashDeadline guard(std::chrono::milliseconds(10), "thread");
+		Busy(std::chrono::milliseconds(100));
+	});
+	uint32_t tid = 0;
+	thread.join();
+	events = TakeAll();
+	CHECK_EQUAL(events.size(), size_t(1));
+	if (events.size() == 1) {
+		CHECK_EQUAL(events[0].message, std::string("thread"));
+		tid = events[0].tid;
+	}
+	CHECK(tid != 0 && tid != CurrentThreadId());
+}
+
+static void TestHang() {
+	HungThread hang;
+	CHECK(!WatchingThreads());
+	CHECK(!CrashWatchThread("invalid", std::chrono::milliseconds(0)));
+	CHECK_EQUAL(errno, EINVAL);
+	CHECK(CrashWatchThread("main loop", std::chrono::milliseconds(50)));
+	CHECK(WatchingThreads());
+	CHECK(!FindHang(hang));
+
+	// one report per stall
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(FindHang(hang));
+	CHECK_EQUAL(hang.tid, CurrentThreadId());
+	CHECK_EQUAL(hang.name, std::string("main loop"));
+	CHECK_EQUAL(hang.threshold, uint64_t(50000000));
+	CHECK(hang.stalled > hang.threshold);
+	CHECK(!FindHang(hang));
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+	CHECK(!FindHang(hang));
+
+	// the heartbeat ends the stall: the next one is reported again
+	CrashHeartbeat();
+	CHECK(!FindHang(hang));
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(FindHang(hang));
+	CHECK(!FindHang(hang));
+
+	// not watched any more
+	CrashHeartbeat();
+	CrashUnwatchThread();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(!FindHang(hang));
+	CHECK(!WatchingThreads());
+
+	// the slot of a thread is released when it exits
+	std::thread thread([] {
+		CHECK(CrashWatchThread("worker", std::chrono::milliseconds(50)));
+	});
+	thread.join();
+	CHECK(!WatchingThreads());
+}
+
+static void TestThreadStacks() {
+	// the reporter is another process: it interrupts each thread of this one to capture its stack; a thread blocking
+	// the signal is reported without stack
+	std::atomic<bool> stop {false};
+	std::atomic<int> started {0};
+	std::vector<std::thread> threads;
+	for (int blocked = 0; blocked < 2; ++blocked) {
+		threads.emplace_back([&, blocked] {
+			pthread_setname_np(pthread_self(), blocked ? "blocked" : "worker");
+			if (blocked) {
+				sigset_t set;
+				sigemptyset(&set);
+				sigaddset(&set, SIGRTMIN + 5);
+				pthread_sigmask(SIG_BLOCK, &set, nullptr);
+			}
+			++started;
+			while (!stop)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		});
+	}
+	while (started < 2)
+		;
+	int ready[2];
+	CHECK(pipe(ready) == 0);
+	pid_t reporter = fork();
+	if (reporter == 0) {
+		char c;
+		(void)!read(ready[0], &c, 1);
+		auto stacks = DumpThreadStacks(getppid());
+		// and the main thread and the one checking deadlines (a sanitizer can have threads of its own)
+		CHECK(stacks.size() >= 4);
+		int named = 0;
+		for (auto& thread : stacks) {
+			if (thread.name == "blocked") {
+				++named;
+				CHECK(thread.frames.empty());
+			} else if (thread.name == "worker" || thread.tid == uint32_t(getppid())) {
+				++named;
+				CHECK(!thread.frames.empty());
+			}
+		}
+		CHECK_EQUAL(named, 3);
+		_exit(failures);
+	}
+	// only the stack signal of the reporter is handled
+	StartWatchdog(reporter);
+	(void)!write(ready[1], "", 1);
+	int status = 0;
+	// not blocked in waitpid, where a sanitizer holds signals back
+	pid_t waited;
+	while ((waited = waitpid(reporter, &status, WNOHANG)) == 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	CHECK(waited == reporter);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	close(ready[0]);
+	close(ready[1]);
+	stop = true;
+	for (auto& thread : threads)
+		thread.join();
+}
+
+int main() {
+	options.deadlineSlots = 4;
+	options.deadlineCheckInterval = std::chrono::milliseconds(1);
+	options.watchdogSlots = 4;
+	CHECK(!CrashWatchThread("main loop", std::chrono::milliseconds(50)));
+	CHECK_EQUAL(errno, ENOTSUP);
+	CreateNonFatalQueue(options);
+	CreateWatchdog(options);
+	TestDeadline();
+	TestHang();
+	TestThreadStacks();
+	return failures;
+}